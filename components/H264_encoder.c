@@ -169,7 +169,11 @@ void set_h264_preview_settings(component_t* encoder_prv)
                  dump_OMX_ERRORTYPE (error));
         exit(1);
     }
+#if PREVIEW_INTRA_REFRESH
+    idr_st.nIDRPeriod = PREVIEW_REFRESH_IDR_PERIOD;
+#else
     idr_st.nIDRPeriod = PREVIEW_IDR_PERIOD;
+#endif
     if ((error = OMX_SetConfig (encoder_prv->handle,
            OMX_IndexConfigVideoAVCIntraPeriod, &idr_st)))
     {
@@ -177,61 +181,81 @@ void set_h264_preview_settings(component_t* encoder_prv)
         exit(1);
     }
 
+#if PREVIEW_INTRA_REFRESH
+    //Cyclic intra refresh, PREVIEW_REFRESH_MBS macroblocks per frame
+    OMX_VIDEO_PARAM_INTRAREFRESHTYPE refresh_st;
+    OMX_INIT_STRUCTURE(refresh_st);
+    refresh_st.nPortIndex = 201;
+    if ((error = OMX_GetParameter(encoder_prv->handle,
+           OMX_IndexParamVideoIntraRefresh, &refresh_st)))
+    {
+        fprintf(stderr, "error: OMX_GetParameter: %s\n",
+                dump_OMX_ERRORTYPE(error));
+        exit(1);
+    }
+    refresh_st.eRefreshMode = OMX_VIDEO_IntraRefreshCyclic;
+    refresh_st.nCirMBs = PREVIEW_REFRESH_MBS;
+    if ((error = OMX_SetParameter(encoder_prv->handle,
+           OMX_IndexParamVideoIntraRefresh, &refresh_st)))
+    {
+        fprintf(stderr, "error: OMX_SetParameter: %s\n",
+                dump_OMX_ERRORTYPE(error));
+        exit(1);
+    }
+#endif
+
     //Note: Motion vectors are not implemented in this program.
     //See for further details
     //https://github.com/gagle/raspberrypi-omxcam/blob/master/src/h264.c
     //https://github.com/gagle/raspberrypi-omxcam/blob/master/src/video.c
 }
 
-//encoder output port have a buffer.
-//add functions to allocate buffer of encoder
-void enable_encoder_output_port(component_t* encoder,
-        OMX_BUFFERHEADERTYPE** encoder_output_buffer)
+//Ask the encoder to make the next frame an IDR.
+//Used when a viewer joins a stream that is already running
+void request_h264_idr(component_t* encoder)
 {
-    //The port is not enabled until the buffer is allocated
-    OMX_ERRORTYPE error;
+    printf("requesting IDR from %s\n", encoder->name);
 
-    enable_port(encoder, 201);
+    OMX_ERRORTYPE error;
 
-    OMX_PARAM_PORTDEFINITIONTYPE port_st;
-    OMX_INIT_STRUCTURE(port_st);
-    port_st.nPortIndex = 201;
-    if ((error = OMX_GetParameter(encoder->handle, OMX_IndexParamPortDefinition,
-            &port_st)))
-    {
-        fprintf(stderr, "error: OMX_GetParameter: %s\n",
-                dump_OMX_ERRORTYPE(error));
-        exit(1);
-    }
-    printf("allocating %s output buffer\n", encoder->name);
-    if ((error = OMX_AllocateBuffer(encoder->handle, encoder_output_buffer, 201,
-            0, port_st.nBufferSize)))
+    OMX_CONFIG_PORTBOOLEANTYPE idr_st;
+    OMX_INIT_STRUCTURE(idr_st);
+    idr_st.nPortIndex = 201;
+    idr_st.bEnabled = OMX_TRUE;
+    if ((error = OMX_SetConfig(encoder->handle,
+            OMX_IndexConfigBrcmVideoRequestIFrame, &idr_st)))
     {
-        fprintf(stderr, "error: OMX_AllocateBuffer: %s\n",
+        fprintf(stderr, "error: OMX_SetConfig: %s\n",
                 dump_OMX_ERRORTYPE(error));
         exit(1);
     }
+}
+
+//encoder output port have a pool of buffers.
+//add functions to allocate buffers of encoder
+void enable_encoder_output_port(component_t* encoder,
+        buffer_pool_t* encoder_output_pool, int count)
+{
+    //The port is not enabled until the buffers are allocated.
+    //The buffer count can only be changed while the port is disabled
+    count = buffer_pool_set_count(encoder, 201, count);
+
+    enable_port(encoder, 201);
+
+    buffer_pool_allocate(encoder, encoder_output_pool, 201, count);
 
     wait_enable_port(encoder, 201);
     //wait(encoder, EVENT_PORT_ENABLE, 0);
 }
 
 void disable_encoder_output_port(component_t* encoder,
-        OMX_BUFFERHEADERTYPE* encoder_output_buffer)
+        buffer_pool_t* encoder_output_pool)
 {
-    //The port is not disabled until the buffer is released
-    OMX_ERRORTYPE error;
-
+    //The port is not disabled until the buffers are released
     disable_port(encoder, 201);
 
-    //Free encoder output buffer
-    printf("releasing %s output buffer\n", encoder->name);
-    if ((error = OMX_FreeBuffer(encoder->handle, 201, encoder_output_buffer)))
-    {
-        fprintf(stderr, "error: OMX_FreeBuffer: %s\n",
-                dump_OMX_ERRORTYPE(error));
-        exit(1);
-    }
+    //Free encoder output buffers
+    buffer_pool_free(encoder, encoder_output_pool);
 
     wait_disable_port(encoder, 201);
     //wait(encoder, EVENT_PORT_DISABLE, 0);
@@ -2,6 +2,7 @@
 #define H264_ENCODER_H
 
 #include "component_common.h"
+#include "buffer_pool.h"
 
 void set_h264_port_definition(component_t* encoder);
 void set_h264_settings(component_t* encoder);
@@ -9,9 +10,11 @@ void set_h264_settings(component_t* encoder);
 void set_h264_preview_port_definition(component_t* encoder_prv);
 void set_h264_preview_settings(component_t* encoder_prv);
 
+void request_h264_idr(component_t* encoder);
+
 void enable_encoder_output_port(component_t* encoder,
-        OMX_BUFFERHEADERTYPE** encoder_output_buffer);
+        buffer_pool_t* encoder_output_pool, int count);
 void disable_encoder_output_port(component_t* encoder,
-        OMX_BUFFERHEADERTYPE* encoder_output_buffer);
+        buffer_pool_t* encoder_output_pool);
 
 #endif
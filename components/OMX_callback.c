@@ -1,4 +1,5 @@
 #include "OMX_callback.h"
+#include "buffer_pool.h"
 
 //Function that is called when a component receives an event from a secondary
 //thread
@@ -20,16 +21,19 @@ OMX_ERRORTYPE event_handler (
             case OMX_CommandStateSet:
             printf ("event: %s, OMX_CommandStateSet, state: %s\n",
                     component->name, dump_OMX_STATETYPE (data2));
+            command_complete (component, OMX_CommandStateSet, data2);
             wake (component, EVENT_STATE_SET);
             break;
             case OMX_CommandPortDisable:
             printf ("event: %s, OMX_CommandPortDisable, port: %d\n",
                     component->name, data2);
+            command_complete (component, OMX_CommandPortDisable, data2);
             wake (component, EVENT_PORT_DISABLE);
             break;
             case OMX_CommandPortEnable:
             printf ("event: %s, OMX_CommandPortEnable, port: %d\n",
                     component->name, data2);
+            command_complete (component, OMX_CommandPortEnable, data2);
             wake (component, EVENT_PORT_ENABLE);
             break;
             case OMX_CommandFlush:
@@ -94,6 +98,10 @@ OMX_ERRORTYPE fill_buffer_done (
     component_t* component = (component_t*)app_data;
 
     //printf ("event: %s, fill_buffer_done\n", component->name);
+    if (component->pool)
+    {
+        buffer_pool_push_filled(component->pool, buffer);
+    }
     wake (component, EVENT_FILL_BUFFER_DONE);
 
     return OMX_ErrorNone;
@@ -0,0 +1,171 @@
+#include "buffer_pool.h"
+
+/*---------------------------------------------------------------------
+   set nBufferCountActual of a (disabled) port
+   the count is clamped to [nBufferCountMin, BUFFER_POOL_MAX]
+   return : the number of buffers the port will really use
+----------------------------------------------------------------------*/
+int buffer_pool_set_count(component_t* component, OMX_U32 port, int count)
+{
+    OMX_ERRORTYPE error;
+
+    OMX_PARAM_PORTDEFINITIONTYPE port_st;
+    OMX_INIT_STRUCTURE(port_st);
+    port_st.nPortIndex = port;
+    if ((error = OMX_GetParameter(component->handle,
+            OMX_IndexParamPortDefinition, &port_st)))
+    {
+        fprintf(stderr, "error: OMX_GetParameter: %s\n",
+                dump_OMX_ERRORTYPE(error));
+        exit(1);
+    }
+
+    if (count < (int)port_st.nBufferCountMin)
+        count = port_st.nBufferCountMin;
+    if (count > BUFFER_POOL_MAX)
+        count = BUFFER_POOL_MAX;
+
+    port_st.nBufferCountActual = count;
+    if ((error = OMX_SetParameter(component->handle,
+            OMX_IndexParamPortDefinition, &port_st)))
+    {
+        fprintf(stderr, "error: OMX_SetParameter: %s\n",
+                dump_OMX_ERRORTYPE(error));
+        exit(1);
+    }
+
+    return count;
+}
+
+/*---------------------------------------------------------------------
+   allocate 'count' buffers on the port
+   must be called after enable_port() and before waiting for it
+----------------------------------------------------------------------*/
+void buffer_pool_allocate(component_t* component, buffer_pool_t* pool,
+        OMX_U32 port, int count)
+{
+    OMX_ERRORTYPE error;
+
+    OMX_PARAM_PORTDEFINITIONTYPE port_st;
+    OMX_INIT_STRUCTURE(port_st);
+    port_st.nPortIndex = port;
+    if ((error = OMX_GetParameter(component->handle,
+            OMX_IndexParamPortDefinition, &port_st)))
+    {
+        fprintf(stderr, "error: OMX_GetParameter: %s\n",
+                dump_OMX_ERRORTYPE(error));
+        exit(1);
+    }
+
+    if (vcos_mutex_create(&pool->lock, "buffer_pool"))
+    {
+        fprintf(stderr, "error: vcos_mutex_create\n");
+        exit(1);
+    }
+    pool->port = port;
+    pool->count = count;
+    pool->head = 0;
+    pool->nfilled = 0;
+
+    printf("allocating %d %s output buffers, size = %d\n", count,
+            component->name, port_st.nBufferSize);
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        if ((error = OMX_AllocateBuffer(component->handle, &pool->buffers[i],
+                port, 0, port_st.nBufferSize)))
+        {
+            fprintf(stderr, "error: OMX_AllocateBuffer: %s\n",
+                    dump_OMX_ERRORTYPE(error));
+            exit(1);
+        }
+    }
+
+    component->pool = pool;
+}
+
+/*---------------------------------------------------------------------
+   release all the buffers of the pool
+   must be called after disable_port() and before waiting for it
+----------------------------------------------------------------------*/
+void buffer_pool_free(component_t* component, buffer_pool_t* pool)
+{
+    OMX_ERRORTYPE error;
+
+    component->pool = NULL;
+
+    printf("releasing %d %s output buffers\n", pool->count, component->name);
+    int i;
+    for (i = 0; i < pool->count; i++)
+    {
+        if ((error = OMX_FreeBuffer(component->handle, pool->port,
+                pool->buffers[i])))
+        {
+            fprintf(stderr, "error: OMX_FreeBuffer: %s\n",
+                    dump_OMX_ERRORTYPE(error));
+            exit(1);
+        }
+    }
+
+    vcos_mutex_delete(&pool->lock);
+}
+
+//hand every buffer of the pool to the component, so that it always has
+//somewhere to write while the application is busy with a previous one
+OMX_ERRORTYPE buffer_pool_fill_all(component_t* component)
+{
+    OMX_ERRORTYPE error;
+    buffer_pool_t* pool = component->pool;
+
+    int i;
+    for (i = 0; i < pool->count; i++)
+    {
+        if ((error = buffer_pool_fill(component, pool->buffers[i])))
+            return error;
+    }
+
+    return OMX_ErrorNone;
+}
+
+//give back one buffer to the component
+OMX_ERRORTYPE buffer_pool_fill(component_t* component,
+        OMX_BUFFERHEADERTYPE* buffer)
+{
+    return OMX_FillThisBuffer(component->handle, buffer);
+}
+
+//block until the component returns a filled buffer, oldest first
+OMX_BUFFERHEADERTYPE* buffer_pool_get_filled(component_t* component)
+{
+    buffer_pool_t* pool = component->pool;
+    OMX_BUFFERHEADERTYPE* buffer = NULL;
+
+    while (1)
+    {
+        vcos_mutex_lock(&pool->lock);
+        if (pool->nfilled > 0)
+        {
+            buffer = pool->filled[pool->head];
+            pool->head = (pool->head + 1) % BUFFER_POOL_MAX;
+            pool->nfilled--;
+        }
+        vcos_mutex_unlock(&pool->lock);
+
+        if (buffer)
+            return buffer;
+
+        //the flag is raised after the buffer is queued, so a buffer that
+        //arrives between the check above and this call is not missed
+        wait(component, EVENT_FILL_BUFFER_DONE, 0);
+    }
+}
+
+//called from fill_buffer_done()
+void buffer_pool_push_filled(buffer_pool_t* pool,
+        OMX_BUFFERHEADERTYPE* buffer)
+{
+    vcos_mutex_lock(&pool->lock);
+    pool->filled[(pool->head + pool->nfilled) % BUFFER_POOL_MAX] = buffer;
+    pool->nfilled++;
+    vcos_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,38 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include "component_common.h"
+
+//Upper limit of buffers that can be allocated on one port
+#define BUFFER_POOL_MAX 16
+
+//Buffers allocated on a non-tunneled output port.
+//All buffers are handed to the component at once, the component returns them
+//through fill_buffer_done() and they are queued in 'filled' (FIFO order) until
+//the application takes them with buffer_pool_get_filled().
+typedef struct buffer_pool_t
+{
+    OMX_U32 port;
+    int count;
+    OMX_BUFFERHEADERTYPE* buffers[BUFFER_POOL_MAX];
+
+    //FIFO of filled buffers, written by the OMX callback thread
+    OMX_BUFFERHEADERTYPE* filled[BUFFER_POOL_MAX];
+    int head;
+    int nfilled;
+    VCOS_MUTEX_T lock;
+} buffer_pool_t;
+
+int buffer_pool_set_count(component_t* component, OMX_U32 port, int count);
+void buffer_pool_allocate(component_t* component, buffer_pool_t* pool,
+        OMX_U32 port, int count);
+void buffer_pool_free(component_t* component, buffer_pool_t* pool);
+
+OMX_ERRORTYPE buffer_pool_fill_all(component_t* component);
+OMX_ERRORTYPE buffer_pool_fill(component_t* component,
+        OMX_BUFFERHEADERTYPE* buffer);
+OMX_BUFFERHEADERTYPE* buffer_pool_get_filled(component_t* component);
+void buffer_pool_push_filled(buffer_pool_t* pool,
+        OMX_BUFFERHEADERTYPE* buffer);
+
+#endif
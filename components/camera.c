@@ -342,3 +342,26 @@ void set_camera_settings(component_t* camera)
         exit(1);
     }
 }
+
+//Start or stop the capture on the video port (71).
+//While the capture is stopped the graph stays in Executing but no frame
+//flows, which is how a pipeline is parked between two sessions
+void set_camera_capture(component_t* camera, OMX_BOOL enabled)
+{
+    printf("%s %s capture port\n", enabled ? "enabling" : "disabling",
+            camera->name);
+
+    OMX_ERRORTYPE error;
+
+    OMX_CONFIG_PORTBOOLEANTYPE capture_st;
+    OMX_INIT_STRUCTURE(capture_st);
+    capture_st.nPortIndex = 71;
+    capture_st.bEnabled = enabled;
+    if ((error = OMX_SetConfig(camera->handle, OMX_IndexConfigPortCapturing,
+            &capture_st)))
+    {
+        fprintf(stderr, "error: OMX_SetConfig: %s\n",
+                dump_OMX_ERRORTYPE(error));
+        exit(1);
+    }
+}
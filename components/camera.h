@@ -6,5 +6,6 @@
 void load_camera_drivers(component_t* component);
 void set_camera_port_definition(component_t* camera);
 void set_camera_settings(component_t* camera);
+void set_camera_capture(component_t* camera, OMX_BOOL enabled);
 
 #endif
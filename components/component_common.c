@@ -26,56 +26,187 @@ void wait(component_t* component, VCOS_UNSIGNED events,
     }
 }
 
-//non-event based blocking function
-void wait_enable_port(component_t* component, OMX_U32 port)
+//called from event_handler() when a command completes.
+//The completion is recorded before the waiting thread is woken up, so that
+//a command finishing before anybody waits for it is not lost
+void command_complete(component_t* component, OMX_U32 command, OMX_U32 data)
 {
-    //printf("Check enable port directly.\n");
-    
-    OMX_ERRORTYPE r;
-    OMX_PARAM_PORTDEFINITIONTYPE port_st;
-    OMX_INIT_STRUCTURE(port_st);
-    port_st.nPortIndex = port;
-    while(port_st.bEnabled != OMX_TRUE)
+    vcos_mutex_lock(&component->lock);
+    if (component->ncompleted == MAX_COMPLETED_COMMANDS)
+    {
+        //nobody is waiting for the oldest one, drop it
+        fprintf(stderr, "warning: %s completed commands table full\n",
+                component->name);
+        memmove(component->completed[0], component->completed[1],
+                sizeof(component->completed[0]) * (MAX_COMPLETED_COMMANDS - 1));
+        component->ncompleted--;
+    }
+    component->completed[component->ncompleted][0] = command;
+    component->completed[component->ncompleted][1] = data;
+    component->ncompleted++;
+    vcos_mutex_unlock(&component->lock);
+}
+
+//remove a completion from the table, return 1 if it was there
+static int take_command(component_t* component, OMX_U32 command, OMX_U32 data)
+{
+    int i, found = 0;
+
+    vcos_mutex_lock(&component->lock);
+    for (i = 0; i < component->ncompleted; i++)
+    {
+        if (component->completed[i][0] == command
+                && component->completed[i][1] == data)
+        {
+            memmove(component->completed[i], component->completed[i + 1],
+                    sizeof(component->completed[0])
+                    * (component->ncompleted - i - 1));
+            component->ncompleted--;
+            found = 1;
+            break;
+        }
+    }
+    vcos_mutex_unlock(&component->lock);
+
+    return found;
+}
+
+static const char* command_name(OMX_U32 command)
+{
+    switch (command)
+    {
+        case OMX_CommandStateSet:
+        return "state set";
+        case OMX_CommandPortEnable:
+        return "port enable";
+        case OMX_CommandPortDisable:
+        return "port disable";
+        default:
+        return "command";
+    }
+}
+
+//event based blocking function with timeout.
+//Only the completion of 'command' for this port/state releases the caller,
+//completions of other ports/states stay in the table for their own waiter.
+//A slow component is reported every COMPONENT_WAIT_WARNING ms.
+//return 1 if the command completed, 0 on timeout
+static int wait_command(component_t* component, OMX_U32 command, OMX_U32 data,
+        VCOS_UNSIGNED event)
+{
+    VCOS_UNSIGNED set;
+    VCOS_STATUS_T status;
+    uint64_t now;
+    uint64_t start = GetTimeStamp();
+    uint64_t deadline = start + COMPONENT_WAIT_TIMEOUT * 1000ULL;
+    uint64_t warning = start + COMPONENT_WAIT_WARNING * 1000ULL;
+    uint64_t until;
+
+    while (!take_command(component, command, data))
     {
-        if((r = OMX_GetParameter(component->handle, OMX_IndexParamPortDefinition, &port_st)) != OMX_ErrorNone)
+        now = GetTimeStamp();
+        if (now >= deadline)
         {
-            fprintf(stderr, "port enable check fail, %s, port %d, %s\n", component->name, port, dump_OMX_ERRORTYPE(r));
+            fprintf(stderr, "warning: %s %s %d not completed after %d ms\n",
+                    component->name, command_name(command), data,
+                    COMPONENT_WAIT_TIMEOUT);
+            return 0;
+        }
+        if (now >= warning)
+        {
+            fprintf(stderr, "warning: %s still waiting for %s %d (%d ms)\n",
+                    component->name, command_name(command), data,
+                    (int)((now - start) / 1000));
+            warning += COMPONENT_WAIT_WARNING * 1000ULL;
+        }
+
+        until = warning < deadline ? warning : deadline;
+        status = vcos_event_flags_get(&component->flags, event | EVENT_ERROR,
+                VCOS_OR_CONSUME, (until - now) / 1000 + 1, &set);
+        if (status == VCOS_EAGAIN)
+        {
+            continue;
+        }
+        if (status != VCOS_SUCCESS)
+        {
+            fprintf(stderr, "error: vcos_event_flags_get\n");
+            exit(1);
+        }
+        //the error can come in the same wakeup as another event
+        if (set & EVENT_ERROR)
+        {
+            fprintf(stderr, "error: %s reported an error while waiting for "
+                    "%s %d\n", component->name, command_name(command), data);
             exit(1);
         }
-        usleep(10000);
     }
-    //printf("%s port %d enabled\n", component->name, port);
+
+    return 1;
 }
 
-void wait_disable_port(component_t* component, OMX_U32 port)
+//drop a stale completion (e.g. one that arrived after a timeout) before
+//the same command is sent again
+static void forget_command(component_t* component, OMX_U32 command,
+        OMX_U32 data)
+{
+    while (take_command(component, command, data))
+        ;
+}
+
+static OMX_BOOL get_port_enabled(component_t* component, OMX_U32 port)
 {
-    //printf("Check disable port directly.\n");
-    
     OMX_ERRORTYPE r;
     OMX_PARAM_PORTDEFINITIONTYPE port_st;
     OMX_INIT_STRUCTURE(port_st);
     port_st.nPortIndex = port;
-    while(port_st.bEnabled != OMX_FALSE)
+    if((r = OMX_GetParameter(component->handle, OMX_IndexParamPortDefinition, &port_st)) != OMX_ErrorNone)
     {
-        if((r = OMX_GetParameter(component->handle, OMX_IndexParamPortDefinition, &port_st)) != OMX_ErrorNone)
-        {
-            fprintf(stderr, "port disable check fail, %s, port %d, %s\n", component->name, port, dump_OMX_ERRORTYPE(r));
-            exit(1);
-        }
-        usleep(10000);
+        fprintf(stderr, "port enable check fail, %s, port %d, %s\n", component->name, port, dump_OMX_ERRORTYPE(r));
+        exit(1);
+    }
+    return port_st.bEnabled;
+}
+
+//If the event does not come within COMPONENT_WAIT_TIMEOUT, the component is
+//asked directly before giving up
+void wait_enable_port(component_t* component, OMX_U32 port)
+{
+    if (!wait_command(component, OMX_CommandPortEnable, port,
+            EVENT_PORT_ENABLE) && get_port_enabled(component, port) != OMX_TRUE)
+    {
+        fprintf(stderr, "error: timeout enabling port %d (%s)\n", port,
+                component->name);
+        exit(1);
+    }
+    //printf("%s port %d enabled\n", component->name, port);
+}
+
+void wait_disable_port(component_t* component, OMX_U32 port)
+{
+    if (!wait_command(component, OMX_CommandPortDisable, port,
+            EVENT_PORT_DISABLE) && get_port_enabled(component, port) != OMX_FALSE)
+    {
+        fprintf(stderr, "error: timeout disabling port %d (%s)\n", port,
+                component->name);
+        exit(1);
     }
     //printf("%s port %d disabled\n", component->name, port);
 }
 
 void wait_state_change(component_t* component, OMX_STATETYPE wanted_state)
 {
-    //printf("check state change directly\n");
+    OMX_STATETYPE receive_state = OMX_StateInvalid;
 
-    OMX_STATETYPE receive_state;
-    while(receive_state != wanted_state)
+    if (!wait_command(component, OMX_CommandStateSet, wanted_state,
+            EVENT_STATE_SET))
     {
         OMX_GetState(component->handle, &receive_state);
-        usleep(10000);
+        if (receive_state != wanted_state)
+        {
+            fprintf(stderr, "error: timeout changing %s state to %s\n",
+                    component->name, dump_OMX_STATETYPE(wanted_state));
+            exit(1);
+        }
     }
     //printf("%s state chaneged\n", component->name);
 }
@@ -93,6 +224,14 @@ void init_component(component_t* component)
         exit(1);
     }
 
+    //Create the table of completed commands
+    if (vcos_mutex_create(&component->lock, "component"))
+    {
+        fprintf(stderr, "error: vcos_mutex_create\n");
+        exit(1);
+    }
+    component->ncompleted = 0;
+
     //Each component has an event_handler and fill_buffer_done functions
     OMX_CALLBACKTYPE callbacks_st;
     callbacks_st.EventHandler = event_handler;
@@ -108,16 +247,17 @@ void init_component(component_t* component)
     }
 
     //Disable all the ports
+    //The commands are sent for every port first and waited for afterwards
     OMX_INDEXTYPE types[] =
     { OMX_IndexParamAudioInit, OMX_IndexParamVideoInit, OMX_IndexParamImageInit,
             OMX_IndexParamOtherInit };
-    OMX_PORT_PARAM_TYPE ports_st;
-    OMX_INIT_STRUCTURE(ports_st);
+    OMX_PORT_PARAM_TYPE ports_st[4];
 
     int i;
     for (i = 0; i < 4; i++)
     {
-        if ((error = OMX_GetParameter(component->handle, types[i], &ports_st)))
+        OMX_INIT_STRUCTURE(ports_st[i]);
+        if ((error = OMX_GetParameter(component->handle, types[i], &ports_st[i])))
         {
             fprintf(stderr, "error: OMX_GetParameter: %s\n",
                     dump_OMX_ERRORTYPE(error));
@@ -125,13 +265,20 @@ void init_component(component_t* component)
         }
 
         OMX_U32 port;
-        for (port = ports_st.nStartPortNumber;
-                port < ports_st.nStartPortNumber + ports_st.nPorts; port++)
+        for (port = ports_st[i].nStartPortNumber;
+                port < ports_st[i].nStartPortNumber + ports_st[i].nPorts; port++)
         {
             //Disable the port
             disable_port(component, port);
+        }
+    }
+    for (i = 0; i < 4; i++)
+    {
+        OMX_U32 port;
+        for (port = ports_st[i].nStartPortNumber;
+                port < ports_st[i].nStartPortNumber + ports_st[i].nPorts; port++)
+        {
             //Wait to the event
-            //wait(component, EVENT_PORT_DISABLE, 0);
             wait_disable_port(component, port);
         }
     }
@@ -144,6 +291,7 @@ void deinit_component(component_t* component)
     OMX_ERRORTYPE error;
 
     vcos_event_flags_delete(&component->flags);
+    vcos_mutex_delete(&component->lock);
 
     if ((error = OMX_FreeHandle(component->handle)))
     {
@@ -160,6 +308,7 @@ void change_state(component_t* component, OMX_STATETYPE state)
 
     OMX_ERRORTYPE error;
 
+    forget_command(component, OMX_CommandStateSet, state);
     if ((error = OMX_SendCommand(component->handle, OMX_CommandStateSet, state,
             0)))
     {
@@ -175,6 +324,7 @@ void enable_port(component_t* component, OMX_U32 port)
 
     OMX_ERRORTYPE error;
 
+    forget_command(component, OMX_CommandPortEnable, port);
     if ((error = OMX_SendCommand(component->handle, OMX_CommandPortEnable, port,
             0)))
     {
@@ -190,6 +340,7 @@ void disable_port(component_t* component, OMX_U32 port)
 
     OMX_ERRORTYPE error;
 
+    forget_command(component, OMX_CommandPortDisable, port);
     if ((error = OMX_SendCommand(component->handle, OMX_CommandPortDisable,
             port, 0)))
     {
@@ -198,3 +349,65 @@ void disable_port(component_t* component, OMX_U32 port)
         exit(1);
     }
 }
+
+/*---------------------------------------------------------------------
+   graph-level transitions
+   the command is sent to every component (or port) first and then all
+   of them are waited for, so the VideoCore handles them concurrently
+   instead of one after another.
+   Only pass components whose transitions do not depend on each other,
+   e.g. Loaded <-> Idle while all the tunnel ports are disabled.
+----------------------------------------------------------------------*/
+void change_state_graph(component_t** components, int count,
+        OMX_STATETYPE state)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        change_state(components[i], state);
+    }
+    for (i = 0; i < count; i++)
+    {
+        wait_state_change(components[i], state);
+    }
+}
+
+void enable_ports(component_port_t* ports, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        enable_port(ports[i].component, ports[i].port);
+    }
+    for (i = 0; i < count; i++)
+    {
+        wait_enable_port(ports[i].component, ports[i].port);
+    }
+}
+
+void disable_ports(component_port_t* ports, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        disable_port(ports[i].component, ports[i].port);
+    }
+    for (i = 0; i < count; i++)
+    {
+        wait_disable_port(ports[i].component, ports[i].port);
+    }
+}
+
+//nTimeStamp of a buffer in microseconds
+//OMX_TICKS is a structure of two 32 bits words when OMX_SKIP64BIT is defined
+uint64_t omx_ticks_to_us(OMX_TICKS ticks)
+{
+#ifdef OMX_SKIP64BIT
+    return ((uint64_t)ticks.nHighPart << 32) | ticks.nLowPart;
+#else
+    return ticks;
+#endif
+}
@@ -26,6 +26,9 @@
 //Encoding setting
 #define VIDEO_FRAMERATE 30
 #define VIDEO_BITRATE 10000000
+//Number of output buffers kept in flight on the encoder output port (201).
+//1 reproduces the old single buffer behaviour
+#define VIDEO_OUTPUT_BUFFERS 4
 
 //Preview Resizing and Encoding setting
 #define PREVIEW_FRAMERATE 30
@@ -34,6 +37,32 @@
 #define PREVIEW_HEIGHT 240
 #define PREVIEW_SPS_PPS_INLINE OMX_TRUE
 #define PREVIEW_IDR_PERIOD 3
+//P frames with a rolling intra refresh: a band of intra macroblocks crosses
+//the picture in PREVIEW_REFRESH_PERIOD frames instead of IDRs, every frame
+//is sent and the bitrate stays even. 0 : one frame out of
+//PREVIEW_IDR_PERIOD is an IDR and only the IDRs are sent
+#define PREVIEW_INTRA_REFRESH 1
+#define PREVIEW_REFRESH_PERIOD 30 //frames
+#define PREVIEW_REFRESH_MBS ((((PREVIEW_WIDTH + 15) / 16) \
+        * ((PREVIEW_HEIGHT + 15) / 16) + PREVIEW_REFRESH_PERIOD - 1) \
+        / PREVIEW_REFRESH_PERIOD) //intra macroblocks per frame
+//IDR period with the refresh, the viewers that join ask for their IDR
+#define PREVIEW_REFRESH_IDR_PERIOD (10 * PREVIEW_FRAMERATE)
+#define PREVIEW_OUTPUT_BUFFERS 4
+//Number of output buffers on the resize output port (61) when its frames
+//wait in a queue for the software encoder (h264_udp_ffstream)
+#define RESIZE_OUTPUT_BUFFERS 4
+
+//Max time to wait for a command (state change, port enable/disable) to
+//complete, in ms. A loaded VideoCore can take seconds, so it is generous
+//and can be changed at build time (-DCOMPONENT_WAIT_TIMEOUT=...)
+#ifndef COMPONENT_WAIT_TIMEOUT
+#define COMPONENT_WAIT_TIMEOUT 15000
+#endif
+//A warning is printed every COMPONENT_WAIT_WARNING ms while still waiting
+#define COMPONENT_WAIT_WARNING 2000
+//Size of the table of completed commands kept per component
+#define MAX_COMPLETED_COMMANDS 32
 
 //Camera component port setting
 //Some settings doesn't work well
@@ -157,12 +186,29 @@ typedef struct
     VCOS_EVENT_FLAGS_T flags;
     //The fullname of the component
     OMX_STRING name;
+    //Commands completed by the component that nobody waited for yet, as
+    //{OMX_COMMANDTYPE, port or state} pairs. Filled by event_handler() and
+    //consumed by the wait_*() functions, protected by 'lock'
+    VCOS_MUTEX_T lock;
+    OMX_U32 completed[MAX_COMPLETED_COMMANDS][2];
+    int ncompleted;
+    //Output buffers of a non-tunneled port, NULL if the application manages
+    //a single buffer by itself. See buffer_pool.h
+    struct buffer_pool_t* pool;
 } component_t;
 
+//A port of a component, used to enable or disable several ports at once
+typedef struct
+{
+    component_t* component;
+    OMX_U32 port;
+} component_port_t;
+
 //Prototypes
 void wake(component_t* component, VCOS_UNSIGNED event);
 void wait(component_t* component, VCOS_UNSIGNED events,
         VCOS_UNSIGNED* retrieved_events);
+void command_complete(component_t* component, OMX_U32 command, OMX_U32 data);
 void wait_enable_port(component_t* component, OMX_U32 port);
 void wait_disable_port(component_t* component, OMX_U32 port);
 void wait_state_change(component_t* component, OMX_STATETYPE wanted_state);
@@ -173,4 +219,11 @@ void change_state(component_t* component, OMX_STATETYPE state);
 void enable_port(component_t* component, OMX_U32 port);
 void disable_port(component_t* component, OMX_U32 port);
 
+void change_state_graph(component_t** components, int count,
+        OMX_STATETYPE state);
+void enable_ports(component_port_t* ports, int count);
+void disable_ports(component_port_t* ports, int count);
+
+uint64_t omx_ticks_to_us(OMX_TICKS ticks);
+
 #endif
@@ -98,5 +98,32 @@ void disable_resize_output_port(component_t* cmp,
     wait_disable_port(cmp, 61); // @TODO for consistency move this outside
 }
 
+/*-------------------------------------------------------------------
+   non-tunneling output setting, with a pool of buffers
+   the frames can be kept while the component fills the other buffers
+   (see buffer_pool.h)
+---------------------------------------------------------------------*/
+void enable_resize_output_pool(component_t* cmp,
+        buffer_pool_t* resize_output_pool, int count)
+{
+    //The port is not enabled until the buffers are allocated.
+    //The buffer count can only be changed while the port is disabled
+    count = buffer_pool_set_count(cmp, 61, count);
+
+    enable_port(cmp, 61);
+
+    buffer_pool_allocate(cmp, resize_output_pool, 61, count);
 
+    wait_enable_port(cmp, 61);
+}
+
+void disable_resize_output_pool(component_t* cmp,
+        buffer_pool_t* resize_output_pool)
+{
+    //The port is not disabled until the buffers are released
+    disable_port(cmp, 61);
+
+    buffer_pool_free(cmp, resize_output_pool);
 
+    wait_disable_port(cmp, 61);
+}
@@ -2,6 +2,7 @@
 #define RESIZE_H
 
 #include "component_common.h"
+#include "buffer_pool.h"
 
 void set_resize_port_definition(component_t* resize);
 
@@ -10,4 +11,9 @@ void enable_resize_output_port(component_t* resize,
 void disable_resize_output_port(component_t* resize,
         OMX_BUFFERHEADERTYPE* resize_output_buffer);
 
+void enable_resize_output_pool(component_t* resize,
+        buffer_pool_t* resize_output_pool, int count);
+void disable_resize_output_pool(component_t* resize,
+        buffer_pool_t* resize_output_pool);
+
 #endif
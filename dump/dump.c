@@ -1,4 +1,5 @@
 #include "dump.h"
+#include "../stream/h264_nal.h"
 
 #define DUMP_CASE(x) case x: return #x;
 
@@ -390,37 +391,45 @@ void dump_OMX_BUFFERHEADERTYPE (OMX_BUFFERHEADERTYPE* header){
       header->nInputPortIndex);
 }
 
+//every NAL unit of the buffer, with its length
 int printNALFrame(unsigned char *frame, int len) {
     static int count = 0;
+    h264_nal_reader_t reader;
+    h264_nal_t nal;
     int i = 0;
 
     printf("%03d (len=%d):", ++count, len);
-    switch (frame[4] & 0x1F) {
+    h264_nal_reader_init(&reader, frame, len);
+    while (h264_next_nal(&reader, &nal)) {
+        switch (nal.type) {
 
-    case 1:
-        printf("[%-3s]", "PoB");
-        break;
-    case 2:
-    case 3:
-    case 4:
-        printf("[%-3s]", "PAT");
-        break;
-    case 5:
-        printf("===========================================================\n");
-        printf("[%-3s]", "IDR");
+        case 1:
+            printf("[%-3s]", "PoB");
+            break;
+        case 2:
+        case 3:
+        case 4:
+            printf("[%-3s]", "PAT");
+            break;
+        case 5:
+            printf("===========================================================\n");
+            printf("[%-3s]", "IDR");
 
-        break;
-    case 6:
-        printf("[%-3s]", "SEI");
-        break;
-    case 7:
-        printf("[%-3s]", "SPS");
-        break;
-    case 8:
-        printf("[%-3s]", "PPS");
-        break;
-    default:
-        break;
+            break;
+        case 6:
+            printf("[%-3s]", "SEI");
+            break;
+        case 7:
+            printf("[%-3s]", "SPS");
+            break;
+        case 8:
+            printf("[%-3s]", "PPS");
+            break;
+        default:
+            printf("[%3d]", nal.type);
+            break;
+        }
+        printf("%d ", nal.len);
     }
 
     for (i = 0; i < 10 && i < len; i++)
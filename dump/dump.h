@@ -5,6 +5,7 @@
 #include <string.h>
 #include <sys/time.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <IL/OMX_Broadcom.h>
 
 const char* dump_OMX_COLOR_FORMATTYPE (OMX_COLOR_FORMATTYPE color);
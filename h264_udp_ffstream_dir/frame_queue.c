@@ -0,0 +1,102 @@
+#include "frame_queue.h"
+
+void frame_queue_init(frame_queue_t* q, int depth)
+{
+    if (depth < 1)
+        depth = 1;
+    if (depth > FRAME_QUEUE_MAX)
+        depth = FRAME_QUEUE_MAX;
+
+    q->depth = depth;
+    q->head = 0;
+    q->count = 0;
+    q->closed = 0;
+    q->pushed = 0;
+    q->dropped = 0;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->cond, NULL);
+}
+
+void frame_queue_deinit(frame_queue_t* q)
+{
+    pthread_cond_destroy(&q->cond);
+    pthread_mutex_destroy(&q->lock);
+}
+
+/*---------------------------------------------------------------------
+   queue a frame, never blocks
+   return : the oldest frame, taken out to make room, NULL : none
+----------------------------------------------------------------------*/
+void* frame_queue_push(frame_queue_t* q, void* frame, uint64_t time)
+{
+    void* dropped = NULL;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->count == q->depth)
+    {
+        dropped = q->entries[q->head].frame;
+        q->head = (q->head + 1) % FRAME_QUEUE_MAX;
+        q->count--;
+        q->dropped++;
+    }
+    q->entries[(q->head + q->count) % FRAME_QUEUE_MAX].frame = frame;
+    q->entries[(q->head + q->count) % FRAME_QUEUE_MAX].time = time;
+    q->count++;
+    q->pushed++;
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+
+    return dropped;
+}
+
+/*---------------------------------------------------------------------
+   oldest frame, waits for one
+   time : when it was pushed, can be NULL
+   return : NULL once the queue is closed and empty
+----------------------------------------------------------------------*/
+void* frame_queue_pop(frame_queue_t* q, uint64_t* time)
+{
+    void* frame = NULL;
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && !q->closed)
+        pthread_cond_wait(&q->cond, &q->lock);
+    if (q->count > 0)
+    {
+        frame = q->entries[q->head].frame;
+        if (time)
+            *time = q->entries[q->head].time;
+        q->head = (q->head + 1) % FRAME_QUEUE_MAX;
+        q->count--;
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return frame;
+}
+
+//take a frame out without waiting, to empty the queue at the end
+//return : NULL if it is empty
+void* frame_queue_flush(frame_queue_t* q)
+{
+    void* frame = NULL;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->count > 0)
+    {
+        frame = q->entries[q->head].frame;
+        q->head = (q->head + 1) % FRAME_QUEUE_MAX;
+        q->count--;
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return frame;
+}
+
+//no more frames: frame_queue_pop() returns what is left, then NULL
+void frame_queue_close(frame_queue_t* q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+}
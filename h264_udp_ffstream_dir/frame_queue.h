@@ -0,0 +1,43 @@
+#ifndef FRAME_QUEUE_H
+#define FRAME_QUEUE_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+//Frames waiting for the software encoder
+//The OMX side pushes the filled buffers of the resize component and goes
+//back to OMX at once, an encoder thread pops them. A full queue drops its
+//oldest frame rather than blocking the OMX side: the caller gives the
+//dropped buffer back to the component.
+
+#define FRAME_QUEUE_MAX 16
+
+typedef struct
+{
+    void* frame;
+    uint64_t time; //us, when it was pushed
+} frame_queue_entry_t;
+
+typedef struct
+{
+    frame_queue_entry_t entries[FRAME_QUEUE_MAX];
+    int depth; //frames kept at most
+    int head;  //oldest frame
+    int count;
+    int closed;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    uint32_t pushed;
+    uint32_t dropped;
+} frame_queue_t;
+
+void frame_queue_init(frame_queue_t* q, int depth);
+void frame_queue_deinit(frame_queue_t* q);
+void* frame_queue_push(frame_queue_t* q, void* frame, uint64_t time);
+void* frame_queue_pop(frame_queue_t* q, uint64_t* time);
+void* frame_queue_flush(frame_queue_t* q);
+void frame_queue_close(frame_queue_t* q);
+
+#endif
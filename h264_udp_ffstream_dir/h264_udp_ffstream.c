@@ -2,6 +2,7 @@
 #include "omx_part.h"
 //for ffmpeg
 #include "ffh264enc.h"
+#include "frame_queue.h"
 
 //for UDP and TCP
 #include <stdlib.h>
@@ -15,6 +16,14 @@
 #include <string.h> /* memset() */
 #include <pthread.h>
 
+//for RTP
+#include "../stream/rtp.h"
+#include "../stream/udp_batch.h"
+#include "../stream/pacer.h"
+#include "../stream/fec.h"
+#include "../stream/rtx.h"
+#include "../stream/h264_params.h"
+
 //compile and run as daemon
 //if want to run in console, disable this definition
 #define RUN_DAEMON
@@ -26,8 +35,48 @@
 #define LOCAL_SERVER_PORT  1500
 #define STREAM_CLIENT_PORT 1501   
 
-#define MAX_UDP_SIZE 512       //
-#define MAX_PAYLOAD_SIZE 508   // 4 bytes header 
+//max RTP packet size, header included
+#define RTP_MTU RTP_DEFAULT_MTU
+//the packets of a frame are sent at once, see udp_send_mode_t
+#define UDP_SEND_MODE UDP_SEND_GSO
+//a frame is spread over this fraction of the frame interval, so that an
+//IDR does not leave as one burst; PACING_FRACTION 0 disables it
+//PACER_TXTIME needs the fq qdisc, e.g. "tc qdisc replace dev wlan0 root fq"
+#define PACING_MODE PACER_TIMER
+#define PACING_FRACTION 0.5
+#define PACING_WINDOW ((uint64_t)(PACING_FRACTION * 1000000 / VIDEO_FRAMERATE))
+#define PACING_MAX_RATE 0 //SO_MAX_PACING_RATE in bytes/s, 0 : not set
+//repair packets per media packet of a frame (payload type FEC_PAYLOAD_TYPE)
+//0.25 : one lost packet out of five is repaired, 0 disables it
+#define FEC_RATIO 0.25
+//the repair packets carry the longest media packet and FEC_OVERHEAD bytes,
+//the media packets leave that room so that the repairs fit in RTP_MTU
+#define PREVIEW_MTU ((FEC_RATIO > 0) ? RTP_MTU - FEC_OVERHEAD : RTP_MTU)
+//the client asking for an IDR (RTCP PLI) gets at most one per interval:
+//x264 makes a forced keyframe a full IDR, a bad link would turn the
+//preview into a stream of IDRs
+#define IDR_REQUEST_INTERVAL 500000 //us
+//SPS/PPS go in band in front of the first IDR of a session, of the IDR
+//asked by the client, then in front of an IDR at most once per interval
+//(without PREVIEW_INTRA_REFRESH x264 runs with gop_size 1, every frame is
+//an IDR); 0 : every IDR
+#define PARAMS_REPEAT 1000000 //us
+//resized frames per frame encoded: all of them with the intra refresh
+//(PREVIEW_INTRA_REFRESH), one out of PREVIEW_IDR_PERIOD without it
+#if PREVIEW_INTRA_REFRESH
+#define PREVIEW_FRAME_PERIOD 1
+#else
+#define PREVIEW_FRAME_PERIOD PREVIEW_IDR_PERIOD
+#endif
+//x264 reads the picture in the resize output buffer instead of a copy of
+//it, the buffer goes back to OMX once the encoder let it go
+//0 : copied into a buffer of the encoder
+#define PREVIEW_ZERO_COPY 1
+//resized frames waiting for the software encoder, the oldest one is
+//dropped when x264 falls behind: 1 always encodes the latest frame, 2
+//absorbs a short stall for one more frame of latency. Keep it at most
+//RESIZE_OUTPUT_BUFFERS - 2 so that the resize always has a buffer to fill
+#define PREVIEW_QUEUE_DEPTH 1
 
 //Signal flags for user interrupt and for save end
 //e.g : ctrl + c, client send quit message
@@ -47,49 +96,72 @@ int signal_flag_check(void)
 //also used for checking "Keep alive", periodically received message
 static int udpsock = -1;  // init with invalid
 static struct sockaddr_in cliAddr; // make a copy for modified
-static int nframe = 0;
-
-static void send_data(unsigned char *pBuf, int len)
+//RTP packetizer of the preview, reset on every session
+static rtp_packetizer_t rtp;
+//packets of the frame being sent
+static udp_batch_t batch;
+//spreads the packets of a frame
+static pacer_t pacer;
+//repair packets of the preview
+static fec_encoder_t fec;
+//sent packets, resent when the client reports them lost (RTCP NACK)
+static rtx_history_t rtx;
+//SPS/PPS of the preview, from the extradata of the encoder
+static h264_params_t params_prv;
+//software encoder of the preview while a session runs, NULL : none
+//enc_lock keeps it open while the control thread asks it for an IDR
+static ffh264_enc_t *preview_enc = NULL;
+static pthread_mutex_t enc_lock = PTHREAD_MUTEX_INITIALIZER;
+//resized frames (OMX buffers of the resize pool) for the encoder thread
+static frame_queue_t preview_queue;
+static component_t *preview_resize = NULL;
+static volatile int preview_encode_error = 0;
+
+//give a buffer back to the resize component
+static void yuv_refill(OMX_BUFFERHEADERTYPE *buffer)
 {
-    int n;
-    int flags = 0;
-    int cliLen = sizeof(struct sockaddr_in);
-    //int _len = len;
-    unsigned char nalType = pBuf[4] & 0x1F;
-    nframe++;
-    int nfragment = 0;
+    OMX_ERRORTYPE error;
 
-    while (len > 0)
+    if ((error = buffer_pool_fill(preview_resize, buffer)))
     {
-        /* 1. add header */
-        if (nfragment == 0)
-        { // use the space of '0001'
-            ;
-        }
-        else
-        { // use the previous fragement area for header
-            pBuf -= 4, len += 4;
-        }
-        *((unsigned short *) pBuf) = nframe;
-        pBuf[2] = nfragment;
-        pBuf[3] = nalType;
+        fprintf(stderr, "error: OMX_FillThisBuffer: %s\n",
+                dump_OMX_ERRORTYPE(error));
+        preview_encode_error = 1;
+    }
+}
 
-        /* 2. send one fragment */
-        n = (len > MAX_UDP_SIZE) ? MAX_UDP_SIZE : len;
-        n = sendto(udpsock, pBuf, n, flags, (struct sockaddr *) &cliAddr, cliLen);
-        if (n <= 0)
-        {
-            fprintf(stderr, "cannot send all data (%d) to client\n", n);
-            break;
-        }
-        /*
-        fprintf(stdout, "fn=%d(%d),fragment=%d(%d), nal=%d\n", nframe, _len,
-                nfragment, n, nalType); // to check
-        */
-        len -= n;
-        pBuf += n;  // @TODO header size ?
-        nfragment++;
+//release callback of ffh264_enc_encode_buffer(), opaque is the buffer
+static void yuv_release(void *opaque, unsigned char *data)
+{
+    yuv_refill((OMX_BUFFERHEADERTYPE*)opaque);
+}
+
+//rtp_send_t, the packet is sent with the rest of the frame
+//a big frame is sent in blocks of fec.block packets, each one with its
+//repair packets
+static int send_packet(void *arg, const unsigned char *packet, int len)
+{
+    int r = 0;
+
+    rtx_store(&rtx, packet, len);
+    if (batch.count == fec.block)
+    {
+        fec_protect(&fec, &batch);
+        r = pacer_flush(&pacer, &batch, udpsock, &cliAddr);
     }
+    udp_batch_put(&batch, packet, len);
+
+    return r;
+}
+
+//send an Annex-B buffer as RTP/H.264 packets
+//timestamp in us, end_of_frame sets the marker bit on the last packet
+static void send_data(unsigned char *pBuf, int len, uint64_t timestamp,
+        int end_of_frame)
+{
+    rtp_send_frame(&rtp, pBuf, len, rtp_timestamp(timestamp), end_of_frame);
+    fec_protect(&fec, &batch);
+    pacer_flush(&pacer, &batch, udpsock, &cliAddr);
 }
 
 static int open_listenfd(short portNum)
@@ -209,18 +281,19 @@ void* encoding_thread(void* arg)
     float frame_rate = 0;
 
     printf("Encoding thread will write to video.h264 file\n");
-    while (1)
+    //Hand all the output buffers to the encoder at once, so it keeps
+    //encoding into the free ones while a filled one is being consumed
+    if ((error = buffer_pool_fill_all(cmp->component)))
     {
-        //Get the buffer data
-        if ((error = OMX_FillThisBuffer(cmp->component->handle, cmp->buffer)))
-        {
-            fprintf(stderr, "error: OMX_FillThisBuffer: %s\n",
-                    dump_OMX_ERRORTYPE(error));
-            vcos_thread_exit((void*)1);
-        }
+        fprintf(stderr, "error: OMX_FillThisBuffer: %s\n",
+                dump_OMX_ERRORTYPE(error));
+        vcos_thread_exit((void*)1);
+    }
 
-        //Wait until it's filled
-        wait(cmp->component, EVENT_FILL_BUFFER_DONE, 0);
+    while (1)
+    {
+        //Wait until a buffer is filled (oldest first)
+        OMX_BUFFERHEADERTYPE* buffer = buffer_pool_get_filled(cmp->component);
 
         //for calculate actual frame rate
         pre_time = currunt_time;
@@ -238,7 +311,7 @@ void* encoding_thread(void* arg)
             //wait the key frame for check the boundry of video and exit
 
             //wait until find I frame(syncframe)
-            if(cmp->buffer->nFlags & OMX_BUFFERFLAG_SYNCFRAME)
+            if(buffer->nFlags & OMX_BUFFERFLAG_SYNCFRAME)
             {
                 printf("encoding : SyncFrame found, It will be finished in a moment.\n");
                 encoding_thread_exit_flag = 1;
@@ -248,12 +321,20 @@ void* encoding_thread(void* arg)
 
         //Append the buffer into the file
         if (write(*(cmp->fd)
-                    , cmp->buffer->pBuffer
-                    , cmp->buffer->nFilledLen) == -1)
+                    , buffer->pBuffer
+                    , buffer->nFilledLen) == -1)
         {
             fprintf(stderr, "error: write\n");
             vcos_thread_exit((void*)1);
         }
+
+        //Give the buffer back to the encoder
+        if ((error = buffer_pool_fill(cmp->component, buffer)))
+        {
+            fprintf(stderr, "error: OMX_FillThisBuffer: %s\n",
+                    dump_OMX_ERRORTYPE(error));
+            vcos_thread_exit((void*)1);
+        }
     }
 
     vcos_thread_exit((void*)0);
@@ -271,17 +352,19 @@ enum NAL_TYPE
     PPS = 8,
 };
 
+//type of the frame in the buffer, which can hold SPS + PPS + IDR
 int get_NAL_type(unsigned char* frame, int len)
 {
-    return frame[4] & 0x1f;
+    return h264_nal_type(frame, len);
 }
 
-//Thread for preview, write resized video to preview.h264
-void* preview_thread(void* arg)
+//Encoder thread of the preview: the resized frames from preview_queue to
+//x264 then RTP, the OMX side never waits for it
+static void* preview_encode_thread(void* arg)
 {
-    component_buffer_t* cmp = (component_buffer_t*)arg;
-
-    OMX_ERRORTYPE error;
+    ffh264_enc_t *enc = (ffh264_enc_t*)arg;
+    OMX_BUFFERHEADERTYPE *buffer;
+    uint64_t queued;
 
     //for calculate actual frame rate
     uint64_t pre_time = 0;
@@ -290,35 +373,133 @@ void* preview_thread(void* arg)
     int frame_count = 0;
     float frame_rate = 0;
 
+    //queued to sent
+    uint64_t latency_sum = 0;
+    uint64_t latency_max = 0;
+
+    while ((buffer = frame_queue_pop(&preview_queue, &queued)))
+    {
+        pre_time = currunt_time;
+        currunt_time = GetTimeStamp();
+        time_gap = currunt_time - pre_time;
+        frame_rate = (double) 1000000 / (double) time_gap;
+        frame_count++;
+        printf("preview_thread\nframecount : %d\nframerate : %f\n\n", frame_count, frame_rate);;
+
+        //capture time of the picture, x264 runs with zerolatency so
+        //the encoded frame comes out of this same call
+        uint64_t timestamp = omx_ticks_to_us(buffer->nTimeStamp);
+        if (timestamp == 0)
+            timestamp = queued;
+
+        unsigned char *pBuffer;
+#if PREVIEW_ZERO_COPY
+        int n = ffh264_enc_encode_buffer(enc, buffer->pBuffer,
+                buffer->nFilledLen, yuv_release, buffer, &pBuffer);
+#else
+        int n = ffh264_enc_encode(enc, buffer->pBuffer, &pBuffer);
+        yuv_refill(buffer);
+#endif
+        if (n < 0)
+        { // errror in encoding
+            fprintf(stderr, "error: encoding\n");
+            preview_encode_error = 1;
+            return (void*) 1;
+        }
+        else if (n > 0)
+        {
+            // write SPS/PPS data, in front of the IDRs that need it
+            unsigned char params[2 * H264_PARAMS_MAX + 8];
+            int params_len = h264_params_inject(&params_prv, pBuffer, n,
+                    GetTimeStamp(), params, sizeof(params));
+            if (params_len > 0)
+                send_data(params, params_len, timestamp, 0);
+            // write frame data
+            send_data(pBuffer, n, timestamp, 1);
+        }
+
+        uint64_t latency = GetTimeStamp() - queued;
+        latency_sum += latency;
+        if (latency > latency_max)
+            latency_max = latency;
+    }
+
+    printf("preview : %u frames queued, %u dropped, queued to sent "
+            "%.1f ms mean, %.1f ms max\n", preview_queue.pushed,
+            preview_queue.dropped,
+            frame_count ? latency_sum / 1000.0 / frame_count : 0.0,
+            latency_max / 1000.0);
+
+    return (void*) 0;
+}
+
+//Thread for preview: takes the resized frames from OMX and queues them
+//for the encoder thread
+void* preview_thread(void* arg)
+{
+    component_buffer_t* cmp = (component_buffer_t*)arg;
+
+    OMX_ERRORTYPE error;
+    pthread_t encode_tid;
+    void *encode_status;
+    OMX_BUFFERHEADERTYPE *dropped;
+
     printf("preview thread will write to preview.h264 file\n");
 
     //Since OMX, which was originally used, did not change the encoder frame rate in the middle.
     //So, we set the frame rate to send UDP by modifying the IDR period.
     //in this source We use ffmpeg, but I use IDR_PERIOD to determine the frame rate
     //to be finally sent to UDP for common use with the above case.
+    //With the intra refresh every frame is encoded and sent.
     int idr_period_count = 0;
     
     // init software codec
-    int width = PREVIEW_WIDTH, height= PREVIEW_HEIGHT, bitrate = PREVIEW_BITRATE, fps = PREVIEW_FRAMERATE / PREVIEW_IDR_PERIOD; 
-    ffh264_enc_open(width, height, bitrate, fps);
+    int width = PREVIEW_WIDTH, height= PREVIEW_HEIGHT, bitrate = PREVIEW_BITRATE, fps = PREVIEW_FRAMERATE / PREVIEW_FRAME_PERIOD; 
+    ffh264_enc_config_t cfg;
+    ffh264_enc_config_default(&cfg, width, height, bitrate, fps);
+#if PREVIEW_INTRA_REFRESH
+    cfg.gop = PREVIEW_REFRESH_PERIOD;
+    cfg.intra_refresh = 1;
+#endif
+    ffh264_enc_t *enc = ffh264_enc_open_config(&cfg);
+    if (!enc)
+    {
+        fprintf(stderr, "error: ffh264_enc_open\n");
+        vcos_thread_exit((void*) 1);
+    }
+    pthread_mutex_lock(&enc_lock);
+    preview_enc = enc;
+    pthread_mutex_unlock(&enc_lock);
 
-    // get SPS/PPS data directly.
+    // get SPS/PPS data directly, sent with the first IDR of the session
     unsigned char extradata[100] = {0,};
     int extradata_size = 0;
-    ffh264_get_global_header(&extradata_size, extradata);
+    ffh264_get_global_header(enc, &extradata_size, extradata);
+    h264_params_update(&params_prv, extradata, extradata_size);
+    h264_params_resend(&params_prv);
+
+    preview_resize = cmp->component;
+    preview_encode_error = 0;
+    frame_queue_init(&preview_queue, PREVIEW_QUEUE_DEPTH);
+    if (pthread_create(&encode_tid, NULL, preview_encode_thread, enc))
+    {
+        fprintf(stderr, "error: pthread_create\n");
+        vcos_thread_exit((void*) 1);
+    }
 
-    while (1)
+    //Hand all the output buffers to the resize at once, so it keeps
+    //resizing into the free ones while x264 works on a previous one
+    if ((error = buffer_pool_fill_all(cmp->component)))
     {
-        //Get the buffer data
-        if ((error = OMX_FillThisBuffer(cmp->component->handle, cmp->buffer)))
-        {
-            fprintf(stderr, "error: OMX_FillThisBuffer: %s\n",
-                    dump_OMX_ERRORTYPE(error));
-            vcos_thread_exit((void*)1);
-        }
+        fprintf(stderr, "error: OMX_FillThisBuffer: %s\n",
+                dump_OMX_ERRORTYPE(error));
+        vcos_thread_exit((void*)1);
+    }
 
-        //Wait until it's filled
-        wait(cmp->component, EVENT_FILL_BUFFER_DONE, 0);
+    while (!preview_encode_error)
+    {
+        //Wait until a buffer is filled (oldest first)
+        OMX_BUFFERHEADERTYPE* buffer = buffer_pool_get_filled(cmp->component);
 
         //check if user press "ctrl c" or other interrupt occured
         if(signal_flag_check() || quit_flag)
@@ -334,41 +515,32 @@ void* preview_thread(void* arg)
             }
         }
 
-        // Encoding
+        // Encoding, one frame out of PREVIEW_FRAME_PERIOD
         idr_period_count++;
-        if(idr_period_count == PREVIEW_IDR_PERIOD)
+        if(idr_period_count != PREVIEW_FRAME_PERIOD)
         {
-            idr_period_count = 0;
-
-            pre_time = currunt_time;
-            currunt_time = GetTimeStamp();
-            time_gap = currunt_time - pre_time;
-            frame_rate = (double) 1000000 / (double) time_gap;
-            frame_count++;
-            printf("preview_thread\nframecount : %d\nframerate : %f\n\n", frame_count, frame_rate);;
-
-            unsigned char *pBuffer;
-            int n = ffh264_enc_encode(cmp->buffer->pBuffer, &pBuffer);
-            if (n < 0)
-            { // errror in encoding
-                fprintf(stderr, "error: encoding\n");
-                vcos_thread_exit((void*) 1);
-            }
-            else if (n > 0)
-            {
-                // write SPS/PPS data
-                send_data(extradata, extradata_size);
-                // write frame data
-                send_data(pBuffer, n);
-            }
-            else if (n == 0) // encoding ok but no data to give
-                continue;
+            yuv_refill(buffer);
+            continue;
         }
+        idr_period_count = 0;
+
+        //x264 is behind: the oldest frame waiting goes back to the resize
+        dropped = frame_queue_push(&preview_queue, buffer, GetTimeStamp());
+        if (dropped)
+            yuv_refill(dropped);
     }
 
-    ffh264_enc_close();
+    //the frames already queued are still sent
+    frame_queue_close(&preview_queue);
+    pthread_join(encode_tid, &encode_status);
+    frame_queue_deinit(&preview_queue);
+
+    pthread_mutex_lock(&enc_lock);
+    preview_enc = NULL;
+    pthread_mutex_unlock(&enc_lock);
+    ffh264_enc_close(enc);
     
-    vcos_thread_exit((void*)0);
+    vcos_thread_exit(encode_status);
 
     return NULL;
 }
@@ -388,8 +560,9 @@ static void *stream_loop(void *arg)
         exit(1);
     }
 
-    //frame count initialise
-    nframe = 0;
+    //new RTP stream (sequence number, SSRC)
+    rtp_packetizer_init(&rtp, PREVIEW_MTU, rand(), send_packet, NULL);
+    fec_encoder_init(&fec, FEC_RATIO, rand());
 
     // 1.  create omx grpah  
     rpiomx_open();
@@ -417,6 +590,8 @@ static void *stream_loop(void *arg)
         fprintf(stderr, "Error: cannot bind port number %d\n", localport);
         pthread_exit((void *) -1);
     }
+    udp_batch_init(&batch, udpsock, UDP_SEND_MODE);
+    pacer_init(&pacer, udpsock, PACING_MODE, PACING_WINDOW, PACING_MAX_RATE);
 
     /* 3. prepare destination address */
     //cliAddr.sin_family = AF_INET;
@@ -430,7 +605,6 @@ static void *stream_loop(void *arg)
     component_buffer_t encode_cmp;
     encode_cmp.fd = &fd;
     encode_cmp.component = cmp_buf.encoder;
-    encode_cmp.buffer = cmp_buf.encoder_output_buffer;
     
     VCOS_THREAD_T encode_th;
     vcos_thread_create(&encode_th, "encode_thread", NULL, encoding_thread, (void*)(&encode_cmp));
@@ -442,7 +616,7 @@ static void *stream_loop(void *arg)
     //preview_cmp.component = cmp_buf.encoder_prv;
     //preview_cmp.buffer = cmp_buf.preview_output_buffer;
     preview_cmp.component = cmp_buf.resize;
-    preview_cmp.buffer = cmp_buf.resize_output_buffer;
+    preview_cmp.buffer = NULL; //buffers of cmp_buf.resize_output_pool
 
     VCOS_THREAD_T preview_th;
     vcos_thread_create(&preview_th, "preview_thread", NULL, preview_thread, (void*)(&preview_cmp));
@@ -475,6 +649,9 @@ static void *stream_loop(void *arg)
     rpiomx_close();
 
     close(fd);
+    printf("preview : %u packets in %u send calls\n", batch.packets,
+            batch.calls);
+    pacer_deinit(&pacer);
     close(udpsock);
     udpsock = -1;  // mark it invalid
     pthread_exit((void *) 0); // user-requested-stop
@@ -490,6 +667,9 @@ static int stream_control(int sock, struct sockaddr_in *pCliAddr)
     unsigned char txbuf[128]; /* one byte only used */
     int flags = 0;
     int event = 0;
+    rtcp_feedback_t fb;
+    uint64_t last_idr_request = 0;
+    int i;
 
     while (1)
     {
@@ -514,12 +694,29 @@ static int stream_control(int sock, struct sockaddr_in *pCliAddr)
         else if (event == 2)
         {
             updateKeepAlive();
-            n = 128;
+            n = 127;
             n = recvfrom(udpsock, rxbuf, n, 0, NULL, 0); // don't care of address
             if (n < 0)
             {
                 fprintf(stderr, " Ooops, Error in reading udp socket...\n");
             }
+            else if (rtcp_parse_feedback(rxbuf, n, &fb) == 0)
+            {
+                //lost packets and keyframe requests of the client
+                for (i = 0; i < fb.nlost; i++)
+                    rtx_resend(&rtx, udpsock, &cliAddr, fb.ssrc, fb.lost[i]);
+                if (fb.pli
+                        && GetTimeStamp() - last_idr_request
+                                >= IDR_REQUEST_INTERVAL)
+                {
+                    last_idr_request = GetTimeStamp();
+                    h264_params_resend(&params_prv);
+                    pthread_mutex_lock(&enc_lock);
+                    if (preview_enc)
+                        ffh264_enc_request_idr(preview_enc);
+                    pthread_mutex_unlock(&enc_lock);
+                }
+            }
             else
             {
                 rxbuf[n] = 0;
@@ -650,6 +847,9 @@ int main(int argc, char **argv)
 
     listenfd = open_listenfd(port);
     listen(listenfd, 1);
+    rtx_init(&rtx);
+    h264_params_init(&params_prv);
+    params_prv.repeat = PARAMS_REPEAT;
 
     printf("now listen something\n");
 
@@ -13,10 +13,27 @@
 #include <string.h> /* memset() */
 #include <pthread.h>
 
+//for RTP
+#include "../stream/rtp.h"
+#include "../stream/udp_batch.h"
+#include "../stream/pacer.h"
+#include "../stream/fec.h"
+#include "../stream/rtx.h"
+#include "../stream/fanout.h"
+#include "../stream/h264_params.h"
+#include "../stream/rtsp.h"
+#include "../stream/control.h"
+
 //compile and run as daemon
 //if want to run in console, disable this definition
 #define RUN_DAEMON
 
+//keep the OMX graph running between streaming sessions
+//a client sending 's' attaches to the running graph and gets an IDR, instead
+//of waiting for OpenMAX and the camera drivers to be loaded again.
+//if want to rebuild the graph on every session, disable this definition
+#define KEEP_PIPELINE_WARM
+
 //Save High resolution video to file
 #define FILENAME "video.h264" 
 
@@ -24,8 +41,36 @@
 #define LOCAL_SERVER_PORT  1500
 #define STREAM_CLIENT_PORT 1501   
 
-#define MAX_UDP_SIZE 512       //
-#define MAX_PAYLOAD_SIZE 508   // 4 bytes header 
+//max RTP packet size, header included
+#define RTP_MTU RTP_DEFAULT_MTU
+//the packets of a frame are sent at once, see udp_send_mode_t
+#define UDP_SEND_MODE UDP_SEND_GSO
+//a frame is spread over this fraction of the frame interval, so that an
+//IDR does not leave as one burst; PACING_FRACTION 0 disables it
+//PACER_TXTIME needs the fq qdisc, e.g. "tc qdisc replace dev wlan0 root fq"
+#define PACING_MODE PACER_TIMER
+#define PACING_FRACTION 0.5
+#define PACING_WINDOW ((uint64_t)(PACING_FRACTION * 1000000 / VIDEO_FRAMERATE))
+#define PACING_MAX_RATE 0 //SO_MAX_PACING_RATE in bytes/s, 0 : not set
+//repair packets per media packet of a frame (payload type FEC_PAYLOAD_TYPE)
+//0.25 : one lost packet out of five is repaired, 0 disables it
+#define FEC_RATIO 0.25
+//the repair packets carry the longest media packet and FEC_OVERHEAD bytes,
+//the media packets leave that room so that the repairs fit in RTP_MTU
+#define PREVIEW_MTU ((FEC_RATIO > 0) ? RTP_MTU - FEC_OVERHEAD : RTP_MTU)
+//a viewer asking for an IDR (RTCP PLI) gets at most one per interval, so
+//that a bad link does not turn the preview into a stream of IDRs
+#define IDR_REQUEST_INTERVAL 500000 //us
+//SPS/PPS go in band in front of the first IDR a viewer gets, then in front
+//of an IDR at most once per interval (without PREVIEW_INTRA_REFRESH the
+//preview is all IDRs and its encoder puts them in every one); 0 : every IDR
+#define PARAMS_REPEAT 1000000 //us
+
+//RTSP server: rtsp://<address>:RTSP_PORT/ with the preview as track0 and
+//the main stream as track1
+#define RTSP_PORT 8554
+//biggest frame of the main stream sent to the RTSP viewers
+#define MAIN_FRAME_MAX (1024 * 1024)
 
 //Signal flags for user interrupt and for save end
 //e.g : ctrl + c, client send quit message
@@ -41,53 +86,45 @@ int signal_flag_check(void)
 }
 
 //global variables for UDP
-//udpsock be used for sending low resolution video 
+//udpsock be used for sending low resolution video to all the viewers
 //also used for checking "Keep alive", periodically received message
 static int udpsock = -1;  // init with invalid
-static struct sockaddr_in cliAddr; // make a copy for modified
-static int nframe = 0;
-
-static void send_data(unsigned char *pBuf, int len)
+//RTP packetizer of the preview, reset on every session
+static rtp_packetizer_t rtp;
+//viewers of the preview, the packets of a frame are built once for all
+static fanout_t fanout;
+//repair packets of the preview, added to each frame by the fan-out
+static fec_encoder_t fec;
+//sent packets, resent when a viewer reports them lost (RTCP NACK)
+static rtx_history_t rtx;
+//main stream, only packetized while an RTSP viewer watches it
+static rtp_packetizer_t rtp_main;
+static fanout_t fanout_main;
+//SPS/PPS of both streams for the RTSP DESCRIBE and the in band copies
+static h264_params_t params_main;
+static h264_params_t params_prv;
+static rtsp_server_t rtsp;
+
+//Streaming session, shared by the control threads and the encoding threads
+//it lasts from the first viewer that sends 's' to the last one that leaves
+//session_fd    : main video file of the session (-1 : no session)
+//session_active: preview is packetized for the viewers
+//all of them are protected by session_lock
+static pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
+static int session_fd = -1;
+static int session_active = 0;
+static int session_wait_sync = 0; // new file waits for an IDR
+static int preview_wait_idr = 0;  // new RTP stream starts on an IDR
+static uint64_t attach_time = 0;  // for connect-to-first-IDR latency
+
+//send an Annex-B buffer as RTP/H.264 packets
+//timestamp in us, end_of_frame sets the marker bit on the last packet
+static void send_data(unsigned char *pBuf, int len, uint64_t timestamp,
+        int end_of_frame)
 {
-    int n;
-    int flags = 0;
-    int cliLen = sizeof(struct sockaddr_in);
-    //int _len = len;
-    unsigned char nalType = pBuf[4] & 0x1F;
-    nframe++;
-    int nfragment = 0;
-
-    while (len > 0)
-    {
-        /* 1. add header */
-        if (nfragment == 0)
-        { // use the space of '0001'
-            ;
-        }
-        else
-        { // use the previous fragement area for header
-            pBuf -= 4, len += 4;
-        }
-        *((unsigned short *) pBuf) = nframe;
-        pBuf[2] = nfragment;
-        pBuf[3] = nalType;
-
-        /* 2. send one fragment */
-        n = (len > MAX_UDP_SIZE) ? MAX_UDP_SIZE : len;
-        n = sendto(udpsock, pBuf, n, flags, (struct sockaddr *) &cliAddr, cliLen);
-        if (n <= 0)
-        {
-            fprintf(stderr, "cannot send all data (%d) to client\n", n);
-            break;
-        }
-        /*
-        fprintf(stdout, "fn=%d(%d),fragment=%d(%d), nal=%d\n", nframe, _len,
-                nfragment, n, nalType); // to check
-        */
-        len -= n;
-        pBuf += n;  // @TODO header size ?
-        nfragment++;
-    }
+    rtp_send_frame(&rtp, pBuf, len, rtp_timestamp(timestamp), end_of_frame);
+    //queue the packets to every viewer
+    fanout_publish(&fanout);
 }
 
 static int open_listenfd(short portNum)
@@ -126,60 +163,49 @@ static int open_listenfd(short portNum)
 
 // definition for check period of "Keep alive" message from client
 #define KEEP_ALIVE_INTERVAL    2500  //in ms
-static struct timespec latestKeepAlive;
 
-//for check "Keep alive", update the time 
-static void updateKeepAlive()
-{
-    clock_gettime(CLOCK_MONOTONIC, &latestKeepAlive);
-}
+//main stream of the RTSP viewers, the buffers of a frame are put together
+//so that the packetizer sees whole NAL units; -1 : skip to the next frame
+static unsigned char main_frame[MAIN_FRAME_MAX];
+static int main_frame_len = 0;
 
-//for check "Keep alive", get the difference between the previous time and the present time.
-static long elapsedtimeKeepAlive()
+//called for every buffer of the main encoder, with session_lock held
+static void send_main(OMX_BUFFERHEADERTYPE *buffer, int watched)
 {
-    long elapsed_in_ms;
-    struct timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
-    elapsed_in_ms = (now.tv_sec * 1000 + now.tv_nsec / 1.0e6)
-            - (latestKeepAlive.tv_sec * 1000 + latestKeepAlive.tv_nsec / 1.0e6);
+    int len = buffer->nFilledLen;
+    int end = buffer->nFlags & OMX_BUFFERFLAG_ENDOFFRAME;
+    int sync = buffer->nFlags & OMX_BUFFERFLAG_SYNCFRAME;
 
-    return elapsed_in_ms;
-}
+    //sent from the cache in front of every IDR
+    if (buffer->nFlags & OMX_BUFFERFLAG_CODECCONFIG)
+        return;
 
-static int waitEvent(int fd1, int fd2, int time)
-{
-    int nselected;
-    struct timeval timeout;
-    fd_set readfds; //, writefds;
-    int max_fd;
-
-    timeout.tv_sec = 0;
-    timeout.tv_usec = time * 1000L; // ms to us
-
-    FD_ZERO(&readfds);
-    if (fd1 < 0)
-        return -1;
-    FD_SET(fd1, &readfds);
-    if (fd2 >= 0)
-        FD_SET(fd2, &readfds);
-    max_fd = (fd1 > fd2) ? fd1 : fd2;
+    if (!watched || main_frame_len == -1
+            || main_frame_len + len > MAIN_FRAME_MAX)
+    {
+        main_frame_len = end ? 0 : -1;
+        return;
+    }
 
-    nselected = select(max_fd + 1, &readfds, (fd_set *) NULL, (fd_set *) NULL,
-            &timeout);
+    //a viewer that joins gets SPS/PPS with the IDR
+    if (main_frame_len == 0 && sync)
+        main_frame_len = h264_params_inject(&params_main,
+                buffer->pBuffer + buffer->nOffset, len, GetTimeStamp(),
+                main_frame, MAIN_FRAME_MAX - len);
+    memcpy(main_frame + main_frame_len, buffer->pBuffer + buffer->nOffset,
+            len);
+    main_frame_len += len;
 
-    if (nselected == 0)
-        return 0;
-    else if (nselected > 0)
+    if (end)
     {
-        if (FD_ISSET(fd1, &readfds))
-            return 1;
-        else if (FD_ISSET(fd2, &readfds))
-            return 2;
-        else
-            return -1;
+        uint64_t timestamp = omx_ticks_to_us(buffer->nTimeStamp);
+        if (timestamp == 0)
+            timestamp = GetTimeStamp();
+        rtp_send_frame(&rtp_main, main_frame, main_frame_len,
+                rtp_timestamp(timestamp), 1);
+        fanout_publish(&fanout_main);
+        main_frame_len = 0;
     }
-    else
-        return -1;
 }
 
 //Informations to pass to the thread as an argument
@@ -203,19 +229,25 @@ void* encoding_thread(void* arg)
     int frame_count = 0;
     float frame_rate = 0;
 
+    //SPS/PPS of the main encoder
+    unsigned char codec_config[256];
+    unsigned int codec_config_len = 0;
+    int in_codec_config = 0;
+
     printf("Encoding thread will write to video.h264 file\n");
-    while (1)
+    //Hand all the output buffers to the encoder at once, so it keeps
+    //encoding into the free ones while a filled one is being consumed
+    if ((error = buffer_pool_fill_all(cmp->component)))
     {
-        //Get the buffer data
-        if ((error = OMX_FillThisBuffer(cmp->component->handle, cmp->buffer)))
-        {
-            fprintf(stderr, "error: OMX_FillThisBuffer: %s\n",
-                    dump_OMX_ERRORTYPE(error));
-            vcos_thread_exit((void*)1);
-        }
+        fprintf(stderr, "error: OMX_FillThisBuffer: %s\n",
+                dump_OMX_ERRORTYPE(error));
+        vcos_thread_exit((void*)1);
+    }
 
-        //Wait until it's filled
-        wait(cmp->component, EVENT_FILL_BUFFER_DONE, 0);
+    while (1)
+    {
+        //Wait until a buffer is filled (oldest first)
+        OMX_BUFFERHEADERTYPE* buffer = buffer_pool_get_filled(cmp->component);
 
         //for calculate actual frame rate
         pre_time = currunt_time;
@@ -233,19 +265,63 @@ void* encoding_thread(void* arg)
             //wait the key frame for check the boundry of video and exit
 
             //wait until find I frame(syncframe)
-            if(cmp->buffer->nFlags & OMX_BUFFERFLAG_SYNCFRAME)
+            if(buffer->nFlags & OMX_BUFFERFLAG_SYNCFRAME)
             {
                 printf("encoding : SyncFrame found, It will be finished in a moment.\n");
                 break;
             }
         }
 
-        //Append the buffer into the file
-        if (pwrite(*(cmp->fd), cmp->buffer->pBuffer,
-                cmp->buffer->nFilledLen,
-                cmp->buffer->nOffset) == -1)
+        //SPS/PPS only come at the start of the stream, keep them for the
+        //sessions that start later on the running encoder
+        if (buffer->nFlags & OMX_BUFFERFLAG_CODECCONFIG)
         {
-            fprintf(stderr, "error: pwrite\n");
+            if (!in_codec_config)
+                codec_config_len = 0;
+            in_codec_config = 1;
+            if (codec_config_len + buffer->nFilledLen <= sizeof(codec_config))
+            {
+                memcpy(codec_config + codec_config_len,
+                        buffer->pBuffer + buffer->nOffset, buffer->nFilledLen);
+                codec_config_len += buffer->nFilledLen;
+            }
+            h264_params_update(&params_main, buffer->pBuffer + buffer->nOffset,
+                    buffer->nFilledLen);
+        }
+        else
+        {
+            in_codec_config = 0;
+        }
+
+        //Append the buffer into the file of the current session
+        //a new file starts with SPS/PPS and an IDR
+        int r = 0;
+        pthread_mutex_lock(&session_lock);
+        if (*(cmp->fd) != -1 && session_wait_sync
+                && (buffer->nFlags & OMX_BUFFERFLAG_SYNCFRAME))
+        {
+            session_wait_sync = 0;
+            r = write(*(cmp->fd), codec_config, codec_config_len);
+        }
+        if (r != -1 && *(cmp->fd) != -1 && !session_wait_sync
+                && !(buffer->nFlags & OMX_BUFFERFLAG_CODECCONFIG))
+        {
+            r = write(*(cmp->fd), buffer->pBuffer + buffer->nOffset,
+                    buffer->nFilledLen);
+        }
+        send_main(buffer, session_active && fanout_count(&fanout_main) > 0);
+        pthread_mutex_unlock(&session_lock);
+        if (r == -1)
+        {
+            fprintf(stderr, "error: write\n");
+            vcos_thread_exit((void*)1);
+        }
+
+        //Give the buffer back to the encoder
+        if ((error = buffer_pool_fill(cmp->component, buffer)))
+        {
+            fprintf(stderr, "error: OMX_FillThisBuffer: %s\n",
+                    dump_OMX_ERRORTYPE(error));
             vcos_thread_exit((void*)1);
         }
     }
@@ -265,9 +341,10 @@ enum NAL_TYPE
     PPS = 8,
 };
 
+//type of the frame in the buffer, which can hold SPS + PPS + IDR
 int get_NAL_type(unsigned char* frame, int len)
 {
-    return frame[4] & 0x1f;
+    return h264_nal_type(frame, len);
 }
 
 //Thread for preview, write resized video to preview.h264
@@ -285,18 +362,19 @@ void* preview_thread(void* arg)
     float frame_rate = 0;
 
     printf("preview thread will write to preview.h264 file\n");
-    while (1)
+    //Hand all the output buffers to the encoder at once, so it keeps
+    //encoding into the free ones while a filled one is being consumed
+    if ((error = buffer_pool_fill_all(cmp->component)))
     {
-        //Get the buffer data
-        if ((error = OMX_FillThisBuffer(cmp->component->handle, cmp->buffer)))
-        {
-            fprintf(stderr, "error: OMX_FillThisBuffer: %s\n",
-                    dump_OMX_ERRORTYPE(error));
-            vcos_thread_exit((void*)1);
-        }
+        fprintf(stderr, "error: OMX_FillThisBuffer: %s\n",
+                dump_OMX_ERRORTYPE(error));
+        vcos_thread_exit((void*)1);
+    }
 
-        //Wait until it's filled
-        wait(cmp->component, EVENT_FILL_BUFFER_DONE, 0);
+    while (1)
+    {
+        //Wait until a buffer is filled (oldest first)
+        OMX_BUFFERHEADERTYPE* buffer = buffer_pool_get_filled(cmp->component);
 
         //check if user press "ctrl c" or other interrupt occured
         if(signal_flag_check() || quit_flag)
@@ -305,8 +383,10 @@ void* preview_thread(void* arg)
             //signal interrupt detected
             //wait the key frame for check the boundry of video and exit
 
-            //wait until find I frame(syncframe)
-            if(cmp->buffer->nFlags & OMX_BUFFERFLAG_SYNCFRAME)
+            //wait until find I frame(syncframe), with the intra refresh
+            //the IDRs are rare and any frame will do
+            if(PREVIEW_INTRA_REFRESH
+               || (buffer->nFlags & OMX_BUFFERFLAG_SYNCFRAME))
             {
                 printf("preview : SyncFrame found, It will be finished in a moment.\n");
                 break;
@@ -314,17 +394,46 @@ void* preview_thread(void* arg)
         }
         
         //print type of NAL header
-        //printNALFrame(cmp->buffer->pBuffer, cmp->buffer->nFilledLen);
+        //printNALFrame(buffer->pBuffer, buffer->nFilledLen);
 
         ////Write buffer to UDP
-        //only send IDR slice or SPS/PPS
-        int nal_type = get_NAL_type(cmp->buffer->pBuffer, cmp->buffer->nFilledLen);
-        if((nal_type == IDR) 
-            || (nal_type == SPS)
-            || (nal_type == PPS))
+        //only send IDR slice (and the P slices of the intra refresh once the
+        //stream began on an IDR), the SPS/PPS go to the cache
+        int nal_type = get_NAL_type(buffer->pBuffer, buffer->nFilledLen);
+        //the SPS/PPS can also come in the buffer of the IDR
+        if ((nal_type == SPS) || (nal_type == PPS) || (nal_type == IDR))
+            h264_params_update(&params_prv, buffer->pBuffer,
+                    buffer->nFilledLen);
+        pthread_mutex_lock(&session_lock);
+        if (nal_type == IDR)
+            preview_wait_idr = 0;
+        if(session_active && ((nal_type == IDR)
+               || (PREVIEW_INTRA_REFRESH && (nal_type == POB)
+                   && !preview_wait_idr)))
         {
-            send_data(cmp->buffer->pBuffer, cmp->buffer->nFilledLen);
+            //SPS/PPS carry no timestamp, they are sent with the frame
+            uint64_t timestamp = omx_ticks_to_us(buffer->nTimeStamp);
+            if (timestamp == 0)
+                timestamp = GetTimeStamp();
+            //inline SPS/PPS out, put back from the cache when needed
+            int skip = h264_params_skip(buffer->pBuffer, buffer->nFilledLen);
+            unsigned char params[2 * H264_PARAMS_MAX + 8];
+            int params_len = h264_params_inject(&params_prv,
+                    buffer->pBuffer + skip, buffer->nFilledLen - skip,
+                    GetTimeStamp(), params, sizeof(params));
+            if (params_len > 0)
+                send_data(params, params_len, timestamp, 0);
+            send_data(buffer->pBuffer + skip, buffer->nFilledLen - skip,
+                    timestamp, buffer->nFlags & OMX_BUFFERFLAG_ENDOFFRAME);
+
+            if((nal_type == IDR) && attach_time)
+            {
+                printf("connect to first IDR : %" PRIu64 " us\n",
+                        GetTimeStamp() - attach_time);
+                attach_time = 0;
+            }
         }
+        pthread_mutex_unlock(&session_lock);
 
         //for calculate actual frame rate
         if((nal_type != SPS)
@@ -337,6 +446,14 @@ void* preview_thread(void* arg)
             frame_count++;
             printf("preview_thread\nframecount : %d\nframerate : %f\n\n", frame_count, frame_rate);
         }
+
+        //Give the buffer back to the encoder
+        if ((error = buffer_pool_fill(cmp->component, buffer)))
+        {
+            fprintf(stderr, "error: OMX_FillThisBuffer: %s\n",
+                    dump_OMX_ERRORTYPE(error));
+            vcos_thread_exit((void*)1);
+        }
     }
 
     vcos_thread_exit((void*)0);
@@ -344,64 +461,74 @@ void* preview_thread(void* arg)
     return NULL;
 }
 
-static void *stream_loop(void *arg)
+//begin a session: open the main video file and start a new RTP stream
+static int session_open(void)
 {
-    // socket related
-    int rc;
-    struct sockaddr_in servAddr;
-    short localport = LOCAL_SERVER_PORT + rand() % 1000;
-    cliAddr = *(struct sockaddr_in *) arg; // make a copy for modified
-    
     int fd = open(FILENAME, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0666);
     if (fd == -1)
     {
         fprintf(stderr, "error: open main video file\n");
-        exit(1);
+        return -1;
     }
 
-    //frame count initialise
-    nframe = 0;
+    pthread_mutex_lock(&session_lock);
+    session_fd = fd;
+    session_wait_sync = 1;
+    preview_wait_idr = 1;
+    session_active = 1;
+    //new RTP stream (sequence number, SSRC)
+    rtp_packetizer_init(&rtp, PREVIEW_MTU, rand(), fanout_add, &fanout);
+    fec_encoder_init(&fec, FEC_RATIO, rand());
+    rtp_packetizer_init(&rtp_main, RTP_MTU, rand(), fanout_add, &fanout_main);
+    pthread_mutex_unlock(&session_lock);
 
-    // 1.  create omx grpah  
-    rpiomx_open();
+    return 0;
+}
 
-    //signal interrupt
-    signal(SIGINT,  sig_flag_set);
-    signal(SIGTERM, sig_flag_set);
-    signal(SIGQUIT, sig_flag_set);
+//end the session, the encoding threads stop writing and sending
+static void session_close(void)
+{
+    pthread_mutex_lock(&session_lock);
+    int fd = session_fd;
+    session_fd = -1;
+    session_active = 0;
+    pthread_mutex_unlock(&session_lock);
+
+    if (fd != -1)
+        close(fd);
+}
 
-    /* 1. socket creation */
-    udpsock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (udpsock < 0)
-    {
-        fprintf(stderr, "Error:cannot open udp socket\n");
-        pthread_exit((void *) -1);
-    }
+//viewers[] and nstreaming (below) are protected by control_lock, which
+//also serialises the start and stop of the pipeline with the RTSP server
+static pthread_mutex_t control_lock = PTHREAD_MUTEX_INITIALIZER;
+static int nstreaming = 0; // viewers that sent 's' and RTSP sessions
+
+//the graph thread, joined by join_pipeline() or shutdown_pipeline()
+static pthread_t stream_tid;
+static int stream_started = 0; // stream_tid not joined yet
+#ifdef KEEP_PIPELINE_WARM
+static int pipeline_running = 0; // the graph is up, parked or not
+#else
+static int stream_stopping = 0; // told to stop, join_pipeline() to come
+#endif
 
-    /* 2. bind local server port */
-    servAddr.sin_family = AF_INET;
-    servAddr.sin_addr.s_addr = htonl(INADDR_ANY);
-    servAddr.sin_port = htons(STREAM_CLIENT_PORT - 1); // can use any not conflicting
-    rc = bind(udpsock, (struct sockaddr *) &servAddr, sizeof(servAddr));
-    if (rc < 0)
-    {
-        fprintf(stderr, "Error: cannot bind port number %d\n", localport);
-        pthread_exit((void *) -1);
-    }
+//runs the OMX graph and the encoding threads
+//without KEEP_PIPELINE_WARM it lives for one session, otherwise until a
+//signal stops the encoders
+static void *stream_loop(void *arg)
+{
+    // 1.  create omx grpah  
+    rpiomx_open();
 
-    /* 3. prepare destination address */
-    //cliAddr.sin_family = AF_INET;
-    //cliAddr.sin_addr.s_addr = htonl(); // same destination as contoller 
-    cliAddr.sin_port = htons(1501);      // different port 
+    /* 2. the UDP socket and the destinations are owned by main() */
 
-    /* 4. infinite loop */
+    /* 3. infinite loop */
     printf("---------Start Capture and Encode---------------\n");
     //Create Encoding thread
     int encode_status;
     component_buffer_t encode_cmp;
-    encode_cmp.fd = &fd;
+    encode_cmp.fd = &session_fd;
     encode_cmp.component = cmp_buf.encoder;
-    encode_cmp.buffer = cmp_buf.encoder_output_buffer;
     
     VCOS_THREAD_T encode_th;
     vcos_thread_create(&encode_th, "encode_thread", NULL, encoding_thread, (void*)(&encode_cmp));
@@ -411,7 +538,6 @@ static void *stream_loop(void *arg)
     int preview_status;
     component_buffer_t preview_cmp;
     preview_cmp.component = cmp_buf.encoder_prv;
-    preview_cmp.buffer = cmp_buf.preview_output_buffer;
 
     VCOS_THREAD_T preview_th;
     vcos_thread_create(&preview_th, "preview_thread", NULL, preview_thread, (void*)(&preview_cmp));
@@ -435,144 +561,412 @@ static void *stream_loop(void *arg)
     
     printf("------------------------------------------------\n");
 
-    // Restore signal handlers
-    signal(SIGINT,  SIG_DFL);
-    signal(SIGTERM, SIG_DFL);
-    signal(SIGQUIT, SIG_DFL);
-
     // 3. destroy the context
     rpiomx_close();
 
-    close(fd);
-    close(udpsock);
-    udpsock = -1;  // mark it invalid
+    session_close();
+#ifdef KEEP_PIPELINE_WARM
+    pthread_mutex_lock(&control_lock);
+    pipeline_running = 0;
+    pthread_mutex_unlock(&control_lock);
+#endif
     pthread_exit((void *) 0); // user-requested-stop
 }
 
-static int stream_control(int sock, struct sockaddr_in *pCliAddr)
+//first viewer: start recording and encoding
+//called with control_lock held
+static int start_pipeline(void)
 {
-    size_t n;
-    int r;
-    pthread_t tid;
+#ifndef KEEP_PIPELINE_WARM
+    //the last graph waits for its sync frame, the viewer tries again
+    if (stream_stopping)
+        return -1;
+#endif
+    if (session_open())
+        return -1;
+
+#ifdef KEEP_PIPELINE_WARM
+    if (pipeline_running)
+    {
+        //attach to the running graph, first frame will be an IDR
+        rpiomx_resume();
+        return 0;
+    }
+    //the graph thread ended on an error, it is done with the graph
+    if (stream_started)
+    {
+        pthread_join(stream_tid, NULL);
+        stream_started = 0;
+    }
+#endif
+
+    if (pthread_create(&stream_tid, NULL, stream_loop, NULL) != 0)
+    {
+        fprintf(stderr, "ERROR:pthread_create\n");
+        session_close();
+        return -1;
+    }
+    stream_started = 1;
+#ifdef KEEP_PIPELINE_WARM
+    pipeline_running = 1;
+#endif
+    return 0;
+}
+
+//last viewer left
+//called with control_lock held, join_pipeline() after releasing it
+static int stop_pipeline(void)
+{
+#ifdef KEEP_PIPELINE_WARM
+    //keep the graph, only park it
+    session_close();
+    if (pipeline_running)
+        rpiomx_pause();
+#else
+    quit_flag = 1;
+    stream_stopping = 1;
+#endif
+    return 0;
+}
+
+//wait for the graph thread stop_pipeline() stopped
+//called without control_lock: the thread ends on the next sync frame, up
+//to a GOP later, and the control connections, the keep-alives, the RTCP
+//and the RTSP server go on meanwhile
+static int join_pipeline(void)
+{
+    int r = 0;
+#ifndef KEEP_PIPELINE_WARM
     int retval;
-    unsigned char rxbuf[128]; /* one byte only used */
-    unsigned char txbuf[128]; /* one byte only used */
-    int flags = 0;
-    int event = 0;
 
-    while (1)
+    pthread_mutex_lock(&control_lock);
+    int join = stream_stopping && stream_started;
+    if (join)
+        stream_started = 0; //joined here, not by shutdown_pipeline()
+    pthread_mutex_unlock(&control_lock);
+
+    if (join)
     {
-        //select TCP socket or UDP socket. 
-        //it will return available socket
-        event = waitEvent(sock, udpsock, 1000);
+        r = pthread_join(stream_tid, (void **) &retval);
+        pthread_mutex_lock(&control_lock);
+        quit_flag = 0;
+        stream_stopping = 0;
+        pthread_mutex_unlock(&control_lock);
+    }
+#endif
+    return r;
+}
 
-        printf("==> event: %d\n", event);
-        if (event == 0)
-        {
-            if (udpsock != -1)
-            {
-                if (elapsedtimeKeepAlive() > 2 * KEEP_ALIVE_INTERVAL)
-                {
-                    fprintf(stderr, "Time-OUTED\n");
-                    quit_flag = 1;
-                    r = pthread_join(tid, (void **) &retval);
-                    quit_flag = 0;
-                }
-            }
-            continue; 
-            //@TODO Is this the correct place to use "continue"?
-            //@TODO Is the above condition a problem?
-        }
-        else if (event == 2)
+//a signal stops the daemon: end the encoding threads and close the graph
+static void shutdown_pipeline(void)
+{
+    pthread_mutex_lock(&control_lock);
+    int started = stream_started;
+#ifdef KEEP_PIPELINE_WARM
+    //a parked graph makes no frame, the encoding threads blocked in
+    //buffer_pool_get_filled() would never see the signal
+    if (pipeline_running && nstreaming == 0)
+        rpiomx_resume();
+#endif
+    quit_flag = 1;
+    stream_started = 0;
+    pthread_mutex_unlock(&control_lock);
+
+    if (started)
+        pthread_join(stream_tid, NULL);
+}
+
+//One TCP control connection, the control plane gives it its id
+#define MAX_VIEWERS CONTROL_MAX_CLIENTS
+typedef struct
+{
+    int used;
+    struct sockaddr_in addr;    // address of the client
+    in_port_t udp_port;         // source port of its keep-alive, 0 : unknown
+    uint32_t ssrc;              // SSRC of its RTCP feedback, 0 : unknown
+    int subscriber;             // id in the fan-out, -1 : not streaming
+} viewer_t;
+
+//all the control connections and the keep-alive messages are served by
+//main() with epoll
+static control_server_t control;
+
+static viewer_t viewers[MAX_VIEWERS];
+
+//answer of 's', called with control_lock held, then join_pipeline()
+static int start_streaming(viewer_t *viewer)
+{
+    struct sockaddr_in dest = viewer->addr; // make a copy for modified
+    dest.sin_port = htons(STREAM_CLIENT_PORT); // different port
+
+    if (viewer->subscriber != -1)
+        return 0;
+
+    if (nstreaming == 0 && start_pipeline())
+        return -1;
+
+    viewer->subscriber = fanout_subscribe(&fanout, &dest, 1);
+    if (viewer->subscriber == -1)
+    {
+        if (nstreaming == 0)
+            stop_pipeline(); //joined by the caller
+        return -1;
+    }
+    nstreaming++;
+
+    pthread_mutex_lock(&session_lock);
+    attach_time = GetTimeStamp();
+    pthread_mutex_unlock(&session_lock);
+    h264_params_resend(&params_prv);
+
+    return 0;
+}
+
+//answer of 'c', keep-alive time-out or control connection lost
+//called with control_lock held, then join_pipeline()
+static int stop_streaming(viewer_t *viewer)
+{
+    if (viewer->subscriber == -1)
+        return 0;
+
+    fanout_unsubscribe(&fanout, viewer->subscriber);
+    viewer->subscriber = -1;
+
+    if (--nstreaming == 0)
+        return stop_pipeline();
+
+    return 0;
+}
+
+//control_ops_t of the viewers
+static int viewer_opened(void *arg, int id, const struct sockaddr_in *addr)
+{
+    printf("Accept client\n");
+
+    pthread_mutex_lock(&control_lock);
+    viewers[id].used = 1;
+    viewers[id].addr = *addr;
+    viewers[id].udp_port = 0;
+    viewers[id].ssrc = 0;
+    viewers[id].subscriber = -1;
+    pthread_mutex_unlock(&control_lock);
+
+    return 0;
+}
+
+static int viewer_command(void *arg, int id, unsigned char cmd)
+{
+    int r;
+
+    switch (cmd)
+    {
+    case 's':
+        control_keep_alive(&control, id);
+        pthread_mutex_lock(&control_lock);
+        r = start_streaming(&viewers[id]);
+        pthread_mutex_unlock(&control_lock);
+        join_pipeline();
+        return (r != 0) ? 'n' : 'a';
+    case 'c': // finish streaming
+        pthread_mutex_lock(&control_lock);
+        r = stop_streaming(&viewers[id]);
+        pthread_mutex_unlock(&control_lock);
+        if (r == 0)
+            r = join_pipeline();
+        if (r != 0)
         {
-            updateKeepAlive();
-            n = 128;
-            n = recvfrom(udpsock, rxbuf, n, 0, NULL, 0); // don't care of address
-            if (n < 0)
-            {
-                fprintf(stderr, " Ooops, Error in reading udp socket...\n");
-            }
-            else
-            {
-                rxbuf[n] = 0;
-                fprintf(stdout, "===>KEEP-ALIVE: %s (%d)\n", rxbuf, n);
-            }
-            continue;
+            fprintf(stderr, "ERROR:pthread_join\n");
+            return 'n';
         }
-        else if (event != 1)
-        {
-            break;
-        } // if event == 1
+        return 'a' | CONTROL_CLOSE; // normal finish
+    default:
+        return 'n'; // nack
+    }
+}
+
+//no keep-alive message for 2 * KEEP_ALIVE_INTERVAL
+static void viewer_expired(void *arg, int id)
+{
+    pthread_mutex_lock(&control_lock);
+    if (viewers[id].subscriber != -1)
+    {
+        fprintf(stderr, "Time-OUTED\n");
+        stop_streaming(&viewers[id]);
+    }
+    pthread_mutex_unlock(&control_lock);
+    join_pipeline();
+}
 
-        // 1. get commands from client
-        n = recv(sock, rxbuf, 128, flags);
+static void viewer_closed(void *arg, int id)
+{
+    pthread_mutex_lock(&control_lock);
+    stop_streaming(&viewers[id]);
+    viewers[id].used = 0;
+    pthread_mutex_unlock(&control_lock);
+    join_pipeline();
+
+    printf("client left\n");
+}
+
+//an RTSP session starts playing, it counts as a viewer
+static int rtsp_play(void *arg)
+{
+    int r = 0;
 
-        // 2. prorocol error check
-        if (n <= 0)
+    pthread_mutex_lock(&control_lock);
+    if (nstreaming == 0)
+        r = start_pipeline();
+    if (r == 0)
+    {
+        nstreaming++;
+        pthread_mutex_lock(&session_lock);
+        attach_time = GetTimeStamp();
+        pthread_mutex_unlock(&session_lock);
+    }
+    pthread_mutex_unlock(&control_lock);
+
+    return r;
+}
+
+//an RTSP session stops playing
+static void rtsp_stop(void *arg)
+{
+    pthread_mutex_lock(&control_lock);
+    if (--nstreaming == 0)
+        stop_pipeline();
+    pthread_mutex_unlock(&control_lock);
+    join_pipeline();
+}
+
+//RTCP feedback of a viewer: resend the lost packets, ask for an IDR
+//called without control_lock, a long NACK list does not hold up the
+//control connections and the subscriptions
+static void handle_feedback(const struct sockaddr_in *addr, rtcp_feedback_t *fb)
+{
+    static uint64_t last_idr_request = 0;
+    struct sockaddr_in dest = *addr;
+    dest.sin_port = htons(STREAM_CLIENT_PORT);
+    int i;
+
+    for (i = 0; i < fb->nlost; i++)
+        rtx_resend(&rtx, udpsock, &dest, fb->ssrc, fb->lost[i]);
+
+    if (fb->pli)
+    {
+        uint64_t now = GetTimeStamp();
+        if (now - last_idr_request >= IDR_REQUEST_INTERVAL)
         {
-            fprintf(stderr, "read error: connection closed\n");
-            quit_flag = 1;
-            r = pthread_join(tid, (void **) &retval);
-            quit_flag = 0;
-            return -1;  // abnormal finish
+            last_idr_request = now;
+            h264_params_resend(&params_prv);
+            rpiomx_request_preview_idr();
         }
-        else if (n > 1)
-        {
-            fprintf(stderr, "protocol error: too big msg\n");
-            txbuf[0] = 'n'; // nack
-            write(sock, txbuf, 1);
+    }
+}
+
+//viewer a UDP message comes from, -1 : none
+//Its address is the one of the control connection, the source port of its
+//keep-alive messages is learnt from the first of them: several viewers
+//behind the same address are told apart by that port.
+//'sender' : SSRC of an RTCP message, 0 for a keep-alive. A viewer known by
+//its SSRC is found again when a NAT gave it another source port.
+//called with control_lock held
+static int find_viewer(const struct sockaddr_in *from, uint32_t sender)
+{
+    int i, found = -1;
+
+    for (i = 0; i < MAX_VIEWERS; i++)
+    {
+        if (!viewers[i].used
+                || viewers[i].addr.sin_addr.s_addr != from->sin_addr.s_addr)
             continue;
-        }
-        // 3. protocol handle
-        else
+        if (viewers[i].udp_port == from->sin_port
+                || (sender != 0 && viewers[i].ssrc == sender))
         {
-            switch (rxbuf[0])
-            {
-            case 's':
-                updateKeepAlive();
-
-                r = pthread_create(&tid, NULL, stream_loop, (void *) pCliAddr);
-                if (r != 0)
-                {
-                    fprintf(stderr, "ERROR:pthread_create\n");
-                    txbuf[0] = 'n'; // ack
-                    write(sock, txbuf, 1);
-                }
-                else
-                {
-                    txbuf[0] = 'a'; // ack
-                    write(sock, txbuf, 1);
-                }
-
-                break;
-            case 'c': // finish streaming
-                quit_flag = 1;
-                r = pthread_join(tid, (void **) &retval); // @TODO: check it run successfully
-                quit_flag = 0;
-                if (r != 0)
-                {
-                    fprintf(stderr, "ERROR:pthread_join\n");
-                    quit_flag = 0;
-                    txbuf[0] = 'n'; // ack
-                    write(sock, txbuf, 1);
-
-                }
-                else
-                {
-                    txbuf[0] = 'a'; // ack
-                    write(sock, txbuf, 1);
-                    return 0; // normal  finish
-                }
-
-            default:
-                txbuf[0] = 'n'; // nack
-                write(sock, txbuf, 1);
-                break;
-            }
+            found = i;
+            break;
         }
+        //the first message of a viewer, one that streams rather than one
+        //that did not send 's' yet
+        if (viewers[i].udp_port == 0 && (found == -1
+                || (viewers[found].subscriber == -1
+                        && viewers[i].subscriber != -1)))
+            found = i;
+    }
+    if (found != -1)
+    {
+        viewers[found].udp_port = from->sin_port;
+        if (sender != 0)
+            viewers[found].ssrc = sender;
     }
 
-    return -1;
+    return found;
+}
+
+//a keep-alive message or RTCP feedback, from the UDP port of the client
+static void recv_keep_alive(void *arg)
+{
+    ssize_t n;
+    int i;
+    unsigned char rxbuf[1500];
+    struct sockaddr_in from, viewer_addr;
+    socklen_t fromlen = sizeof(from);
+    rtcp_feedback_t fb;
+
+    n = recvfrom(udpsock, rxbuf, sizeof(rxbuf) - 1, 0,
+            (struct sockaddr *) &from, &fromlen);
+    if (n < 0)
+    {
+        fprintf(stderr, " Ooops, Error in reading udp socket...\n");
+        return;
+    }
+
+    int feedback = (rtcp_parse_feedback(rxbuf, n, &fb) == 0);
+    if (!feedback)
+    {
+        rxbuf[n] = 0;
+        fprintf(stdout, "===>KEEP-ALIVE: %s (%d)\n", rxbuf, (int) n);
+    }
+
+    //any message of a viewer shows it is still there
+    pthread_mutex_lock(&control_lock);
+    i = find_viewer(&from, feedback ? fb.sender : 0);
+    if (i != -1)
+    {
+        control_keep_alive(&control, i);
+        viewer_addr = viewers[i].addr;
+        if (viewers[i].subscriber == -1)
+            feedback = 0;
+    }
+    pthread_mutex_unlock(&control_lock);
+
+    if (i != -1 && feedback)
+        handle_feedback(&viewer_addr, &fb);
+}
+
+//UDP socket the preview is sent from and the keep-alive messages come to
+static int open_udpsock(short portNum)
+{
+    int sock, rc;
+    struct sockaddr_in servAddr;
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0)
+    {
+        fprintf(stderr, "Error:cannot open udp socket\n");
+        return -1;
+    }
+
+    servAddr.sin_family = AF_INET;
+    servAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    servAddr.sin_port = htons(portNum);
+    rc = bind(sock, (struct sockaddr *) &servAddr, sizeof(servAddr));
+    if (rc < 0)
+    {
+        fprintf(stderr, "Error: cannot bind port number %d\n", portNum);
+        return -1;
+    }
+
+    return sock;
 }
 
 int main(int argc, char **argv)
@@ -606,11 +1000,9 @@ int main(int argc, char **argv)
     freopen("debug.log", "w", stderr);
     freopen("/dev/null", "w", stdout);
 #endif
-    int listenfd, connfd, port;
-    socklen_t clientlen;
-    struct sockaddr_in clientaddr;
-    //struct hostent *hp;
-    //char *haddrp;
+    int listenfd, port;
+    control_ops_t ops = { viewer_opened, viewer_command, viewer_expired,
+            viewer_closed, recv_keep_alive, NULL };
     if (argc != 2)
     {
         fprintf(stderr, "usage: %s <port>\n", argv[0]);
@@ -621,29 +1013,65 @@ int main(int argc, char **argv)
     printf("get user input %d\n", port);
 
     listenfd = open_listenfd(port);
-    listen(listenfd, 1);
-
-    printf("now listen something\n");
-
-    clientlen = sizeof(clientaddr);
+    listen(listenfd, SOMAXCONN);
 
-    while (1) // to stop CTRL-C or kill me 
+    //the preview goes to all the viewers from this socket
+    udpsock = open_udpsock(STREAM_CLIENT_PORT - 1); // can use any not conflicting
+    if (udpsock < 0)
+        exit(1);
+    fanout_init(&fanout, udpsock, UDP_SEND_MODE, PACING_MODE, PACING_WINDOW,
+            PACING_MAX_RATE);
+    fanout.fec = &fec;
+    rtx_init(&rtx);
+    fanout.rtx = &rtx;
+    fanout_init(&fanout_main, udpsock, UDP_SEND_MODE, PACING_MODE,
+            PACING_WINDOW, PACING_MAX_RATE);
+    h264_params_init(&params_prv);
+    h264_params_init(&params_main);
+    params_prv.repeat = PARAMS_REPEAT;
+    params_main.repeat = PARAMS_REPEAT;
+
+    //standard players, next to the private TCP protocol
+    if (rtsp_server_init(&rtsp, RTSP_PORT, rtsp_play, rtsp_stop, NULL) == 0)
     {
-        connfd = accept(listenfd, (struct sockaddr *) &clientaddr, &clientlen);
-        
-        printf("Accept client\n");
+        rtsp_server_add_track(&rtsp, &fanout, &params_prv,
+                rpiomx_request_preview_idr);
+        rtsp_server_add_track(&rtsp, &fanout_main, &params_main,
+                rpiomx_request_main_idr);
+        rtsp_server_start(&rtsp);
+    }
 
-        /* determine the domain name and IP address of the client */
-        //hp = gethostbyaddr(&clientaddr.sin_addr, sizeof(clientaddr.sin_addr), AF_INET);
-        //haddrp = inet_ntoa(clientaddr.sin_addr);
-        //fprintf(stderr, "CNTL> new client %s (%s) connected\n", hp->h_name, haddrp);
-        
-        printf("go to stream process\n");
-        stream_control(connfd, &clientaddr);
+    printf("now listen something\n");
 
-        //fprintf(stderr, "CTNL> connection %s (%s) lost\n", hp->h_name, haddrp);
+    //control connections and keep-alive messages
+    if (control_init(&control, listenfd, udpsock, 2 * KEEP_ALIVE_INTERVAL,
+            &ops))
+        exit(1);
 
-        close(connfd);
+    //signal interrupt, the daemon stops cleanly whether a graph runs,
+    //is parked or was never built
+    signal(SIGINT,  sig_flag_set);
+    signal(SIGTERM, sig_flag_set);
+    signal(SIGQUIT, sig_flag_set);
+
+    //the signal can land on any thread, the time-out makes sure the flag
+    //is seen
+    while (!signal_flag_check()) // to stop CTRL-C or kill me 
+    {
+        if (control_run(&control, 500) == -1)
+            break;
     }
+
+    control_deinit(&control);
+    rtsp_server_stop(&rtsp);
+    shutdown_pipeline();
+    fanout_deinit(&fanout);
+    fanout_deinit(&fanout_main);
+    h264_params_deinit(&params_prv);
+    h264_params_deinit(&params_main);
+    printf("preview : %u packets resent, %u asked too late\n", rtx.resent,
+            rtx.missed);
+    rtx_deinit(&rtx);
+    close(udpsock);
     return 0;
 }
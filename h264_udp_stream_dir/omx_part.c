@@ -1,9 +1,11 @@
+#include <pthread.h>
+
 #include "omx_part.h"
 
 //Variable, handlers for OMX components
 static OMX_ERRORTYPE error;
-static OMX_BUFFERHEADERTYPE* encoder_output_buffer;
-static OMX_BUFFERHEADERTYPE* preview_output_buffer;
+static buffer_pool_t encoder_output_pool;
+static buffer_pool_t preview_output_pool;
 static component_t camera;
 static component_t encoder;
 static component_t encoder_prv;
@@ -11,11 +13,36 @@ static component_t resize;
 static component_t splitter;
 static component_t null_sink;
 
+//Components of the graph, in the order they are brought up
+static component_t* graph[] =
+{ &camera, &encoder, &encoder_prv, &resize, &splitter, &null_sink };
+#define GRAPH_SIZE (sizeof(graph) / sizeof(graph[0]))
+
+//Tunneled ports, enabled and disabled together
+static component_port_t tunnel_ports[] =
+{
+    { &camera, 71 }, { &camera, 70 },
+    { &splitter, 250 }, { &splitter, 251 }, { &splitter, 252 },
+    { &resize, 60 }, { &resize, 61 },
+    { &encoder, 200 }, { &encoder_prv, 200 },
+    { &null_sink, 240 },
+};
+#define TUNNEL_PORTS_SIZE (sizeof(tunnel_ports) / sizeof(tunnel_ports[0]))
+
 //It looks good to use structures to easily share components and buffers with the outside world.
 components_n_buffers cmp_buf;
 
+//graph_ready tells the other threads (IDR requests of the viewers) that
+//the components can be used, it is protected by graph_lock
+static pthread_mutex_t graph_lock = PTHREAD_MUTEX_INITIALIZER;
+static int graph_ready = 0;
+
 void rpiomx_open()
 { 
+    //bring-up latency, mostly spent waiting for state changes and ports
+    DECLARE_TIME(rpiomx_open_time)
+    START_TIME(rpiomx_open_time)
+
     camera.name      = "OMX.broadcom.camera";
     encoder.name     = "OMX.broadcom.video_encode";
     encoder_prv.name = "OMX.broadcom.video_encode";
@@ -102,106 +129,32 @@ void rpiomx_open()
  
     printf("----------Change state to IDLE------------------\n");
     //Change state to IDLE
-    change_state(&camera, OMX_StateIdle);
-    //wait(&camera, EVENT_STATE_SET, 0);
-    wait_state_change(&camera, OMX_StateIdle);
-
-    change_state(&encoder, OMX_StateIdle);
-    //wait(&encoder, EVENT_STATE_SET, 0);
-    wait_state_change(&encoder, OMX_StateIdle);
-    
-    change_state(&encoder_prv, OMX_StateIdle);
-    //wait(&encoder_prv, EVENT_STATE_SET, 0);
-    wait_state_change(&encoder_prv, OMX_StateIdle);
-    
-    change_state(&resize, OMX_StateIdle);
-    //wait(&resize, EVENT_STATE_SET, 0);
-    wait_state_change(&resize, OMX_StateIdle);
-    
-    change_state(&splitter, OMX_StateIdle);
-    //wait(&splitter, EVENT_STATE_SET, 0);
-    wait_state_change(&splitter, OMX_StateIdle);
-    
-    change_state(&null_sink, OMX_StateIdle);
-    //wait(&null_sink, EVENT_STATE_SET, 0);
-    wait_state_change(&null_sink, OMX_StateIdle);
+    //All the ports are disabled, so no component waits for another one and
+    //the whole graph can change state at once
+    change_state_graph(graph, GRAPH_SIZE, OMX_StateIdle);
 
 
     printf("----------Enable the ports----------------------\n");
     //Enable the ports
-    enable_port(&camera, 71);
-    wait_enable_port(&camera, 71);
-    enable_port(&camera, 70);
-    wait_enable_port(&camera, 70);
-
-    enable_port(&splitter, 250);
-    wait_enable_port(&splitter, 250);
-    enable_port(&splitter, 251);
-    wait_enable_port(&splitter, 251);
-    enable_port(&splitter, 252);
-    wait_enable_port(&splitter, 252);
-    
-    enable_port(&resize, 60);
-    wait_enable_port(&resize, 60);
-    enable_port(&resize, 61);
-    wait_enable_port(&resize, 61);
-
-    enable_port(&encoder, 200);
-    wait_enable_port(&encoder, 200);
-    enable_encoder_output_port(&encoder, &encoder_output_buffer);
-    
-    enable_port(&encoder_prv, 200);
-    wait_enable_port(&encoder_prv, 200);
-    enable_encoder_output_port(&encoder_prv, &preview_output_buffer); 
-    
-    enable_port(&null_sink, 240);
-    wait_enable_port(&null_sink, 240);
+    enable_ports(tunnel_ports, TUNNEL_PORTS_SIZE);
+    enable_encoder_output_port(&encoder, &encoder_output_pool,
+            VIDEO_OUTPUT_BUFFERS);
+    enable_encoder_output_port(&encoder_prv, &preview_output_pool,
+            PREVIEW_OUTPUT_BUFFERS);
 
 
     printf("----------Change state to EXECUTING-------------\n");
     //Change state to EXECUTING
-    change_state(&camera, OMX_StateExecuting);
-    //wait(&camera, EVENT_STATE_SET, 0);
-    wait_state_change(&camera, OMX_StateExecuting);
-
-    change_state(&splitter, OMX_StateExecuting);
-    //wait(&splitter, EVENT_STATE_SET, 0);
-    wait_state_change(&splitter, OMX_StateExecuting);
-    
-    change_state(&resize, OMX_StateExecuting);
-    //wait(&resize, EVENT_STATE_SET, 0);
-    wait_state_change(&resize, OMX_StateExecuting);
-    
-    change_state(&encoder, OMX_StateExecuting);
-    //wait(&encoder, EVENT_STATE_SET, 0);
-    wait_state_change(&encoder, OMX_StateExecuting);
+    //Nothing flows before the camera capture port is enabled below
+    change_state_graph(graph, GRAPH_SIZE, OMX_StateExecuting);
     wait(&encoder, EVENT_PORT_SETTINGS_CHANGED, 0);
-    
-    change_state(&encoder_prv, OMX_StateExecuting);
-    //wait(&encoder_prv, EVENT_STATE_SET, 0);
-    wait_state_change(&encoder_prv, OMX_StateExecuting);
     wait(&encoder_prv, EVENT_PORT_SETTINGS_CHANGED, 0);
-    
-    change_state(&null_sink, OMX_StateExecuting);
-    //wait(&null_sink, EVENT_STATE_SET, 0);
-    wait_state_change(&null_sink, OMX_StateExecuting);
-    
+
     printf("---------Set camera capture Enable--------------\n");
     //Enable camera capture port. This basically says that the port 71 will be
     //used to get data from the camera. If you're capturing a still, the port 72
     //must be used
-    printf("enabling %s capture port\n", camera.name);
-    OMX_CONFIG_PORTBOOLEANTYPE capture_st;
-    OMX_INIT_STRUCTURE(capture_st);
-    capture_st.nPortIndex = 71;
-    capture_st.bEnabled = OMX_TRUE;
-    if ((error = OMX_SetConfig(camera.handle, OMX_IndexConfigPortCapturing,
-            &capture_st)))
-    {
-        fprintf(stderr, "error: OMX_SetConfig: %s\n",
-                dump_OMX_ERRORTYPE(error));
-        exit(1);
-    }
+    set_camera_capture(&camera, OMX_TRUE);
 
     //make it easier to share handlers and buffers when more components are available
     cmp_buf.camera      = &camera;
@@ -210,126 +163,47 @@ void rpiomx_open()
     cmp_buf.resize      = &resize;
     cmp_buf.splitter    = &splitter;
     cmp_buf.null_sink   = &null_sink;
-    cmp_buf.encoder_output_buffer = encoder_output_buffer;
-    cmp_buf.preview_output_buffer = preview_output_buffer;
+    cmp_buf.encoder_output_pool = &encoder_output_pool;
+    cmp_buf.preview_output_pool = &preview_output_pool;
+
+    pthread_mutex_lock(&graph_lock);
+    graph_ready = 1;
+    pthread_mutex_unlock(&graph_lock);
+
+    STOP_TIME(rpiomx_open_time)
+    PRINT_EXECUTION_TIME(rpiomx_open_time)
 }
 
 void rpiomx_close()
 {
+    DECLARE_TIME(rpiomx_close_time)
+    START_TIME(rpiomx_close_time)
+
+    //wait for a request in progress, none can come after this
+    pthread_mutex_lock(&graph_lock);
+    graph_ready = 0;
+    pthread_mutex_unlock(&graph_lock);
+
     //Disable camera capture port
-    printf("disabling %s capture port\n", camera.name);
-    OMX_CONFIG_PORTBOOLEANTYPE capture_st;
-    OMX_INIT_STRUCTURE(capture_st);
-    capture_st.nPortIndex = 71;
-    capture_st.bEnabled = OMX_FALSE;
-    if ((error = OMX_SetConfig(camera.handle, OMX_IndexConfigPortCapturing,
-            &capture_st)))
-    {
-        fprintf(stderr, "error: OMX_SetConfig: %s\n",
-                dump_OMX_ERRORTYPE(error));
-        exit(1);
-    }
+    set_camera_capture(&camera, OMX_FALSE);
 
     printf("-----------Disable tunnel ports-----------------\n");
     //Disable the tunnel ports
-    disable_port(&camera, 71);
-    //wait(&camera, EVENT_PORT_ENABLE, 0);
-    wait_disable_port(&camera, 71); 
+    disable_ports(tunnel_ports, TUNNEL_PORTS_SIZE);
+    disable_encoder_output_port(&encoder, &encoder_output_pool);
+    disable_encoder_output_port(&encoder_prv, &preview_output_pool);
+
 
-    disable_port(&camera, 70);
-    //wait(&camera, EVENT_PORT_ENABLE, 0);
-    wait_disable_port(&camera, 70); 
-    
-    disable_port(&null_sink, 240);
-    //wait(&null_sink, EVENT_PORT_ENABLE, 0);
-    wait_disable_port(&null_sink, 240); 
-    
-    disable_port(&splitter, 250);
-    //wait(&splitter, EVENT_PORT_ENABLE, 0);
-    wait_disable_port(&splitter, 250); 
-    
-    disable_port(&splitter, 251);
-    //wait(&splitter, EVENT_PORT_ENABLE, 0);
-    wait_disable_port(&splitter, 251); 
-    
-    disable_port(&splitter, 252);
-    //wait(&splitter, EVENT_PORT_ENABLE, 0);
-    wait_disable_port(&splitter, 252); 
-    
-    disable_port(&resize, 60);
-    //wait(&splitter, EVENT_PORT_ENABLE, 0);
-    wait_disable_port(&resize, 60); 
-    
-    disable_port(&resize, 61);
-    //wait(&splitter, EVENT_PORT_ENABLE, 0);
-    wait_disable_port(&resize, 61); 
-    
-    disable_port(&encoder, 200);
-    wait_disable_port(&encoder, 200); 
-    //wait(&encoder, EVENT_PORT_ENABLE, 0);
-    disable_encoder_output_port(&encoder, encoder_output_buffer);
-    
-    disable_port(&encoder_prv, 200);
-    //wait(&encoder_prv, EVENT_PORT_ENABLE, 0);
-    wait_disable_port(&encoder_prv, 200); 
-    disable_encoder_output_port(&encoder_prv, preview_output_buffer);
-    
-    
     printf("---------Change state to IDLE-------------------\n");
     //Change state to IDLE
-    change_state(&camera, OMX_StateIdle);
-    //wait(&camera, EVENT_STATE_SET, 0);
-    wait_state_change(&camera, OMX_StateIdle);
-
-    change_state(&encoder, OMX_StateIdle);
-    //wait(&encoder, EVENT_STATE_SET, 0);
-    wait_state_change(&encoder, OMX_StateIdle);
-    
-    change_state(&encoder_prv, OMX_StateIdle);
-    //wait(&encoder_prv, EVENT_STATE_SET, 0);
-    wait_state_change(&encoder_prv, OMX_StateIdle);
-    
-    change_state(&resize, OMX_StateIdle);
-    //wait(&resize, EVENT_STATE_SET, 0);
-    wait_state_change(&resize, OMX_StateIdle);
-    
-    change_state(&splitter, OMX_StateIdle);
-    //wait(&splitter, EVENT_STATE_SET, 0);
-    wait_state_change(&splitter, OMX_StateIdle);
-    
-    change_state(&null_sink, OMX_StateIdle);
-    //wait(&null_sink, EVENT_STATE_SET, 0);
-    wait_state_change(&null_sink, OMX_StateIdle);
+    change_state_graph(graph, GRAPH_SIZE, OMX_StateIdle);
 
 
-    
     printf("---------Change state to LOADED-----------------\n");
     //Change state to LOADED
-    change_state(&camera, OMX_StateLoaded);
-    //wait(&camera, EVENT_STATE_SET, 0);
-    wait_state_change(&camera, OMX_StateLoaded);
+    change_state_graph(graph, GRAPH_SIZE, OMX_StateLoaded);
 
-    change_state(&encoder_prv, OMX_StateLoaded);
-    //wait(&encoder_prv, EVENT_STATE_SET, 0);
-    wait_state_change(&encoder_prv, OMX_StateLoaded);
-    
-    change_state(&encoder, OMX_StateLoaded);
-    //wait(&encoder, EVENT_STATE_SET, 0);
-    wait_state_change(&encoder_prv, OMX_StateLoaded);
-    
-    change_state(&resize, OMX_StateLoaded);
-    //wait(&resize, EVENT_STATE_SET, 0);
-    wait_state_change(&resize, OMX_StateLoaded);
-    
-    change_state(&splitter, OMX_StateLoaded);
-    //wait(&splitter, EVENT_STATE_SET, 0);
-    wait_state_change(&splitter, OMX_StateLoaded);
-    
-    change_state(&null_sink, OMX_StateLoaded);
-    //wait(&null_sink, EVENT_STATE_SET, 0);
-    wait_state_change(&null_sink, OMX_StateLoaded);
 
-     
     printf("--------Deinitialize components-----------------\n");
     //Deinitialize components
     deinit_component(&camera);
@@ -348,4 +222,46 @@ void rpiomx_close()
 
     //Deinitialize Broadcom's VideoCore APIs
     bcm_host_deinit();
+
+    STOP_TIME(rpiomx_close_time)
+    PRINT_EXECUTION_TIME(rpiomx_close_time)
+}
+
+//Park the running graph between two streaming sessions.
+//Only the capture is stopped, the components stay in Executing
+void rpiomx_pause()
+{
+    set_camera_capture(&camera, OMX_FALSE);
+}
+
+//Restart the capture of a parked graph. Both encoders are asked for an IDR
+//so that a new viewer can decode from the first frame it gets
+void rpiomx_resume()
+{
+    request_h264_idr(&encoder);
+    request_h264_idr(&encoder_prv);
+    set_camera_capture(&camera, OMX_TRUE);
+}
+
+//Ask one encoder of the graph for an IDR. It can be called from any thread,
+//it does nothing when the graph is not up
+static void request_idr(component_t* encoder)
+{
+    pthread_mutex_lock(&graph_lock);
+    if (graph_ready)
+        request_h264_idr(encoder);
+    pthread_mutex_unlock(&graph_lock);
+}
+
+//A viewer lost part of the preview (PLI), the next preview frame will be
+//an IDR
+void rpiomx_request_preview_idr()
+{
+    request_idr(&encoder_prv);
+}
+
+//A viewer starts watching the main stream
+void rpiomx_request_main_idr()
+{
+    request_idr(&encoder);
 }
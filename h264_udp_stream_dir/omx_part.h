@@ -9,6 +9,10 @@
 
 void rpiomx_open();
 void rpiomx_close();
+void rpiomx_pause();
+void rpiomx_resume();
+void rpiomx_request_preview_idr();
+void rpiomx_request_main_idr();
 
 typedef struct components_n_buffers
 {
@@ -19,8 +23,8 @@ typedef struct components_n_buffers
     component_t* splitter;
     component_t* null_sink;
 
-    OMX_BUFFERHEADERTYPE* encoder_output_buffer;
-    OMX_BUFFERHEADERTYPE* preview_output_buffer;
+    buffer_pool_t* encoder_output_pool;
+    buffer_pool_t* preview_output_pool;
 } components_n_buffers;
 
 extern components_n_buffers cmp_buf;
@@ -4,6 +4,10 @@
  */
 #include "stddef.h" // size_t
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>	// memcpy, memset
+#include <errno.h>	// EAGAIN
+#include <pthread.h>
 #include <sys/time.h>	// gettimeofday
 #include <math.h>
 #include <libavutil/opt.h>
@@ -14,14 +18,39 @@
 #include <libavutil/mathematics.h>
 #include <libavutil/samplefmt.h>
 
-//#define INBUF_SIZE 4096
-static AVCodec *codec;  // codect function table
-static AVCodecContext *c = NULL;  // codec status
-static AVFrame *frame;  // input picture
-//static void *backupptr;
-static AVPacket pkt;    // encoded data
-static int width_align; //when buffer allocation, must be padded to 32
-static int height_align; //when buffer allocation, must be padded to 16
+#include "ffh264enc.h"
+
+//One encoder, the caller owns it: several of them can encode at the same
+//time in different threads, each one used by a single thread (except
+//ffh264_enc_request_idr())
+struct ffh264_enc_t
+{
+    AVCodec *codec;  // codect function table
+    AVCodecContext *c;  // codec status
+    AVFrame *frame;  // input picture
+    AVPacket pkt;    // encoded data
+    int width_align; //when buffer allocation, must be padded to 32
+    int height_align; //when buffer allocation, must be padded to 16
+    uint8_t *image[3]; //planes of av_image_alloc(), the frame copied in
+    AVBufferRef *image_buf; //owns the planes, referenced by the frame
+    volatile int idr_requested; //set by ffh264_enc_request_idr()
+};
+
+//library init, once for all the encoders
+static pthread_once_t register_once = PTHREAD_ONCE_INIT;
+//avcodec_open2() and avcodec_close() of the encoders, libavcodec only
+//serialises them itself with a lock manager
+static pthread_mutex_t open_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void register_all(void)
+{
+    avcodec_register_all();
+}
+
+//AVBufferRef free callback of a frame buffer the caller keeps
+static void no_release(void *opaque, uint8_t *data)
+{
+}
 
 #ifdef SAVE_OWN_FILE
 static FILE *f;
@@ -29,58 +58,114 @@ static char *filename = "test.h264";
 #endif
 
 /*------------------------------------------------------------
- open a h264 encoder (singletone) 
- 
- @TODO: multiple intances of codecs   
+ settings of ffh264_enc_open(): the lowest delay, every frame an IDR
+ and slice threads
+ -------------------------------------------------------------
+ */
+void ffh264_enc_config_default(ffh264_enc_config_t *cfg, int w, int h,
+        int bit_rate, int fps)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->width = w;
+    cfg->height = h;
+    cfg->bit_rate = bit_rate;
+    cfg->fps = fps;
+    cfg->thread_type = FFH264_THREAD_SLICE;
+    cfg->threads = 3; // more thread more delay
+    cfg->lookahead = 0;
+    cfg->gop = 1;
+    cfg->intra_refresh = 0;
+}
+
+/*------------------------------------------------------------
+ open a h264 encoder, one more instance each call
+ return : the encoder, NULL on error
+ -------------------------------------------------------------
+ */
+ffh264_enc_t* ffh264_enc_open(int w, int h, int bit_rate, int fps)
+{
+    ffh264_enc_config_t cfg;
+
+    ffh264_enc_config_default(&cfg, w, h, bit_rate, fps);
+    return ffh264_enc_open_config(&cfg);
+}
+
+/*------------------------------------------------------------
+ open a h264 encoder with its threading, GOP and intra refresh
+ FFH264_THREAD_SLICE : x264 tuned for zerolatency, a frame comes out of
+   the encode call that takes it
+ FFH264_THREAD_FRAME : more frames per second, 'threads' - 1 +
+   'lookahead' frames of delay: ffh264_enc_encode() returns 0 until the
+   first one comes out, ffh264_enc_close() drains the last ones
+ return : the encoder, NULL on error
  -------------------------------------------------------------
  */
-int ffh264_enc_open(int w, int h, int bit_rate, int fps)
+ffh264_enc_t* ffh264_enc_open_config(const ffh264_enc_config_t *cfg)
 {
-    static int is_first = 1;
+    ffh264_enc_t *enc;
+    AVCodecContext *c;
+    AVFrame *frame;
     int ret;
 
     // 0. init library once
-    if (is_first)
+    pthread_once(&register_once, register_all);
+
+    enc = calloc(1, sizeof(ffh264_enc_t));
+    if (!enc)
     {
-        avcodec_register_all();
-        is_first = 0;
+        fprintf(stderr, "Could not allocate the encoder\n");
+        return NULL;
     }
 
     /* 1.1 find the video encoder */
-    codec = avcodec_find_encoder(AV_CODEC_ID_H264);
-    if (!codec)
+    enc->codec = avcodec_find_encoder(AV_CODEC_ID_H264);
+    if (!enc->codec)
     {
         fprintf(stderr, "Codec not found\n");
-        return -1;
+        free(enc);
+        return NULL;
     }
 
     /* 1.2 create instance for codec status */
-    c = avcodec_alloc_context3(codec);
+    c = enc->c = avcodec_alloc_context3(enc->codec);
     if (!c)
     {
         fprintf(stderr, "Could not allocate video codec context\n");
-        return -1;
+        free(enc);
+        return NULL;
     }
 
     // 2.1 setting the codec paramters  
 
     // user level  paramters
-    c->bit_rate = bit_rate;
-    c->width = w;
-    c->height = h;
+    c->bit_rate = cfg->bit_rate;
+    c->width = cfg->width;
+    c->height = cfg->height;
     c->pix_fmt = AV_PIX_FMT_YUV420P;
     //c->time_base = (AVRational){1,fps};
-    c->time_base.den = fps;
+    c->time_base.den = cfg->fps;
     c->time_base.num = 1;
-    c->gop_size = 1;   // 1? or  1 IDR/sec?
+    c->gop_size = cfg->gop;
 
-    /* key for low delay operation in X264 codec */
-    av_opt_set(c->priv_data, "tune", "zerolatency", 0);
+    if (cfg->thread_type == FFH264_THREAD_SLICE)
+    {
+        /* key for low delay operation in X264 codec */
+        av_opt_set(c->priv_data, "tune", "zerolatency", 0);
+    }
+    else
+    {
+        //frame types and rate control decided on the next frames
+        av_opt_set_int(c->priv_data, "rc-lookahead", cfg->lookahead, 0);
+    }
+    //a column of intra macroblocks crosses the picture in 'gop' frames,
+    //no IDR after the first frame: no bitrate peaks
+    if (cfg->intra_refresh)
+        av_opt_set_int(c->priv_data, "intra-refresh", 1, 0);
     //av_opt_set(c->priv_data, "profile", "baseline", 0);
     c->delay = 0;        // low delay option 
     c->max_b_frames = 0; // no B frame  
 
-    c->flags |= CODEC_FLAG_GLOBAL_HEADER; // SPS, PPS will not be included when call 'avcodec_encode_video2' 
+    c->flags |= AV_CODEC_FLAG_GLOBAL_HEADER; // SPS, PPS will not be included in the packets 
                                           // SPS/PPS information can be obtained separately by reading the context's extradata later.
     // quality control paramters
     c->codec_type = AVMEDIA_TYPE_VIDEO;
@@ -95,42 +180,48 @@ int ffh264_enc_open(int w, int h, int bit_rate, int fps)
     //c->rc_buffer_size = bit_rate * 2;
 
     // implementation level params
-    c->thread_count = 3; // more thread more delay
-    c->thread_type = FF_THREAD_SLICE;
+    c->thread_count = cfg->threads;
+    c->thread_type = (cfg->thread_type == FFH264_THREAD_FRAME)
+            ? FF_THREAD_FRAME : FF_THREAD_SLICE;
     c->refs = 1;  // 1?
 
     /* 2.2 open it */
-    if (avcodec_open2(c, codec, NULL) < 0)
+    pthread_mutex_lock(&open_lock);
+    ret = avcodec_open2(c, enc->codec, NULL);
+    pthread_mutex_unlock(&open_lock);
+    if (ret < 0)
     {
         fprintf(stderr, "Could not open codec\n");
-        // @TODO free codec context before return
-        return -1;
+        av_free(c);
+        free(enc);
+        return NULL;
     }
 
     // 3. prepare frames (raw picture)
-    frame = av_frame_alloc();
+    frame = enc->frame = av_frame_alloc();
     if (!frame)
     {
         fprintf(stderr, "Could not allocate video frame\n");
-        return -1;
+        ffh264_enc_close(enc);
+        return NULL;
     }
 
     //Width and height align
-    width_align = c->width;
+    enc->width_align = c->width;
     if(c->width % 32 != 0)
-        width_align = (c->width / 32 + 1) * 32;
+        enc->width_align = (c->width / 32 + 1) * 32;
     
-    height_align = c->height;
+    enc->height_align = c->height;
     if(c->height % 16 != 0)
-        height_align = (c->height / 16 + 1) * 16;
+        enc->height_align = (c->height / 16 + 1) * 16;
     
     //setting frame buffer information
     frame->format = c->pix_fmt;
     frame->width = c->width;
     frame->height = c->height;
-    frame->linesize[0] = width_align;
-    frame->linesize[1] = width_align / 2;
-    frame->linesize[2] = width_align / 2;
+    frame->linesize[0] = enc->width_align;
+    frame->linesize[1] = enc->width_align / 2;
+    frame->linesize[2] = enc->width_align / 2;
     frame->pts = 0; // init pts
 
     //@TODO: make a dual buffer
@@ -144,48 +235,112 @@ int ffh264_enc_open(int w, int h, int bit_rate, int fps)
     if (ret < 0)
     {
         fprintf(stderr, "Could not allocate raw picture buffer\n");
-        return -1;
+        ffh264_enc_close(enc);
+        return NULL;
     }
 #endif
+    //reference counted: avcodec_send_frame() copies a frame that is not
+    enc->image_buf = av_buffer_create(frame->data[0], ret,
+            av_buffer_default_free, NULL, 0);
+    if (!enc->image_buf)
+    {
+        fprintf(stderr, "Could not wrap the raw picture buffer\n");
+        ffh264_enc_close(enc);
+        return NULL;
+    }
     // trick heejune
     //backupptr = &frame->data[0]; 
+    enc->image[0] = frame->data[0];
+    enc->image[1] = frame->data[1];
+    enc->image[2] = frame->data[2];
 
     // compressed steam output buffer
-    av_init_packet(&pkt);
-    pkt.data = NULL;    // packet data will be allocated by the encoder
-    pkt.size = 0;
+    av_init_packet(&enc->pkt);
+    enc->pkt.data = NULL;    // packet data will be allocated by the encoder
+    enc->pkt.size = 0;
 
-    return 0;
+    return enc;
 }
 
 /*------------------------------------------------------------------
  * get extradata(SPS/PPS)
  * return  + : data and data size of extradata(SPS/PPS)
  ------------------------------------------------------------------*/
-void ffh264_get_global_header(int* header_size, unsigned char* header_data)
+void ffh264_get_global_header(ffh264_enc_t *enc, int* header_size,
+        unsigned char* header_data)
+{
+    *header_size = enc->c->extradata_size;
+    memcpy(header_data, enc->c->extradata, enc->c->extradata_size);
+}
+
+//encode enc->frame, its planes are set
+static int encode_frame(ffh264_enc_t *enc, unsigned char **ppBuf)
 {
-    *header_size = c->extradata_size;
-    memcpy(header_data, c->extradata, c->extradata_size);
+    AVFrame *frame = enc->frame;
+    int ret;
+
+    ++frame->pts;
+
+    //forced keyframe, x264 makes it an IDR (no open GOP), also with the
+    //intra refresh
+    if (enc->idr_requested)
+    {
+        enc->idr_requested = 0;
+        frame->pict_type = AV_PICTURE_TYPE_I;
+    }
+    else
+        frame->pict_type = AV_PICTURE_TYPE_NONE;
+
+    /* encode the image, x264 gives at most one packet per frame */
+    ret = avcodec_send_frame(enc->c, frame);
+    if (ret < 0)
+    {
+        fprintf(stderr, "Error encoding frame\n");
+        return -1;
+    }
+
+    return ffh264_enc_receive(enc, ppBuf);
 }
 
 /*------------------------------------------------------------------
- * encode one frame 
+ * next encoded frame, the one of the last encode call or a delayed one
+ * (FFH264_THREAD_FRAME). *ppBuf is valid until the next call.
  * return  + : compressed data output 
  0 : no compressed output
  - : error
  ------------------------------------------------------------------*/
-int ffh264_enc_encode(unsigned char *pYUV, unsigned char **ppBuf)
+int ffh264_enc_receive(ffh264_enc_t *enc, unsigned char **ppBuf)
 {
-    int ret, got_output;
+    int ret;
+
+    // the previous packet is given back
+    av_packet_unref(&enc->pkt);
 
-    // output buffer setting
-    if (pkt.data != NULL)
-    {  // previously used
-        av_packet_unref(&pkt); // @TODO check, To free the allocate buffer
+    ret = avcodec_receive_packet(enc->c, &enc->pkt);
+    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+        return 0;
+    if (ret < 0)
+    {
+        fprintf(stderr, "Error encoding frame\n");
+        return -1;
     }
-    av_init_packet(&pkt);
-    pkt.data = NULL;    // packet data will be allocated by the encoder
-    pkt.size = 0;
+    //printf("Write frame %lld (size=%5d)\n",enc->pkt.pts, enc->pkt.size);
+    *ppBuf = enc->pkt.data;
+    return enc->pkt.size;
+}
+
+/*------------------------------------------------------------------
+ * encode one frame 
+ * return  + : compressed data output 
+ 0 : no compressed output
+ - : error
+ ------------------------------------------------------------------*/
+int ffh264_enc_encode(ffh264_enc_t *enc, unsigned char *pYUV,
+        unsigned char **ppBuf)
+{
+    AVFrame *frame = enc->frame;
+    int height_align = enc->height_align;
+    int ret;
 
     //void (*cbf_save)(const unsigned char *, int) = cbf;
 
@@ -201,56 +356,118 @@ int ffh264_enc_encode(unsigned char *pYUV, unsigned char **ppBuf)
                    + frame->linesize[1] * height_align / 2
             , frame->linesize[2] * height_align / 2);
 
-    ++frame->pts;
+    //libavcodec takes a reference instead of a copy; x264 copies its
+    //input and drops it before the return, the next memcpy() is safe
+    frame->buf[0] = av_buffer_ref(enc->image_buf);
+    if (!frame->buf[0])
+    {
+        fprintf(stderr, "Could not reference the frame buffer\n");
+        return -1;
+    }
+    ret = encode_frame(enc, ppBuf);
+    av_buffer_unref(&frame->buf[0]);
 
-    /* encode the image */
-    ret = avcodec_encode_video2(c, &pkt, frame, &got_output);
-    if (ret < 0)
+    return ret;
+}
+
+/*------------------------------------------------------------------
+ * encode one frame without copying it: the planes point into pYUV,
+ * the layout of the resize output (Y, U, V, lines padded to 32 bytes,
+ * planes to 16 lines), size : bytes of pYUV
+ * pYUV is wrapped in a reference counted buffer, release(opaque, pYUV)
+ * is called once libavcodec no longer reads it: the caller must not
+ * reuse the buffer before. x264 copies its input, so it comes before
+ * the return, also with frame threads.
+ * release NULL : not told, for a buffer that is never reused early
+ * return  + : compressed data output 
+ 0 : no compressed output
+ - : error
+ ------------------------------------------------------------------*/
+int ffh264_enc_encode_buffer(ffh264_enc_t *enc, unsigned char *pYUV,
+        int size, void (*release)(void *opaque, unsigned char *data),
+        void *opaque, unsigned char **ppBuf)
+{
+    AVFrame *frame = enc->frame;
+    int luma = frame->linesize[0] * enc->height_align;
+    int chroma = frame->linesize[1] * enc->height_align / 2;
+    int ret;
+
+    if (size < luma + 2 * chroma)
     {
-        fprintf(stderr, "Error encoding frame\n");
+        fprintf(stderr, "Frame buffer too small (%d < %d)\n", size,
+                luma + 2 * chroma);
         return -1;
     }
-    if (got_output)
+
+    //the only reference of the frame, libavcodec takes its own ones
+    frame->buf[0] = av_buffer_create(pYUV, size, release ? release : no_release,
+            opaque, AV_BUFFER_FLAG_READONLY);
+    if (!frame->buf[0])
     {
-        //printf("Write frame %lld (size=%5d)\n",frame->pts, pkt.size);
-        *ppBuf = pkt.data;
-        return pkt.size;
+        fprintf(stderr, "Could not wrap the frame buffer\n");
+        return -1;
     }
-    else
-        return 0;
+    frame->data[0] = pYUV;
+    frame->data[1] = pYUV + luma;
+    frame->data[2] = pYUV + luma + chroma;
 
+    ret = encode_frame(enc, ppBuf);
+
+    av_buffer_unref(&frame->buf[0]);
+    frame->data[0] = enc->image[0];
+    frame->data[1] = enc->image[1];
+    frame->data[2] = enc->image[2];
+
+    return ret;
+}
+
+/*------------------------------------------------------------------
+ * make the next encoded frame an IDR (a viewer lost the picture)
+ * can be called from another thread than the encoding one
+ ------------------------------------------------------------------*/
+void ffh264_enc_request_idr(ffh264_enc_t *enc)
+{
+    enc->idr_requested = 1;
+}
+
+/*------------------------------------------------------------------
+ * no more frames to encode: the delayed ones (FFH264_THREAD_FRAME) come
+ * out of ffh264_enc_receive(), until it returns 0
+ * return  0 : ok, - : error or already drained
+ ------------------------------------------------------------------*/
+int ffh264_enc_drain(ffh264_enc_t *enc)
+{
+    return (avcodec_send_frame(enc->c, NULL) < 0) ? -1 : 0;
 }
 
 /*
- * clean up encoder  
+ * clean up encoder, also after a failed ffh264_enc_open()
+ * the frames still delayed are dropped, ffh264_enc_drain() first to get
+ * them
+ * return  0 : ok, - : error getting the delayed frames, the encoder is
+ * freed all the same
  */
-void ffh264_enc_close() //void *cbf)
+int ffh264_enc_close(ffh264_enc_t *enc) //void *cbf)
 {
+    AVFrame *frame = enc->frame;
+    unsigned char *pBuf;
     /* get the delayed frames */
-    int i = 0, got_output, ret;
-    if (pkt.data != NULL)
-    {  // previously used
-        av_packet_unref(&pkt); // @TODO check, To free the allocate buffer
-    }
+    int ret, r = 0;
 
-    for (got_output = 1; got_output; i++)
+    av_packet_unref(&enc->pkt);
+    if (frame != NULL && ffh264_enc_drain(enc) == 0)
     {
-        ret = avcodec_encode_video2(c, &pkt, NULL, &got_output);
-        if (ret < 0)
+        while ((ret = ffh264_enc_receive(enc, &pBuf)) > 0)
         {
-            fprintf(stderr, "Error encoding frame\n");
-            exit(1);
-        }
-        if (got_output)
-        {
-            printf("Write frame %3d (size=%5d)\n", i, pkt.size);
 #ifdef SAVE_OWN_FILE
-            fwrite(pkt.data, 1, pkt.size, f);
+            fwrite(pBuf, 1, ret, f);
 #else
-            //(*cbf_save)(pkt.data, pkt.size);
+            //(*cbf_save)(pBuf, ret);
 #endif
-            av_packet_unref(&pkt);
         }
+        if (ret < 0)
+            r = -1;
+        av_packet_unref(&enc->pkt);
     }
     /* add sequence end code to have a real mpeg file */
     /*
@@ -261,11 +478,21 @@ void ffh264_enc_close() //void *cbf)
     fclose(f);
 #endif
 
-    avcodec_close(c);
-    av_free(c);
-    av_freep(&frame->data[0]);  // [1,2,3] is in the same allocated mem?
-    //av_freep(backupptr);  // [1,2,3] is in the same allocated mem?
-    av_frame_free(&frame);
-    printf("\n");
+    pthread_mutex_lock(&open_lock);
+    avcodec_close(enc->c);
+    pthread_mutex_unlock(&open_lock);
+    av_free(enc->c);
+    if (frame)
+    {
+        if (enc->image_buf)
+            av_buffer_unref(&enc->image_buf); // the planes are freed with it
+        else
+            av_freep(&frame->data[0]);  // [1,2,3] is in the same allocated mem?
+        //av_freep(backupptr);  // [1,2,3] is in the same allocated mem?
+        av_frame_free(&frame);
+    }
+    free(enc);
+
+    return r;
 }
 
@@ -1,18 +1,59 @@
 #ifndef FFH264ENC_H
 #define FFH264ENC_H
 
-/* init the instance (context) */
-extern int ffh264_enc_open(int w, int h, int bit_rate, int fps);
+/* one encoder instance (context), opaque */
+typedef struct ffh264_enc_t ffh264_enc_t;
+
+/* threading of x264 */
+#define FFH264_THREAD_SLICE 0 //the slices of a frame in parallel, no delay
+#define FFH264_THREAD_FRAME 1 //frames in parallel, frames of delay
+
+/* settings of an instance, ffh264_enc_config_default() first */
+typedef struct
+{
+    int width;
+    int height;
+    int bit_rate;
+    int fps;
+    int thread_type;   //FFH264_THREAD_xxx
+    int threads;       //0 : one per core
+    int lookahead;     //frames, FFH264_THREAD_FRAME only
+    int gop;           //frames from an IDR to the next, 1 : all IDR
+    int intra_refresh; //refresh over 'gop' frames instead of IDRs
+} ffh264_enc_config_t;
+
+/* latency settings: slice threads, all IDR */
+void ffh264_enc_config_default(ffh264_enc_config_t *cfg, int w, int h,
+        int bit_rate, int fps);
+
+/* init the instance (context), NULL on error */
+extern ffh264_enc_t* ffh264_enc_open(int w, int h, int bit_rate, int fps);
+extern ffh264_enc_t* ffh264_enc_open_config(const ffh264_enc_config_t *cfg);
 
 /* get extradata(SPS/PPS) */
-void ffh264_get_global_header(int* header_size, unsigned char* header_data);
+void ffh264_get_global_header(ffh264_enc_t *enc, int* header_size,
+        unsigned char* header_data);
+
+/* encode one frame with the instance */
+extern int ffh264_enc_encode(ffh264_enc_t *enc, unsigned char *pYUV,
+        unsigned char **cbf);
 
-/* encode one using the single tone */
-extern int ffh264_enc_encode(unsigned char *pYUV, unsigned char **cbf);
+/* encode one frame in place, release(opaque, pYUV) once it is not read */
+extern int ffh264_enc_encode_buffer(ffh264_enc_t *enc, unsigned char *pYUV,
+        int size, void (*release)(void *opaque, unsigned char *data),
+        void *opaque, unsigned char **cbf);
+
+/* next delayed frame, the rest of the output of an encode call */
+extern int ffh264_enc_receive(ffh264_enc_t *enc, unsigned char **cbf);
+
+/* end of the input, the delayed frames come out of ffh264_enc_receive() */
+extern int ffh264_enc_drain(ffh264_enc_t *enc);
+
+/* next frame will be an IDR */
+void ffh264_enc_request_idr(ffh264_enc_t *enc);
 
 /* close it */ 
-extern int ffh264_enc_close( );
+extern int ffh264_enc_close(ffh264_enc_t *enc);
 
 #endif
 
-
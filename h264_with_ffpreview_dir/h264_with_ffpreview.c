@@ -31,8 +31,20 @@
 #include "omx_part.h"
 #include "ffh264enc.h"   // wrapper for libavcodec 
 
+#include "../stream/h264_nal.h"
+#include "../stream/h264_params.h"
+
 #define FILENAME "video.h264"
 #define PREVIEW_NAME "preview.h264"
+//SPS/PPS are written in front of the first frame, then in front of an IDR
+//at most once per interval; 0 : every IDR
+#define PARAMS_REPEAT 1000000 //us
+//the preview is a recording, nobody waits for its frames: frame threads
+//and a lookahead for more frames per second, an IDR per second
+#define PREVIEW_THREADING FFH264_THREAD_FRAME
+#define PREVIEW_THREADS 3
+#define PREVIEW_LOOKAHEAD 10 //frames
+#define PREVIEW_GOP PREVIEW_FRAMERATE
 
 //Signal flags for user interrupt
 //e.g : ctrl + c
@@ -63,9 +75,10 @@ enum NAL_TYPE
     PPS = 8,
 };
 
+//type of the frame in the buffer, which can hold SPS + PPS + IDR
 int get_NAL_type(unsigned char* frame, int len)
 {
-    return frame[4] & 0x1f;
+    return h264_nal_type(frame, len);
 }
 
 //flag that encoding thread find key frame and will exit
@@ -86,18 +99,19 @@ void* encoding_thread(void* arg)
     float frame_rate = 0;
 
     printf("Encoding thread will write to video.h264 file\n");
-    while (1)
+    //Hand all the output buffers to the encoder at once, so it keeps
+    //encoding into the free ones while a filled one is being consumed
+    if ((error = buffer_pool_fill_all(cmp->component)))
     {
-        //Get the buffer data
-        if ((error = OMX_FillThisBuffer(cmp->component->handle, cmp->buffer)))
-        {
-            fprintf(stderr, "error: OMX_FillThisBuffer: %s\n",
-                    dump_OMX_ERRORTYPE(error));
-            vcos_thread_exit((void*)1);
-        }
+        fprintf(stderr, "error: OMX_FillThisBuffer: %s\n",
+                dump_OMX_ERRORTYPE(error));
+        vcos_thread_exit((void*)1);
+    }
 
-        //Wait until it's filled
-        wait(cmp->component, EVENT_FILL_BUFFER_DONE, 0);
+    while (1)
+    {
+        //Wait until a buffer is filled (oldest first)
+        OMX_BUFFERHEADERTYPE* buffer = buffer_pool_get_filled(cmp->component);
         
         //for calculate actual frame rate
         pre_time = currunt_time;
@@ -114,7 +128,7 @@ void* encoding_thread(void* arg)
             //wait the key frame for check the boundry of video and exit
 
             //wait until find I frame(syncframe)
-            if(cmp->buffer->nFlags & OMX_BUFFERFLAG_SYNCFRAME)
+            if(buffer->nFlags & OMX_BUFFERFLAG_SYNCFRAME)
             {
                 printf("encoding : SyncFrame found, It will be finished in a moment.\n");
                 encoding_thread_exit_flag = 1;
@@ -124,12 +138,20 @@ void* encoding_thread(void* arg)
 
         //Append the buffer into the file
         if (write(*(cmp->fd)
-                    , cmp->buffer->pBuffer
-                    , cmp->buffer->nFilledLen) == -1)
+                    , buffer->pBuffer
+                    , buffer->nFilledLen) == -1)
         {
             fprintf(stderr, "error: write\n");
             vcos_thread_exit((void*)1);
         }
+
+        //Give the buffer back to the encoder
+        if ((error = buffer_pool_fill(cmp->component, buffer)))
+        {
+            fprintf(stderr, "error: OMX_FillThisBuffer: %s\n",
+                    dump_OMX_ERRORTYPE(error));
+            vcos_thread_exit((void*)1);
+        }
     }
 
     vcos_thread_exit((void*)0);
@@ -137,6 +159,22 @@ void* encoding_thread(void* arg)
     return NULL;
 }
 
+//write one encoded frame of the preview, SPS/PPS first if it needs them
+static int write_preview(int fd, h264_params_t *params, unsigned char *frame,
+        int len)
+{
+    unsigned char header[2 * H264_PARAMS_MAX + 8];
+    int header_len = h264_params_inject(params, frame, len, GetTimeStamp(),
+            header, sizeof(header));
+
+    if (header_len > 0 && write(fd, header, header_len) == -1)
+        return -1;
+    if (write(fd, frame, len) == -1)
+        return -1;
+
+    return 0;
+}
+
 //Thread for preview, write resized video to preview.h264
 // using ffmpeg sw codec 
 // arg : YUV video source component (hopefully one frame) 
@@ -158,12 +196,27 @@ void* preview_thread(void* arg)
 
     // init software codec
     int width = PREVIEW_WIDTH, height= PREVIEW_HEIGHT, bitrate = PREVIEW_BITRATE, fps = PREVIEW_FRAMERATE; 
-    ffh264_enc_open(width, height, bitrate, fps);
+    ffh264_enc_config_t cfg;
+    ffh264_enc_config_default(&cfg, width, height, bitrate, fps);
+    cfg.thread_type = PREVIEW_THREADING;
+    cfg.threads = PREVIEW_THREADS;
+    cfg.lookahead = PREVIEW_LOOKAHEAD;
+    cfg.gop = PREVIEW_GOP;
+    ffh264_enc_t *enc = ffh264_enc_open_config(&cfg);
+    if (!enc)
+    {
+        fprintf(stderr, "error: ffh264_enc_open\n");
+        vcos_thread_exit((void*) 1);
+    }
 
     // get SPS/PPS data directly.
     unsigned char extradata[100] = {0,};
     int extradata_size = 0;
-    ffh264_get_global_header(&extradata_size, extradata);
+    ffh264_get_global_header(enc, &extradata_size, extradata);
+    h264_params_t params;
+    h264_params_init(&params);
+    h264_params_update(&params, extradata, extradata_size);
+    params.repeat = PARAMS_REPEAT;
 
     while (1)
     {
@@ -195,34 +248,23 @@ void* preview_thread(void* arg)
 
 	// Encoding
         unsigned char *pBuffer;
-        int n = ffh264_enc_encode(cmp->buffer->pBuffer, &pBuffer);
-        if (n < 0)
-        { // errror in encoding
-            fprintf(stderr, "error: encoding\n");
-            vcos_thread_exit((void*) 1);
-        }
-        else if (n > 0)
+        int n = ffh264_enc_encode(enc, cmp->buffer->pBuffer, &pBuffer);
+        if (n == 0) // encoding ok but no data to give (lookahead)
+            continue;
+        for (; n > 0; n = ffh264_enc_receive(enc, &pBuffer))
         {
-            // write SPS/PPS data
-            printf("first write\n");
-            if (write(*(cmp->fd)
-                        , extradata
-                        , extradata_size) == -1)
-            {
-                fprintf(stderr, "error: write\n");
-                vcos_thread_exit((void*) 1);
-            }
-            // write frame data
-            if (write(*(cmp->fd)
-                        , pBuffer
-                        , n) == -1)
+            // write frame data, SPS/PPS in front of the IDRs that need it
+            if (write_preview(*(cmp->fd), &params, pBuffer, n) == -1)
             {
                 fprintf(stderr, "error: write\n");
                 vcos_thread_exit((void*) 1);
             }
         }
-        else if (n == 0) // encoding ok but no data to give
-            continue;
+        if (n < 0)
+        { // errror in encoding
+            fprintf(stderr, "error: encoding\n");
+            vcos_thread_exit((void*) 1);
+        }
 
         pre_time = currunt_time;
         currunt_time = GetTimeStamp();
@@ -233,7 +275,25 @@ void* preview_thread(void* arg)
     
     } // while loop
 
-    ffh264_enc_close();
+    // the frames still in the lookahead
+    unsigned char *pBuffer;
+    int n = 0;
+    if (ffh264_enc_drain(enc) == 0)
+    {
+        while ((n = ffh264_enc_receive(enc, &pBuffer)) > 0)
+        {
+            if (write_preview(*(cmp->fd), &params, pBuffer, n) == -1)
+            {
+                fprintf(stderr, "error: write\n");
+                vcos_thread_exit((void*) 1);
+            }
+        }
+    }
+    if (n < 0)
+        fprintf(stderr, "error: encoding\n");
+
+    ffh264_enc_close(enc);
+    h264_params_deinit(&params);
 
     vcos_thread_exit((void*)0);
 
@@ -274,7 +334,6 @@ int main()
     component_buffer_t encode_cmp;
     encode_cmp.fd = &fd;
     encode_cmp.component = cmp_buf.encoder;
-    encode_cmp.buffer = cmp_buf.encoder_output_buffer;
     
     VCOS_THREAD_T encode_th;
     vcos_thread_create(&encode_th, "encode_thread", NULL, encoding_thread, (void*)(&encode_cmp));
@@ -2,7 +2,7 @@
 
 //Variable, handlers for OMX components
 static OMX_ERRORTYPE error;
-static OMX_BUFFERHEADERTYPE* encoder_output_buffer;
+static buffer_pool_t encoder_output_pool;
 static OMX_BUFFERHEADERTYPE* resize_output_buffer;
 static component_t camera;
 static component_t encoder;
@@ -10,11 +10,31 @@ static component_t resize;
 static component_t splitter;
 static component_t null_sink;
 
+//Components of the graph, in the order they are brought up
+static component_t* graph[] =
+{ &camera, &encoder, &resize, &splitter, &null_sink };
+#define GRAPH_SIZE (sizeof(graph) / sizeof(graph[0]))
+
+//Tunneled ports, enabled and disabled together
+static component_port_t tunnel_ports[] =
+{
+    { &camera, 71 }, { &camera, 70 },
+    { &splitter, 250 }, { &splitter, 251 }, { &splitter, 252 },
+    { &resize, 60 },
+    { &encoder, 200 },
+    { &null_sink, 240 },
+};
+#define TUNNEL_PORTS_SIZE (sizeof(tunnel_ports) / sizeof(tunnel_ports[0]))
+
 //It looks good to use structures to easily share components and buffers with the outside world.
 components_n_buffers cmp_buf;
 
 void rpiomx_open()
 { 
+    //bring-up latency, mostly spent waiting for state changes and ports
+    DECLARE_TIME(rpiomx_open_time)
+    START_TIME(rpiomx_open_time)
+
     camera.name      = "OMX.broadcom.camera";
     encoder.name     = "OMX.broadcom.video_encode";
     resize.name      = "OMX.broadcom.resize";
@@ -89,77 +109,25 @@ void rpiomx_open()
  
     printf("----------Change state to IDLE------------------\n");
     //Change state to IDLE
-    change_state(&camera, OMX_StateIdle);
-    //wait(&camera, EVENT_STATE_SET, 0);
-    wait_state_change(&camera, OMX_StateIdle);
-
-    change_state(&encoder, OMX_StateIdle);
-    //wait(&encoder, EVENT_STATE_SET, 0);
-    wait_state_change(&encoder, OMX_StateIdle);
-    
-    change_state(&resize, OMX_StateIdle);
-    //wait(&resize, EVENT_STATE_SET, 0);
-    wait_state_change(&resize, OMX_StateIdle);
-    
-    change_state(&splitter, OMX_StateIdle);
-    //wait(&splitter, EVENT_STATE_SET, 0);
-    wait_state_change(&splitter, OMX_StateIdle);
-    
-    change_state(&null_sink, OMX_StateIdle);
-    //wait(&null_sink, EVENT_STATE_SET, 0);
-    wait_state_change(&null_sink, OMX_StateIdle);
+    //All the ports are disabled, so no component waits for another one and
+    //the whole graph can change state at once
+    change_state_graph(graph, GRAPH_SIZE, OMX_StateIdle);
 
 
     printf("----------Enable the ports----------------------\n");
     //Enable the ports
-    enable_port(&camera, 71);
-    wait_enable_port(&camera, 71);
-    enable_port(&camera, 70);
-    wait_enable_port(&camera, 70);
-
-    enable_port(&splitter, 250);
-    wait_enable_port(&splitter, 250);
-    enable_port(&splitter, 251);
-    wait_enable_port(&splitter, 251);
-    enable_port(&splitter, 252);
-    wait_enable_port(&splitter, 252);
-    
-    enable_port(&resize, 60);
-    wait_enable_port(&resize, 60);
-
-    enable_resize_output_port(&resize, &resize_output_buffer); 
-
-    enable_port(&encoder, 200);
-    wait_enable_port(&encoder, 200);
-    enable_encoder_output_port(&encoder, &encoder_output_buffer);
-    
-    enable_port(&null_sink, 240);
-    wait_enable_port(&null_sink, 240);
+    enable_ports(tunnel_ports, TUNNEL_PORTS_SIZE);
+    enable_resize_output_port(&resize, &resize_output_buffer);
+    enable_encoder_output_port(&encoder, &encoder_output_pool,
+            VIDEO_OUTPUT_BUFFERS);
 
 
     printf("----------Change state to EXECUTING-------------\n");
     //Change state to EXECUTING
-    change_state(&camera, OMX_StateExecuting);
-    //wait(&camera, EVENT_STATE_SET, 0);
-    wait_state_change(&camera, OMX_StateExecuting);
-
-    change_state(&splitter, OMX_StateExecuting);
-    //wait(&splitter, EVENT_STATE_SET, 0);
-    wait_state_change(&splitter, OMX_StateExecuting);
-    
-    change_state(&resize, OMX_StateExecuting);
-    //wait(&resize, EVENT_STATE_SET, 0);
-    wait_state_change(&resize, OMX_StateExecuting);
-    
-    change_state(&encoder, OMX_StateExecuting);
-    //wait(&encoder, EVENT_STATE_SET, 0);
-    wait_state_change(&encoder, OMX_StateExecuting);
+    //Nothing flows before the camera capture port is enabled below
+    change_state_graph(graph, GRAPH_SIZE, OMX_StateExecuting);
     wait(&encoder, EVENT_PORT_SETTINGS_CHANGED, 0);
-    
-    change_state(&null_sink, OMX_StateExecuting);
-    //wait(&null_sink, EVENT_STATE_SET, 0);
-    wait_state_change(&null_sink, OMX_StateExecuting);
-    
+
     printf("---------Set camera capture Enable--------------\n");
     //Enable camera capture port. This basically says that the port 71 will be
     //used to get data from the camera. If you're capturing a still, the port 72
@@ -183,12 +151,18 @@ void rpiomx_open()
     cmp_buf.resize      = &resize;
     cmp_buf.splitter    = &splitter;
     cmp_buf.null_sink   = &null_sink;
-    cmp_buf.encoder_output_buffer = encoder_output_buffer;
+    cmp_buf.encoder_output_pool = &encoder_output_pool;
     cmp_buf.resize_output_buffer = resize_output_buffer;
+
+    STOP_TIME(rpiomx_open_time)
+    PRINT_EXECUTION_TIME(rpiomx_open_time)
 }
 
 void rpiomx_close()
 {
+    DECLARE_TIME(rpiomx_close_time)
+    START_TIME(rpiomx_close_time)
+
     //Disable camera capture port
     printf("disabling %s capture port\n", camera.name);
     OMX_CONFIG_PORTBOOLEANTYPE capture_st;
@@ -205,89 +179,21 @@ void rpiomx_close()
 
     printf("-----------Disable tunnel ports-----------------\n");
     //Disable the tunnel ports
-    disable_port(&camera, 71);
-    //wait(&camera, EVENT_PORT_ENABLE, 0);
-    wait_disable_port(&camera, 71); 
-
-    disable_port(&camera, 70);
-    //wait(&camera, EVENT_PORT_ENABLE, 0);
-    wait_disable_port(&camera, 70); 
-    
-    disable_port(&null_sink, 240);
-    //wait(&null_sink, EVENT_PORT_ENABLE, 0);
-    wait_disable_port(&null_sink, 240); 
-    
-    disable_port(&splitter, 250);
-    //wait(&splitter, EVENT_PORT_ENABLE, 0);
-    wait_disable_port(&splitter, 250); 
-    
-    disable_port(&splitter, 251);
-    //wait(&splitter, EVENT_PORT_ENABLE, 0);
-    wait_disable_port(&splitter, 251); 
-    
-    disable_port(&splitter, 252);
-    //wait(&splitter, EVENT_PORT_ENABLE, 0);
-    wait_disable_port(&splitter, 252); 
-    
-    disable_port(&resize, 60);
-    //wait(&splitter, EVENT_PORT_ENABLE, 0);
-    wait_disable_port(&resize, 60); 
-
+    disable_ports(tunnel_ports, TUNNEL_PORTS_SIZE);
     disable_resize_output_port(&resize, resize_output_buffer);
-    
-    disable_port(&encoder, 200);
-    wait_disable_port(&encoder, 200); 
-    //wait(&encoder, EVENT_PORT_ENABLE, 0);
-    disable_encoder_output_port(&encoder, encoder_output_buffer);
+    disable_encoder_output_port(&encoder, &encoder_output_pool);
+
 
     printf("---------Change state to IDLE-------------------\n");
     //Change state to IDLE
-    change_state(&camera, OMX_StateIdle);
-    //wait(&camera, EVENT_STATE_SET, 0);
-    wait_state_change(&camera, OMX_StateIdle);
+    change_state_graph(graph, GRAPH_SIZE, OMX_StateIdle);
 
-    change_state(&encoder, OMX_StateIdle);
-    //wait(&encoder, EVENT_STATE_SET, 0);
-    wait_state_change(&encoder, OMX_StateIdle);
-    
-    change_state(&resize, OMX_StateIdle);
-    //wait(&resize, EVENT_STATE_SET, 0);
-    wait_state_change(&resize, OMX_StateIdle);
-    
-    change_state(&splitter, OMX_StateIdle);
-    //wait(&splitter, EVENT_STATE_SET, 0);
-    wait_state_change(&splitter, OMX_StateIdle);
-    
-    change_state(&null_sink, OMX_StateIdle);
-    //wait(&null_sink, EVENT_STATE_SET, 0);
-    wait_state_change(&null_sink, OMX_StateIdle);
 
-    
     printf("---------Change state to LOADED-----------------\n");
     //Change state to LOADED
-    change_state(&camera, OMX_StateLoaded);
-    //wait(&camera, EVENT_STATE_SET, 0);
-    wait_state_change(&camera, OMX_StateLoaded);
-    
-    change_state(&encoder, OMX_StateLoaded);
-    //wait(&encoder, EVENT_STATE_SET, 0);
-    // HEEJUNE! may be bug
-    //wait_state_change(&encoder_prv, OMX_StateLoaded);
-    wait_state_change(&encoder, OMX_StateLoaded);
-    
-    change_state(&resize, OMX_StateLoaded);
-    //wait(&resize, EVENT_STATE_SET, 0);
-    wait_state_change(&resize, OMX_StateLoaded);
-    
-    change_state(&splitter, OMX_StateLoaded);
-    //wait(&splitter, EVENT_STATE_SET, 0);
-    wait_state_change(&splitter, OMX_StateLoaded);
-    
-    change_state(&null_sink, OMX_StateLoaded);
-    //wait(&null_sink, EVENT_STATE_SET, 0);
-    wait_state_change(&null_sink, OMX_StateLoaded);
+    change_state_graph(graph, GRAPH_SIZE, OMX_StateLoaded);
+
 
-     
     printf("--------Deinitialize components-----------------\n");
     //Deinitialize components
     deinit_component(&camera);
@@ -305,4 +211,7 @@ void rpiomx_close()
 
     //Deinitialize Broadcom's VideoCore APIs
     bcm_host_deinit();
+
+    STOP_TIME(rpiomx_close_time)
+    PRINT_EXECUTION_TIME(rpiomx_close_time)
 }
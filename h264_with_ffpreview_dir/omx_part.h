@@ -18,7 +18,7 @@ typedef struct components_n_buffers
     component_t* splitter;
     component_t* null_sink;
 
-    OMX_BUFFERHEADERTYPE* encoder_output_buffer;
+    buffer_pool_t* encoder_output_pool;
     OMX_BUFFERHEADERTYPE* resize_output_buffer;
 } components_n_buffers;
 
@@ -30,9 +30,62 @@
 
 #include "omx_part.h"
 
-#define FILENAME "video.h264"
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../stream/h264_nal.h"
+#include "../record/au.h"
+#include "../record/ts.h"
+#include "../record/fmp4.h"
+#include "../record/segment.h"
+#include "../record/disk_writer.h"
+#include "../record/preroll.h"
+
+//container of the main video
+#define RECORD_RAW 0 //H.264 elementary stream, as the encoder gives it
+#define RECORD_TS 1  //MPEG-TS (timestamps, plays as is)
+#define RECORD_MP4 2 //fragmented MP4, one fragment per GOP, seekable
+#define RECORD_FORMAT RECORD_TS
+
+#if RECORD_FORMAT == RECORD_TS
+#define FILE_EXT ".ts"
+#elif RECORD_FORMAT == RECORD_MP4
+#define FILE_EXT ".mp4"
+#else
+#define FILE_EXT ".h264"
+#endif
+
+//the main video is cut in segments on keyframes, named by their start time
+//(strftime), a restart never overwrites a recording
+#define SEGMENT_DIR "."
+#define SEGMENT_NAME "video-%Y%m%d-%H%M%S" FILE_EXT
+#define SEGMENT_SECONDS 300 //0 : no time limit
+#define SEGMENT_BYTES 0     //0 : no size limit
+#define SEGMENT_KEEP 0      //segments kept, older ones deleted, 0 : all
+//blocks reserved when a segment is opened: one contiguous file on the card
+#define SEGMENT_PREALLOCATE ((uint64_t)SEGMENT_SECONDS * VIDEO_BITRATE / 8)
+#define SEGMENT_FSYNC SEGMENT_FSYNC_SEGMENT //_NEVER, _SEGMENT or _GOP
+
+//the card is written in aligned chunks of DISK_CHUNK bytes (1 to 4MB), with
+//O_DIRECT (no page cache) if DISK_DIRECT is 1
+#define DISK_CHUNK (1024 * 1024)
+#define DISK_DIRECT 0
+
+//event recording: the last PREROLL_SECONDS are kept in RAM (PREROLL_SIZE
+//bytes, room for the seconds plus one GOP) and only written from a trigger
+//(kill -USR1 <pid>) up to POSTROLL_SECONDS after the last trigger, one
+//segment per event; comment out to record all the time
+//#define PREROLL_SECONDS 10
+#define PREROLL_SIZE (16 * 1024 * 1024)
+#define POSTROLL_SECONDS 20
 #define PREVIEW_NAME "preview.h264"
 
+//send the main video as MPEG-TS to a UDP (multicast) address too
+//#define TS_UDP_ADDR "239.0.0.1"
+#define TS_UDP_PORT 5004
+
 //Signal flags for user interrupt
 //e.g : ctrl + c
 int signal_flag;
@@ -62,9 +115,234 @@ enum NAL_TYPE
     PPS = 8,
 };
 
+//type of the frame in the buffer, which can hold SPS + PPS + IDR
 int get_NAL_type(unsigned char* frame, int len)
 {
-    return frame[4] & 0x1f;
+    return h264_nal_type(frame, len);
+}
+
+static au_t au;
+static segment_writer_t segments;
+//the encoding thread only queues the data, the disk is written by its thread
+static disk_writer_t disk;
+static int disk_drop;         //dropping frames up to the next keyframe
+static uint32_t disk_dropped;
+
+#ifdef PREROLL_SECONDS
+static preroll_t preroll;
+static volatile sig_atomic_t event_trigger;
+static int event_recording;
+static uint64_t event_end; //pts of the end of the post-roll
+
+//Record the event: the pre-roll, then up to the end of the post-roll
+static void sig_event(int signal)
+{
+    event_trigger = 1;
+}
+#endif
+#if RECORD_FORMAT == RECORD_TS
+static ts_muxer_t ts_file;
+#elif RECORD_FORMAT == RECORD_MP4
+static fmp4_writer_t mp4_file;
+#endif
+
+//end of a segment: what the container keeps goes to the old file
+static int container_flush(void)
+{
+#if RECORD_FORMAT == RECORD_TS
+    return ts_flush(&ts_file);
+#elif RECORD_FORMAT == RECORD_MP4
+    if (fmp4_finish(&mp4_file) == -1)
+        return -1;
+    fmp4_restart(&mp4_file);
+    return 0;
+#else
+    return 0;
+#endif
+}
+
+#ifdef TS_UDP_ADDR
+static ts_muxer_t ts_udp;
+static int ts_sock = -1;
+static struct sockaddr_in ts_addr;
+
+//one datagram of up to TS_PACKETS_PER_DATAGRAM packets
+static int send_datagram(void* arg, const unsigned char* data, int len)
+{
+    //a lost datagram is the receiver's problem, the recording goes on
+    sendto(ts_sock, data, len, 0, (struct sockaddr*)&ts_addr, sizeof(ts_addr));
+    return 0;
+}
+
+static void ts_udp_open(void)
+{
+    ts_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (ts_sock == -1)
+    {
+        fprintf(stderr, "error: socket\n");
+        exit(1);
+    }
+
+    memset(&ts_addr, 0, sizeof(ts_addr));
+    ts_addr.sin_family = AF_INET;
+    ts_addr.sin_port = htons(TS_UDP_PORT);
+    ts_addr.sin_addr.s_addr = inet_addr(TS_UDP_ADDR);
+
+    ts_muxer_init(&ts_udp, TS_PACKETS_PER_DATAGRAM, send_datagram, NULL);
+}
+#endif
+
+//Write one frame in the RECORD_FORMAT container, a new segment is started
+//on the keyframe when due
+//preroll_out_t, also called with the frames of the pre-roll
+static int write_frame(void* arg, const unsigned char* data, int len,
+        uint64_t pts, int keyframe)
+{
+    if (keyframe && segment_due(&segments, pts))
+    {
+        if (container_flush() == -1)
+            return -1;
+        segment_rotate(&segments, pts, pts);
+        printf("new segment %u\n", segments.segments);
+    }
+
+#if RECORD_FORMAT == RECORD_TS
+    //no B frames from the encoder: DTS is the PTS
+    int r = ts_mux_frame(&ts_file, data, len, pts, pts, keyframe);
+#elif RECORD_FORMAT == RECORD_MP4
+    int r = fmp4_write_frame(&mp4_file, data, len, pts, keyframe);
+#else
+    int r = segment_write(&segments, data, len);
+#endif
+
+    //SEGMENT_FSYNC_GOP: the GOP before the keyframe is out of the container
+    //(the fMP4 writes it on the keyframe), sync it
+    if (r == 0 && keyframe && segments.config.fsync == SEGMENT_FSYNC_GOP)
+    {
+#if RECORD_FORMAT == RECORD_TS
+        r = ts_flush(&ts_file);
+#endif
+        if (r == 0)
+            r = segment_sync(&segments);
+    }
+
+    return r;
+}
+
+#ifdef PREROLL_SECONDS
+//Write the pre-roll as far as the disk writer has room for it (the same
+//margin as record_main() for the container), the rest goes with the next
+//frames: a pre-roll of several MB does not block the encoder thread
+static int write_preroll(void)
+{
+    return preroll_flush(&preroll, disk_writer_free(&disk) / 2, write_frame,
+            NULL);
+}
+
+//Event recording: the frames go to the pre-roll until a trigger, then the
+//pre-roll and the frames up to POSTROLL_SECONDS after the last trigger go
+//to a new segment
+//return : 1 if the frame is to be recorded, 0 if it is kept in the
+//pre-roll (or was written with it), -1 on write error
+static int record_event(void)
+{
+    if (!event_recording)
+    {
+        preroll_add(&preroll, au.data, au.len, au.pts, au.keyframe);
+
+        //the pre-roll starts on a keyframe, the spare file is needed
+        if (!event_trigger || preroll_frames(&preroll) == 0
+                || !segment_ready(&segments))
+            return 0;
+
+        event_trigger = 0;
+        event_end = au.pts + POSTROLL_SECONDS * 1000000ULL;
+        event_recording = 1;
+        printf("event: %d frames of pre-roll, %.1fs\n",
+                preroll_frames(&preroll),
+                (au.pts - preroll_first_pts(&preroll)) / 1000000.0);
+
+        if (container_flush() == -1)
+            return -1;
+        segment_rotate(&segments, preroll_first_pts(&preroll), au.pts);
+        //this frame is the last one of the pre-roll
+        return write_preroll();
+    }
+
+    //a trigger during the post-roll makes it longer
+    if (event_trigger)
+    {
+        event_trigger = 0;
+        event_end = au.pts + POSTROLL_SECONDS * 1000000ULL;
+    }
+
+    if (au.pts >= event_end)
+    {
+        printf("event: end\n");
+        event_recording = 0;
+        //what the disk did not take of the pre-roll
+        disk_dropped += preroll_clear(&preroll);
+        if (container_flush() == -1)
+            return -1;
+        preroll_add(&preroll, au.data, au.len, au.pts, au.keyframe);
+        return 0;
+    }
+
+    //the frame waits behind the pre-roll still in the ring, an old GOP
+    //is dropped if the disk cannot catch up
+    if (preroll_frames(&preroll))
+    {
+        preroll_add(&preroll, au.data, au.len, au.pts, au.keyframe);
+        return write_preroll();
+    }
+
+    return 1;
+}
+#endif
+
+//Write one buffer of the main encoder in the RECORD_FORMAT container
+//The frames are put together first, so every segment starts on an IDR with
+//its SPS/PPS, whatever the container.
+static int record_main(OMX_BUFFERHEADERTYPE* buffer)
+{
+    uint64_t timestamp = omx_ticks_to_us(buffer->nTimeStamp);
+    if (timestamp == 0)
+        timestamp = GetTimeStamp();
+
+    if (!au_add(&au, buffer->pBuffer + buffer->nOffset, buffer->nFilledLen,
+            timestamp, buffer->nFlags & OMX_BUFFERFLAG_CODECCONFIG,
+            buffer->nFlags & OMX_BUFFERFLAG_SYNCFRAME,
+            buffer->nFlags & OMX_BUFFERFLAG_ENDOFFRAME))
+        return 0;
+
+#ifdef TS_UDP_ADDR
+    //the frame goes out whole, the last datagram is not kept for the next
+    ts_mux_frame(&ts_udp, au.data, au.len, au.pts, au.pts, au.keyframe);
+    ts_flush(&ts_udp);
+#endif
+
+#ifdef PREROLL_SECONDS
+    int r = record_event();
+    if (r != 1)
+        return r;
+#endif
+
+    //the disk is that far behind: drop frames up to the next keyframe
+    //rather than block the encoder (the container adds a few % to a frame)
+    if (disk_drop && !au.keyframe)
+    {
+        disk_dropped++;
+        return 0;
+    }
+    disk_drop = (disk_writer_free(&disk) < 2 * au.len);
+    if (disk_drop)
+    {
+        fprintf(stderr, "disk too slow, frame dropped\n");
+        disk_dropped++;
+        return 0;
+    }
+
+    return write_frame(NULL, au.data, au.len, au.pts, au.keyframe);
 }
 
 //Thread for encode and write to video.h264
@@ -81,19 +359,21 @@ void* encoding_thread(void* arg)
     int frame_count = 0;
     float frame_rate = 0;
 
-    printf("Encoding thread will write to video.h264 file\n");
-    while (1)
+    printf("Encoding thread will write to %s/%s files\n", SEGMENT_DIR,
+            SEGMENT_NAME);
+    //Hand all the output buffers to the encoder at once, so it keeps
+    //encoding into the free ones while a filled one is being consumed
+    if ((error = buffer_pool_fill_all(cmp->component)))
     {
-        //Get the buffer data
-        if ((error = OMX_FillThisBuffer(cmp->component->handle, cmp->buffer)))
-        {
-            fprintf(stderr, "error: OMX_FillThisBuffer: %s\n",
-                    dump_OMX_ERRORTYPE(error));
-            vcos_thread_exit((void*)1);
-        }
+        fprintf(stderr, "error: OMX_FillThisBuffer: %s\n",
+                dump_OMX_ERRORTYPE(error));
+        vcos_thread_exit((void*)1);
+    }
 
-        //Wait until it's filled
-        wait(cmp->component, EVENT_FILL_BUFFER_DONE, 0);
+    while (1)
+    {
+        //Wait until a buffer is filled (oldest first)
+        OMX_BUFFERHEADERTYPE* buffer = buffer_pool_get_filled(cmp->component);
         
         //for calculate actual frame rate
         pre_time = currunt_time;
@@ -110,7 +390,7 @@ void* encoding_thread(void* arg)
             //wait the key frame for check the boundry of video and exit
 
             //wait until find I frame(syncframe)
-            if(cmp->buffer->nFlags & OMX_BUFFERFLAG_SYNCFRAME)
+            if(buffer->nFlags & OMX_BUFFERFLAG_SYNCFRAME)
             {
                 printf("encoding : SyncFrame found, It will be finished in a moment.\n");
                 break;
@@ -118,15 +398,30 @@ void* encoding_thread(void* arg)
         }
 
         //Append the buffer into the file
-        if (write(*(cmp->fd)
-                    , cmp->buffer->pBuffer
-                    , cmp->buffer->nFilledLen) == -1)
+        if (record_main(buffer) == -1)
         {
-            fprintf(stderr, "error: pwrite\n");
+            fprintf(stderr, "error: write\n");
+            vcos_thread_exit((void*)1);
+        }
+
+        //Give the buffer back to the encoder
+        if ((error = buffer_pool_fill(cmp->component, buffer)))
+        {
+            fprintf(stderr, "error: OMX_FillThisBuffer: %s\n",
+                    dump_OMX_ERRORTYPE(error));
             vcos_thread_exit((void*)1);
         }
     }
 
+    //the packets or the GOP the container still keeps
+    if (container_flush() == -1)
+    {
+        fprintf(stderr, "error: write\n");
+        vcos_thread_exit((void*)1);
+    }
+    printf("%u segments, %u rotations late\n", segments.segments,
+            segments.late);
+
     vcos_thread_exit((void*)0);
 
     return NULL;
@@ -147,18 +442,19 @@ void* preview_thread(void* arg)
     float frame_rate = 0;
 
     printf("preview thread will write to preview.h264 file\n");
-    while (1)
+    //Hand all the output buffers to the encoder at once, so it keeps
+    //encoding into the free ones while a filled one is being consumed
+    if ((error = buffer_pool_fill_all(cmp->component)))
     {
-        //Get the buffer data
-        if ((error = OMX_FillThisBuffer(cmp->component->handle, cmp->buffer)))
-        {
-            fprintf(stderr, "error: OMX_FillThisBuffer: %s\n",
-                    dump_OMX_ERRORTYPE(error));
-            vcos_thread_exit((void*)1);
-        }
+        fprintf(stderr, "error: OMX_FillThisBuffer: %s\n",
+                dump_OMX_ERRORTYPE(error));
+        vcos_thread_exit((void*)1);
+    }
 
-        //Wait until it's filled
-        wait(cmp->component, EVENT_FILL_BUFFER_DONE, 0);
+    while (1)
+    {
+        //Wait until a buffer is filled (oldest first)
+        OMX_BUFFERHEADERTYPE* buffer = buffer_pool_get_filled(cmp->component);
 
         //check if user press "ctrl c" or other interrupt occured
         if(signal_flag_check())
@@ -167,8 +463,10 @@ void* preview_thread(void* arg)
             //signal interrupt detected
             //wait the key frame for check the boundry of video and exit
 
-            //wait until find I frame(syncframe)
-            if(cmp->buffer->nFlags & OMX_BUFFERFLAG_SYNCFRAME)
+            //wait until find I frame(syncframe), with the intra refresh
+            //the IDRs are rare and any frame will do
+            if(PREVIEW_INTRA_REFRESH
+               || (buffer->nFlags & OMX_BUFFERFLAG_SYNCFRAME))
             {
                 printf("preview : SyncFrame found, It will be finished in a moment.\n");
                 break;
@@ -176,7 +474,7 @@ void* preview_thread(void* arg)
         }
         
         //for calculate actual frame rate
-        int nal_type = get_NAL_type(cmp->buffer->pBuffer, cmp->buffer->nFilledLen);
+        int nal_type = get_NAL_type(buffer->pBuffer, buffer->nFilledLen);
         if((nal_type != SPS)
            && (nal_type != PPS))
         {
@@ -189,16 +487,24 @@ void* preview_thread(void* arg)
         }
  
         //print type of NAL header
-        //printNALFrame(cmp->buffer->pBuffer, cmp->buffer->nFilledLen);
+        //printNALFrame(buffer->pBuffer, buffer->nFilledLen);
 
         //Append the buffer into the file
         if (write(*(cmp->fd)
-                    , cmp->buffer->pBuffer
-                    , cmp->buffer->nFilledLen) == -1)
+                    , buffer->pBuffer
+                    , buffer->nFilledLen) == -1)
         {
             fprintf(stderr, "error: pwrite\n");
             vcos_thread_exit((void*)1);
         }
+
+        //Give the buffer back to the encoder
+        if ((error = buffer_pool_fill(cmp->component, buffer)))
+        {
+            fprintf(stderr, "error: OMX_FillThisBuffer: %s\n",
+                    dump_OMX_ERRORTYPE(error));
+            vcos_thread_exit((void*)1);
+        }
     }
 
     vcos_thread_exit((void*)0);
@@ -210,13 +516,32 @@ int main()
 {
 
     //Open the file
-    //main file 
-    int fd = open(FILENAME, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0666);
-    if (fd == -1)
+    //main file : the first segment
+    segment_config_t segment_config = {
+        SEGMENT_DIR, SEGMENT_NAME, SEGMENT_SECONDS, SEGMENT_BYTES, SEGMENT_KEEP,
+        &disk, SEGMENT_PREALLOCATE, SEGMENT_FSYNC
+    };
+    if (disk_writer_init(&disk, DISK_CHUNK, DISK_DIRECT) == -1
+            || segment_open(&segments, &segment_config) == -1)
     {
         fprintf(stderr, "error: open main video file\n");
         exit(1);
     }
+    au_init(&au);
+#ifdef PREROLL_SECONDS
+    if (preroll_init(&preroll, PREROLL_SIZE, PREROLL_SECONDS) == -1)
+        exit(1);
+#endif
+#if RECORD_FORMAT == RECORD_TS
+    ts_muxer_init(&ts_file, TS_PACKETS_PER_FILE_WRITE, segment_write,
+            &segments);
+#elif RECORD_FORMAT == RECORD_MP4
+    if (fmp4_writer_init(&mp4_file, segment_write, &segments) == -1)
+        exit(1);
+#endif
+#ifdef TS_UDP_ADDR
+    ts_udp_open();
+#endif
     //preview file
     int fd_prv = open(PREVIEW_NAME, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0666);
     if (fd_prv == -1)
@@ -232,14 +557,16 @@ int main()
     signal(SIGINT,  sig_flag_set);
     signal(SIGTERM, sig_flag_set);
     signal(SIGQUIT, sig_flag_set);
+#ifdef PREROLL_SECONDS
+    signal(SIGUSR1, sig_event);
+#endif
 
     printf("---------Start Capture and Encode---------------\n");
     //Create Encoding thread
     int encode_status;
     component_buffer_t encode_cmp;
-    encode_cmp.fd = &fd;
+    encode_cmp.fd = NULL; //segments
     encode_cmp.component = cmp_buf.encoder;
-    encode_cmp.buffer = cmp_buf.encoder_output_buffer;
     
     VCOS_THREAD_T encode_th;
     vcos_thread_create(&encode_th, "encode_thread", NULL, encoding_thread, (void*)(&encode_cmp));
@@ -250,7 +577,6 @@ int main()
     component_buffer_t preview_cmp;
     preview_cmp.fd = &fd_prv;
     preview_cmp.component = cmp_buf.encoder_prv;
-    preview_cmp.buffer = cmp_buf.preview_output_buffer;
 
     VCOS_THREAD_T preview_th;
     vcos_thread_create(&preview_th, "preview_thread", NULL, preview_thread, (void*)(&preview_cmp));
@@ -278,16 +604,25 @@ int main()
     signal(SIGINT,  SIG_DFL);
     signal(SIGTERM, SIG_DFL);
     signal(SIGQUIT, SIG_DFL);
+#ifdef PREROLL_SECONDS
+    signal(SIGUSR1, SIG_DFL);
+#endif
 
     //Close OpenMAX components
     rpiomx_close();
     
     //Close the file
-    if (close(fd))
-    {
-        fprintf(stderr, "error: close\n");
-        exit(1);
-    }
+    segment_close(&segments);
+    disk_writer_deinit(&disk);
+#ifdef PREROLL_SECONDS
+    preroll_deinit(&preroll);
+#endif
+    printf("%u disk writes (%u partial), %u syncs, %llu bytes queued at most,"
+            " %u frames dropped\n", disk.writes, disk.partial, disk.syncs,
+            (unsigned long long)disk.max_queued, disk_dropped);
+#if RECORD_FORMAT == RECORD_MP4
+    fmp4_writer_deinit(&mp4_file);
+#endif
     if (close(fd_prv))
     {
         fprintf(stderr, "error: close\n");
@@ -19,8 +19,8 @@ typedef struct components_n_buffers
     component_t* splitter;
     component_t* null_sink;
 
-    OMX_BUFFERHEADERTYPE* encoder_output_buffer;
-    OMX_BUFFERHEADERTYPE* preview_output_buffer;
+    buffer_pool_t* encoder_output_pool;
+    buffer_pool_t* preview_output_pool;
 } components_n_buffers;
 
 extern components_n_buffers cmp_buf;
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "au.h"
+
+void au_init(au_t* au)
+{
+    au->config_len = 0;
+    au->in_config = 0;
+    au->len = 0;
+    au->pts = 0;
+    au->keyframe = 0;
+    au->done = 0;
+    au->dropped = 0;
+}
+
+/*---------------------------------------------------------------------
+   add one buffer of the encoder
+   codec_config, sync, end_of_frame : OMX_BUFFERFLAG_CODECCONFIG,
+   OMX_BUFFERFLAG_SYNCFRAME and OMX_BUFFERFLAG_ENDOFFRAME of the buffer
+   return : 1 when au->data holds a whole frame (until the next call),
+   0 otherwise
+----------------------------------------------------------------------*/
+int au_add(au_t* au, const unsigned char* data, int len, uint64_t pts,
+        int codec_config, int sync, int end_of_frame)
+{
+    if (codec_config)
+    {
+        //SPS and PPS come in separate buffers, a new set replaces the old
+        if (!au->in_config)
+            au->config_len = 0;
+        au->in_config = 1;
+        if (au->config_len + len <= AU_CONFIG_MAX)
+        {
+            memcpy(au->config + au->config_len, data, len);
+            au->config_len += len;
+        }
+        return 0;
+    }
+    au->in_config = 0;
+
+    if (au->done)
+    {
+        au->len = 0;
+        au->done = 0;
+    }
+
+    if (au->len == 0)
+    {
+        au->keyframe = sync;
+        if (sync)
+        {
+            memcpy(au->data, au->config, au->config_len);
+            au->len = au->config_len;
+        }
+    }
+
+    if (au->len != -1 && au->len + len <= AU_MAX)
+    {
+        memcpy(au->data + au->len, data, len);
+        au->len += len;
+    }
+    else if (au->len != -1)
+    {
+        fprintf(stderr, "au : frame bigger than %d bytes dropped\n", AU_MAX);
+        au->dropped++;
+        au->len = -1;
+    }
+
+    if (!end_of_frame)
+        return 0;
+
+    au->pts = pts;
+    if (au->len == -1)
+    {
+        au->len = 0;
+        return 0;
+    }
+
+    au->done = 1;
+    return 1;
+}
@@ -0,0 +1,33 @@
+#ifndef AU_H
+#define AU_H
+
+#include <stdint.h>
+
+//Access unit (one encoded frame) put together from the buffers of an
+//encoder, for the containers that need whole frames. The SPS/PPS of the
+//codec config buffers are kept and put in front of every IDR, so any
+//keyframe of the recording can be decoded on its own.
+
+#define AU_MAX (1024 * 1024)
+#define AU_CONFIG_MAX 256
+
+typedef struct
+{
+    unsigned char config[AU_CONFIG_MAX]; //SPS/PPS, Annex-B
+    int config_len;
+    int in_config; //the last buffer was codec config
+
+    unsigned char data[AU_MAX];
+    int len;      //-1 : dropping a frame too big for data
+    uint64_t pts; //us
+    int keyframe;
+    int done; //data was handed out, the next buffer starts a frame
+
+    uint32_t dropped;
+} au_t;
+
+void au_init(au_t* au);
+int au_add(au_t* au, const unsigned char* data, int len, uint64_t pts,
+        int codec_config, int sync, int end_of_frame);
+
+#endif
@@ -0,0 +1,672 @@
+#define _GNU_SOURCE //O_DIRECT
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "disk_writer.h"
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+//io_uring without liburing: one ring of DISK_WRITER_DEPTH writes
+static int uring_init(disk_uring_t* u)
+{
+    struct io_uring_params p;
+
+    memset(u, 0, sizeof(*u));
+    memset(&p, 0, sizeof(p));
+    u->fd = syscall(__NR_io_uring_setup, DISK_WRITER_DEPTH, &p);
+    if (u->fd == -1)
+        return -1;
+
+    u->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+#ifdef IORING_FEAT_SINGLE_MMAP
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (u->cq_size > u->sq_size)
+            u->sq_size = u->cq_size;
+        u->cq_size = 0;
+    }
+#endif
+    u->sq_ptr = mmap(NULL, u->sq_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ptr == MAP_FAILED)
+        goto fail;
+    u->cq_ptr = u->sq_ptr;
+    if (u->cq_size)
+    {
+        u->cq_ptr = mmap(NULL, u->cq_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if (u->cq_ptr == MAP_FAILED)
+            goto fail;
+    }
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED)
+        goto fail;
+
+    unsigned char* sq = u->sq_ptr;
+    unsigned char* cq = u->cq_ptr;
+    u->sq_head = (unsigned*)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned*)(sq + p.sq_off.array);
+    u->cq_head = (unsigned*)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    u->cqes = cq + p.cq_off.cqes;
+
+    return 0;
+
+fail:
+    //the mappings go with the process, this happens once at start
+    close(u->fd);
+    return -1;
+}
+
+static void uring_deinit(disk_uring_t* u)
+{
+    munmap(u->sqes, u->sqes_size);
+    if (u->cq_size)
+        munmap(u->cq_ptr, u->cq_size);
+    munmap(u->sq_ptr, u->sq_size);
+    close(u->fd);
+}
+
+static void uring_queue(disk_uring_t* u, disk_batch_t* b, int id)
+{
+    unsigned tail = *u->sq_tail;
+    unsigned index = tail & *u->sq_mask;
+    struct io_uring_sqe* sqe = (struct io_uring_sqe*)u->sqes + index;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = b->fd;
+    sqe->addr = (uint64_t)(uintptr_t)b->iov;
+    sqe->len = b->iovcnt;
+    sqe->off = b->offset;
+    sqe->user_data = id;
+    u->sq_array[index] = index;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+//submit 'n' queued writes and wait for one completion at least
+static int uring_enter(disk_uring_t* u, int n)
+{
+    while (syscall(__NR_io_uring_enter, u->fd, n, 1, IORING_ENTER_GETEVENTS,
+            NULL, 0) == -1)
+    {
+        if (errno != EINTR)
+            return -1;
+        n = 0; //the writes are submitted, wait again
+    }
+
+    return 0;
+}
+#endif
+
+//the end of a batch the kernel did not write in one go
+static int write_rest(disk_batch_t* b, int done)
+{
+    while (done < b->len)
+    {
+        int pos = done;
+        int k = 0;
+        while (pos >= (int)b->iov[k].iov_len)
+        {
+            pos -= b->iov[k].iov_len;
+            k++;
+        }
+
+        ssize_t n = pwrite(b->fd, (unsigned char*)b->iov[k].iov_base + pos,
+                b->iov[k].iov_len - pos, b->offset + done);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        done += n;
+    }
+
+    return 0;
+}
+
+//bytes of the file of the tail chunk that follow each other in the queue,
+//up to 'want'; 'cut' set if the data of that file stops before the head
+//(data of another file or a sync next)
+static int queued_run(disk_writer_t* w, int want, int* cut)
+{
+    unsigned i = w->tail;
+    disk_chunk_t* c = &w->chunks[i % DISK_WRITER_MAX_CHUNKS];
+    int fd = c->fd;
+    off_t next = c->offset + c->len;
+    int run = c->len - w->tail_used;
+
+    *cut = 0;
+    for (i++; run < want && i != w->head; i++)
+    {
+        c = &w->chunks[i % DISK_WRITER_MAX_CHUNKS];
+        if (c->sync || c->fd != fd || c->offset != next)
+        {
+            *cut = 1;
+            break;
+        }
+        run += c->len;
+        next += c->len;
+    }
+
+    return run;
+}
+
+//size of the next write if it can be taken now, 0 otherwise, called locked
+//A write goes up to the next chunk boundary of the file. It is shorter at
+//the end of the data of a file, for a flush, or when the writer stops.
+static int next_batch(disk_writer_t* w)
+{
+    int cut;
+
+    if (w->tail == w->head)
+        return 0;
+    disk_chunk_t* c = &w->chunks[w->tail % DISK_WRITER_MAX_CHUNKS];
+    if (c->sync)
+        return 0;
+
+    int want = w->chunk - (c->offset + w->tail_used) % w->chunk;
+    int run = queued_run(w, want, &cut);
+    if (run >= want)
+        return want;
+    if (cut || w->quit || w->flush > w->taken)
+        return run;
+
+    return 0;
+}
+
+//take the next 'len' bytes of the queue in one write, called locked
+static void take_batch(disk_writer_t* w, int len)
+{
+    disk_batch_t* b = &w->batches[(w->first_batch + w->nbatches)
+            % DISK_WRITER_DEPTH];
+    disk_chunk_t* c = &w->chunks[w->tail % DISK_WRITER_MAX_CHUNKS];
+    int left = len;
+
+    b->fd = c->fd;
+    b->offset = c->offset + w->tail_used;
+    b->len = len;
+
+    while (left > 0)
+    {
+        c = &w->chunks[w->tail % DISK_WRITER_MAX_CHUNKS];
+        int n = c->len - w->tail_used;
+        if (n > left)
+        {
+            w->tail_used += left;
+            break;
+        }
+        left -= n;
+        w->tail++;
+        w->tail_used = 0;
+    }
+
+    int start = w->taken % DISK_WRITER_SIZE;
+    int first = DISK_WRITER_SIZE - start;
+    b->iov[0].iov_base = w->ring + start;
+    if (b->len <= first)
+    {
+        b->iov[0].iov_len = b->len;
+        b->iovcnt = 1;
+    }
+    else
+    {
+        b->iov[0].iov_len = first;
+        b->iov[1].iov_base = w->ring;
+        b->iov[1].iov_len = b->len - first;
+        b->iovcnt = 2;
+    }
+    b->direct = w->direct && b->offset % DISK_WRITER_ALIGN == 0
+            && b->len % DISK_WRITER_ALIGN == 0;
+    b->submitted = 0;
+    b->done = 0;
+
+    if (b->len < w->chunk)
+        w->partial++;
+    w->deadline.tv_sec = 0;
+    w->taken += b->len;
+    w->nbatches++;
+}
+
+//O_DIRECT on or off for a file, the flag is changed with fcntl() as the
+//unaligned writes (end of a file) cannot use it
+static void set_direct(disk_writer_t* w, int fd, int direct)
+{
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || !(flags & O_DIRECT) == !direct)
+        return;
+
+    if (fcntl(fd, F_SETFL, flags ^ O_DIRECT) == -1 && direct)
+    {
+        //e.g. tmpfs, the next writes go through the page cache
+        fprintf(stderr, "disk_writer : O_DIRECT: %s\n", strerror(errno));
+        w->direct = 0;
+    }
+}
+
+//put the file in the mode of the batch and an O_DIRECT batch in the
+//staging buffer, called unlocked
+//return : 0, -1 if the mode of the file changes while writes are in flight
+static int prepare_batch(disk_writer_t* w, disk_batch_t* b, int id,
+        int in_flight)
+{
+    if (w->staging == NULL)
+        return 0;
+
+    int flags = fcntl(b->fd, F_GETFL);
+    if (flags != -1 && !(flags & O_DIRECT) != !b->direct)
+    {
+        if (in_flight)
+            return -1;
+        set_direct(w, b->fd, b->direct);
+        if (!w->direct)
+            b->direct = 0;
+    }
+
+    if (b->direct)
+    {
+        unsigned char* staging = w->staging + id * w->chunk;
+        memcpy(staging, b->iov[0].iov_base, b->iov[0].iov_len);
+        if (b->iovcnt == 2)
+            memcpy(staging + b->iov[0].iov_len, b->iov[1].iov_base,
+                    b->iov[1].iov_len);
+        b->iov[0].iov_base = staging;
+        b->iov[0].iov_len = b->len;
+        b->iovcnt = 1;
+    }
+
+    return 0;
+}
+
+//write the batches taken, return an errno, 0 if ok
+static int write_batches(disk_writer_t* w)
+{
+    int err = 0;
+    int i;
+
+#ifdef HAVE_IO_URING
+    if (w->use_uring)
+    {
+        disk_uring_t* u = &w->uring;
+        int in_flight = 0;
+        int n = 0;
+
+        for (i = 0; i < w->nbatches; i++)
+        {
+            int id = (w->first_batch + i) % DISK_WRITER_DEPTH;
+            disk_batch_t* b = &w->batches[id];
+            if (b->submitted)
+            {
+                in_flight += !b->done;
+                continue;
+            }
+            //in order: the next ones wait for this one
+            if (prepare_batch(w, b, id, in_flight + n) == -1)
+                break;
+            uring_queue(u, b, id);
+            b->submitted = 1;
+            n++;
+        }
+        w->writes += n;
+
+        if (uring_enter(u, n) == -1)
+            return errno;
+
+        unsigned head = *u->cq_head;
+        unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++)
+        {
+            struct io_uring_cqe* cqe = (struct io_uring_cqe*)u->cqes
+                    + (head & *u->cq_mask);
+            disk_batch_t* b = &w->batches[cqe->user_data];
+
+            if (cqe->res < 0)
+                err = -cqe->res;
+            else if (cqe->res < b->len)
+                err = write_rest(b, cqe->res);
+            b->done = 1;
+        }
+        __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+        return err;
+    }
+#endif
+
+    disk_batch_t* b = &w->batches[w->first_batch];
+    prepare_batch(w, b, w->first_batch, 0);
+    ssize_t n;
+    do
+        n = pwritev(b->fd, b->iov, b->iovcnt, b->offset);
+    while (n == -1 && errno == EINTR);
+    w->writes++;
+
+    if (n == -1)
+        err = errno;
+    else if (n < b->len)
+        err = write_rest(b, n);
+    b->done = 1;
+
+    return err;
+}
+
+//wait for more data for a partial chunk, up to DISK_WRITER_FLUSH_MS after
+//it was first seen, then write it anyway
+static void wait_partial(disk_writer_t* w)
+{
+    if (w->deadline.tv_sec == 0)
+    {
+        clock_gettime(CLOCK_REALTIME, &w->deadline);
+        w->deadline.tv_sec += DISK_WRITER_FLUSH_MS / 1000;
+        w->deadline.tv_nsec += (DISK_WRITER_FLUSH_MS % 1000) * 1000000;
+        if (w->deadline.tv_nsec >= 1000000000)
+        {
+            w->deadline.tv_sec++;
+            w->deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    if (pthread_cond_timedwait(&w->queue_cond, &w->lock, &w->deadline)
+            == ETIMEDOUT)
+    {
+        w->flush = w->queued;
+        w->deadline.tv_sec = 0;
+    }
+}
+
+static void* writer_thread(void* arg)
+{
+    disk_writer_t* w = (disk_writer_t*)arg;
+    int depth = w->use_uring ? DISK_WRITER_DEPTH : 1;
+    int len;
+
+    pthread_mutex_lock(&w->lock);
+    while (1)
+    {
+        while (w->nbatches < depth && (len = next_batch(w)) > 0)
+            take_batch(w, len);
+
+        if (w->nbatches == 0)
+        {
+            if (w->tail != w->head)
+            {
+                disk_chunk_t* c = &w->chunks[w->tail % DISK_WRITER_MAX_CHUNKS];
+                if (!c->sync)
+                {
+                    wait_partial(w);
+                    continue;
+                }
+
+                //the data before is written
+                int fd = c->fd;
+                w->tail++;
+                w->syncing = 1;
+                pthread_mutex_unlock(&w->lock);
+                int r = fdatasync(fd);
+                pthread_mutex_lock(&w->lock);
+                w->syncing = 0;
+                w->syncs++;
+                if (r == -1 && !w->error)
+                {
+                    fprintf(stderr, "disk_writer : fdatasync: %s\n",
+                            strerror(errno));
+                    w->error = errno;
+                }
+                pthread_cond_broadcast(&w->progress_cond);
+                continue;
+            }
+            if (w->quit)
+                break;
+            pthread_cond_wait(&w->queue_cond, &w->lock);
+            continue;
+        }
+
+        pthread_mutex_unlock(&w->lock);
+        int err = write_batches(w);
+        pthread_mutex_lock(&w->lock);
+
+        if (err && !w->error)
+        {
+            fprintf(stderr, "disk_writer : write: %s\n", strerror(err));
+            w->error = err;
+        }
+
+        //the ring is given back in order
+        while (w->nbatches > 0 && w->batches[w->first_batch].done)
+        {
+            w->written += w->batches[w->first_batch].len;
+            w->first_batch = (w->first_batch + 1) % DISK_WRITER_DEPTH;
+            w->nbatches--;
+        }
+        pthread_cond_broadcast(&w->progress_cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+/*---------------------------------------------------------------------
+   allocate the ring buffer and start the writer thread, on io_uring
+   if the kernel has it
+   chunk : bytes of one write and their alignment in the files, a
+           multiple of DISK_WRITER_ALIGN up to DISK_WRITER_CHUNK_MAX,
+           0 : DISK_WRITER_CHUNK
+   direct : write the aligned chunks with O_DIRECT
+   return : 0, -1 on error
+----------------------------------------------------------------------*/
+int disk_writer_init(disk_writer_t* w, int chunk, int direct)
+{
+    memset(w, 0, sizeof(*w));
+
+    if (chunk == 0)
+        chunk = DISK_WRITER_CHUNK;
+    if (chunk < 0 || chunk > DISK_WRITER_CHUNK_MAX
+            || chunk % DISK_WRITER_ALIGN != 0)
+    {
+        fprintf(stderr, "disk_writer : bad chunk size %d\n", chunk);
+        return -1;
+    }
+    w->chunk = chunk;
+    w->direct = direct;
+
+    w->ring = malloc(DISK_WRITER_SIZE);
+    if (w->ring == NULL || (direct && posix_memalign((void**)&w->staging,
+            DISK_WRITER_ALIGN, DISK_WRITER_DEPTH * chunk) != 0))
+    {
+        fprintf(stderr, "disk_writer : out of memory\n");
+        free(w->ring);
+        return -1;
+    }
+
+#ifdef HAVE_IO_URING
+    w->use_uring = (uring_init(&w->uring) == 0);
+#endif
+    printf("disk_writer : %s, %dKB writes%s\n",
+            w->use_uring ? "io_uring" : "pwritev", chunk / 1024,
+            direct ? ", O_DIRECT" : "");
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->queue_cond, NULL);
+    pthread_cond_init(&w->progress_cond, NULL);
+    if (pthread_create(&w->tid, NULL, writer_thread, w) != 0)
+    {
+        fprintf(stderr, "disk_writer : pthread_create failed\n");
+        free(w->staging);
+        free(w->ring);
+        return -1;
+    }
+
+    return 0;
+}
+
+//write what is queued and stop the writer thread
+void disk_writer_deinit(disk_writer_t* w)
+{
+    pthread_mutex_lock(&w->lock);
+    w->quit = 1;
+    pthread_cond_signal(&w->queue_cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->tid, NULL);
+
+#ifdef HAVE_IO_URING
+    if (w->use_uring)
+        uring_deinit(&w->uring);
+#endif
+    pthread_cond_destroy(&w->progress_cond);
+    pthread_cond_destroy(&w->queue_cond);
+    pthread_mutex_destroy(&w->lock);
+    free(w->staging);
+    free(w->ring);
+}
+
+//room for one more chunk and 'len' bytes, called locked
+static int wait_room(disk_writer_t* w, int len)
+{
+    if (!w->error && (w->queued - w->written + len > DISK_WRITER_SIZE
+                || w->head - w->tail == DISK_WRITER_MAX_CHUNKS))
+    {
+        w->full++;
+        while (!w->error && (w->queued - w->written + len > DISK_WRITER_SIZE
+                    || w->head - w->tail == DISK_WRITER_MAX_CHUNKS))
+            pthread_cond_wait(&w->progress_cond, &w->lock);
+    }
+
+    return w->error ? -1 : 0;
+}
+
+/*---------------------------------------------------------------------
+   queue 'len' bytes to write at 'offset' of 'fd', one thread only calls
+   it; blocks while the ring is full
+   return : 0, -1 if a write failed (this one or an earlier one)
+----------------------------------------------------------------------*/
+int disk_writer_write(disk_writer_t* w, int fd, off_t offset,
+        const unsigned char* data, int len)
+{
+    if (len <= 0)
+        return 0;
+    if (len > DISK_WRITER_SIZE)
+        return -1;
+
+    pthread_mutex_lock(&w->lock);
+    if (wait_room(w, len) == -1)
+    {
+        pthread_mutex_unlock(&w->lock);
+        return -1;
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    //this part of the ring is free, the writer thread does not look at it
+    int start = w->queued % DISK_WRITER_SIZE;
+    int first = DISK_WRITER_SIZE - start;
+    if (len <= first)
+        memcpy(w->ring + start, data, len);
+    else
+    {
+        memcpy(w->ring + start, data, first);
+        memcpy(w->ring, data + first, len - first);
+    }
+
+    pthread_mutex_lock(&w->lock);
+    disk_chunk_t* c = &w->chunks[w->head % DISK_WRITER_MAX_CHUNKS];
+    c->fd = fd;
+    c->offset = offset;
+    c->len = len;
+    c->sync = 0;
+    w->head++;
+    w->queued += len;
+    if (w->queued - w->written > w->max_queued)
+        w->max_queued = w->queued - w->written;
+    pthread_cond_signal(&w->queue_cond);
+    pthread_mutex_unlock(&w->lock);
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+   queue an fdatasync() of 'fd' after the data queued so far for it, the
+   partial chunk at the end is written first; does not wait for it
+   return : 0, -1 if a write failed
+----------------------------------------------------------------------*/
+int disk_writer_sync(disk_writer_t* w, int fd)
+{
+    pthread_mutex_lock(&w->lock);
+    if (wait_room(w, 0) == -1)
+    {
+        pthread_mutex_unlock(&w->lock);
+        return -1;
+    }
+    disk_chunk_t* c = &w->chunks[w->head % DISK_WRITER_MAX_CHUNKS];
+    c->fd = fd;
+    c->offset = 0;
+    c->len = 0;
+    c->sync = 1;
+    w->head++;
+    pthread_cond_signal(&w->queue_cond);
+    pthread_mutex_unlock(&w->lock);
+
+    return 0;
+}
+
+//bytes that can be queued without blocking
+int disk_writer_free(disk_writer_t* w)
+{
+    pthread_mutex_lock(&w->lock);
+    int room = (w->head - w->tail == DISK_WRITER_MAX_CHUNKS) ? 0
+            : DISK_WRITER_SIZE - (int)(w->queued - w->written);
+    pthread_mutex_unlock(&w->lock);
+
+    return room;
+}
+
+//bytes queued so far, for disk_writer_wait()
+uint64_t disk_writer_position(disk_writer_t* w)
+{
+    pthread_mutex_lock(&w->lock);
+    uint64_t position = w->queued;
+    pthread_mutex_unlock(&w->lock);
+
+    return position;
+}
+
+/*---------------------------------------------------------------------
+   write the bytes queued before 'position', partial chunk included, and
+   wait for them, e.g. to close a file; a sync queued with them is waited
+   for too
+   return : 0, -1 if a write failed
+----------------------------------------------------------------------*/
+int disk_writer_wait(disk_writer_t* w, uint64_t position)
+{
+    pthread_mutex_lock(&w->lock);
+    if (w->flush < position)
+    {
+        w->flush = position;
+        pthread_cond_signal(&w->queue_cond);
+    }
+    while (!w->error && (w->written < position || w->syncing
+                || (w->tail != w->head
+                    && w->chunks[w->tail % DISK_WRITER_MAX_CHUNKS].sync)))
+        pthread_cond_wait(&w->progress_cond, &w->lock);
+    int r = w->error ? -1 : 0;
+    pthread_mutex_unlock(&w->lock);
+
+    return r;
+}
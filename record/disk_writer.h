@@ -0,0 +1,117 @@
+#ifndef DISK_WRITER_H
+#define DISK_WRITER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+//Disk writes off the encoding thread
+//The data is copied into a ring buffer and written by a thread of the
+//writer, consecutive writes to the same file merged in big ones. The
+//writes go through io_uring when the kernel has it (several in flight),
+//pwritev() otherwise. A full ring blocks the caller: check
+//disk_writer_free() first to drop a frame instead.
+//The files are written in aligned chunks (offset and size multiples of
+//the chunk size), only the end of a file or data waiting too long gives a
+//shorter write. With O_DIRECT the chunks are copied to an aligned buffer
+//and bypass the page cache.
+
+#define DISK_WRITER_SIZE (16 * 1024 * 1024) //ring buffer, ~12s at 10Mbit/s
+#define DISK_WRITER_MAX_CHUNKS 4096          //writes queued
+#define DISK_WRITER_CHUNK (1024 * 1024)      //default size of one write
+#define DISK_WRITER_CHUNK_MAX (4 * 1024 * 1024)
+#define DISK_WRITER_ALIGN 4096               //O_DIRECT buffers and offsets
+#define DISK_WRITER_FLUSH_MS 5000 //a partial chunk is written after this
+#define DISK_WRITER_DEPTH 4                  //io_uring writes in flight
+
+typedef struct
+{
+    int fd;
+    off_t offset;
+    int len;
+    int sync; //no data: fdatasync() of fd once the data before is written
+} disk_chunk_t;
+
+//one write given to the kernel, iov[1] is used at the end of the ring
+typedef struct
+{
+    int fd;
+    off_t offset;
+    int len;
+    struct iovec iov[2];
+    int iovcnt;
+    int direct; //aligned, written with O_DIRECT from the staging buffer
+    int submitted;
+    int done;
+} disk_batch_t;
+
+typedef struct
+{
+    int fd;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    void* sqes;
+    void* cqes;
+    void* sq_ptr;
+    size_t sq_size;
+    void* cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+} disk_uring_t;
+
+typedef struct
+{
+    unsigned char* ring;
+    disk_chunk_t chunks[DISK_WRITER_MAX_CHUNKS];
+    unsigned head; //next chunk queued
+    unsigned tail; //next chunk to write
+    int tail_used; //bytes of the tail chunk already taken
+
+    uint64_t queued;  //bytes queued since the start
+    uint64_t taken;   //bytes handed to the kernel
+    uint64_t written; //bytes on the files (page cache), in order
+    uint64_t flush;   //bytes to write even in partial chunks
+
+    int chunk;  //bytes of one write, its alignment in the files
+    int direct; //O_DIRECT for the aligned writes
+    unsigned char* staging; //DISK_WRITER_DEPTH aligned chunks, O_DIRECT
+    struct timespec deadline; //of the partial chunk waiting, 0 : none
+
+    pthread_mutex_t lock;
+    pthread_cond_t queue_cond;    //chunks queued, or quit
+    pthread_cond_t progress_cond; //bytes written, syncs done
+    pthread_t tid;
+    int quit;
+    int syncing; //fdatasync() running
+    int error; //errno of a failed write, the next calls fail
+
+    int use_uring;
+    disk_uring_t uring;
+    disk_batch_t batches[DISK_WRITER_DEPTH]; //in order of the ring
+    int first_batch;
+    int nbatches;
+
+    uint32_t writes;    //write system calls or io_uring writes
+    uint32_t partial;   //writes shorter than a chunk
+    uint32_t syncs;
+    uint32_t full;      //callers that waited for room
+    uint64_t max_queued;
+} disk_writer_t;
+
+int disk_writer_init(disk_writer_t* w, int chunk, int direct);
+void disk_writer_deinit(disk_writer_t* w);
+int disk_writer_write(disk_writer_t* w, int fd, off_t offset,
+        const unsigned char* data, int len);
+int disk_writer_free(disk_writer_t* w);
+uint64_t disk_writer_position(disk_writer_t* w);
+int disk_writer_wait(disk_writer_t* w, uint64_t position);
+int disk_writer_sync(disk_writer_t* w, int fd);
+
+#endif
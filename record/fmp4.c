@@ -0,0 +1,662 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../stream/h264_nal.h"
+#include "fmp4.h"
+
+//sample_flags of trun: sample_depends_on, sample_is_non_sync_sample
+#define SAMPLE_FLAGS_SYNC 0x02000000
+#define SAMPLE_FLAGS_NON_SYNC 0x01010000
+
+//boxes are built in one buffer, then written at once
+typedef struct
+{
+    unsigned char* p;
+    int len;
+} box_buffer_t;
+
+static void put8(box_buffer_t* b, uint32_t v)
+{
+    b->p[b->len++] = v;
+}
+
+static void put16(box_buffer_t* b, uint32_t v)
+{
+    put8(b, v >> 8);
+    put8(b, v);
+}
+
+static void put32(box_buffer_t* b, uint32_t v)
+{
+    put16(b, v >> 16);
+    put16(b, v);
+}
+
+static void put64(box_buffer_t* b, uint64_t v)
+{
+    put32(b, v >> 32);
+    put32(b, v);
+}
+
+static void put_bytes(box_buffer_t* b, const void* data, int len)
+{
+    memcpy(b->p + b->len, data, len);
+    b->len += len;
+}
+
+//start a box, return its offset for box_end()
+static int box_start(box_buffer_t* b, const char* type)
+{
+    int start = b->len;
+
+    put32(b, 0);
+    put_bytes(b, type, 4);
+
+    return start;
+}
+
+static int full_box_start(box_buffer_t* b, const char* type, int version,
+        uint32_t flags)
+{
+    int start = box_start(b, type);
+
+    put32(b, (version << 24) | flags);
+
+    return start;
+}
+
+static void box_end(box_buffer_t* b, int start)
+{
+    uint32_t size = b->len - start;
+
+    b->p[start] = size >> 24;
+    b->p[start + 1] = size >> 16;
+    b->p[start + 2] = size >> 8;
+    b->p[start + 3] = size;
+}
+
+static int write_out(fmp4_writer_t* mp4, const unsigned char* data, int len)
+{
+    if (mp4->write(mp4->arg, data, len) == -1)
+        return -1;
+    mp4->offset += len;
+
+    return 0;
+}
+
+//Exp-Golomb reader of the SPS, on its RBSP (h264_rbsp())
+typedef struct
+{
+    const unsigned char* p;
+    int len;
+    int pos; //bit
+    int error; //a code of more than 32 bits
+} bit_reader_t;
+
+static int read_bit(bit_reader_t* br)
+{
+    int byte = br->pos >> 3;
+
+    if (byte >= br->len)
+        return 0;
+
+    int bit = (br->p[byte] >> (7 - (br->pos & 7))) & 1;
+    br->pos++;
+
+    return bit;
+}
+
+static uint32_t read_bits(bit_reader_t* br, int n)
+{
+    uint32_t v = 0;
+
+    while (n-- > 0)
+        v = (v << 1) | read_bit(br);
+
+    return v;
+}
+
+static uint32_t read_ue(bit_reader_t* br)
+{
+    int zeros = 0;
+
+    while (read_bit(br) == 0 && zeros < 32)
+        zeros++;
+
+    //32 leading zeros: corrupted, or read past the end of the SPS
+    if (zeros == 32)
+    {
+        br->error = 1;
+        return 0;
+    }
+
+    return ((1U << zeros) - 1) + read_bits(br, zeros);
+}
+
+static int32_t read_se(bit_reader_t* br)
+{
+    uint32_t v = read_ue(br);
+
+    return (v & 1) ? (int32_t)((v + 1) / 2) : -(int32_t)(v / 2);
+}
+
+//picture size from the SPS (NAL header included), for tkhd and avc1
+static void parse_sps(fmp4_writer_t* mp4)
+{
+    unsigned char rbsp[FMP4_PARAMS_MAX];
+    bit_reader_t br = { rbsp, h264_rbsp(mp4->sps, mp4->sps_len, rbsp), 8,
+            0 };
+    int chroma_format_idc = 1;
+    int i, j;
+
+    int profile_idc = read_bits(&br, 8);
+    read_bits(&br, 16); //constraint flags, level_idc
+    read_ue(&br);       //seq_parameter_set_id
+    if (profile_idc == 100 || profile_idc == 110 || profile_idc == 122
+            || profile_idc == 244 || profile_idc == 44 || profile_idc == 83
+            || profile_idc == 86 || profile_idc == 118 || profile_idc == 128
+            || profile_idc == 138 || profile_idc == 139 || profile_idc == 134
+            || profile_idc == 135)
+    {
+        chroma_format_idc = read_ue(&br);
+        if (chroma_format_idc == 3)
+            read_bit(&br); //separate_colour_plane_flag
+        read_ue(&br);      //bit_depth_luma_minus8
+        read_ue(&br);      //bit_depth_chroma_minus8
+        read_bit(&br);     //qpprime_y_zero_transform_bypass_flag
+        if (read_bit(&br)) //seq_scaling_matrix_present_flag
+        {
+            for (i = 0; i < ((chroma_format_idc != 3) ? 8 : 12); i++)
+            {
+                if (!read_bit(&br))
+                    continue;
+                int size = (i < 6) ? 16 : 64;
+                int last = 8, next = 8;
+                for (j = 0; j < size && next != 0; j++)
+                {
+                    next = (last + read_se(&br) + 256) % 256;
+                    last = next ? next : last;
+                }
+            }
+        }
+    }
+    read_ue(&br); //log2_max_frame_num_minus4
+    int poc_type = read_ue(&br);
+    if (poc_type == 0)
+        read_ue(&br); //log2_max_pic_order_cnt_lsb_minus4
+    else if (poc_type == 1)
+    {
+        read_bit(&br);
+        read_se(&br);
+        read_se(&br);
+        int n = read_ue(&br);
+        for (i = 0; i < n && !br.error; i++)
+            read_se(&br);
+    }
+    read_ue(&br);  //max_num_ref_frames
+    read_bit(&br); //gaps_in_frame_num_value_allowed_flag
+    int width_mbs = read_ue(&br) + 1;
+    int height_map_units = read_ue(&br) + 1;
+    int frame_mbs_only = read_bit(&br);
+    if (!frame_mbs_only)
+        read_bit(&br); //mb_adaptive_frame_field_flag
+    read_bit(&br);     //direct_8x8_inference_flag
+
+    mp4->width = width_mbs * 16;
+    mp4->height = (2 - frame_mbs_only) * height_map_units * 16;
+    if (read_bit(&br)) //frame_cropping_flag
+    {
+        int crop_x = (chroma_format_idc == 1 || chroma_format_idc == 2) ? 2 : 1;
+        int crop_y = ((chroma_format_idc == 1) ? 2 : 1) * (2 - frame_mbs_only);
+        int left = read_ue(&br);
+        int right = read_ue(&br);
+        int top = read_ue(&br);
+        int bottom = read_ue(&br);
+        mp4->width -= crop_x * (left + right);
+        mp4->height -= crop_y * (top + bottom);
+    }
+
+    if (br.error)
+    {
+        fprintf(stderr, "fmp4 : bad SPS, no picture size\n");
+        mp4->width = 0;
+        mp4->height = 0;
+    }
+}
+
+//AVCDecoderConfigurationRecord (ISO/IEC 14496-15)
+static void put_avcc(box_buffer_t* b, fmp4_writer_t* mp4)
+{
+    int start = box_start(b, "avcC");
+
+    put8(b, 1);
+    put8(b, mp4->sps[1]); //profile
+    put8(b, mp4->sps[2]); //compatibility
+    put8(b, mp4->sps[3]); //level
+    put8(b, 0xff);        //4 bytes NAL unit lengths
+    put8(b, 0xe1);        //1 SPS
+    put16(b, mp4->sps_len);
+    put_bytes(b, mp4->sps, mp4->sps_len);
+    put8(b, 1);           //1 PPS
+    put16(b, mp4->pps_len);
+    put_bytes(b, mp4->pps, mp4->pps_len);
+    if (mp4->sps[1] == 100 || mp4->sps[1] == 110 || mp4->sps[1] == 122
+            || mp4->sps[1] == 144)
+    {
+        //4:2:0 8 bits, no SPS extension
+        put8(b, 0xfc | 1);
+        put8(b, 0xf8);
+        put8(b, 0xf8);
+        put8(b, 0);
+    }
+
+    box_end(b, start);
+}
+
+static const uint32_t unity_matrix[9] = {
+    0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000
+};
+
+static int write_init_segment(fmp4_writer_t* mp4)
+{
+    unsigned char buffer[1024 + 2 * FMP4_PARAMS_MAX];
+    box_buffer_t b = { buffer, 0 };
+    int moov, trak, mdia, minf, dinf, stbl, stsd, avc1, mvex, box;
+    int i;
+
+    parse_sps(mp4);
+
+    box = box_start(&b, "ftyp");
+    put_bytes(&b, "iso5", 4);
+    put32(&b, 512);
+    put_bytes(&b, "iso5iso6avc1mp41", 16);
+    box_end(&b, box);
+
+    moov = box_start(&b, "moov");
+
+    box = full_box_start(&b, "mvhd", 0, 0);
+    put32(&b, 0);          //creation_time
+    put32(&b, 0);          //modification_time
+    put32(&b, 1000);       //timescale
+    put32(&b, 0);          //duration : in the fragments
+    put32(&b, 0x00010000); //rate
+    put16(&b, 0x0100);     //volume
+    put16(&b, 0);
+    put64(&b, 0);
+    for (i = 0; i < 9; i++)
+        put32(&b, unity_matrix[i]);
+    for (i = 0; i < 6; i++)
+        put32(&b, 0);      //pre_defined
+    put32(&b, 2);          //next_track_ID
+    box_end(&b, box);
+
+    trak = box_start(&b, "trak");
+    box = full_box_start(&b, "tkhd", 0, 3); //enabled, in movie
+    put32(&b, 0);
+    put32(&b, 0);
+    put32(&b, 1);          //track_ID
+    put32(&b, 0);
+    put32(&b, 0);          //duration
+    put64(&b, 0);
+    put16(&b, 0);          //layer
+    put16(&b, 0);          //alternate_group
+    put16(&b, 0);          //volume
+    put16(&b, 0);
+    for (i = 0; i < 9; i++)
+        put32(&b, unity_matrix[i]);
+    put32(&b, mp4->width << 16);
+    put32(&b, mp4->height << 16);
+    box_end(&b, box);
+
+    mdia = box_start(&b, "mdia");
+    box = full_box_start(&b, "mdhd", 0, 0);
+    put32(&b, 0);
+    put32(&b, 0);
+    put32(&b, FMP4_TIMESCALE);
+    put32(&b, 0);
+    put16(&b, 0x55c4);     //language "und"
+    put16(&b, 0);
+    box_end(&b, box);
+
+    box = full_box_start(&b, "hdlr", 0, 0);
+    put32(&b, 0);
+    put_bytes(&b, "vide", 4);
+    put32(&b, 0);
+    put32(&b, 0);
+    put32(&b, 0);
+    put_bytes(&b, "VideoHandler", 13);
+    box_end(&b, box);
+
+    minf = box_start(&b, "minf");
+    box = full_box_start(&b, "vmhd", 0, 1);
+    put64(&b, 0);          //graphicsmode, opcolor
+    box_end(&b, box);
+
+    dinf = box_start(&b, "dinf");
+    int dref = full_box_start(&b, "dref", 0, 0);
+    put32(&b, 1);
+    box = full_box_start(&b, "url ", 0, 1); //media in the same file
+    box_end(&b, box);
+    box_end(&b, dref);
+    box_end(&b, dinf);
+
+    stbl = box_start(&b, "stbl");
+    stsd = full_box_start(&b, "stsd", 0, 0);
+    put32(&b, 1);
+    avc1 = box_start(&b, "avc1");
+    put32(&b, 0);          //reserved
+    put16(&b, 0);
+    put16(&b, 1);          //data_reference_index
+    put32(&b, 0);          //pre_defined, reserved
+    put32(&b, 0);
+    put32(&b, 0);
+    put32(&b, 0);
+    put16(&b, mp4->width);
+    put16(&b, mp4->height);
+    put32(&b, 0x00480000); //72 dpi
+    put32(&b, 0x00480000);
+    put32(&b, 0);
+    put16(&b, 1);          //frame_count
+    for (i = 0; i < 32; i++)
+        put8(&b, 0);       //compressorname
+    put16(&b, 0x0018);     //depth
+    put16(&b, 0xffff);     //pre_defined
+    put_avcc(&b, mp4);
+    box_end(&b, avc1);
+    box_end(&b, stsd);
+
+    //no samples in the moov, they are all in the fragments
+    box = full_box_start(&b, "stts", 0, 0);
+    put32(&b, 0);
+    box_end(&b, box);
+    box = full_box_start(&b, "stsc", 0, 0);
+    put32(&b, 0);
+    box_end(&b, box);
+    box = full_box_start(&b, "stsz", 0, 0);
+    put32(&b, 0);
+    put32(&b, 0);
+    box_end(&b, box);
+    box = full_box_start(&b, "stco", 0, 0);
+    put32(&b, 0);
+    box_end(&b, box);
+    box_end(&b, stbl);
+    box_end(&b, minf);
+    box_end(&b, mdia);
+    box_end(&b, trak);
+
+    mvex = box_start(&b, "mvex");
+    box = full_box_start(&b, "trex", 0, 0);
+    put32(&b, 1);          //track_ID
+    put32(&b, 1);          //default_sample_description_index
+    put32(&b, 0);
+    put32(&b, 0);
+    put32(&b, 0);
+    box_end(&b, box);
+    box_end(&b, mvex);
+
+    box_end(&b, moov);
+
+    return write_out(mp4, buffer, b.len);
+}
+
+/*---------------------------------------------------------------------
+   init the writer, nothing is written before the first keyframe
+   return : 0, -1 on error
+----------------------------------------------------------------------*/
+int fmp4_writer_init(fmp4_writer_t* mp4, fmp4_write_t write, void* arg)
+{
+    memset(mp4, 0, sizeof(*mp4));
+    mp4->write = write;
+    mp4->arg = arg;
+    mp4->last_duration = FMP4_TIMESCALE / 30;
+
+    mp4->mdat = malloc(FMP4_FRAGMENT_MAX);
+    if (mp4->mdat == NULL)
+    {
+        fprintf(stderr, "fmp4 : out of memory\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+void fmp4_writer_deinit(fmp4_writer_t* mp4)
+{
+    free(mp4->mdat);
+    free(mp4->index);
+}
+
+//remember where a fragment starting with a keyframe is, for the mfra
+static void add_index(fmp4_writer_t* mp4, uint64_t time)
+{
+    if (mp4->nindex == mp4->index_size)
+    {
+        int size = mp4->index_size ? mp4->index_size * 2 : 256;
+        uint64_t* index = realloc(mp4->index, size * 2 * sizeof(uint64_t));
+        if (index == NULL)
+            return; //the file still plays, it seeks slower
+        mp4->index = index;
+        mp4->index_size = size;
+    }
+
+    mp4->index[2 * mp4->nindex] = time;
+    mp4->index[2 * mp4->nindex + 1] = mp4->offset;
+    mp4->nindex++;
+}
+
+//write the samples kept as one moof + mdat, 'next' : time of the sample
+//after the last one, for its duration
+static int write_fragment(fmp4_writer_t* mp4, uint64_t next)
+{
+    unsigned char buffer[256 + 16 * FMP4_MAX_SAMPLES];
+    box_buffer_t b = { buffer, 0 };
+    int moof, traf, trun, box;
+    int i;
+
+    if (mp4->nsamples == 0)
+        return 0;
+
+    if (mp4->key[0])
+        add_index(mp4, mp4->time[0]);
+
+    moof = box_start(&b, "moof");
+    box = full_box_start(&b, "mfhd", 0, 0);
+    put32(&b, ++mp4->sequence);
+    box_end(&b, box);
+
+    traf = box_start(&b, "traf");
+    box = full_box_start(&b, "tfhd", 0, 0x020000); //default-base-is-moof
+    put32(&b, 1);
+    box_end(&b, box);
+
+    box = full_box_start(&b, "tfdt", 1, 0);
+    put64(&b, mp4->time[0]);
+    box_end(&b, box);
+
+    //data-offset, sample-duration, sample-size, sample-flags
+    trun = full_box_start(&b, "trun", 0, 0x000701);
+    put32(&b, mp4->nsamples);
+    int data_offset = b.len;
+    put32(&b, 0);
+    for (i = 0; i < mp4->nsamples; i++)
+    {
+        uint64_t end = (i + 1 < mp4->nsamples) ? mp4->time[i + 1] : next;
+        uint32_t duration = (end > mp4->time[i])
+                ? (uint32_t)(end - mp4->time[i]) : mp4->last_duration;
+        mp4->last_duration = duration;
+
+        put32(&b, duration);
+        put32(&b, mp4->size[i]);
+        put32(&b, mp4->key[i] ? SAMPLE_FLAGS_SYNC : SAMPLE_FLAGS_NON_SYNC);
+    }
+    box_end(&b, trun);
+    box_end(&b, traf);
+    box_end(&b, moof);
+
+    //the samples start after the moof and the mdat header
+    uint32_t offset = b.len + 8;
+    b.p[data_offset] = offset >> 24;
+    b.p[data_offset + 1] = offset >> 16;
+    b.p[data_offset + 2] = offset >> 8;
+    b.p[data_offset + 3] = offset;
+
+    put32(&b, 8 + mp4->mdat_len);
+    put_bytes(&b, "mdat", 4);
+
+    if (write_out(mp4, buffer, b.len) == -1
+            || write_out(mp4, mp4->mdat, mp4->mdat_len) == -1)
+        return -1;
+
+    mp4->nsamples = 0;
+    mp4->mdat_len = 0;
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+   add one access unit (Annex-B, SPS/PPS in front of the keyframes)
+   pts : us on the clock of the encoder, the file starts at 0
+   A keyframe ends the fragment being built and starts the next one.
+   return : 0, -1 on write error
+----------------------------------------------------------------------*/
+int fmp4_write_frame(fmp4_writer_t* mp4, const unsigned char* data, int len,
+        uint64_t pts, int keyframe)
+{
+    h264_nal_reader_t reader;
+    h264_nal_t nal;
+
+    //the SPS/PPS go in the avcC, not in the samples
+    if (keyframe)
+    {
+        h264_nal_reader_init(&reader, data, len);
+        while (h264_next_nal(&reader, &nal))
+        {
+            if (nal.type == NAL_TYPE_SPS && nal.len <= FMP4_PARAMS_MAX
+                    && !mp4->started)
+            {
+                memcpy(mp4->sps, nal.data, nal.len);
+                mp4->sps_len = nal.len;
+            }
+            else if (nal.type == NAL_TYPE_PPS && nal.len <= FMP4_PARAMS_MAX
+                    && !mp4->started)
+            {
+                memcpy(mp4->pps, nal.data, nal.len);
+                mp4->pps_len = nal.len;
+            }
+        }
+    }
+
+    if (!mp4->started)
+    {
+        if (!keyframe || mp4->sps_len < 4 || mp4->pps_len == 0)
+        {
+            mp4->skipped++;
+            return 0;
+        }
+        mp4->first_pts = pts;
+        if (write_init_segment(mp4) == -1)
+            return -1;
+        mp4->started = 1;
+    }
+
+    //a 4 bytes length can replace a 3 bytes start code, one per NAL unit of
+    //at least 1 byte
+    int max_len = len + len / 4 + 4;
+    if (max_len > FMP4_FRAGMENT_MAX)
+    {
+        fprintf(stderr, "fmp4 : frame of %d bytes skipped\n", len);
+        mp4->skipped++;
+        return 0;
+    }
+
+    uint64_t time = (pts - mp4->first_pts) * 9 / 100;
+    if (keyframe || mp4->nsamples == FMP4_MAX_SAMPLES
+            || mp4->mdat_len + max_len > FMP4_FRAGMENT_MAX)
+    {
+        if (write_fragment(mp4, time) == -1)
+            return -1;
+    }
+
+    int start = mp4->mdat_len;
+    h264_nal_reader_init(&reader, data, len);
+    while (h264_next_nal(&reader, &nal))
+    {
+        if (nal.type != NAL_TYPE_SPS && nal.type != NAL_TYPE_PPS
+                && nal.type != NAL_TYPE_AUD)
+        {
+            unsigned char* p = mp4->mdat + mp4->mdat_len;
+            p[0] = nal.len >> 24;
+            p[1] = nal.len >> 16;
+            p[2] = nal.len >> 8;
+            p[3] = nal.len;
+            memcpy(p + 4, nal.data, nal.len);
+            mp4->mdat_len += 4 + nal.len;
+        }
+    }
+
+    mp4->size[mp4->nsamples] = mp4->mdat_len - start;
+    mp4->time[mp4->nsamples] = time;
+    mp4->key[mp4->nsamples] = keyframe;
+    mp4->nsamples++;
+    mp4->bytes_in += len;
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+   write the last fragment and the mfra index of the keyframes
+   return : 0, -1 on write error
+----------------------------------------------------------------------*/
+int fmp4_finish(fmp4_writer_t* mp4)
+{
+    int i;
+
+    if (!mp4->started)
+        return 0;
+
+    uint64_t last = mp4->nsamples ? mp4->time[mp4->nsamples - 1] : 0;
+    if (write_fragment(mp4, last + mp4->last_duration) == -1)
+        return -1;
+
+    int size = 8 + 12 + 12 + mp4->nindex * 19 + 16;
+    unsigned char* buffer = malloc(size);
+    if (buffer == NULL)
+        return 0; //no index, the fragments are all there
+    box_buffer_t b = { buffer, 0 };
+
+    int mfra = box_start(&b, "mfra");
+    int tfra = full_box_start(&b, "tfra", 1, 0);
+    put32(&b, 1);          //track_ID
+    put32(&b, 0);          //traf, trun, sample numbers on 1 byte
+    put32(&b, mp4->nindex);
+    for (i = 0; i < mp4->nindex; i++)
+    {
+        put64(&b, mp4->index[2 * i]);
+        put64(&b, mp4->index[2 * i + 1]);
+        put8(&b, 1);
+        put8(&b, 1);
+        put8(&b, 1);
+    }
+    box_end(&b, tfra);
+    int mfro = full_box_start(&b, "mfro", 0, 0);
+    put32(&b, b.len - mfra + 4);
+    box_end(&b, mfro);
+    box_end(&b, mfra);
+
+    int r = write_out(mp4, buffer, b.len);
+    free(buffer);
+
+    return r;
+}
+
+//after fmp4_finish(): the next keyframe starts a new file with its own init
+//segment and timeline
+void fmp4_restart(fmp4_writer_t* mp4)
+{
+    mp4->started = 0;
+    mp4->offset = 0;
+    mp4->nindex = 0;
+    mp4->nsamples = 0;
+    mp4->mdat_len = 0;
+}
@@ -0,0 +1,62 @@
+#ifndef FMP4_H
+#define FMP4_H
+
+#include <stdint.h>
+
+//Fragmented MP4 (ISO/IEC 14496-12) of one H.264 video track
+//An init segment (ftyp + moov with the avcC of the SPS/PPS), then one
+//moof + mdat per GOP, written when the next keyframe comes: a power loss
+//loses the GOP being recorded, the fragments before it stay playable.
+//At the end an mfra indexes the keyframes, so the file seeks at once.
+
+#define FMP4_TIMESCALE 90000
+#define FMP4_FRAGMENT_MAX (8 * 1024 * 1024) //bytes of samples per fragment
+#define FMP4_MAX_SAMPLES 1024               //samples per fragment
+#define FMP4_PARAMS_MAX 128
+
+//'len' bytes of the file, return -1 on error
+typedef int (*fmp4_write_t)(void* arg, const unsigned char* data, int len);
+
+typedef struct
+{
+    fmp4_write_t write;
+    void* arg;
+
+    unsigned char sps[FMP4_PARAMS_MAX];
+    int sps_len;
+    unsigned char pps[FMP4_PARAMS_MAX];
+    int pps_len;
+    int width;
+    int height;
+
+    int started;     //init segment written
+    uint64_t first_pts; //us
+    uint64_t offset; //bytes written so far
+    uint32_t sequence;
+
+    //fragment being built, samples are length-prefixed (AVC format)
+    unsigned char* mdat;
+    int mdat_len;
+    int nsamples;
+    uint32_t size[FMP4_MAX_SAMPLES];
+    uint64_t time[FMP4_MAX_SAMPLES]; //FMP4_TIMESCALE, from 0
+    uint8_t key[FMP4_MAX_SAMPLES];
+    uint32_t last_duration;
+
+    //mfra entries: time and offset of the moof of every keyframe fragment
+    uint64_t* index;
+    int nindex;
+    int index_size;
+
+    uint32_t skipped; //frames before the first keyframe, or too big
+    uint64_t bytes_in;
+} fmp4_writer_t;
+
+int fmp4_writer_init(fmp4_writer_t* mp4, fmp4_write_t write, void* arg);
+void fmp4_writer_deinit(fmp4_writer_t* mp4);
+int fmp4_write_frame(fmp4_writer_t* mp4, const unsigned char* data, int len,
+        uint64_t pts, int keyframe);
+int fmp4_finish(fmp4_writer_t* mp4);
+void fmp4_restart(fmp4_writer_t* mp4);
+
+#endif
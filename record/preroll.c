@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "preroll.h"
+
+/*---------------------------------------------------------------------
+   allocate a ring of 'size' bytes keeping the last 'seconds' of video,
+   size it for the bit rate: seconds plus one GOP
+   return : 0, -1 on error
+----------------------------------------------------------------------*/
+int preroll_init(preroll_t* pr, int size, int seconds)
+{
+    memset(pr, 0, sizeof(*pr));
+    pr->size = size;
+    pr->seconds = seconds;
+
+    pr->ring = malloc(size);
+    if (pr->ring == NULL)
+    {
+        fprintf(stderr, "preroll : out of memory\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+void preroll_deinit(preroll_t* pr)
+{
+    free(pr->ring);
+}
+
+static preroll_frame_t* frame_at(preroll_t* pr, unsigned i)
+{
+    return &pr->frames[i % PREROLL_MAX_FRAMES];
+}
+
+//drop the oldest GOP: the frames up to the next keyframe
+static void drop_gop(preroll_t* pr)
+{
+    do
+    {
+        pr->bytes -= frame_at(pr, pr->tail)->len;
+        pr->tail++;
+    }
+    while (pr->tail != pr->head && !frame_at(pr, pr->tail)->keyframe);
+
+    pr->gops_dropped++;
+}
+
+//where 'len' bytes fit in the ring without splitting them, -1 : no room
+static int find_room(preroll_t* pr, int len)
+{
+    if (pr->tail == pr->head)
+        return (len <= pr->size) ? 0 : -1;
+
+    preroll_frame_t* last = frame_at(pr, pr->head - 1);
+    int start = frame_at(pr, pr->tail)->offset;
+    int end = last->offset + last->len;
+
+    if (end > start)
+    {
+        //used : [start, end), free at the end then at the beginning
+        if (end + len <= pr->size)
+            return end;
+        if (len <= start)
+            return 0;
+        return -1;
+    }
+
+    //wrapped, used : [start, size) and [0, end)
+    return (end + len <= start) ? end : -1;
+}
+
+/*---------------------------------------------------------------------
+   keep one frame (Annex-B access unit, SPS/PPS in front of keyframes),
+   older GOPs are dropped past the size or the seconds of the ring
+----------------------------------------------------------------------*/
+void preroll_add(preroll_t* pr, const unsigned char* data, int len,
+        uint64_t pts, int keyframe)
+{
+    int offset;
+
+    //the ring starts on a keyframe
+    if ((pr->tail == pr->head && !keyframe) || len > pr->size)
+    {
+        pr->frames_skipped++;
+        return;
+    }
+
+    if (pr->head - pr->tail == PREROLL_MAX_FRAMES)
+        drop_gop(pr);
+    while ((offset = find_room(pr, len)) == -1)
+    {
+        drop_gop(pr);
+        //the only GOP was dropped, wait for the next keyframe
+        if (pr->tail == pr->head && !keyframe)
+        {
+            pr->frames_skipped++;
+            return;
+        }
+    }
+
+    preroll_frame_t* f = frame_at(pr, pr->head);
+    memcpy(pr->ring + offset, data, len);
+    f->offset = offset;
+    f->len = len;
+    f->pts = pts;
+    f->keyframe = keyframe;
+    pr->head++;
+    pr->bytes += len;
+
+    //drop the oldest GOP while the next one still starts 'seconds' back
+    while (1)
+    {
+        unsigned i = pr->tail + 1;
+        while (i != pr->head && !frame_at(pr, i)->keyframe)
+            i++;
+        if (i == pr->head
+                || frame_at(pr, i)->pts + pr->seconds * 1000000ULL > pts)
+            break;
+        drop_gop(pr);
+    }
+}
+
+int preroll_frames(preroll_t* pr)
+{
+    return pr->head - pr->tail;
+}
+
+//pts of the first frame, to start a segment with it
+uint64_t preroll_first_pts(preroll_t* pr)
+{
+    return (pr->tail != pr->head) ? frame_at(pr, pr->tail)->pts : 0;
+}
+
+/*---------------------------------------------------------------------
+   give the frames to 'out', oldest first (a keyframe), up to 'max_bytes'
+   the others stay in the ring for the next call, it is empty once all are
+   given. The ring does not start on a keyframe until it is empty
+   return : 0, -1 if out failed
+----------------------------------------------------------------------*/
+int preroll_flush(preroll_t* pr, int max_bytes, preroll_out_t out, void* arg)
+{
+    while (pr->tail != pr->head)
+    {
+        preroll_frame_t* f = frame_at(pr, pr->tail);
+        if (f->len > max_bytes)
+            break;
+        max_bytes -= f->len;
+        pr->bytes -= f->len;
+        pr->tail++;
+        if (out(arg, pr->ring + f->offset, f->len, f->pts, f->keyframe) == -1)
+        {
+            preroll_clear(pr);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+//drop all the frames, return : the number dropped
+int preroll_clear(preroll_t* pr)
+{
+    int n = pr->head - pr->tail;
+
+    pr->tail = pr->head;
+    pr->bytes = 0;
+
+    return n;
+}
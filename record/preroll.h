@@ -0,0 +1,50 @@
+#ifndef PREROLL_H
+#define PREROLL_H
+
+#include <stdint.h>
+
+//Pre-roll: the last seconds of encoded frames kept in RAM, to write what
+//came before an event. The frames are kept whole in a ring of fixed size,
+//the oldest GOP goes first, so the ring always starts on a keyframe and
+//plays from its first frame, except while preroll_flush() has given only
+//part of it.
+
+#define PREROLL_MAX_FRAMES 4096
+
+typedef struct
+{
+    int offset; //in the ring
+    int len;
+    uint64_t pts; //us
+    int keyframe;
+} preroll_frame_t;
+
+//one frame replayed, return -1 to stop
+typedef int (*preroll_out_t)(void* arg, const unsigned char* data, int len,
+        uint64_t pts, int keyframe);
+
+typedef struct
+{
+    unsigned char* ring;
+    int size;
+    int seconds; //kept at least, as the size allows
+
+    preroll_frame_t frames[PREROLL_MAX_FRAMES];
+    unsigned head; //next frame
+    unsigned tail; //oldest frame, a keyframe
+    int bytes;     //of the frames in the ring
+
+    uint32_t gops_dropped;
+    uint32_t frames_skipped; //no keyframe to start from, or too big
+} preroll_t;
+
+int preroll_init(preroll_t* pr, int size, int seconds);
+void preroll_deinit(preroll_t* pr);
+void preroll_add(preroll_t* pr, const unsigned char* data, int len,
+        uint64_t pts, int keyframe);
+int preroll_frames(preroll_t* pr);
+uint64_t preroll_first_pts(preroll_t* pr);
+int preroll_flush(preroll_t* pr, int max_bytes, preroll_out_t out, void* arg);
+int preroll_clear(preroll_t* pr);
+
+#endif
@@ -0,0 +1,502 @@
+#define _GNU_SOURCE //fallocate()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "segment.h"
+
+static int64_t now_ms(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static void path_of(segment_writer_t* seg, const char* name, char* path,
+        int size)
+{
+    snprintf(path, size, "%s/%s", seg->config.dir, name);
+}
+
+//name of a segment starting at 'start', made unique with "-N" before the
+//extension when a file of that name is there already (restart in the same
+//second)
+static void segment_name(segment_writer_t* seg, int64_t start, char* name)
+{
+    char base[SEGMENT_NAME_MAX];
+    char path[2 * SEGMENT_NAME_MAX];
+    struct stat st;
+    struct tm tm;
+    time_t t = start / 1000;
+    int i;
+
+    localtime_r(&t, &tm);
+    if (strftime(base, sizeof(base), seg->config.name, &tm) == 0)
+        snprintf(base, sizeof(base), "segment-%lld", (long long)t);
+
+    strcpy(name, base);
+    for (i = 1; i < 1000; i++)
+    {
+        path_of(seg, name, path, sizeof(path));
+        if (stat(path, &st) == -1)
+            return;
+
+        char* ext = strrchr(base, '.');
+        int len = ext ? ext - base : (int)strlen(base);
+        snprintf(name, SEGMENT_NAME_MAX, "%.*s-%d%s", len, base, i,
+                ext ? ext : "");
+    }
+}
+
+static int open_file(const char* path)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd == -1)
+        fprintf(stderr, "segment : open %s: %s\n", path, strerror(errno));
+
+    return fd;
+}
+
+//reserve the blocks of a new segment, its size stays 0: the file is not
+//fragmented by the other writes of the card and no block is allocated
+//while writing
+static void preallocate(segment_writer_t* seg, int fd)
+{
+    if (seg->config.preallocate == 0)
+        return;
+
+    if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, seg->config.preallocate) == -1)
+    {
+        fprintf(stderr, "segment : fallocate: %s\n", strerror(errno));
+        //e.g. an old vfat driver, do not try again
+        if (errno == EOPNOTSUPP)
+            seg->config.preallocate = 0;
+    }
+}
+
+//the blocks reserved past the end given back, synced for the fsync policy
+static void close_file(segment_writer_t* seg, int fd, uint64_t bytes)
+{
+    if (seg->config.preallocate > 0 && ftruncate(fd, bytes) == -1)
+        fprintf(stderr, "segment : ftruncate: %s\n", strerror(errno));
+    if (seg->config.fsync != SEGMENT_FSYNC_NEVER && fdatasync(fd) == -1)
+        fprintf(stderr, "segment : fdatasync: %s\n", strerror(errno));
+    //close() can wait for the disk, this is why it is done by the helper
+    if (close(fd) == -1)
+        fprintf(stderr, "segment : close: %s\n", strerror(errno));
+}
+
+//the new names and the deletions on the disk too
+static void sync_dir(segment_writer_t* seg)
+{
+    if (seg->config.fsync == SEGMENT_FSYNC_NEVER)
+        return;
+
+    int fd = open(seg->config.dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        return;
+    if (fsync(fd) == -1)
+        fprintf(stderr, "segment : fsync %s: %s\n", seg->config.dir,
+                strerror(errno));
+    close(fd);
+}
+
+//read back the index of a previous run, for the retention of its segments
+static void load_index(segment_writer_t* seg)
+{
+    char path[2 * SEGMENT_NAME_MAX];
+    char line[2 * SEGMENT_NAME_MAX];
+    segment_entry_t entry;
+    long long sec;
+    int ms;
+    unsigned long long bytes;
+
+    path_of(seg, SEGMENT_INDEX_NAME, path, sizeof(path));
+    FILE* f = fopen(path, "r");
+    if (f == NULL)
+        return;
+
+    while (fgets(line, sizeof(line), f))
+    {
+        if (sscanf(line, "%lld.%d %llu %255s", &sec, &ms, &bytes,
+                entry.name) != 4)
+            continue;
+        entry.start = sec * 1000 + ms;
+        entry.bytes = bytes;
+
+        if (seg->nentries == seg->size)
+        {
+            int size = seg->size ? seg->size * 2 : 64;
+            segment_entry_t* entries = realloc(seg->entries,
+                    size * sizeof(segment_entry_t));
+            if (entries == NULL)
+                break;
+            seg->entries = entries;
+            seg->size = size;
+        }
+        seg->entries[seg->nentries++] = entry;
+    }
+
+    fclose(f);
+}
+
+//"<start s.ms> <bytes> <name>" per segment, oldest first, replaced at once
+static void write_index(segment_writer_t* seg)
+{
+    char path[2 * SEGMENT_NAME_MAX];
+    char tmp[2 * SEGMENT_NAME_MAX + 8];
+    int i;
+
+    path_of(seg, SEGMENT_INDEX_NAME, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE* f = fopen(tmp, "w");
+    if (f == NULL)
+    {
+        fprintf(stderr, "segment : open %s: %s\n", tmp, strerror(errno));
+        return;
+    }
+
+    for (i = 0; i < seg->nentries; i++)
+    {
+        segment_entry_t* e = &seg->entries[i];
+        fprintf(f, "%lld.%03d %llu %s\n", (long long)(e->start / 1000),
+                (int)(e->start % 1000), (unsigned long long)e->bytes,
+                e->name);
+    }
+
+    if (fclose(f) == 0)
+        rename(tmp, path);
+}
+
+//a new segment starts, the ones past the retention are deleted
+static void add_entry(segment_writer_t* seg, const char* name, int64_t start)
+{
+    char path[2 * SEGMENT_NAME_MAX];
+
+    if (seg->nentries == seg->size)
+    {
+        int size = seg->size ? seg->size * 2 : 64;
+        segment_entry_t* entries = realloc(seg->entries,
+                size * sizeof(segment_entry_t));
+        if (entries == NULL)
+            return;
+        seg->entries = entries;
+        seg->size = size;
+    }
+
+    segment_entry_t* e = &seg->entries[seg->nentries++];
+    snprintf(e->name, SEGMENT_NAME_MAX, "%s", name);
+    e->start = start;
+    e->bytes = 0;
+
+    if (seg->config.keep > 0 && seg->nentries > seg->config.keep)
+    {
+        int n = seg->nentries - seg->config.keep;
+        int i;
+
+        for (i = 0; i < n; i++)
+        {
+            path_of(seg, seg->entries[i].name, path, sizeof(path));
+            if (unlink(path) == -1 && errno != ENOENT)
+                fprintf(stderr, "segment : unlink %s: %s\n", path,
+                        strerror(errno));
+        }
+        memmove(seg->entries, seg->entries + n,
+                seg->config.keep * sizeof(segment_entry_t));
+        seg->nentries = seg->config.keep;
+    }
+
+    write_index(seg);
+}
+
+//close the segment left and name the new one, off the writing thread
+static void finish_rotation(segment_writer_t* seg, int old_fd,
+        uint64_t old_bytes, uint64_t old_position, int64_t start)
+{
+    char next[2 * SEGMENT_NAME_MAX];
+    char path[2 * SEGMENT_NAME_MAX];
+    char name[SEGMENT_NAME_MAX];
+
+    if (seg->config.writer)
+        disk_writer_wait(seg->config.writer, old_position);
+    close_file(seg, old_fd, old_bytes);
+    if (seg->nentries > 0)
+    {
+        //nothing was recorded in it (event recording between events)
+        if (old_bytes == 0)
+        {
+            path_of(seg, seg->entries[seg->nentries - 1].name, path,
+                    sizeof(path));
+            unlink(path);
+            seg->nentries--;
+        }
+        else
+            seg->entries[seg->nentries - 1].bytes = old_bytes;
+    }
+
+    //the writing thread goes on in the renamed file
+    segment_name(seg, start, name);
+    path_of(seg, SEGMENT_NEXT_NAME, next, sizeof(next));
+    path_of(seg, name, path, sizeof(path));
+    if (rename(next, path) == -1)
+        fprintf(stderr, "segment : rename %s: %s\n", path, strerror(errno));
+
+    add_entry(seg, name, start);
+    sync_dir(seg);
+}
+
+static void* helper_thread(void* arg)
+{
+    segment_writer_t* seg = (segment_writer_t*)arg;
+    char next[2 * SEGMENT_NAME_MAX];
+
+    path_of(seg, SEGMENT_NEXT_NAME, next, sizeof(next));
+
+    pthread_mutex_lock(&seg->lock);
+    while (!seg->quit)
+    {
+        if (seg->job)
+        {
+            int old_fd = seg->old_fd;
+            uint64_t old_bytes = seg->old_bytes;
+            uint64_t old_position = seg->old_position;
+            int64_t start = seg->new_start;
+            seg->job = 0;
+
+            pthread_mutex_unlock(&seg->lock);
+            finish_rotation(seg, old_fd, old_bytes, old_position, start);
+            pthread_mutex_lock(&seg->lock);
+            continue;
+        }
+
+        if (seg->next_fd == -1)
+        {
+            pthread_mutex_unlock(&seg->lock);
+            int fd = open_file(next);
+            if (fd != -1)
+                preallocate(seg, fd);
+            pthread_mutex_lock(&seg->lock);
+            seg->next_fd = fd;
+            if (fd == -1)
+            {
+                //try again later, the segment goes on meanwhile
+                struct timespec ts;
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_sec += 1;
+                pthread_cond_timedwait(&seg->cond, &seg->lock, &ts);
+            }
+            continue;
+        }
+
+        pthread_cond_wait(&seg->cond, &seg->lock);
+    }
+    pthread_mutex_unlock(&seg->lock);
+
+    return NULL;
+}
+
+/*---------------------------------------------------------------------
+   open the first segment and start the helper thread
+   The index of a previous run in the same directory is read back, its
+   segments count for the retention.
+   return : 0, -1 on error
+----------------------------------------------------------------------*/
+int segment_open(segment_writer_t* seg, const segment_config_t* config)
+{
+    char path[2 * SEGMENT_NAME_MAX];
+    char name[SEGMENT_NAME_MAX];
+
+    memset(seg, 0, sizeof(*seg));
+    seg->config = *config;
+    seg->next_fd = -1;
+    seg->old_fd = -1;
+
+    load_index(seg);
+
+    int64_t start = now_ms();
+    segment_name(seg, start, name);
+    path_of(seg, name, path, sizeof(path));
+    seg->fd = open_file(path);
+    if (seg->fd == -1)
+        return -1;
+    preallocate(seg, seg->fd);
+    add_entry(seg, name, start);
+    seg->segments = 1;
+
+    pthread_mutex_init(&seg->lock, NULL);
+    pthread_cond_init(&seg->cond, NULL);
+    if (pthread_create(&seg->tid, NULL, helper_thread, seg) != 0)
+    {
+        fprintf(stderr, "segment : pthread_create failed\n");
+        close(seg->fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+//stop the helper thread, close the last segment and drop the spare file
+void segment_close(segment_writer_t* seg)
+{
+    char next[2 * SEGMENT_NAME_MAX];
+
+    pthread_mutex_lock(&seg->lock);
+    seg->quit = 1;
+    pthread_cond_signal(&seg->cond);
+    pthread_mutex_unlock(&seg->lock);
+    pthread_join(seg->tid, NULL);
+
+    //a rotation the helper did not get to
+    if (seg->job)
+        finish_rotation(seg, seg->old_fd, seg->old_bytes, seg->old_position,
+                seg->new_start);
+
+    if (seg->config.writer)
+        disk_writer_wait(seg->config.writer,
+                disk_writer_position(seg->config.writer));
+    close_file(seg, seg->fd, seg->bytes);
+    if (seg->nentries > 0 && seg->bytes == 0)
+    {
+        path_of(seg, seg->entries[seg->nentries - 1].name, next, sizeof(next));
+        unlink(next);
+        seg->nentries--;
+    }
+    else if (seg->nentries > 0)
+        seg->entries[seg->nentries - 1].bytes = seg->bytes;
+    write_index(seg);
+
+    if (seg->next_fd != -1)
+    {
+        close(seg->next_fd);
+        path_of(seg, SEGMENT_NEXT_NAME, next, sizeof(next));
+        unlink(next);
+    }
+    sync_dir(seg);
+
+    pthread_cond_destroy(&seg->cond);
+    pthread_mutex_destroy(&seg->lock);
+    free(seg->entries);
+}
+
+/*---------------------------------------------------------------------
+   write to the current segment, same shape as ts_write_t/fmp4_write_t
+   arg : segment_writer_t*
+   return : 0, -1 on error
+----------------------------------------------------------------------*/
+int segment_write(void* arg, const unsigned char* data, int len)
+{
+    segment_writer_t* seg = (segment_writer_t*)arg;
+
+    if (seg->config.writer)
+    {
+        if (disk_writer_write(seg->config.writer, seg->fd, seg->bytes, data,
+                len) == -1)
+            return -1;
+        seg->bytes += len;
+        return 0;
+    }
+
+    while (len > 0)
+    {
+        ssize_t n = write(seg->fd, data, len);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+        seg->bytes += n;
+    }
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+   call on every keyframe, before writing it
+   return : 1 if the keyframe has to start a new segment: flush what the
+   container keeps for the old one, then segment_rotate()
+----------------------------------------------------------------------*/
+int segment_due(segment_writer_t* seg, uint64_t pts)
+{
+    if (!seg->has_pts)
+    {
+        seg->start_pts = pts;
+        seg->has_pts = 1;
+        return 0;
+    }
+
+    if (!((seg->config.seconds > 0
+                    && pts - seg->start_pts >= seg->config.seconds * 1000000ULL)
+            || (seg->config.bytes > 0 && seg->bytes >= seg->config.bytes)))
+        return 0;
+
+    int ready = segment_ready(seg);
+
+    //the segment gets longer until the helper thread catches up
+    if (!ready)
+        seg->late++;
+
+    return ready;
+}
+
+//the next file is open, segment_rotate() can be called
+int segment_ready(segment_writer_t* seg)
+{
+    pthread_mutex_lock(&seg->lock);
+    int ready = (seg->next_fd != -1 && !seg->job);
+    pthread_mutex_unlock(&seg->lock);
+
+    return ready;
+}
+
+//switch to the pre-opened file, the helper thread does the rest
+//pts : of the first frame of the new segment
+//now_pts : of the frame being recorded, later than pts for a pre-roll: the
+//segment is named and indexed at the wall clock time of its first frame
+void segment_rotate(segment_writer_t* seg, uint64_t pts, uint64_t now_pts)
+{
+    int64_t age = (now_pts > pts) ? (int64_t)((now_pts - pts) / 1000) : 0;
+
+    pthread_mutex_lock(&seg->lock);
+    seg->old_fd = seg->fd;
+    seg->old_bytes = seg->bytes;
+    if (seg->config.writer)
+        seg->old_position = disk_writer_position(seg->config.writer);
+    seg->new_start = now_ms() - age;
+    seg->job = 1;
+    seg->fd = seg->next_fd;
+    seg->next_fd = -1;
+    pthread_cond_signal(&seg->cond);
+    pthread_mutex_unlock(&seg->lock);
+
+    seg->bytes = 0;
+    seg->start_pts = pts;
+    seg->segments++;
+}
+
+/*---------------------------------------------------------------------
+   call at the end of a GOP, with SEGMENT_FSYNC_GOP syncs what was
+   written of the segment; through the disk writer it is queued after
+   the data, the call does not wait
+   return : 0, -1 on error
+----------------------------------------------------------------------*/
+int segment_sync(segment_writer_t* seg)
+{
+    if (seg->config.fsync != SEGMENT_FSYNC_GOP)
+        return 0;
+
+    if (seg->config.writer)
+        return disk_writer_sync(seg->config.writer, seg->fd);
+
+    return fdatasync(seg->fd);
+}
@@ -0,0 +1,88 @@
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "disk_writer.h"
+
+//Recording cut in segment files on keyframes, every N seconds of video or
+//M bytes. The file names come from strftime() at the start of a segment,
+//the oldest segments are deleted past a count, and an index file lists
+//the segments with their start time.
+//With a disk writer the data is written by its thread, the files are
+//closed once their data is written.
+//The writing thread only swaps file descriptors: the next file is opened
+//ahead by a helper thread, which also renames, closes and deletes the files
+//and rewrites the index.
+//The blocks of a segment can be reserved when it is opened (fallocate()),
+//the rest is given back when it is closed.
+
+#define SEGMENT_NAME_MAX 256
+#define SEGMENT_INDEX_NAME "segments.idx"
+#define SEGMENT_NEXT_NAME ".segment-next" //pre-opened file, renamed on use
+
+//when the data gets to the disk, not only to the page cache
+#define SEGMENT_FSYNC_NEVER 0   //the kernel writeback
+#define SEGMENT_FSYNC_SEGMENT 1 //a closed segment is on the disk
+#define SEGMENT_FSYNC_GOP 2     //and every GOP, segment_sync()
+
+typedef struct
+{
+    const char* dir;  //directory of the segments and of the index
+    const char* name; //strftime() pattern, e.g. "video-%Y%m%d-%H%M%S.ts"
+    int seconds;      //new segment at the first keyframe after this much
+                      //video, 0 : no limit
+    uint64_t bytes;   //or after this much data, 0 : no limit
+    int keep;         //segments kept, older ones deleted, 0 : all
+    disk_writer_t* writer; //writes off the calling thread, NULL : write()
+    uint64_t preallocate; //bytes reserved in a new segment, 0 : none
+    int fsync;            //SEGMENT_FSYNC_xxx
+} segment_config_t;
+
+typedef struct
+{
+    char name[SEGMENT_NAME_MAX];
+    int64_t start;  //ms since the epoch
+    uint64_t bytes; //0 while it is written
+} segment_entry_t;
+
+typedef struct
+{
+    segment_config_t config;
+
+    //writing thread
+    int fd;
+    uint64_t bytes;     //in the current segment
+    uint64_t start_pts; //us, first frame of the current segment
+    int has_pts;
+
+    //helper thread
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int quit;
+    int next_fd;  //pre-opened next segment, -1 : not ready
+    int job;      //a rotation to finish
+    int old_fd;   //segment to close
+    uint64_t old_bytes;
+    uint64_t old_position; //of the disk writer, at the end of old_fd
+    int64_t new_start;
+
+    segment_entry_t* entries; //oldest first, the last one is written
+    int nentries;
+    int size;
+
+    uint32_t segments;
+    uint32_t late; //keyframes with a rotation due but no next file ready
+} segment_writer_t;
+
+int segment_open(segment_writer_t* seg, const segment_config_t* config);
+void segment_close(segment_writer_t* seg);
+int segment_write(void* arg, const unsigned char* data, int len);
+int segment_due(segment_writer_t* seg, uint64_t pts);
+int segment_ready(segment_writer_t* seg);
+void segment_rotate(segment_writer_t* seg, uint64_t pts, uint64_t now_pts);
+int segment_sync(segment_writer_t* seg);
+
+#endif
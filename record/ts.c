@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "ts.h"
+
+#define TS_PAYLOAD_SIZE (TS_PACKET_SIZE - 4)
+#define STREAM_TYPE_H264 0x1b
+#define STREAM_ID_VIDEO 0xe0
+
+//access unit delimiter, primary_pic_type 7 (any slice type)
+static const unsigned char aud[6] = { 0, 0, 0, 1, 0x09, 0xf0 };
+
+void ts_muxer_init(ts_muxer_t* ts, int packets_per_write, ts_write_t write,
+        void* arg)
+{
+    memset(ts, 0, sizeof(*ts));
+    if (packets_per_write < 1)
+        packets_per_write = 1;
+    if (packets_per_write > TS_MAX_PACKETS_PER_WRITE)
+        packets_per_write = TS_MAX_PACKETS_PER_WRITE;
+    ts->packets_per_write = packets_per_write;
+    ts->write = write;
+    ts->arg = arg;
+}
+
+//hand the packets built so far to the write callback
+int ts_flush(ts_muxer_t* ts)
+{
+    int n = ts->nout;
+
+    ts->nout = 0;
+    if (n == 0)
+        return 0;
+
+    return ts->write(ts->arg, ts->out, n * TS_PACKET_SIZE);
+}
+
+//CRC-32/MPEG-2 of the PSI sections
+static uint32_t crc32_mpeg(const unsigned char* data, int len)
+{
+    uint32_t crc = 0xffffffff;
+    int i, j;
+
+    for (i = 0; i < len; i++)
+    {
+        crc ^= (uint32_t)data[i] << 24;
+        for (j = 0; j < 8; j++)
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+    }
+
+    return crc;
+}
+
+/*---------------------------------------------------------------------
+   one packet of 'pid' with as much of 'payload' as fits, the room left
+   is stuffed in the adaptation field
+   pcr : PCR base (90kHz) to put in the packet, NULL : none
+   return : bytes of payload taken, -1 on write error
+----------------------------------------------------------------------*/
+static int put_packet(ts_muxer_t* ts, int pid, int start, uint8_t* cc,
+        const uint64_t* pcr, int random_access,
+        const unsigned char* payload, int len)
+{
+    int af_size = 0; //adaptation field, length byte included
+    int n;
+
+    if (ts->nout == ts->packets_per_write && ts_flush(ts) == -1)
+        return -1;
+    unsigned char* p = ts->out + ts->nout * TS_PACKET_SIZE;
+    ts->nout++;
+    ts->packets++;
+
+    if (pcr || random_access)
+        af_size = 2 + (pcr ? 6 : 0);
+    n = (len < TS_PAYLOAD_SIZE - af_size) ? len : TS_PAYLOAD_SIZE - af_size;
+    if (af_size + n < TS_PAYLOAD_SIZE)
+        af_size = TS_PAYLOAD_SIZE - n;
+
+    p[0] = 0x47;
+    p[1] = (start ? 0x40 : 0) | ((pid >> 8) & 0x1f);
+    p[2] = pid & 0xff;
+    p[3] = (af_size ? 0x30 : 0x10) | (*cc & 0x0f);
+    *cc = (*cc + 1) & 0x0f;
+
+    if (af_size > 0)
+    {
+        int i = 6;
+
+        p[4] = af_size - 1;
+        if (af_size > 1)
+        {
+            p[5] = (random_access ? 0x40 : 0) | (pcr ? 0x10 : 0);
+            if (pcr)
+            {
+                //33 bits base, 6 reserved bits, 9 bits extension (0)
+                uint64_t base = *pcr & 0x1ffffffffULL;
+                p[6] = base >> 25;
+                p[7] = base >> 17;
+                p[8] = base >> 9;
+                p[9] = base >> 1;
+                p[10] = ((base & 1) << 7) | 0x7e;
+                p[11] = 0;
+                i = 12;
+            }
+            memset(p + i, 0xff, 4 + af_size - i);
+        }
+    }
+
+    memcpy(p + 4 + af_size, payload, n);
+
+    return n;
+}
+
+//one PSI section in one packet, the rest of the payload is 0xff
+static int put_section(ts_muxer_t* ts, int pid, uint8_t* cc,
+        unsigned char* section, int len)
+{
+    unsigned char payload[TS_PAYLOAD_SIZE];
+    uint32_t crc;
+
+    //section_length counts from after itself, CRC included
+    section[1] = 0xb0 | (((len + 4 - 3) >> 8) & 0x0f);
+    section[2] = (len + 4 - 3) & 0xff;
+    crc = crc32_mpeg(section, len);
+    section[len++] = crc >> 24;
+    section[len++] = crc >> 16;
+    section[len++] = crc >> 8;
+    section[len++] = crc;
+
+    payload[0] = 0; //pointer_field
+    memcpy(payload + 1, section, len);
+    memset(payload + 1 + len, 0xff, TS_PAYLOAD_SIZE - 1 - len);
+
+    return put_packet(ts, pid, 1, cc, NULL, 0, payload, TS_PAYLOAD_SIZE);
+}
+
+static int put_psi(ts_muxer_t* ts)
+{
+    unsigned char pat[16] = {
+        0x00, 0, 0,                          //table_id, section_length
+        0x00, 0x01,                          //transport_stream_id
+        0xc1, 0x00, 0x00,                    //version 0, current, sections
+        TS_PROGRAM >> 8, TS_PROGRAM & 0xff,
+        0xe0 | (TS_PID_PMT >> 8), TS_PID_PMT & 0xff,
+    };
+    unsigned char pmt[32] = {
+        0x02, 0, 0,
+        TS_PROGRAM >> 8, TS_PROGRAM & 0xff,
+        0xc1, 0x00, 0x00,
+        0xe0 | (TS_PID_VIDEO >> 8), TS_PID_VIDEO & 0xff, //PCR_PID
+        0xf0, 0x00,                                      //program_info
+        STREAM_TYPE_H264,
+        0xe0 | (TS_PID_VIDEO >> 8), TS_PID_VIDEO & 0xff,
+        0xf0, 0x00,                                      //ES_info
+    };
+
+    if (put_section(ts, 0, &ts->cc_pat, pat, 12) == -1
+            || put_section(ts, TS_PID_PMT, &ts->cc_pmt, pmt, 17) == -1)
+        return -1;
+
+    return 0;
+}
+
+//PTS/DTS field, 'prefix' is 0010 (PTS only), 0011 (PTS of PTS+DTS), 0001
+static void put_timestamp(unsigned char* p, int prefix, uint64_t t)
+{
+    p[0] = (prefix << 4) | (((t >> 30) & 0x07) << 1) | 1;
+    p[1] = t >> 22;
+    p[2] = (((t >> 15) & 0x7f) << 1) | 1;
+    p[3] = t >> 7;
+    p[4] = ((t & 0x7f) << 1) | 1;
+}
+
+/*---------------------------------------------------------------------
+   mux one access unit (Annex-B)
+   pts, dts : us on the clock of the encoder (omx_ticks_to_us()), the
+   stream starts at 0 on the first dts; equal without B frames
+   keyframe : IDR, PAT/PMT go in front and the random access bit is set
+   The packets of the frame that do not fill a write stay in the muxer
+   until the next frame or ts_flush().
+   return : 0, -1 on write error
+----------------------------------------------------------------------*/
+int ts_mux_frame(ts_muxer_t* ts, const unsigned char* data, int len,
+        uint64_t pts, uint64_t dts, int keyframe)
+{
+    unsigned char header[19 + sizeof(aud)];
+    int header_len;
+
+    if (!ts->started)
+    {
+        ts->first_dts = dts;
+        ts->started = 1;
+    }
+
+    //90kHz, the PCR starts at 0 and runs TS_PCR_DELAY behind the DTS
+    uint64_t pcr = (dts - ts->first_dts) * 9 / 100;
+    uint64_t dts90 = pcr + TS_PCR_DELAY;
+    uint64_t pts90 = (pts - ts->first_dts) * 9 / 100 + TS_PCR_DELAY;
+
+    if (keyframe || ts->frames == 0 || pcr - ts->last_psi >= TS_PSI_INTERVAL)
+    {
+        if (put_psi(ts) == -1)
+            return -1;
+        ts->last_psi = pcr;
+    }
+
+    //PES header, PES_packet_length 0 : unbounded (video only)
+    header[0] = 0;
+    header[1] = 0;
+    header[2] = 1;
+    header[3] = STREAM_ID_VIDEO;
+    header[4] = 0;
+    header[5] = 0;
+    header[6] = 0x84; //data_alignment_indicator
+    if (pts90 != dts90)
+    {
+        header[7] = 0xc0;
+        header[8] = 10;
+        put_timestamp(header + 9, 3, pts90);
+        put_timestamp(header + 14, 1, dts90);
+        header_len = 19;
+    }
+    else
+    {
+        header[7] = 0x80;
+        header[8] = 5;
+        put_timestamp(header + 9, 2, pts90);
+        header_len = 14;
+    }
+
+    //an access unit delimiter starts every access unit in a TS
+    if (len < 5 || memcmp(data, aud, 5) != 0)
+    {
+        memcpy(header + header_len, aud, sizeof(aud));
+        header_len += sizeof(aud);
+    }
+
+    //the first packet carries the PCR, the PES header and what fits of the
+    //frame: put the header in front of the data in a copy of one payload
+    unsigned char first[TS_PAYLOAD_SIZE];
+    int n = TS_PAYLOAD_SIZE - 8 - header_len;
+    if (n > len)
+        n = len;
+    memcpy(first, header, header_len);
+    memcpy(first + header_len, data, n);
+    if (put_packet(ts, TS_PID_VIDEO, 1, &ts->cc_video, &pcr, keyframe,
+            first, header_len + n) == -1)
+        return -1;
+
+    data += n;
+    len -= n;
+    while (len > 0)
+    {
+        n = put_packet(ts, TS_PID_VIDEO, 0, &ts->cc_video, NULL, 0, data, len);
+        if (n == -1)
+            return -1;
+        data += n;
+        len -= n;
+    }
+
+    ts->frames++;
+
+    return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef TS_H
+#define TS_H
+
+#include <stdint.h>
+
+//MPEG-2 transport stream (ISO/IEC 13818-1) of one H.264 video stream
+//One program: PAT, PMT and the video PES, the PCR is on the video PID.
+//The packets are handed to a write callback by groups, a file takes big
+//groups to save system calls, UDP takes 7 packets (1316 bytes) per
+//datagram so a datagram plus the IP/UDP headers fits in an Ethernet frame.
+
+#define TS_PACKET_SIZE 188
+#define TS_PACKETS_PER_DATAGRAM 7
+#define TS_PACKETS_PER_FILE_WRITE 348 //64KB
+#define TS_MAX_PACKETS_PER_WRITE TS_PACKETS_PER_FILE_WRITE
+
+#define TS_PID_PMT 0x1000
+#define TS_PID_VIDEO 0x100
+#define TS_PROGRAM 1
+
+//PAT/PMT repeated at least this often (and in front of every keyframe)
+#define TS_PSI_INTERVAL 9000 //90kHz, 100ms
+//the PCR is this much behind the DTS of the frame it comes with
+#define TS_PCR_DELAY 9000
+
+//'len' bytes of whole packets, return -1 on error
+typedef int (*ts_write_t)(void* arg, const unsigned char* data, int len);
+
+typedef struct
+{
+    int packets_per_write;
+    unsigned char out[TS_MAX_PACKETS_PER_WRITE * TS_PACKET_SIZE];
+    int nout; //packets in out
+
+    ts_write_t write;
+    void* arg;
+
+    uint8_t cc_pat; //continuity counters
+    uint8_t cc_pmt;
+    uint8_t cc_video;
+
+    int started;
+    uint64_t first_dts; //us
+    uint64_t last_psi;  //90kHz
+
+    uint32_t frames;
+    uint64_t packets;
+} ts_muxer_t;
+
+void ts_muxer_init(ts_muxer_t* ts, int packets_per_write, ts_write_t write,
+        void* arg);
+int ts_mux_frame(ts_muxer_t* ts, const unsigned char* data, int len,
+        uint64_t pts, uint64_t dts, int keyframe);
+int ts_flush(ts_muxer_t* ts);
+
+#endif
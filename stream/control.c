@@ -0,0 +1,247 @@
+#define _GNU_SOURCE //accept4()
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+
+#include "control.h"
+
+//what an epoll event is about, the id of the client is in the low bits
+enum
+{
+    EVENT_LISTEN,
+    EVENT_DATAGRAM,
+    EVENT_CLIENT,
+    EVENT_TIMER,
+};
+
+#define EVENT_DATA(type, id) (((uint64_t)(type) << 32) | (uint32_t)(id))
+
+static int watch(control_server_t* control, int fd, int type, int id)
+{
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = EVENT_DATA(type, id);
+    if (epoll_ctl(control->epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+    {
+        fprintf(stderr, "control : epoll_ctl: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+   init the control plane
+   listenfd : listening TCP socket of the control connections
+   udpsock  : socket of the keep-alive messages, -1 : none
+   timeout  : keep-alive time-out of a connection in ms
+   return : 0, -1 on error
+----------------------------------------------------------------------*/
+int control_init(control_server_t* control, int listenfd, int udpsock,
+        int timeout, const control_ops_t* ops)
+{
+    memset(control, 0, sizeof(*control));
+    control->listenfd = listenfd;
+    control->udpsock = udpsock;
+    control->timeout = timeout;
+    control->ops = *ops;
+
+    control->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (control->epfd == -1)
+    {
+        fprintf(stderr, "control : epoll_create1: %s\n", strerror(errno));
+        return -1;
+    }
+
+    //accept() must not block when the client is already gone
+    fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK);
+    if (watch(control, listenfd, EVENT_LISTEN, 0) == -1)
+        return -1;
+    if (udpsock != -1 && watch(control, udpsock, EVENT_DATAGRAM, 0) == -1)
+        return -1;
+
+    return 0;
+}
+
+//close all the connections
+void control_deinit(control_server_t* control)
+{
+    int id;
+
+    for (id = 0; id < CONTROL_MAX_CLIENTS; id++)
+    {
+        if (control->clients[id].used)
+            control_close(control, id);
+    }
+
+    close(control->epfd);
+}
+
+//(re)start the keep-alive time-out of a connection
+void control_keep_alive(control_server_t* control, int id)
+{
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = control->timeout / 1000;
+    its.it_value.tv_nsec = (control->timeout % 1000) * 1000000L;
+    timerfd_settime(control->clients[id].timerfd, 0, &its, NULL);
+}
+
+//close a connection, ops.closed is called first
+void control_close(control_server_t* control, int id)
+{
+    control_client_t* client = &control->clients[id];
+
+    if (!client->used)
+        return;
+
+    if (control->ops.closed)
+        control->ops.closed(control->ops.arg, id);
+
+    //closing the fds removes them from the epoll set
+    close(client->timerfd);
+    close(client->sock);
+    client->used = 0;
+    control->nclients--;
+}
+
+static void accept_clients(control_server_t* control)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len;
+    int id;
+
+    while (1)
+    {
+        addr_len = sizeof(addr);
+        int sock = accept4(control->listenfd, (struct sockaddr*)&addr,
+                &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sock == -1)
+            return; //EAGAIN : no more connections
+
+        for (id = 0; id < CONTROL_MAX_CLIENTS; id++)
+        {
+            if (!control->clients[id].used)
+                break;
+        }
+        if (id == CONTROL_MAX_CLIENTS)
+        {
+            fprintf(stderr, "too many clients\n");
+            close(sock);
+            continue;
+        }
+
+        control_client_t* client = &control->clients[id];
+        client->sock = sock;
+        client->addr = addr;
+        client->timerfd = timerfd_create(CLOCK_MONOTONIC,
+                TFD_NONBLOCK | TFD_CLOEXEC);
+        if (client->timerfd == -1)
+        {
+            fprintf(stderr, "control : timerfd_create: %s\n", strerror(errno));
+            close(sock);
+            continue;
+        }
+
+        if (watch(control, sock, EVENT_CLIENT, id) == -1
+                || watch(control, client->timerfd, EVENT_TIMER, id) == -1
+                || (control->ops.opened
+                        && control->ops.opened(control->ops.arg, id, &addr)))
+        {
+            close(client->timerfd);
+            close(sock);
+            continue;
+        }
+
+        client->used = 1;
+        control->nclients++;
+        control_keep_alive(control, id);
+    }
+}
+
+//commands of a client, one byte each
+static void read_commands(control_server_t* control, int id)
+{
+    control_client_t* client = &control->clients[id];
+    unsigned char rxbuf[128];
+    int i;
+
+    ssize_t n = recv(client->sock, rxbuf, sizeof(rxbuf), 0);
+    if (n == -1 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (n <= 0)
+    {
+        fprintf(stderr, "read error: connection closed\n");
+        control_close(control, id);
+        return;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        int answer = control->ops.command(control->ops.arg, id, rxbuf[i]);
+        unsigned char txbuf = answer & 0xff;
+
+        //one byte always fits in the socket buffer of a control connection
+        if (txbuf && send(client->sock, &txbuf, 1, MSG_NOSIGNAL) != 1)
+            answer |= CONTROL_CLOSE;
+        if (answer & CONTROL_CLOSE)
+        {
+            control_close(control, id);
+            return;
+        }
+    }
+}
+
+/*---------------------------------------------------------------------
+   wait up to 'wait' ms (-1 : forever) and handle the events
+   return : number of events, -1 on error
+----------------------------------------------------------------------*/
+int control_run(control_server_t* control, int wait)
+{
+    struct epoll_event events[32];
+    uint64_t expirations;
+    int i;
+
+    int n = epoll_wait(control->epfd, events, 32, wait);
+    if (n == -1)
+        return (errno == EINTR) ? 0 : -1;
+
+    for (i = 0; i < n; i++)
+    {
+        int type = events[i].data.u64 >> 32;
+        int id = (uint32_t)events[i].data.u64;
+        control_client_t* client = &control->clients[id];
+
+        switch (type)
+        {
+        case EVENT_LISTEN:
+            accept_clients(control);
+            break;
+        case EVENT_DATAGRAM:
+            if (control->ops.datagram)
+                control->ops.datagram(control->ops.arg);
+            break;
+        case EVENT_CLIENT:
+            if (client->used)
+                read_commands(control, id);
+            break;
+        case EVENT_TIMER:
+            //an event of a connection closed in this round reads EAGAIN
+            if (client->used && read(client->timerfd, &expirations,
+                    sizeof(expirations)) == sizeof(expirations)
+                    && control->ops.expired)
+                control->ops.expired(control->ops.arg, id);
+            break;
+        }
+    }
+
+    return n;
+}
@@ -0,0 +1,59 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <netinet/in.h>
+
+//Control plane of the streaming server: the TCP control connections, their
+//keep-alive time-outs and the UDP socket the keep-alive messages come to,
+//all served by one thread with epoll.
+//The protocol is one byte per command ('s' start, 'c' finish), answered
+//with one byte ('a' ack, 'n' nack); the bytes of one read are handled one
+//by one, whatever way the client wrote them.
+
+#define CONTROL_MAX_CLIENTS 256
+//a command answer with this flag closes the connection after the answer
+#define CONTROL_CLOSE 0x100
+
+//What the server does with the events, 'arg' is given to every call
+typedef struct
+{
+    //new connection 'id', return -1 to refuse it
+    int (*opened)(void* arg, int id, const struct sockaddr_in* addr);
+    //one command byte, return the answer byte (| CONTROL_CLOSE), 0 : none
+    int (*command)(void* arg, int id, unsigned char cmd);
+    //no keep-alive for the time-out since the last control_keep_alive()
+    void (*expired)(void* arg, int id);
+    //connection closed by the client or after CONTROL_CLOSE
+    void (*closed)(void* arg, int id);
+    //the UDP socket is readable
+    void (*datagram)(void* arg);
+    void* arg;
+} control_ops_t;
+
+typedef struct
+{
+    int used;
+    int sock;
+    int timerfd; //keep-alive time-out
+    struct sockaddr_in addr;
+} control_client_t;
+
+typedef struct
+{
+    int epfd;
+    int listenfd;
+    int udpsock;
+    int timeout; //ms
+    control_ops_t ops;
+    control_client_t clients[CONTROL_MAX_CLIENTS];
+    int nclients;
+} control_server_t;
+
+int control_init(control_server_t* control, int listenfd, int udpsock,
+        int timeout, const control_ops_t* ops);
+void control_deinit(control_server_t* control);
+int control_run(control_server_t* control, int wait);
+void control_keep_alive(control_server_t* control, int id);
+void control_close(control_server_t* control, int id);
+
+#endif
@@ -0,0 +1,438 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "fanout.h"
+
+/*---------------------------------------------------------------------
+   init the fan-out of one stream, without any viewer
+   sock   : UDP socket all the viewers are served from
+   mode   : the preferred way to send, see udp_send_mode_t
+   pacing, window, max_rate : pacer of each viewer, see pacer_init()
+----------------------------------------------------------------------*/
+void fanout_init(fanout_t* fanout, int sock, udp_send_mode_t mode,
+        pacer_mode_t pacing, uint64_t window, uint32_t max_rate)
+{
+    memset(fanout, 0, sizeof(*fanout));
+
+    fanout->sock = sock;
+    fanout->mode = udp_batch_probe(sock, mode);
+    fanout->pacing = pacing;
+    fanout->window = window;
+    fanout->max_rate = max_rate;
+    pthread_mutex_init(&fanout->lock, NULL);
+}
+
+//stop all the viewers
+void fanout_deinit(fanout_t* fanout)
+{
+    int i;
+
+    for (i = 0; i < FANOUT_MAX_SUBSCRIBERS; i++)
+    {
+        if (fanout->subscribers[i].used)
+            fanout_unsubscribe(fanout, i);
+    }
+    if (fanout->discarded)
+        printf("fanout : %u frames lost for want of a free frame\n",
+                fanout->discarded);
+
+    pthread_mutex_destroy(&fanout->lock);
+}
+
+//a free frame (or part) for the packetizer, called with the lock held
+static fanout_frame_t* acquire_frame(fanout_t* fanout)
+{
+    int i;
+
+    for (i = 0; i < FANOUT_FRAMES; i++)
+    {
+        fanout_frame_t* frame = &fanout->frames[i];
+        if (frame->refs == 0)
+        {
+            frame->refs = 1;
+            frame->next = NULL;
+            udp_batch_clear(&frame->batch);
+            return frame;
+        }
+    }
+
+    return NULL;
+}
+
+//take or give back a reference on every part of a frame
+//called with the lock held
+static void hold_frame(fanout_frame_t* frame)
+{
+    for (; frame; frame = frame->next)
+        frame->refs++;
+}
+
+static void release_frame(fanout_frame_t* frame)
+{
+    for (; frame; frame = frame->next)
+        frame->refs--;
+}
+
+//queue the current frame to every viewer, called with the lock held
+static void publish_locked(fanout_t* fanout)
+{
+    fanout_frame_t* frame = fanout->current;
+    int i;
+
+    if (fanout->discard)
+    {
+        fanout->discard = 0;
+        fanout->discarded++;
+    }
+    if (!frame)
+        return;
+    fanout->current = NULL;
+    fanout->last = NULL;
+
+    for (i = 0; (i < FANOUT_MAX_SUBSCRIBERS) && (frame->batch.count > 0); i++)
+    {
+        subscriber_t* sub = &fanout->subscribers[i];
+        if (!sub->used || sub->quit)
+            continue;
+
+        //slow viewer, its oldest frame is dropped with all its parts
+        if (sub->count == FANOUT_QUEUE_SIZE)
+        {
+            release_frame(sub->queue[sub->head]);
+            sub->head = (sub->head + 1) % FANOUT_QUEUE_SIZE;
+            sub->count--;
+            sub->dropped++;
+        }
+
+        sub->queue[(sub->head + sub->count) % FANOUT_QUEUE_SIZE] = frame;
+        sub->count++;
+        hold_frame(frame);
+        pthread_cond_signal(&sub->cond);
+    }
+
+    //released by the packetizer
+    release_frame(frame);
+}
+
+/*---------------------------------------------------------------------
+   write all of 'iov' to a non-blocking socket
+   waits up to FANOUT_WRITE_TIMEOUT for room in the socket buffer
+   return : 0, -1 on error or time-out (part of it may have been written)
+----------------------------------------------------------------------*/
+int fanout_writev(int sock, struct iovec* iov, int iovcnt)
+{
+    while (iovcnt > 0)
+    {
+        ssize_t n = writev(sock, iov, iovcnt);
+        if (n == -1)
+        {
+            struct pollfd pfd = { sock, POLLOUT, 0 };
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return -1;
+            if (poll(&pfd, 1, FANOUT_WRITE_TIMEOUT) <= 0)
+                return -1;
+            continue;
+        }
+
+        //skip what was written
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    return 0;
+}
+
+//RTSP interleaved framing (RFC 2326 10.12): '$', channel, length, packet
+//of the first 'count' packets of the batch
+//return : 1 (one call), -1 if the viewer was disconnected
+static int send_interleaved(subscriber_t* sub, udp_batch_t* batch, int count)
+{
+    struct iovec iov[2 * UDP_BATCH_MAX];
+    unsigned char header[UDP_BATCH_MAX][4];
+    int n = 0;
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        unsigned char* packet = batch->data + batch->offset[i];
+
+        header[i][0] = '$';
+        header[i][1] = sub->channel;
+        header[i][2] = batch->len[i] >> 8;
+        header[i][3] = batch->len[i];
+        iov[n].iov_base = header[i];
+        iov[n].iov_len = 4;
+        n++;
+        iov[n].iov_base = packet;
+        iov[n].iov_len = batch->len[i];
+        n++;
+    }
+
+    pthread_mutex_lock(sub->write_lock);
+    int r = fanout_writev(sub->tcp, iov, n);
+    pthread_mutex_unlock(sub->write_lock);
+
+    //a half written frame breaks the framing, the RTSP server sees the
+    //connection closed and ends the session
+    if (r == -1)
+    {
+        shutdown(sub->tcp, SHUT_RDWR);
+        return -1;
+    }
+
+    return 1;
+}
+
+//sending thread of one viewer
+static void* subscriber_thread(void* arg)
+{
+    subscriber_t* sub = (subscriber_t*)arg;
+    fanout_t* fanout = sub->fanout;
+
+    pthread_mutex_lock(&fanout->lock);
+    while (1)
+    {
+        while ((sub->count == 0) && !sub->quit)
+            pthread_cond_wait(&sub->cond, &fanout->lock);
+        if (sub->quit)
+            break;
+
+        fanout_frame_t* frame = sub->queue[sub->head];
+        sub->head = (sub->head + 1) % FANOUT_QUEUE_SIZE;
+        sub->count--;
+        pthread_mutex_unlock(&fanout->lock);
+
+        //the frame cannot be reused while we hold a reference, and its
+        //parts are chained before it is published
+        fanout_frame_t* part;
+        int r = 0, calls = 0, packets = 0;
+        for (part = frame; part && (r != -1); part = part->next)
+        {
+            int count = sub->fec ? part->batch.count : part->media;
+            if (sub->tcp != -1)
+                r = send_interleaved(sub, &part->batch, count);
+            else
+                r = pacer_send(&sub->pacer, &part->batch, count, &sub->mode,
+                        fanout->sock, &sub->addr);
+            if (r > 0)
+                calls += r;
+            packets += count;
+        }
+
+        pthread_mutex_lock(&fanout->lock);
+        sub->calls += calls;
+        sub->packets += packets;
+        sub->frames++;
+        //remember a fall back to a slower mode for the next viewers
+        if (sub->mode != fanout->mode)
+            fanout->mode = sub->mode;
+        release_frame(frame);
+    }
+    pthread_mutex_unlock(&fanout->lock);
+
+    return NULL;
+}
+
+static int subscribe(fanout_t* fanout, const struct sockaddr_in* addr,
+        int fec, int tcp, int channel, pthread_mutex_t* write_lock)
+{
+    int id;
+
+    pthread_mutex_lock(&fanout->lock);
+    for (id = 0; id < FANOUT_MAX_SUBSCRIBERS; id++)
+    {
+        if (!fanout->subscribers[id].used)
+            break;
+    }
+    if (id == FANOUT_MAX_SUBSCRIBERS)
+    {
+        pthread_mutex_unlock(&fanout->lock);
+        fprintf(stderr, "error: too many viewers\n");
+        return -1;
+    }
+
+    subscriber_t* sub = &fanout->subscribers[id];
+    memset(sub, 0, sizeof(*sub));
+    sub->used = 1;
+    if (addr)
+        sub->addr = *addr;
+    sub->fec = fec;
+    sub->tcp = tcp;
+    sub->channel = channel;
+    sub->write_lock = write_lock;
+    sub->mode = fanout->mode;
+    sub->fanout = fanout;
+    pthread_cond_init(&sub->cond, NULL);
+    //TCP paces itself
+    if (tcp == -1)
+        pacer_init(&sub->pacer, fanout->sock, fanout->pacing, fanout->window,
+                fanout->max_rate);
+    else
+        pacer_init(&sub->pacer, fanout->sock, PACER_OFF, 0, 0);
+    fanout->nsubscribers++;
+    pthread_mutex_unlock(&fanout->lock);
+
+    if (pthread_create(&sub->tid, NULL, subscriber_thread, sub) != 0)
+    {
+        fprintf(stderr, "ERROR:pthread_create\n");
+        pthread_mutex_lock(&fanout->lock);
+        sub->used = 0;
+        fanout->nsubscribers--;
+        pthread_mutex_unlock(&fanout->lock);
+        pthread_cond_destroy(&sub->cond);
+        pacer_deinit(&sub->pacer);
+        return -1;
+    }
+
+    return id;
+}
+
+/*---------------------------------------------------------------------
+   add a viewer, it receives the frames published from now on
+   fec    : send it the FEC repair packets, 0 for a player that does not
+            know them (an RTSP viewer, the SDP only has H.264)
+   return : id of the viewer, -1 if the table is full
+----------------------------------------------------------------------*/
+int fanout_subscribe(fanout_t* fanout, const struct sockaddr_in* addr,
+        int fec)
+{
+    return subscribe(fanout, addr, fec, -1, 0, NULL);
+}
+
+/*---------------------------------------------------------------------
+   add a viewer served on its RTSP connection (interleaved RTP)
+   sock       : non-blocking TCP connection of the viewer
+   channel    : interleaved channel of the RTP packets
+   write_lock : held while a frame or an RTSP reply is written to 'sock'
+   return : id of the viewer, -1 if the table is full
+----------------------------------------------------------------------*/
+int fanout_subscribe_interleaved(fanout_t* fanout, int sock, int channel,
+        pthread_mutex_t* write_lock)
+{
+    //TCP does not lose packets, no repair packets
+    return subscribe(fanout, NULL, 0, sock, channel, write_lock);
+}
+
+//remove a viewer, the frames still in its queue are dropped
+void fanout_unsubscribe(fanout_t* fanout, int id)
+{
+    subscriber_t* sub = &fanout->subscribers[id];
+
+    pthread_mutex_lock(&fanout->lock);
+    sub->quit = 1;
+    pthread_cond_signal(&sub->cond);
+    pthread_mutex_unlock(&fanout->lock);
+
+    pthread_join(sub->tid, NULL);
+
+    pthread_mutex_lock(&fanout->lock);
+    while (sub->count > 0)
+    {
+        release_frame(sub->queue[sub->head]);
+        sub->head = (sub->head + 1) % FANOUT_QUEUE_SIZE;
+        sub->count--;
+    }
+    sub->used = 0;
+    fanout->nsubscribers--;
+    pthread_mutex_unlock(&fanout->lock);
+
+    pthread_cond_destroy(&sub->cond);
+    pacer_deinit(&sub->pacer);
+
+    printf("viewer %d : %u frames, %u packets in %u send calls, "
+            "%u frames dropped\n", id, sub->frames, sub->packets,
+            sub->calls, sub->dropped);
+}
+
+/*---------------------------------------------------------------------
+   rtp_send_t of the packetizer, the packet is added to the current frame
+   a frame too big for one batch (or one FEC block) goes on in a new part
+   chained to it
+   the whole frame is dropped if all the frames are still held by the
+   viewers, a viewer never gets part of it
+----------------------------------------------------------------------*/
+int fanout_add(void* arg, const unsigned char* packet, int len)
+{
+    fanout_t* fanout = (fanout_t*)arg;
+
+    if (fanout->rtx)
+        rtx_store(fanout->rtx, packet, len);
+
+    pthread_mutex_lock(&fanout->lock);
+    if (!fanout->current && !fanout->discard)
+    {
+        fanout->current = fanout->last = acquire_frame(fanout);
+        fanout->discard = !fanout->current;
+    }
+    pthread_mutex_unlock(&fanout->lock);
+
+    //the current frame only belongs to the packetizer
+    //a part keeps room for the repair packets of its block
+    if (fanout->discard
+            || ((!fanout->fec
+                    || fanout->last->batch.count < fanout->fec->block)
+                && (udp_batch_put(&fanout->last->batch, packet, len) == 0)))
+        return 0;
+
+    pthread_mutex_lock(&fanout->lock);
+    fanout_frame_t* part = acquire_frame(fanout);
+    if (part)
+    {
+        fanout->last->next = part;
+        fanout->last = part;
+    }
+    else
+    {
+        release_frame(fanout->current);
+        fanout->current = fanout->last = NULL;
+        fanout->discard = 1;
+    }
+    pthread_mutex_unlock(&fanout->lock);
+
+    if (part)
+        udp_batch_put(&part->batch, packet, len);
+
+    return 0;
+}
+
+//number of viewers, the producer can skip a stream nobody watches
+int fanout_count(fanout_t* fanout)
+{
+    pthread_mutex_lock(&fanout->lock);
+    int n = fanout->nsubscribers;
+    pthread_mutex_unlock(&fanout->lock);
+
+    return n;
+}
+
+//the packets added since the last call are a frame, queue it to the viewers
+//each part of the frame is an FEC block
+void fanout_publish(fanout_t* fanout)
+{
+    fanout_frame_t* part;
+
+    for (part = fanout->current; part; part = part->next)
+    {
+        part->media = part->batch.count;
+        if (fanout->fec)
+            fec_protect(fanout->fec, &part->batch);
+    }
+
+    pthread_mutex_lock(&fanout->lock);
+    publish_locked(fanout);
+    pthread_mutex_unlock(&fanout->lock);
+}
@@ -0,0 +1,109 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/uio.h>
+
+#include "udp_batch.h"
+#include "pacer.h"
+#include "fec.h"
+#include "rtx.h"
+
+//Max number of viewers of one stream
+#define FANOUT_MAX_SUBSCRIBERS 16
+//Frames queued for a viewer, the oldest one is dropped when a new frame
+//comes and the queue is full
+#define FANOUT_QUEUE_SIZE 4
+//Shared frames: each viewer can hold a full queue and the frame it is
+//sending, plus the one being packetized. A frame of more than
+//UDP_BATCH_MAX packets takes several
+#define FANOUT_FRAMES (FANOUT_MAX_SUBSCRIBERS + FANOUT_QUEUE_SIZE + 1)
+//a TCP viewer that cannot take a frame for this long is disconnected (ms)
+#define FANOUT_WRITE_TIMEOUT 1000
+
+//The packets of one frame, built once and sent to every viewer
+//A frame of more than UDP_BATCH_MAX packets is a chain of parts, queued,
+//sent and dropped as one
+typedef struct fanout_frame_t
+{
+    udp_batch_t batch;
+    int media; //packets of the batch before its FEC repair packets
+    int refs; //queues (and the packetizer) still using it
+    struct fanout_frame_t* next; //next part of the frame, NULL : last one
+} fanout_frame_t;
+
+struct fanout_t;
+
+//One viewer, it has its own queue, pacer and sending thread so that a slow
+//viewer only loses its own frames
+typedef struct
+{
+    int used;
+    int quit;
+    struct sockaddr_in addr;
+    //RTSP interleaved viewer: packets go to its TCP connection, -1 : UDP
+    int tcp;
+    int channel;
+    int fec; //the FEC repair packets are sent to it
+    pthread_mutex_t* write_lock; //shared with the RTSP replies
+    fanout_frame_t* queue[FANOUT_QUEUE_SIZE];
+    int head;
+    int count;
+    pthread_cond_t cond;
+    pthread_t tid;
+    pacer_t pacer;
+    //how this viewer's thread sends, the shared batches are only read
+    udp_send_mode_t mode;
+    struct fanout_t* fanout;
+
+    //statistics
+    uint32_t frames;
+    uint32_t dropped;
+    uint32_t packets;
+    uint32_t calls;
+} subscriber_t;
+
+typedef struct fanout_t
+{
+    int sock;
+    udp_send_mode_t mode;
+    //pacing of the viewers, see pacer_init()
+    pacer_mode_t pacing;
+    uint64_t window;
+    uint32_t max_rate;
+    //repair packets added to each frame, NULL : no FEC
+    fec_encoder_t* fec;
+    //sent packets kept for the NACKs of the viewers, NULL : none
+    rtx_history_t* rtx;
+
+    //protects everything below, and the queues of the subscribers
+    pthread_mutex_t lock;
+    fanout_frame_t frames[FANOUT_FRAMES];
+    fanout_frame_t* current; //frame being packetized, NULL if none
+    fanout_frame_t* last;    //its part being filled
+    int discard;             //no free part, the frame is not published
+    subscriber_t subscribers[FANOUT_MAX_SUBSCRIBERS];
+    int nsubscribers;
+
+    //statistics
+    uint32_t discarded; //frames lost for want of a free part
+} fanout_t;
+
+void fanout_init(fanout_t* fanout, int sock, udp_send_mode_t mode,
+        pacer_mode_t pacing, uint64_t window, uint32_t max_rate);
+void fanout_deinit(fanout_t* fanout);
+
+int fanout_subscribe(fanout_t* fanout, const struct sockaddr_in* addr,
+        int fec);
+int fanout_subscribe_interleaved(fanout_t* fanout, int sock, int channel,
+        pthread_mutex_t* write_lock);
+void fanout_unsubscribe(fanout_t* fanout, int id);
+int fanout_count(fanout_t* fanout);
+int fanout_writev(int sock, struct iovec* iov, int iovcnt);
+
+int fanout_add(void* fanout, const unsigned char* packet, int len);
+void fanout_publish(fanout_t* fanout);
+
+#endif
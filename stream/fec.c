@@ -0,0 +1,379 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "fec.h"
+
+//GF(256) with the polynomial x^8 + x^4 + x^3 + x^2 + 1
+static unsigned char gf_exp[512];
+static unsigned char gf_log[256];
+static int gf_ready = 0;
+
+static void gf_init(void)
+{
+    int i;
+    int x = 1;
+
+    if (gf_ready)
+        return;
+
+    for (i = 0; i < 255; i++)
+    {
+        gf_exp[i] = x;
+        gf_exp[i + 255] = x;
+        gf_log[x] = i;
+        x <<= 1;
+        if (x & 0x100)
+            x ^= 0x11d;
+    }
+    gf_exp[510] = gf_exp[255];
+    gf_exp[511] = gf_exp[256];
+    gf_ready = 1;
+}
+
+static unsigned char gf_mul(unsigned char a, unsigned char b)
+{
+    if (a == 0 || b == 0)
+        return 0;
+    return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static unsigned char gf_inv(unsigned char a)
+{
+    return gf_exp[255 - gf_log[a]];
+}
+
+//dst ^= c * src
+static void gf_mul_add(unsigned char* dst, const unsigned char* src,
+        unsigned char c, int len)
+{
+    int i;
+
+    if (c == 0)
+        return;
+
+    int log_c = gf_log[c];
+    for (i = 0; i < len; i++)
+    {
+        if (src[i])
+            dst[i] ^= gf_exp[gf_log[src[i]] + log_c];
+    }
+}
+
+//dst = c * dst
+static void gf_scale(unsigned char* dst, unsigned char c, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++)
+        dst[i] = gf_mul(dst[i], c);
+}
+
+//coefficient of media packet i in repair row j
+//x_j = 255 - j and y_i = i never meet when k + r <= 256, so every square
+//sub-matrix can be inverted: any r losses can be repaired
+static unsigned char cauchy(int j, int i)
+{
+    return gf_inv((255 - j) ^ i);
+}
+
+static uint16_t packet_seq(const unsigned char* packet)
+{
+    return (packet[2] << 8) | packet[3];
+}
+
+//repair packets of a block of k media packets
+static int repair_count(const fec_encoder_t* fec, int k)
+{
+    int r = (int) (k * fec->ratio);
+    if (r < k * fec->ratio)
+        r++; //rounded up
+    if (r > FEC_MAX_REPAIR)
+        r = FEC_MAX_REPAIR;
+
+    return r;
+}
+
+/*---------------------------------------------------------------------
+   init the sender side
+   ratio : repair packets per media packet (0.25 : one for four), 0 : off
+   ssrc  : SSRC of the repair packets
+----------------------------------------------------------------------*/
+void fec_encoder_init(fec_encoder_t* fec, double ratio, uint32_t ssrc)
+{
+    gf_init();
+
+    fec->ratio = (ratio > 0) ? ratio : 0;
+    fec->seq = 0;
+    fec->ssrc = ssrc;
+
+    //the biggest block that leaves room for its repairs in a batch
+    fec->block = UDP_BATCH_MAX;
+    while (fec->block + repair_count(fec, fec->block) > UDP_BATCH_MAX)
+        fec->block--;
+}
+
+/*---------------------------------------------------------------------
+   add the repair packets of the media packets of the batch (a frame, or
+   a part of it of at most 'block' packets)
+   return : number of repair packets added
+----------------------------------------------------------------------*/
+int fec_protect(fec_encoder_t* fec, udp_batch_t* batch)
+{
+    int k = batch->count;
+    int i, j;
+
+    if ((fec->ratio <= 0) || (k == 0))
+        return 0;
+
+    int r = repair_count(fec, k);
+    if (k + r > UDP_BATCH_MAX)
+        r = UDP_BATCH_MAX - k; //more than 'block' packets
+    if (r <= 0)
+        return 0;
+
+    //the block is identified by consecutive sequence numbers
+    const unsigned char* first = batch->data + batch->offset[0];
+    uint16_t base = packet_seq(first);
+    int unit = 0;
+    for (i = 0; i < k; i++)
+    {
+        if (packet_seq(batch->data + batch->offset[i]) != (uint16_t)(base + i))
+            return 0;
+        if (batch->len[i] + 2 > unit)
+            unit = batch->len[i] + 2;
+    }
+
+    //repair rows, over the length and the bytes of each packet
+    for (j = 0; j < r; j++)
+    {
+        memset(fec->repair[j], 0, unit);
+        for (i = 0; i < k; i++)
+        {
+            unsigned char c = cauchy(j, i);
+            unsigned char len[2] = { batch->len[i] >> 8, batch->len[i] };
+            gf_mul_add(fec->repair[j], len, c, 2);
+            gf_mul_add(fec->repair[j] + 2, batch->data + batch->offset[i], c,
+                    batch->len[i]);
+        }
+    }
+
+    for (j = 0; j < r; j++)
+    {
+        unsigned char* p = fec->packet;
+
+        p[0] = 0x80;
+        p[1] = FEC_PAYLOAD_TYPE;
+        p[2] = fec->seq >> 8;
+        p[3] = fec->seq;
+        memcpy(p + 4, first + 4, 4); //timestamp of the frame
+        p[8] = fec->ssrc >> 24;
+        p[9] = fec->ssrc >> 16;
+        p[10] = fec->ssrc >> 8;
+        p[11] = fec->ssrc;
+
+        p += RTP_HEADER_SIZE;
+        p[0] = base >> 8;
+        p[1] = base;
+        p[2] = k;
+        p[3] = r;
+        p[4] = j;
+        p[5] = 0;
+        memcpy(p + FEC_HEADER_SIZE, fec->repair[j], unit);
+
+        if (udp_batch_put(batch, fec->packet,
+                RTP_HEADER_SIZE + FEC_HEADER_SIZE + unit) == -1)
+            return j;
+        fec->seq++;
+    }
+
+    return r;
+}
+
+void fec_decoder_init(fec_decoder_t* dec)
+{
+    gf_init();
+
+    memset(dec->media_len, 0, sizeof(dec->media_len));
+    dec->k = 0;
+    dec->r = 0;
+    dec->done = 1;
+}
+
+//media packet of the current block, NULL if it was not received
+static const unsigned char* get_media(fec_decoder_t* dec, uint16_t seq,
+        int* len)
+{
+    int slot = seq % FEC_HISTORY;
+
+    if (dec->media_len[slot] == 0 || dec->media_seq[slot] != seq)
+        return NULL;
+
+    *len = dec->media_len[slot];
+    return dec->media[slot];
+}
+
+//solve the missing media packets of the block if there are enough repairs
+static int recover(fec_decoder_t* dec, rtp_send_t recovered, void* arg)
+{
+    int missing[FEC_MAX_REPAIR];
+    int rows[FEC_MAX_REPAIR];
+    unsigned char a[FEC_MAX_REPAIR][FEC_MAX_REPAIR];
+    unsigned char (*s)[FEC_MAX_UNIT] = dec->solve;
+    int nmissing = 0;
+    int nrows = 0;
+    int i, j, b, len;
+
+    for (i = 0; i < dec->k; i++)
+    {
+        if (!get_media(dec, dec->base + i, &len))
+        {
+            if (nmissing == FEC_MAX_REPAIR)
+                return 0;
+            missing[nmissing++] = i;
+        }
+    }
+    if (nmissing == 0)
+    {
+        dec->done = 1;
+        return 0;
+    }
+
+    for (j = 0; (j < dec->r) && (nrows < nmissing); j++)
+    {
+        if (dec->have_repair[j])
+            rows[nrows++] = j;
+    }
+    if (nrows < nmissing)
+        return 0; //wait for more repair packets
+
+    //s = repair row - contribution of the received packets
+    for (b = 0; b < nmissing; b++)
+    {
+        j = rows[b];
+        memcpy(s[b], dec->repair[j], dec->unit);
+        for (i = 0; i < dec->k; i++)
+        {
+            const unsigned char* media = get_media(dec, dec->base + i, &len);
+            if (!media)
+                continue;
+            unsigned char c = cauchy(j, i);
+            unsigned char l[2] = { len >> 8, len };
+            gf_mul_add(s[b], l, c, 2);
+            gf_mul_add(s[b] + 2, media, c, len);
+        }
+        for (i = 0; i < nmissing; i++)
+            a[b][i] = cauchy(j, missing[i]);
+    }
+
+    //Gauss-Jordan elimination, a * x = s
+    for (i = 0; i < nmissing; i++)
+    {
+        int pivot = i;
+        while (a[pivot][i] == 0)
+            pivot++; //a Cauchy matrix is never singular
+        if (pivot != i)
+        {
+            unsigned char tmp[FEC_MAX_REPAIR];
+            memcpy(tmp, a[i], nmissing);
+            memcpy(a[i], a[pivot], nmissing);
+            memcpy(a[pivot], tmp, nmissing);
+            for (b = 0; b < dec->unit; b++)
+            {
+                unsigned char t = s[i][b];
+                s[i][b] = s[pivot][b];
+                s[pivot][b] = t;
+            }
+        }
+
+        unsigned char inv = gf_inv(a[i][i]);
+        gf_scale(a[i], inv, nmissing);
+        gf_scale(s[i], inv, dec->unit);
+
+        for (b = 0; b < nmissing; b++)
+        {
+            unsigned char c = a[b][i];
+            if (b == i || c == 0)
+                continue;
+            gf_mul_add(a[b], a[i], c, nmissing);
+            gf_mul_add(s[b], s[i], c, dec->unit);
+        }
+    }
+
+    //s[i] is the unit of missing[i]: length then packet
+    int n = 0;
+    for (i = 0; i < nmissing; i++)
+    {
+        len = (s[i][0] << 8) | s[i][1];
+        if (len <= 0 || len > dec->unit - 2 || len > RTP_MAX_MTU)
+            continue;
+
+        uint16_t seq = dec->base + missing[i];
+        int slot = seq % FEC_HISTORY;
+        memcpy(dec->media[slot], s[i] + 2, len);
+        dec->media_len[slot] = len;
+        dec->media_seq[slot] = seq;
+
+        recovered(arg, dec->media[slot], len);
+        n++;
+    }
+
+    dec->done = 1;
+    return n;
+}
+
+/*---------------------------------------------------------------------
+   give every received RTP packet (media or repair) to the decoder
+   recovered : called with each media packet rebuilt from the repairs
+   return    : number of packets recovered by this one
+   media packets are not passed to 'recovered', the caller already has them
+----------------------------------------------------------------------*/
+int fec_decode(fec_decoder_t* dec, const unsigned char* packet, int len,
+        rtp_send_t recovered, void* arg)
+{
+    if (len < RTP_HEADER_SIZE)
+        return 0;
+
+    if ((packet[1] & 0x7f) != FEC_PAYLOAD_TYPE)
+    {
+        if (len > RTP_MAX_MTU)
+            return 0;
+
+        uint16_t seq = packet_seq(packet);
+        int slot = seq % FEC_HISTORY;
+        memcpy(dec->media[slot], packet, len);
+        dec->media_len[slot] = len;
+        dec->media_seq[slot] = seq;
+        return 0;
+    }
+
+    const unsigned char* p = packet + RTP_HEADER_SIZE;
+    int unit = len - RTP_HEADER_SIZE - FEC_HEADER_SIZE;
+    if (unit <= 2 || unit > FEC_MAX_UNIT)
+        return 0;
+
+    uint16_t base = (p[0] << 8) | p[1];
+    int k = p[2];
+    int r = p[3];
+    int j = p[4];
+    if (k == 0 || r == 0 || r > FEC_MAX_REPAIR || j >= r)
+        return 0;
+
+    //first repair packet of a new block
+    if (base != dec->base || k != dec->k || r != dec->r || unit != dec->unit)
+    {
+        dec->base = base;
+        dec->k = k;
+        dec->r = r;
+        dec->unit = unit;
+        dec->done = 0;
+        memset(dec->have_repair, 0, sizeof(dec->have_repair));
+    }
+
+    if (dec->done)
+        return 0;
+
+    memcpy(dec->repair[j], p + FEC_HEADER_SIZE, unit);
+    dec->have_repair[j] = 1;
+
+    return recover(dec, recovered, arg);
+}
@@ -0,0 +1,80 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <stdint.h>
+
+#include "rtp.h"
+#include "udp_batch.h"
+
+//Forward error correction of the RTP packets of a frame
+//The media packets of a batch are a block, 'r' repair packets are added to
+//it (systematic Reed-Solomon code over GF(256), Cauchy matrix). A receiver
+//that gets any 'k' packets out of the 'k + r' recovers the whole block.
+//A frame of more than 'block' packets is split into several batches (see
+//fec_encoder_t), each one is protected on its own.
+
+#define FEC_PAYLOAD_TYPE 97 //dynamic, repair packets
+#define FEC_HEADER_SIZE 6
+//a media packet is protected with its length in front
+#define FEC_MAX_UNIT (RTP_MAX_MTU + 2)
+//a repair packet (its own RTP header, the FEC header, the length and the
+//bytes of a whole media packet) is this much bigger than the longest media
+//packet of its block: packetize the media with an MTU smaller by that
+#define FEC_OVERHEAD (RTP_HEADER_SIZE + FEC_HEADER_SIZE + 2)
+#define FEC_MAX_REPAIR (UDP_BATCH_MAX / 2)
+//media packets kept by the receiver, power of 2
+#define FEC_HISTORY 256
+
+/*
+ Repair packet: RTP header (payload type FEC_PAYLOAD_TYPE, timestamp of the
+ frame, sequence numbers of its own) followed by
+
+ 0      2   3   4   5   6
+ +------+---+---+---+---+-------------------------------------+
+ | base | k | r | j | 0 | repair data of row j (unit length)  |
+ +------+---+---+---+---+-------------------------------------+
+ base : sequence number of the first media packet of the block
+ k    : media packets in the block, r : repair packets, j : this row
+*/
+
+typedef struct
+{
+    double ratio; //repair packets per media packet, 0 : off
+    //most media packets of a block whose repairs fit in the same batch
+    int block;
+    uint16_t seq;
+    uint32_t ssrc;
+
+    //repair rows being computed
+    unsigned char repair[FEC_MAX_REPAIR][FEC_MAX_UNIT];
+    unsigned char packet[RTP_MAX_MTU + RTP_HEADER_SIZE + FEC_HEADER_SIZE + 2];
+} fec_encoder_t;
+
+void fec_encoder_init(fec_encoder_t* fec, double ratio, uint32_t ssrc);
+int fec_protect(fec_encoder_t* fec, udp_batch_t* batch);
+
+//Receiver side
+typedef struct
+{
+    //recent media packets, by sequence number % FEC_HISTORY
+    unsigned char media[FEC_HISTORY][RTP_MAX_MTU];
+    int media_len[FEC_HISTORY];
+    uint16_t media_seq[FEC_HISTORY];
+
+    //repair packets of the current block
+    uint16_t base;
+    int k;
+    int r;
+    int unit;
+    int done;
+    unsigned char repair[FEC_MAX_REPAIR][FEC_MAX_UNIT];
+    int have_repair[FEC_MAX_REPAIR];
+    //missing packets being solved
+    unsigned char solve[FEC_MAX_REPAIR][FEC_MAX_UNIT];
+} fec_decoder_t;
+
+void fec_decoder_init(fec_decoder_t* dec);
+int fec_decode(fec_decoder_t* dec, const unsigned char* packet, int len,
+        rtp_send_t recovered, void* arg);
+
+#endif
@@ -0,0 +1,208 @@
+#include <stdint.h>
+
+#include "h264_nal.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define H264_NAL_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define H264_NAL_NEON
+#endif
+
+//return the position of the next start code (00 00 01), or 'end'
+const unsigned char* h264_find_start_code_scalar(const unsigned char* p,
+        const unsigned char* end)
+{
+    for (; p + 3 <= end; p++)
+    {
+        if (p[2] > 1)
+            p += 2; //p[1..2] cannot be the beginning of a start code
+        else if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+            return p;
+    }
+
+    return end;
+}
+
+#ifdef H264_NAL_SSE2
+//bit i set if a start code begins at p[i], reads p[0..17]
+static int start_codes_16(const unsigned char* p)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i b0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), zero);
+    __m128i b1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 1)),
+            zero);
+    __m128i b2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 2)),
+            _mm_set1_epi8(1));
+
+    return _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(b0, b1), b2));
+}
+
+//any zero byte in p[0..31]
+static int has_zero_32(const unsigned char* p)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), zero);
+    __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 16)),
+            zero);
+
+    return _mm_movemask_epi8(_mm_or_si128(a, b));
+}
+
+static int first_start_code(const unsigned char* p)
+{
+    int mask = start_codes_16(p);
+
+    return mask ? __builtin_ctz(mask) : -1;
+}
+#endif
+
+#ifdef H264_NAL_NEON
+//4 bits per byte, set if a start code begins at p[i], reads p[0..17]
+static uint64_t start_codes_16(const unsigned char* p)
+{
+    uint8x16_t b0 = vceqq_u8(vld1q_u8(p), vdupq_n_u8(0));
+    uint8x16_t b1 = vceqq_u8(vld1q_u8(p + 1), vdupq_n_u8(0));
+    uint8x16_t b2 = vceqq_u8(vld1q_u8(p + 2), vdupq_n_u8(1));
+    uint8x16_t m = vandq_u8(vandq_u8(b0, b1), b2);
+
+    //no movemask on NEON: narrow each byte to a nibble
+    return vget_lane_u64(vreinterpret_u64_u8(
+            vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+}
+
+static int has_zero_32(const unsigned char* p)
+{
+    uint8x16_t z = vorrq_u8(vceqq_u8(vld1q_u8(p), vdupq_n_u8(0)),
+            vceqq_u8(vld1q_u8(p + 16), vdupq_n_u8(0)));
+    uint64x2_t z64 = vreinterpretq_u64_u8(z);
+
+    return (vgetq_lane_u64(z64, 0) | vgetq_lane_u64(z64, 1)) != 0;
+}
+
+static int first_start_code(const unsigned char* p)
+{
+    uint64_t mask = start_codes_16(p);
+
+    return mask ? __builtin_ctzll(mask) >> 2 : -1;
+}
+#endif
+
+/*---------------------------------------------------------------------
+   return the position of the next start code (00 00 01), or 'end'
+   A start code begins on a zero byte: the blocks of 32 bytes without
+   any are skipped, the others are matched 16 bytes at a time. Same
+   result as h264_find_start_code_scalar().
+----------------------------------------------------------------------*/
+const unsigned char* h264_find_start_code(const unsigned char* p,
+        const unsigned char* end)
+{
+#if defined(H264_NAL_SSE2) || defined(H264_NAL_NEON)
+    //2 bytes more than the block are read
+    while (end - p >= 32 + 2)
+    {
+        if (has_zero_32(p))
+        {
+            int i = first_start_code(p);
+            if (i >= 0)
+                return p + i;
+            i = first_start_code(p + 16);
+            if (i >= 0)
+                return p + 16 + i;
+        }
+        p += 32;
+    }
+#endif
+
+    return h264_find_start_code_scalar(p, end);
+}
+
+void h264_nal_reader_init(h264_nal_reader_t* reader, const unsigned char* data,
+        int len)
+{
+    reader->begin = data;
+    reader->end = data + len;
+    reader->p = h264_find_start_code(data, reader->end);
+}
+
+/*---------------------------------------------------------------------
+   next NAL unit of the buffer, the empty ones are skipped
+   The zeros before a start code belong to it (4 bytes start code or
+   trailing_zero_8bits), not to the NAL unit before.
+   return : 1, 0 after the last one
+----------------------------------------------------------------------*/
+int h264_next_nal(h264_nal_reader_t* reader, h264_nal_t* nal)
+{
+    while (reader->p < reader->end)
+    {
+        const unsigned char* start = reader->p + 3;
+        const unsigned char* next = h264_find_start_code(start, reader->end);
+        const unsigned char* nal_end = next;
+        while (nal_end > start && nal_end[-1] == 0)
+            nal_end--;
+
+        nal->start_code_len = (reader->p > reader->begin && reader->p[-1] == 0)
+                ? 4 : 3;
+        reader->p = next;
+        if (nal_end > start)
+        {
+            nal->data = start;
+            nal->len = nal_end - start;
+            nal->type = start[0] & 0x1f;
+            nal->last = (next == reader->end);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+   type of the frame in a buffer: the type of its first slice (IDR or
+   not), of its first NAL unit if it has no slice (SPS, PPS, SEI)
+   return : NAL_TYPE_xxx, 0 if there is no NAL unit
+----------------------------------------------------------------------*/
+int h264_nal_type(const unsigned char* data, int len)
+{
+    h264_nal_reader_t reader;
+    h264_nal_t nal;
+    int type = 0;
+
+    h264_nal_reader_init(&reader, data, len);
+    while (h264_next_nal(&reader, &nal))
+    {
+        if (nal.type >= NAL_TYPE_SLICE && nal.type <= NAL_TYPE_IDR)
+            return nal.type;
+        if (type == 0)
+            type = nal.type;
+    }
+
+    return type;
+}
+
+/*---------------------------------------------------------------------
+   the RBSP of a NAL unit: the emulation prevention bytes (the 03 of
+   00 00 03) taken out, to read its syntax elements
+   out : room for 'len' bytes, can be 'nal'
+   return : bytes in out
+----------------------------------------------------------------------*/
+int h264_rbsp(const unsigned char* nal, int len, unsigned char* out)
+{
+    int zeros = 0;
+    int n = 0;
+    int i;
+
+    for (i = 0; i < len; i++)
+    {
+        if (zeros >= 2 && nal[i] == 3)
+        {
+            zeros = 0;
+            continue;
+        }
+        zeros = (nal[i] == 0) ? zeros + 1 : 0;
+        out[n++] = nal[i];
+    }
+
+    return n;
+}
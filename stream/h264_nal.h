@@ -0,0 +1,46 @@
+#ifndef H264_NAL_H
+#define H264_NAL_H
+
+//Annex-B parser: the NAL units of a buffer of the encoder
+//A buffer can hold several NAL units (SPS + PPS + IDR), each after a
+//3 bytes (00 00 01) or 4 bytes (00 00 00 01) start code. The start codes
+//are searched 16 bytes at a time with SSE2 or NEON when the compiler has
+//them, byte by byte otherwise.
+
+//NAL unit types (nal_unit_type, 5 low bits of the header)
+#define NAL_TYPE_SLICE 1
+#define NAL_TYPE_IDR 5
+#define NAL_TYPE_SEI 6
+#define NAL_TYPE_SPS 7
+#define NAL_TYPE_PPS 8
+#define NAL_TYPE_AUD 9
+
+typedef struct
+{
+    const unsigned char* data; //header byte first, no start code
+    int len;                   //trailing zeros left out
+    int type;
+    int start_code_len;        //3 or 4
+    int last;                  //last NAL unit of the buffer
+} h264_nal_t;
+
+typedef struct
+{
+    const unsigned char* begin;
+    const unsigned char* p; //next start code
+    const unsigned char* end;
+} h264_nal_reader_t;
+
+const unsigned char* h264_find_start_code(const unsigned char* p,
+        const unsigned char* end);
+const unsigned char* h264_find_start_code_scalar(const unsigned char* p,
+        const unsigned char* end);
+
+void h264_nal_reader_init(h264_nal_reader_t* reader, const unsigned char* data,
+        int len);
+int h264_next_nal(h264_nal_reader_t* reader, h264_nal_t* nal);
+
+int h264_nal_type(const unsigned char* data, int len);
+int h264_rbsp(const unsigned char* nal, int len, unsigned char* out);
+
+#endif
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "h264_nal.h"
+#include "h264_params.h"
+
+void h264_params_init(h264_params_t* params)
+{
+    params->sps_len = 0;
+    params->pps_len = 0;
+    params->repeat = 0;
+    params->sent = 0;
+    params->resend = 1;
+    pthread_mutex_init(&params->lock, NULL);
+}
+
+void h264_params_deinit(h264_params_t* params)
+{
+    pthread_mutex_destroy(&params->lock);
+}
+
+/*---------------------------------------------------------------------
+   keep the SPS/PPS of an Annex-B buffer, other NAL units are skipped
+----------------------------------------------------------------------*/
+void h264_params_update(h264_params_t* params, const unsigned char* data,
+        int len)
+{
+    h264_nal_reader_t reader;
+    h264_nal_t nal;
+
+    h264_nal_reader_init(&reader, data, len);
+    while (h264_next_nal(&reader, &nal))
+    {
+        if (nal.len <= H264_PARAMS_MAX
+                && (nal.type == NAL_TYPE_SPS || nal.type == NAL_TYPE_PPS))
+        {
+            pthread_mutex_lock(&params->lock);
+            if (nal.type == NAL_TYPE_SPS)
+            {
+                memcpy(params->sps, nal.data, nal.len);
+                params->sps_len = nal.len;
+            }
+            else
+            {
+                memcpy(params->pps, nal.data, nal.len);
+                params->pps_len = nal.len;
+            }
+            pthread_mutex_unlock(&params->lock);
+        }
+    }
+}
+
+//base64 (RFC 4648) of 'len' bytes, return the length written
+static int base64(const unsigned char* in, int len, char* out)
+{
+    static const char table[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    int n = 0;
+    int i;
+
+    for (i = 0; i < len; i += 3)
+    {
+        int v = in[i] << 16;
+        if (i + 1 < len)
+            v |= in[i + 1] << 8;
+        if (i + 2 < len)
+            v |= in[i + 2];
+
+        out[n++] = table[(v >> 18) & 0x3f];
+        out[n++] = table[(v >> 12) & 0x3f];
+        out[n++] = (i + 1 < len) ? table[(v >> 6) & 0x3f] : '=';
+        out[n++] = (i + 2 < len) ? table[v & 0x3f] : '=';
+    }
+    out[n] = 0;
+
+    return n;
+}
+
+/*---------------------------------------------------------------------
+   SDP fmtp parameters of the stream (RFC 6184)
+   "profile-level-id=...;sprop-parameter-sets=<SPS>,<PPS>"
+   return : length written, 0 if no SPS/PPS was seen yet
+----------------------------------------------------------------------*/
+int h264_params_fmtp(h264_params_t* params, char* out, int size)
+{
+    char sps[(H264_PARAMS_MAX + 2) / 3 * 4 + 1];
+    char pps[(H264_PARAMS_MAX + 2) / 3 * 4 + 1];
+    int profile = 0;
+    int n = 0;
+
+    pthread_mutex_lock(&params->lock);
+    if (params->sps_len >= 4 && params->pps_len > 0)
+    {
+        //profile_idc, constraint flags, level_idc follow the NAL header
+        profile = (params->sps[1] << 16) | (params->sps[2] << 8)
+                | params->sps[3];
+        base64(params->sps, params->sps_len, sps);
+        base64(params->pps, params->pps_len, pps);
+        n = 1;
+    }
+    pthread_mutex_unlock(&params->lock);
+
+    if (n == 0)
+        return 0;
+
+    n = snprintf(out, size, "profile-level-id=%06X;sprop-parameter-sets=%s,%s",
+            profile, sps, pps);
+    if (n < 0 || n >= size)
+        return 0;
+
+    return n;
+}
+
+//append a NAL unit with a 4 bytes start code
+static int put_nal(unsigned char* out, const unsigned char* nal, int len)
+{
+    out[0] = 0;
+    out[1] = 0;
+    out[2] = 0;
+    out[3] = 1;
+    memcpy(out + 4, nal, len);
+
+    return 4 + len;
+}
+
+/*---------------------------------------------------------------------
+   the SPS and PPS as an Annex-B buffer, to send in front of an IDR
+   return : length written, 0 if no SPS/PPS was seen yet or no room
+----------------------------------------------------------------------*/
+int h264_params_annexb(h264_params_t* params, unsigned char* out, int size)
+{
+    int n = 0;
+
+    pthread_mutex_lock(&params->lock);
+    if (params->sps_len > 0 && params->pps_len > 0
+            && 8 + params->sps_len + params->pps_len <= size)
+    {
+        n = put_nal(out, params->sps, params->sps_len);
+        n += put_nal(out + n, params->pps, params->pps_len);
+    }
+    pthread_mutex_unlock(&params->lock);
+
+    return n;
+}
+
+//the next IDR carries the SPS/PPS, whatever the repeat interval
+//can be called from another thread than the encoding one
+void h264_params_resend(h264_params_t* params)
+{
+    pthread_mutex_lock(&params->lock);
+    params->resend = 1;
+    pthread_mutex_unlock(&params->lock);
+}
+
+/*---------------------------------------------------------------------
+   SPS/PPS to send in front of a frame of the encoder
+   Only an IDR gets them: when a viewer joined or asked for an IDR since
+   the last copy, or 'repeat' us after it. A frame that already carries
+   them counts as a copy.
+   now : us, the clock of 'repeat'
+   return : length written in out, 0 : nothing to send
+----------------------------------------------------------------------*/
+int h264_params_inject(h264_params_t* params, const unsigned char* frame,
+        int len, uint64_t now, unsigned char* out, int size)
+{
+    h264_nal_reader_t reader;
+    h264_nal_t nal;
+    int in_band = 0;
+    int type = 0;
+    int n = 0;
+
+    h264_nal_reader_init(&reader, frame, len);
+    while (type == 0 && h264_next_nal(&reader, &nal))
+    {
+        if (nal.type == NAL_TYPE_SPS)
+            in_band = 1;
+        if (nal.type >= NAL_TYPE_SLICE && nal.type <= NAL_TYPE_IDR)
+            type = nal.type;
+    }
+    if (type != NAL_TYPE_IDR)
+        return 0;
+
+    pthread_mutex_lock(&params->lock);
+    if (!in_band && (params->resend || params->repeat == 0
+            || now - params->sent >= params->repeat))
+    {
+        pthread_mutex_unlock(&params->lock);
+        n = h264_params_annexb(params, out, size);
+        pthread_mutex_lock(&params->lock);
+    }
+    if (in_band || n > 0)
+    {
+        params->resend = 0;
+        params->sent = now;
+    }
+    pthread_mutex_unlock(&params->lock);
+
+    return n;
+}
+
+/*---------------------------------------------------------------------
+   offset of the first NAL unit of a frame that is not a SPS or PPS, to
+   send a frame of an encoder with inline headers without them
+----------------------------------------------------------------------*/
+int h264_params_skip(const unsigned char* frame, int len)
+{
+    h264_nal_reader_t reader;
+    h264_nal_t nal;
+
+    h264_nal_reader_init(&reader, frame, len);
+    while (h264_next_nal(&reader, &nal))
+    {
+        if (nal.type != NAL_TYPE_SPS && nal.type != NAL_TYPE_PPS)
+            return nal.data - nal.start_code_len - frame;
+    }
+
+    return len;
+}
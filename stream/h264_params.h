@@ -0,0 +1,37 @@
+#ifndef H264_PARAMS_H
+#define H264_PARAMS_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+//SPS/PPS of a stream, kept from the encoder output to describe the stream
+//to the viewers that join later (SDP sprop-parameter-sets), and put in band
+//in front of the IDRs that need them instead of in front of every frame
+#define H264_PARAMS_MAX 128
+
+typedef struct
+{
+    pthread_mutex_t lock; //updated by the encoder, read by the server
+    unsigned char sps[H264_PARAMS_MAX];
+    int sps_len;
+    unsigned char pps[H264_PARAMS_MAX];
+    int pps_len;
+
+    uint64_t repeat; //us between two copies in band, 0 : every IDR
+    uint64_t sent;   //time of the last copy in band
+    int resend;      //a viewer joined or lost the picture: next IDR
+} h264_params_t;
+
+void h264_params_init(h264_params_t* params);
+void h264_params_deinit(h264_params_t* params);
+void h264_params_update(h264_params_t* params, const unsigned char* data,
+        int len);
+int h264_params_fmtp(h264_params_t* params, char* out, int size);
+
+int h264_params_annexb(h264_params_t* params, unsigned char* out, int size);
+void h264_params_resend(h264_params_t* params);
+int h264_params_inject(h264_params_t* params, const unsigned char* frame,
+        int len, uint64_t now, unsigned char* out, int size);
+int h264_params_skip(const unsigned char* frame, int len);
+
+#endif
@@ -0,0 +1,247 @@
+#define _GNU_SOURCE //sendmmsg()
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/timerfd.h>
+
+#include "pacer.h"
+
+//not in the headers of older libc
+#ifndef SO_MAX_PACING_RATE
+#define SO_MAX_PACING_RATE 47
+#endif
+#ifndef SO_TXTIME
+#define SO_TXTIME 61
+#endif
+#ifndef SCM_TXTIME
+#define SCM_TXTIME SO_TXTIME
+#endif
+
+//struct sock_txtime of <linux/net_tstamp.h>, Linux 4.19 or later
+typedef struct
+{
+    clockid_t clockid;
+    uint32_t flags;
+} txtime_config_t;
+
+static const char* mode_name[] = { "SO_TXTIME", "timerfd", "off" };
+
+static uint64_t now_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/*---------------------------------------------------------------------
+   init the pacer of one destination
+   mode     : PACER_TXTIME needs the fq qdisc on the interface, without
+              it the kernel sends at once; it falls back to PACER_TIMER
+              when the socket does not know SO_TXTIME
+   window   : a frame is spread over 'window' us, 0 : no pacing
+   max_rate : SO_MAX_PACING_RATE of the socket in bytes/s, 0 : unchanged
+----------------------------------------------------------------------*/
+void pacer_init(pacer_t* pacer, int sock, pacer_mode_t mode,
+        uint64_t window, uint32_t max_rate)
+{
+    pacer->window = window;
+    pacer->timerfd = -1;
+    pacer->next = 0;
+
+    //a cap for the fq qdisc, ignored by the others
+    if (max_rate && setsockopt(sock, SOL_SOCKET, SO_MAX_PACING_RATE,
+            &max_rate, sizeof(max_rate)) == -1)
+        fprintf(stderr, "pacer : SO_MAX_PACING_RATE: %s\n", strerror(errno));
+
+    if (window == 0)
+        mode = PACER_OFF;
+
+    if (mode == PACER_TXTIME)
+    {
+        txtime_config_t config = { CLOCK_MONOTONIC, 0 };
+        if (setsockopt(sock, SOL_SOCKET, SO_TXTIME, &config,
+                sizeof(config)) == -1)
+            mode = PACER_TIMER;
+    }
+
+    if (mode == PACER_TIMER)
+    {
+        pacer->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        if (pacer->timerfd == -1)
+        {
+            fprintf(stderr, "pacer : timerfd_create: %s\n", strerror(errno));
+            mode = PACER_OFF;
+        }
+    }
+
+    pacer->mode = mode;
+    printf("pacer : %s, frames spread over %" PRIu64 " us\n",
+            mode_name[mode], window);
+}
+
+void pacer_deinit(pacer_t* pacer)
+{
+    if (pacer->timerfd != -1)
+        close(pacer->timerfd);
+    pacer->timerfd = -1;
+}
+
+//sleep until 't' (us, CLOCK_MONOTONIC)
+static void wait_until(pacer_t* pacer, uint64_t t)
+{
+    struct itimerspec spec;
+    uint64_t expirations;
+
+    if (t <= now_us())
+        return;
+
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = t / 1000000;
+    spec.it_value.tv_nsec = (t % 1000000) * 1000;
+    if (timerfd_settime(pacer->timerfd, TFD_TIMER_ABSTIME, &spec, NULL) == -1)
+        return;
+
+    //interrupted or not, the datagrams are sent
+    if (read(pacer->timerfd, &expirations, sizeof(expirations)) == -1)
+        return;
+}
+
+//every datagram carries its departure time, one sendmmsg() for the frame
+static int send_txtime(udp_batch_t* batch, int count, int sock,
+        const struct sockaddr_in* addr, uint64_t start, double rate)
+{
+    struct mmsghdr msgs[UDP_BATCH_MAX];
+    struct iovec iovs[UDP_BATCH_MAX];
+    char control[UDP_BATCH_MAX][CMSG_SPACE(sizeof(uint64_t))];
+    int calls = 0;
+    int sent = 0; //bytes before the datagram
+    int i;
+
+    memset(msgs, 0, sizeof(struct mmsghdr) * count);
+    memset(control, 0, sizeof(control[0]) * count);
+    for (i = 0; i < count; i++)
+    {
+        iovs[i].iov_base = batch->data + batch->offset[i];
+        iovs[i].iov_len = batch->len[i];
+        msgs[i].msg_hdr.msg_name = (void *) addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(*addr);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = control[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_TXTIME;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+        uint64_t txtime = (start + (uint64_t)(sent / rate)) * 1000; //ns
+        memcpy(CMSG_DATA(cmsg), &txtime, sizeof(txtime));
+
+        sent += batch->len[i];
+    }
+
+    i = 0;
+    while (i < count)
+    {
+        calls++;
+        int n = sendmmsg(sock, msgs + i, count - i, 0);
+        if (n == -1)
+            return -1;
+        i += n;
+    }
+
+    return calls;
+}
+
+/*---------------------------------------------------------------------
+   send the first 'count' datagrams of the batch to 'addr', spread over
+   the window
+   a new frame is not started before the end of the previous one
+   blocks until the last burst is sent (PACER_TIMER)
+   mode : see udp_batch_send_mode(), the batch is only read
+   return : number of send syscalls, -1 if some datagrams were not sent
+----------------------------------------------------------------------*/
+int pacer_send(pacer_t* pacer, udp_batch_t* batch, int count,
+        udp_send_mode_t* mode, int sock, const struct sockaddr_in* addr)
+{
+    int size = 0;
+    int i;
+
+    for (i = 0; i < count; i++)
+        size += batch->len[i];
+
+    if ((pacer->mode == PACER_OFF) || (size <= PACER_BURST))
+        return udp_batch_send_mode(batch, mode, sock, addr, 0, count);
+
+    uint64_t now = now_us();
+    uint64_t start = (pacer->next > now) ? pacer->next : now;
+    //refill rate of the bucket for this frame, in bytes per us
+    double rate = (double) size / pacer->window;
+    pacer->next = start + pacer->window;
+
+    if (pacer->mode == PACER_TXTIME)
+    {
+        int r = send_txtime(batch, count, sock, addr, start, rate);
+        if ((r != -1) || (errno != EINVAL && errno != EOPNOTSUPP))
+            return r;
+
+        //the route does not take SO_TXTIME
+        fprintf(stderr, "pacer : SO_TXTIME failed, fall back to timerfd\n");
+        pacer->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        if (pacer->timerfd == -1)
+        {
+            pacer->mode = PACER_OFF;
+            return udp_batch_send_mode(batch, mode, sock, addr, 0, count);
+        }
+        pacer->mode = PACER_TIMER;
+    }
+
+    //bursts of PACER_BURST bytes, each one when the bucket has the tokens
+    int calls = 0;
+    int sent = 0; //bytes
+    int first = 0;
+    while (first < count)
+    {
+        int burst = 0;
+        int bytes = 0;
+        while ((first + burst < count)
+                && ((burst == 0)
+                    || (bytes + batch->len[first + burst] <= PACER_BURST)))
+        {
+            bytes += batch->len[first + burst];
+            burst++;
+        }
+
+        wait_until(pacer, start + (uint64_t)(sent / rate));
+
+        int r = udp_batch_send_mode(batch, mode, sock, addr, first, burst);
+        if (r == -1)
+            return -1;
+
+        calls += r;
+        sent += bytes;
+        first += burst;
+    }
+
+    return calls;
+}
+
+//pacer_send() then empty the batch, like udp_batch_flush()
+int pacer_flush(pacer_t* pacer, udp_batch_t* batch, int sock,
+        const struct sockaddr_in* addr)
+{
+    int r = pacer_send(pacer, batch, batch->count, &batch->mode, sock, addr);
+
+    if (r > 0)
+        batch->calls += r;
+    batch->packets += batch->count;
+    udp_batch_clear(batch);
+
+    return (r == -1) ? -1 : 0;
+}
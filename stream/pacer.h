@@ -0,0 +1,39 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "udp_batch.h"
+
+//Bytes that can leave back to back (depth of the token bucket), a frame
+//smaller than that is sent at once
+#define PACER_BURST (4 * RTP_DEFAULT_MTU)
+
+typedef enum
+{
+    PACER_TXTIME, //the kernel sends each datagram at its time (SO_TXTIME)
+    PACER_TIMER,  //the thread sleeps on a timerfd between bursts
+    PACER_OFF,    //no pacing
+} pacer_mode_t;
+
+//Token bucket spreading each frame over 'window'
+//the refill rate is set for every frame: its size / window
+typedef struct
+{
+    pacer_mode_t mode;
+    uint64_t window; //us
+    int timerfd;
+    uint64_t next;   //us, end of the previous paced frame
+} pacer_t;
+
+void pacer_init(pacer_t* pacer, int sock, pacer_mode_t mode,
+        uint64_t window, uint32_t max_rate);
+void pacer_deinit(pacer_t* pacer);
+
+int pacer_send(pacer_t* pacer, udp_batch_t* batch, int count,
+        udp_send_mode_t* mode, int sock, const struct sockaddr_in* addr);
+int pacer_flush(pacer_t* pacer, udp_batch_t* batch, int sock,
+        const struct sockaddr_in* addr);
+
+#endif
@@ -0,0 +1,216 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "rtp.h"
+
+/*---------------------------------------------------------------------
+   init the packetizer of one RTP stream
+   mtu  : max RTP packet size, 0 for RTP_DEFAULT_MTU
+   send : called for every packet built, with 'arg'
+----------------------------------------------------------------------*/
+void rtp_packetizer_init(rtp_packetizer_t* rtp, int mtu, uint32_t ssrc,
+        rtp_send_t send, void* arg)
+{
+    memset(rtp, 0, sizeof(*rtp));
+
+    if (mtu <= 0)
+        mtu = RTP_DEFAULT_MTU;
+    if (mtu > RTP_MAX_MTU)
+        mtu = RTP_MAX_MTU;
+
+    rtp->mtu = mtu;
+    rtp->payload_type = RTP_H264_PAYLOAD_TYPE;
+    rtp->seq = rand() & 0xffff; //random initial value, RFC 3550
+    rtp->ssrc = ssrc;
+    rtp->send = send;
+    rtp->arg = arg;
+}
+
+//microseconds to the 90kHz RTP clock, wraps around as RTP expects
+uint32_t rtp_timestamp(uint64_t us)
+{
+    return (uint32_t)(us * 9 / 100);
+}
+
+static void write_header(rtp_packetizer_t* rtp, uint32_t timestamp,
+        int marker)
+{
+    unsigned char* p = rtp->packet;
+
+    p[0] = 0x80; //V=2, no padding, no extension, no CSRC
+    p[1] = (marker ? 0x80 : 0) | rtp->payload_type;
+    p[2] = rtp->seq >> 8;
+    p[3] = rtp->seq;
+    p[4] = timestamp >> 24;
+    p[5] = timestamp >> 16;
+    p[6] = timestamp >> 8;
+    p[7] = timestamp;
+    p[8] = rtp->ssrc >> 24;
+    p[9] = rtp->ssrc >> 16;
+    p[10] = rtp->ssrc >> 8;
+    p[11] = rtp->ssrc;
+}
+
+//send the packet built in rtp->packet, 'len' includes the RTP header
+static int send_packet(rtp_packetizer_t* rtp, int len)
+{
+    rtp->seq++;
+    rtp->packet_count++;
+    rtp->octet_count += len - RTP_HEADER_SIZE;
+
+    return rtp->send(rtp->arg, rtp->packet, len);
+}
+
+//Single NAL unit packet
+static int send_single(rtp_packetizer_t* rtp, const unsigned char* nal,
+        int len, uint32_t timestamp, int marker)
+{
+    write_header(rtp, timestamp, marker);
+    memcpy(rtp->packet + RTP_HEADER_SIZE, nal, len);
+
+    return send_packet(rtp, RTP_HEADER_SIZE + len);
+}
+
+//FU-A, the NAL header is replaced by the FU indicator and FU header
+static int send_fu_a(rtp_packetizer_t* rtp, const unsigned char* nal,
+        int len, uint32_t timestamp, int marker)
+{
+    unsigned char indicator = (nal[0] & 0xe0) | NAL_TYPE_FU_A;
+    unsigned char type = nal[0] & 0x1f;
+    int max_fragment = rtp->mtu - RTP_HEADER_SIZE - 2;
+
+    //skip the NAL header, it is rebuilt by the receiver from the FU bytes
+    nal++;
+    len--;
+
+    int start = 1;
+    while (len > 0)
+    {
+        int n = (len > max_fragment) ? max_fragment : len;
+        int end = (n == len);
+
+        write_header(rtp, timestamp, marker && end);
+        rtp->packet[RTP_HEADER_SIZE] = indicator;
+        rtp->packet[RTP_HEADER_SIZE + 1] =
+                (start ? 0x80 : 0) | (end ? 0x40 : 0) | type;
+        memcpy(rtp->packet + RTP_HEADER_SIZE + 2, nal, n);
+
+        if (send_packet(rtp, RTP_HEADER_SIZE + 2 + n) == -1)
+            return -1;
+
+        nal += n;
+        len -= n;
+        start = 0;
+    }
+
+    return 0;
+}
+
+static int send_nal(rtp_packetizer_t* rtp, const unsigned char* nal,
+        int len, uint32_t timestamp, int marker)
+{
+    if (len <= rtp->mtu - RTP_HEADER_SIZE)
+        return send_single(rtp, nal, len, timestamp, marker);
+    else
+        return send_fu_a(rtp, nal, len, timestamp, marker);
+}
+
+/*---------------------------------------------------------------------
+   send the pending SPS/PPS
+   a single pending NAL unit is sent as it is, more as one STAP-A
+----------------------------------------------------------------------*/
+int rtp_flush(rtp_packetizer_t* rtp, uint32_t timestamp)
+{
+    int r;
+
+    if (rtp->stap_len == 0)
+        return 0;
+
+    int first_len = (rtp->stap[1] << 8) | rtp->stap[2];
+    if (3 + first_len == rtp->stap_len)
+        r = send_single(rtp, rtp->stap + 3, first_len, timestamp, 0);
+    else
+    {
+        write_header(rtp, timestamp, 0);
+        memcpy(rtp->packet + RTP_HEADER_SIZE, rtp->stap, rtp->stap_len);
+        r = send_packet(rtp, RTP_HEADER_SIZE + rtp->stap_len);
+    }
+
+    rtp->stap_len = 0;
+    return r;
+}
+
+//keep a SPS/PPS to aggregate it with the next one
+static int add_to_stap(rtp_packetizer_t* rtp, const unsigned char* nal,
+        int len, uint32_t timestamp)
+{
+    int max_stap = rtp->mtu - RTP_HEADER_SIZE;
+
+    //does not fit even alone
+    if (1 + 2 + len > max_stap)
+    {
+        if (rtp_flush(rtp, timestamp) == -1)
+            return -1;
+        return send_nal(rtp, nal, len, timestamp, 0);
+    }
+
+    if (rtp->stap_len + 2 + len > max_stap)
+    {
+        if (rtp_flush(rtp, timestamp) == -1)
+            return -1;
+    }
+
+    if (rtp->stap_len == 0)
+    {
+        rtp->stap[0] = NAL_TYPE_STAP_A;
+        rtp->stap_len = 1;
+    }
+    //F is the OR of the aggregated F bits, NRI their maximum
+    unsigned char f = (rtp->stap[0] | nal[0]) & 0x80;
+    unsigned char nri = rtp->stap[0] & 0x60;
+    if ((nal[0] & 0x60) > nri)
+        nri = nal[0] & 0x60;
+    rtp->stap[0] = f | nri | NAL_TYPE_STAP_A;
+
+    rtp->stap[rtp->stap_len] = len >> 8;
+    rtp->stap[rtp->stap_len + 1] = len;
+    memcpy(rtp->stap + rtp->stap_len + 2, nal, len);
+    rtp->stap_len += 2 + len;
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+   packetize an Annex-B buffer (one or more NAL units with start codes)
+   timestamp    : 90kHz RTP timestamp of the frame, see rtp_timestamp()
+   end_of_frame : the buffer ends the frame, the marker bit is set on
+                  its last packet
+   SPS/PPS are kept and sent in one STAP-A before the next NAL unit
+   return : 0, -1 if a packet could not be sent
+----------------------------------------------------------------------*/
+int rtp_send_frame(rtp_packetizer_t* rtp, const unsigned char* data, int len,
+        uint32_t timestamp, int end_of_frame)
+{
+    h264_nal_reader_t reader;
+    h264_nal_t nal;
+
+    h264_nal_reader_init(&reader, data, len);
+    while (h264_next_nal(&reader, &nal))
+    {
+        if ((nal.type == NAL_TYPE_SPS) || (nal.type == NAL_TYPE_PPS))
+        {
+            if (add_to_stap(rtp, nal.data, nal.len, timestamp) == -1)
+                return -1;
+        }
+        else
+        {
+            if (rtp_flush(rtp, timestamp) == -1)
+                return -1;
+            if (send_nal(rtp, nal.data, nal.len, timestamp,
+                    end_of_frame && nal.last) == -1)
+                return -1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,58 @@
+#ifndef RTP_H
+#define RTP_H
+
+#include <stdint.h>
+
+#include "h264_nal.h"
+
+//RTP payload format for H.264 (RFC 6184), non-interleaved mode
+//Single NAL unit packets, STAP-A for SPS/PPS and FU-A for big NAL units
+
+//Max size of a RTP packet (header included), must fit in the path MTU
+//with the IP and UDP headers
+#define RTP_DEFAULT_MTU 1400
+#define RTP_MAX_MTU 1500
+
+#define RTP_HEADER_SIZE 12
+#define RTP_H264_PAYLOAD_TYPE 96 //dynamic
+#define RTP_H264_CLOCK_RATE 90000
+
+//NAL unit types of the payload format
+#define NAL_TYPE_STAP_A 24
+#define NAL_TYPE_FU_A 28
+
+//Called for every RTP packet built, returns -1 if it could not be sent
+typedef int (*rtp_send_t)(void* arg, const unsigned char* packet, int len);
+
+typedef struct rtp_packetizer_t
+{
+    int mtu;
+    uint8_t payload_type;
+    uint16_t seq;
+    uint32_t ssrc;
+
+    //SPS/PPS waiting to be sent in one STAP-A with the next frame
+    unsigned char stap[RTP_MAX_MTU];
+    int stap_len;
+
+    //the packet being built, the source buffer is never modified
+    unsigned char packet[RTP_MAX_MTU];
+
+    rtp_send_t send;
+    void* arg;
+
+    //statistics
+    uint32_t packet_count;
+    uint32_t octet_count;
+} rtp_packetizer_t;
+
+void rtp_packetizer_init(rtp_packetizer_t* rtp, int mtu, uint32_t ssrc,
+        rtp_send_t send, void* arg);
+
+int rtp_send_frame(rtp_packetizer_t* rtp, const unsigned char* data, int len,
+        uint32_t timestamp, int end_of_frame);
+int rtp_flush(rtp_packetizer_t* rtp, uint32_t timestamp);
+
+uint32_t rtp_timestamp(uint64_t us);
+
+#endif
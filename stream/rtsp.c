@@ -0,0 +1,708 @@
+#define _GNU_SOURCE //accept4()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "rtsp.h"
+
+#define RTSP_PUBLIC "OPTIONS, DESCRIBE, SETUP, PLAY, TEARDOWN, GET_PARAMETER"
+
+/*---------------------------------------------------------------------
+   init the server, it listens on 'port' but serves nothing before
+   rtsp_server_start()
+   play, stop : a session starts and stops playing
+   return : 0, -1 if the port cannot be used
+----------------------------------------------------------------------*/
+int rtsp_server_init(rtsp_server_t* server, short port,
+        int (*play)(void* arg), void (*stop)(void* arg), void* arg)
+{
+    struct sockaddr_in addr;
+    int optval = 1;
+
+    memset(server, 0, sizeof(*server));
+    server->play = play;
+    server->stop = stop;
+    server->arg = arg;
+    server->epfd = -1;
+
+    server->listenfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (server->listenfd < 0)
+    {
+        fprintf(stderr, "rtsp : socket: %s\n", strerror(errno));
+        return -1;
+    }
+    setsockopt(server->listenfd, SOL_SOCKET, SO_REUSEADDR, &optval,
+            sizeof(optval));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(server->listenfd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+            || listen(server->listenfd, 16) < 0)
+    {
+        fprintf(stderr, "rtsp : cannot listen on port %d: %s\n", port,
+                strerror(errno));
+        close(server->listenfd);
+        server->listenfd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+//UDP socket of the RTCP of a track, on 'port' or else any free port
+//return : the socket, -1 on error
+static int open_rtcp(int port, int* bound)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+    {
+        fprintf(stderr, "rtsp : socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        //players send to server_port + 1 whatever is advertised, the
+        //others use the port of the reply
+        fprintf(stderr, "rtsp : RTCP port %d: %s\n", port, strerror(errno));
+        addr.sin_port = 0;
+        if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+        {
+            close(sock);
+            return -1;
+        }
+    }
+    getsockname(sock, (struct sockaddr*)&addr, &len);
+    *bound = ntohs(addr.sin_port);
+
+    return sock;
+}
+
+/*---------------------------------------------------------------------
+   add a stream, the first one is "track0"
+   return : number of the track, -1 if there are too many
+----------------------------------------------------------------------*/
+int rtsp_server_add_track(rtsp_server_t* server, fanout_t* fanout,
+        h264_params_t* params, void (*request_idr)(void))
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int i;
+
+    if (server->ntracks == RTSP_MAX_TRACKS)
+        return -1;
+
+    rtsp_track_t* track = &server->tracks[server->ntracks];
+    track->fanout = fanout;
+    track->params = params;
+    track->request_idr = request_idr;
+    track->server_port = 0;
+    if (getsockname(fanout->sock, (struct sockaddr*)&addr, &len) == 0)
+        track->server_port = ntohs(addr.sin_port);
+
+    track->rtcp_sock = -1;
+    track->rtcp_port = 0;
+    for (i = 0; i < server->ntracks; i++)
+    {
+        if (server->tracks[i].server_port == track->server_port)
+        {
+            track->rtcp_sock = server->tracks[i].rtcp_sock;
+            track->rtcp_port = server->tracks[i].rtcp_port;
+            break;
+        }
+    }
+    if (i == server->ntracks && track->server_port != 0)
+        track->rtcp_sock = open_rtcp(track->server_port + 1,
+                &track->rtcp_port);
+
+    return server->ntracks++;
+}
+
+//first track of its RTCP socket, the one that owns it
+static int rtcp_owner(rtsp_server_t* server, int track)
+{
+    int i;
+
+    for (i = 0; i < track; i++)
+    {
+        if (server->tracks[i].rtcp_sock == server->tracks[track].rtcp_sock)
+            return 0;
+    }
+
+    return server->tracks[track].rtcp_sock != -1;
+}
+
+//value of a header of the request, NULL if it is not there
+static const char* get_header(const char* msg, const char* name, int* len)
+{
+    int name_len = strlen(name);
+    const char* line = strstr(msg, "\r\n");
+
+    while (line && line[2] != '\r')
+    {
+        line += 2;
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':')
+        {
+            const char* value = line + name_len + 1;
+            while (*value == ' ')
+                value++;
+            *len = strcspn(value, "\r\n");
+            return value;
+        }
+        line = strstr(line, "\r\n");
+    }
+
+    return NULL;
+}
+
+//"trackN" at the end of the URL, -1 if there is none
+static int url_track(rtsp_server_t* server, const char* url)
+{
+    const char* p = strstr(url, "/track");
+    int track;
+
+    if (!p)
+        return (server->ntracks == 1) ? 0 : -1;
+
+    track = atoi(p + 6);
+    if (track < 0 || track >= server->ntracks)
+        return -1;
+
+    return track;
+}
+
+//send a reply, 'headers' are complete lines, 'body' may be NULL
+static int reply(rtsp_session_t* session, int code, const char* reason,
+        const char* cseq, int cseq_len, const char* headers,
+        const char* body)
+{
+    char head[1024];
+    struct iovec iov[2];
+    int body_len = body ? strlen(body) : 0;
+
+    int n = snprintf(head, sizeof(head), "RTSP/1.0 %d %s\r\n"
+            "CSeq: %.*s\r\n"
+            "%s", code, reason, cseq_len, cseq, headers ? headers : "");
+    if (body)
+        n += snprintf(head + n, sizeof(head) - n, "Content-Length: %d\r\n",
+                body_len);
+    n += snprintf(head + n, sizeof(head) - n, "\r\n");
+    if (n >= (int)sizeof(head))
+        return -1;
+
+    iov[0].iov_base = head;
+    iov[0].iov_len = n;
+    iov[1].iov_base = (void*)body;
+    iov[1].iov_len = body_len;
+
+    pthread_mutex_lock(&session->write_lock);
+    int r = fanout_writev(session->sock, iov, body ? 2 : 1);
+    pthread_mutex_unlock(&session->write_lock);
+
+    return r;
+}
+
+//stop sending, the tracks stay set up
+static void stop_playing(rtsp_server_t* server, rtsp_session_t* session)
+{
+    int i;
+
+    if (!session->playing)
+        return;
+
+    for (i = 0; i < server->ntracks; i++)
+    {
+        if (session->subscriber[i] != -1)
+            fanout_unsubscribe(server->tracks[i].fanout,
+                    session->subscriber[i]);
+        session->subscriber[i] = -1;
+    }
+
+    session->playing = 0;
+    if (server->stop)
+        server->stop(server->arg);
+}
+
+static void close_session(rtsp_server_t* server, rtsp_session_t* session)
+{
+    stop_playing(server, session);
+
+    epoll_ctl(server->epfd, EPOLL_CTL_DEL, session->sock, NULL);
+    close(session->sock);
+    pthread_mutex_destroy(&session->write_lock);
+    session->used = 0;
+
+    printf("rtsp : %s left\n", inet_ntoa(session->peer.sin_addr));
+}
+
+static int describe(rtsp_server_t* server, rtsp_session_t* session,
+        const char* url, const char* cseq, int cseq_len)
+{
+    char sdp[2048];
+    char fmtp[512];
+    char headers[640];
+    char local[INET_ADDRSTRLEN] = "0.0.0.0";
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int i;
+
+    if (getsockname(session->sock, (struct sockaddr*)&addr, &addr_len) == 0)
+        inet_ntop(AF_INET, &addr.sin_addr, local, sizeof(local));
+
+    int n = snprintf(sdp, sizeof(sdp), "v=0\r\n"
+            "o=- %u 1 IN IP4 %s\r\n"
+            "s=Raspberry Pi camera\r\n"
+            "c=IN IP4 0.0.0.0\r\n"
+            "t=0 0\r\n"
+            "a=control:*\r\n", (unsigned)rand(), local);
+
+    for (i = 0; i < server->ntracks; i++)
+    {
+        //without SPS/PPS yet the player takes them from the stream
+        fmtp[0] = 0;
+        if (server->tracks[i].params)
+            h264_params_fmtp(server->tracks[i].params, fmtp, sizeof(fmtp));
+
+        n += snprintf(sdp + n, sizeof(sdp) - n,
+                "m=video 0 RTP/AVP %d\r\n"
+                "a=rtpmap:%d H264/%d\r\n"
+                "a=fmtp:%d packetization-mode=1%s%s\r\n"
+                "a=control:track%d\r\n", RTP_H264_PAYLOAD_TYPE,
+                RTP_H264_PAYLOAD_TYPE, RTP_H264_CLOCK_RATE,
+                RTP_H264_PAYLOAD_TYPE, fmtp[0] ? ";" : "", fmtp, i);
+    }
+    if (n >= (int)sizeof(sdp))
+        return reply(session, 500, "Internal Server Error", cseq, cseq_len,
+                NULL, NULL);
+
+    //relative "trackN" URLs are resolved against Content-Base
+    int url_len = strlen(url);
+    snprintf(headers, sizeof(headers), "Content-Base: %s%s\r\n"
+            "Content-Type: application/sdp\r\n", url,
+            (url_len > 0 && url[url_len - 1] == '/') ? "" : "/");
+
+    return reply(session, 200, "OK", cseq, cseq_len, headers, sdp);
+}
+
+static int setup(rtsp_server_t* server, rtsp_session_t* session,
+        const char* msg, const char* url, const char* cseq, int cseq_len)
+{
+    char headers[512];
+    const char* transport;
+    const char* p;
+    int len;
+
+    int track = url_track(server, url);
+    if (track == -1)
+        return reply(session, 404, "Not Found", cseq, cseq_len, NULL, NULL);
+    if (session->playing)
+        return reply(session, 455, "Method Not Valid in This State", cseq,
+                cseq_len, NULL, NULL);
+
+    transport = get_header(msg, "Transport", &len);
+    if (!transport)
+        return reply(session, 461, "Unsupported Transport", cseq, cseq_len,
+                NULL, NULL);
+
+    //one session per connection
+    p = get_header(msg, "Session", &len);
+    if (p && (session->id == 0 || strtoul(p, NULL, 16) != session->id))
+        return reply(session, 454, "Session Not Found", cseq, cseq_len,
+                NULL, NULL);
+    if (session->id == 0)
+        session->id = (rand() & 0x7fffffff) | 1;
+
+    int n = 0;
+    if (strstr(transport, "RTP/AVP/TCP"))
+    {
+        int channel = 2 * track;
+        p = strstr(transport, "interleaved=");
+        if (p)
+            channel = atoi(p + 12);
+
+        session->channel[track] = channel;
+        n = snprintf(headers, sizeof(headers),
+                "Transport: RTP/AVP/TCP;unicast;interleaved=%d-%d\r\n",
+                channel, channel + 1);
+    }
+    else if ((p = strstr(transport, "client_port=")))
+    {
+        int port = atoi(p + 12);
+        int server_port = server->tracks[track].server_port;
+        if (port <= 0 || port > 65535)
+            return reply(session, 461, "Unsupported Transport", cseq,
+                    cseq_len, NULL, NULL);
+
+        session->channel[track] = -1;
+        session->client_port[track] = port;
+        session->dest[track] = session->peer;
+        session->dest[track].sin_port = htons(port);
+        //the RTP of the fan-out socket and the RTCP socket of the track
+        n = snprintf(headers, sizeof(headers),
+                "Transport: RTP/AVP;unicast;client_port=%d-%d;"
+                "server_port=%d-%d\r\n", port, port + 1, server_port,
+                server->tracks[track].rtcp_port ?
+                        server->tracks[track].rtcp_port : server_port);
+    }
+    else
+        return reply(session, 461, "Unsupported Transport", cseq, cseq_len,
+                NULL, NULL);
+
+    session->setup[track] = 1;
+    snprintf(headers + n, sizeof(headers) - n, "Session: %08X;timeout=%d\r\n",
+            session->id, RTSP_SESSION_TIMEOUT);
+
+    return reply(session, 200, "OK", cseq, cseq_len, headers, NULL);
+}
+
+static int play(rtsp_server_t* server, rtsp_session_t* session,
+        const char* cseq, int cseq_len)
+{
+    char headers[128];
+    int i;
+    int ntracks = 0;
+
+    for (i = 0; i < server->ntracks; i++)
+        ntracks += session->setup[i];
+    if (session->id == 0 || ntracks == 0)
+        return reply(session, 455, "Method Not Valid in This State", cseq,
+                cseq_len, NULL, NULL);
+
+    snprintf(headers, sizeof(headers), "Session: %08X\r\n"
+            "Range: npt=0.000-\r\n", session->id);
+    if (session->playing)
+        return reply(session, 200, "OK", cseq, cseq_len, headers, NULL);
+
+    if (server->play && server->play(server->arg) != 0)
+        return reply(session, 503, "Service Unavailable", cseq, cseq_len,
+                NULL, NULL);
+    session->playing = 1;
+
+    //the reply goes before the first interleaved packet
+    if (reply(session, 200, "OK", cseq, cseq_len, headers, NULL) == -1)
+        return -1;
+
+    for (i = 0; i < server->ntracks; i++)
+    {
+        rtsp_track_t* track = &server->tracks[i];
+        if (!session->setup[i])
+            continue;
+
+        //the FEC repair packets are not in the SDP
+        if (session->channel[i] == -1)
+            session->subscriber[i] = fanout_subscribe(track->fanout,
+                    &session->dest[i], 0);
+        else
+            session->subscriber[i] = fanout_subscribe_interleaved(
+                    track->fanout, session->sock, session->channel[i],
+                    &session->write_lock);
+
+        //the viewer can decode from the next frame, SPS/PPS in front
+        if (session->subscriber[i] != -1 && track->params)
+            h264_params_resend(track->params);
+        if (session->subscriber[i] != -1 && track->request_idr)
+            track->request_idr();
+    }
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+   handle one request (NUL terminated, headers only)
+   return : -1 if the connection has to be closed
+----------------------------------------------------------------------*/
+static int handle_request(rtsp_server_t* server, rtsp_session_t* session,
+        const char* msg)
+{
+    char method[32];
+    char url[512];
+    char headers[128];
+    int cseq_len = 0;
+
+    const char* cseq = get_header(msg, "CSeq", &cseq_len);
+    if (!cseq)
+    {
+        cseq = "0";
+        cseq_len = 1;
+    }
+
+    if (sscanf(msg, "%31s %511s", method, url) != 2)
+        return reply(session, 400, "Bad Request", cseq, cseq_len, NULL, NULL);
+
+    if (strcmp(method, "OPTIONS") == 0)
+        return reply(session, 200, "OK", cseq, cseq_len,
+                "Public: " RTSP_PUBLIC "\r\n", NULL);
+    else if (strcmp(method, "DESCRIBE") == 0)
+        return describe(server, session, url, cseq, cseq_len);
+    else if (strcmp(method, "SETUP") == 0)
+        return setup(server, session, msg, url, cseq, cseq_len);
+    else if (strcmp(method, "PLAY") == 0)
+        return play(server, session, cseq, cseq_len);
+    else if (strcmp(method, "TEARDOWN") == 0)
+    {
+        stop_playing(server, session);
+        memset(session->setup, 0, sizeof(session->setup));
+        snprintf(headers, sizeof(headers), "Session: %08X\r\n", session->id);
+        session->id = 0;
+        return reply(session, 200, "OK", cseq, cseq_len, headers, NULL);
+    }
+    else if (strcmp(method, "GET_PARAMETER") == 0)
+    {
+        //keep-alive of the session
+        snprintf(headers, sizeof(headers), "Session: %08X\r\n", session->id);
+        return reply(session, 200, "OK", cseq, cseq_len, headers, NULL);
+    }
+
+    return reply(session, 501, "Not Implemented", cseq, cseq_len,
+            "Public: " RTSP_PUBLIC "\r\n", NULL);
+}
+
+//handle the complete messages in the receive buffer
+//return : -1 if the connection has to be closed
+static int handle_input(rtsp_server_t* server, rtsp_session_t* session)
+{
+    char msg[RTSP_BUFFER_SIZE + 1];
+    unsigned char* rx = session->rx;
+    int len = session->rx_len;
+
+    while (len > 0)
+    {
+        int used;
+
+        if (rx[0] == '$')
+        {
+            //interleaved RTCP of the client, not used
+            if (len < 4)
+                break;
+            used = 4 + ((rx[2] << 8) | rx[3]);
+            if (used > len)
+                break;
+        }
+        else
+        {
+            memcpy(msg, rx, len);
+            msg[len] = 0;
+            char* end = strstr(msg, "\r\n\r\n");
+            if (!end)
+                break;
+            end[2] = 0;
+
+            //a body (SET_PARAMETER...) is skipped
+            int body_len = 0;
+            const char* p = get_header(msg, "Content-Length", &body_len);
+            body_len = p ? atoi(p) : 0;
+            used = (end + 4 - msg) + body_len;
+            if (body_len < 0 || used > RTSP_BUFFER_SIZE)
+                return -1;
+            if (used > len)
+                break;
+
+            if (handle_request(server, session, msg) == -1)
+                return -1;
+        }
+
+        memmove(rx, rx + used, len - used);
+        len -= used;
+    }
+
+    session->rx_len = len;
+
+    //a message that does not fit
+    if (len == RTSP_BUFFER_SIZE)
+        return -1;
+
+    return 0;
+}
+
+static void accept_sessions(rtsp_server_t* server)
+{
+    struct sockaddr_in peer;
+    socklen_t peer_len;
+    int optval = 1;
+    int i;
+
+    while (1)
+    {
+        peer_len = sizeof(peer);
+        int sock = accept4(server->listenfd, (struct sockaddr*)&peer,
+                &peer_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sock < 0)
+            return; //EAGAIN : no more connections
+
+        for (i = 0; i < RTSP_MAX_SESSIONS; i++)
+        {
+            if (!server->sessions[i].used)
+                break;
+        }
+        if (i == RTSP_MAX_SESSIONS)
+        {
+            fprintf(stderr, "rtsp : too many sessions\n");
+            close(sock);
+            continue;
+        }
+
+        //interleaved packets leave at once
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+
+        rtsp_session_t* session = &server->sessions[i];
+        memset(session, 0, sizeof(*session));
+        session->used = 1;
+        session->sock = sock;
+        session->peer = peer;
+        pthread_mutex_init(&session->write_lock, NULL);
+        for (i = 0; i < RTSP_MAX_TRACKS; i++)
+        {
+            session->channel[i] = -1;
+            session->subscriber[i] = -1;
+        }
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = session;
+        epoll_ctl(server->epfd, EPOLL_CTL_ADD, sock, &ev);
+
+        printf("rtsp : %s connected\n", inet_ntoa(peer.sin_addr));
+    }
+}
+
+//the event loop of all the connections
+static void* server_thread(void* arg)
+{
+    rtsp_server_t* server = (rtsp_server_t*)arg;
+    struct epoll_event events[16];
+    int i;
+
+    while (!server->quit)
+    {
+        int n = epoll_wait(server->epfd, events, 16, 500);
+        if (n < 0 && errno != EINTR)
+        {
+            fprintf(stderr, "rtsp : epoll_wait: %s\n", strerror(errno));
+            break;
+        }
+
+        for (i = 0; i < n; i++)
+        {
+            rtsp_session_t* session = (rtsp_session_t*)events[i].data.ptr;
+            if (!session)
+            {
+                accept_sessions(server);
+                continue;
+            }
+            if ((void*)session >= (void*)server->tracks
+                    && (void*)session < (void*)(server->tracks
+                            + RTSP_MAX_TRACKS))
+            {
+                //RTCP of the UDP viewers, not used
+                unsigned char rtcp[1500];
+                rtsp_track_t* track = (rtsp_track_t*)session;
+                while (recv(track->rtcp_sock, rtcp, sizeof(rtcp), 0) >= 0)
+                    ;
+                continue;
+            }
+
+            ssize_t r = recv(session->sock, session->rx + session->rx_len,
+                    RTSP_BUFFER_SIZE - session->rx_len, 0);
+            if (r < 0 && (errno == EAGAIN || errno == EINTR))
+                continue;
+            if (r <= 0)
+            {
+                close_session(server, session);
+                continue;
+            }
+
+            session->rx_len += r;
+            if (handle_input(server, session) == -1)
+                close_session(server, session);
+        }
+    }
+
+    for (i = 0; i < RTSP_MAX_SESSIONS; i++)
+    {
+        if (server->sessions[i].used)
+            close_session(server, &server->sessions[i]);
+    }
+
+    return NULL;
+}
+
+//serve the clients from a thread of the server
+int rtsp_server_start(rtsp_server_t* server)
+{
+    struct epoll_event ev;
+    int i;
+
+    server->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (server->epfd < 0)
+    {
+        fprintf(stderr, "rtsp : epoll_create1: %s\n", strerror(errno));
+        return -1;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; //the listening socket
+    epoll_ctl(server->epfd, EPOLL_CTL_ADD, server->listenfd, &ev);
+
+    for (i = 0; i < server->ntracks; i++)
+    {
+        if (!rtcp_owner(server, i))
+            continue;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &server->tracks[i];
+        epoll_ctl(server->epfd, EPOLL_CTL_ADD, server->tracks[i].rtcp_sock,
+                &ev);
+    }
+
+    server->quit = 0;
+    if (pthread_create(&server->tid, NULL, server_thread, server) != 0)
+    {
+        fprintf(stderr, "ERROR:pthread_create\n");
+        close(server->epfd);
+        server->epfd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+//close all the sessions and the listening socket
+void rtsp_server_stop(rtsp_server_t* server)
+{
+    int i;
+
+    if (server->epfd != -1)
+    {
+        server->quit = 1;
+        pthread_join(server->tid, NULL);
+        close(server->epfd);
+        server->epfd = -1;
+    }
+
+    if (server->listenfd != -1)
+        close(server->listenfd);
+    server->listenfd = -1;
+
+    for (i = 0; i < server->ntracks; i++)
+    {
+        if (rtcp_owner(server, i))
+            close(server->tracks[i].rtcp_sock);
+    }
+    for (i = 0; i < server->ntracks; i++)
+        server->tracks[i].rtcp_sock = -1;
+}
@@ -0,0 +1,79 @@
+#ifndef RTSP_H
+#define RTSP_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include "fanout.h"
+#include "h264_params.h"
+
+//RTSP server (RFC 2326) in front of the fan-outs of the streams
+//OPTIONS, DESCRIBE, SETUP, PLAY, TEARDOWN and GET_PARAMETER, RTP over UDP
+//or interleaved in the RTSP connection. One thread serves all the
+//connections with epoll, the media are sent by the threads of the fan-outs.
+
+#define RTSP_MAX_SESSIONS 64
+#define RTSP_MAX_TRACKS 2
+#define RTSP_BUFFER_SIZE 4096
+#define RTSP_SESSION_TIMEOUT 60 //s, advertised to the clients
+
+//One stream of the server, "trackN" in the URLs
+typedef struct
+{
+    fanout_t* fanout;
+    h264_params_t* params;   //SPS/PPS for the SDP and the joining viewers
+    void (*request_idr)(void); //called when a viewer starts, NULL : none
+    int server_port;         //local port of the fan-out socket
+    //RTCP of the UDP viewers (receiver reports), read and dropped
+    //server_port + 1 when it is free, tracks of one socket share it
+    int rtcp_sock;
+    int rtcp_port;
+} rtsp_track_t;
+
+//One RTSP connection and its session
+typedef struct
+{
+    int used;
+    int sock;
+    struct sockaddr_in peer;
+    pthread_mutex_t write_lock; //replies and interleaved frames
+
+    unsigned char rx[RTSP_BUFFER_SIZE];
+    int rx_len;
+
+    uint32_t id; //0 : no session yet
+    int playing;
+    int setup[RTSP_MAX_TRACKS];
+    int channel[RTSP_MAX_TRACKS]; //interleaved RTP channel, -1 : UDP
+    struct sockaddr_in dest[RTSP_MAX_TRACKS]; //UDP
+    int client_port[RTSP_MAX_TRACKS];
+    int subscriber[RTSP_MAX_TRACKS];
+} rtsp_session_t;
+
+typedef struct
+{
+    int listenfd;
+    int epfd;
+    pthread_t tid;
+    volatile int quit;
+
+    rtsp_track_t tracks[RTSP_MAX_TRACKS];
+    int ntracks;
+
+    //a session starts and stops playing, play returns -1 to refuse it
+    int (*play)(void* arg);
+    void (*stop)(void* arg);
+    void* arg;
+
+    rtsp_session_t sessions[RTSP_MAX_SESSIONS];
+} rtsp_server_t;
+
+int rtsp_server_init(rtsp_server_t* server, short port,
+        int (*play)(void* arg), void (*stop)(void* arg), void* arg);
+int rtsp_server_add_track(rtsp_server_t* server, fanout_t* fanout,
+        h264_params_t* params, void (*request_idr)(void));
+int rtsp_server_start(rtsp_server_t* server);
+void rtsp_server_stop(rtsp_server_t* server);
+
+#endif
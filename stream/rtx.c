@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "rtx.h"
+
+static uint32_t get32(const unsigned char* p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void put32(unsigned char* p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+void rtx_init(rtx_history_t* rtx)
+{
+    memset(rtx->len, 0, sizeof(rtx->len));
+    rtx->resent = 0;
+    rtx->missed = 0;
+    pthread_mutex_init(&rtx->lock, NULL);
+}
+
+void rtx_deinit(rtx_history_t* rtx)
+{
+    pthread_mutex_destroy(&rtx->lock);
+}
+
+/*---------------------------------------------------------------------
+   keep a sent RTP packet, it replaces the one RTX_HISTORY packets older
+   it is an rtp_send_t, so it can also be chained after a packetizer
+----------------------------------------------------------------------*/
+int rtx_store(void* arg, const unsigned char* packet, int len)
+{
+    rtx_history_t* rtx = (rtx_history_t*)arg;
+
+    if (len < RTP_HEADER_SIZE || len > RTP_MAX_MTU)
+        return -1;
+
+    int slot = ((packet[2] << 8) | packet[3]) % RTX_HISTORY;
+
+    pthread_mutex_lock(&rtx->lock);
+    memcpy(rtx->packet[slot], packet, len);
+    rtx->len[slot] = len;
+    pthread_mutex_unlock(&rtx->lock);
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+   send the packet 'seq' of the stream 'ssrc' again
+   return : 0, -1 if it is no longer kept or cannot be sent
+----------------------------------------------------------------------*/
+int rtx_resend(rtx_history_t* rtx, int sock, const struct sockaddr_in* addr,
+        uint32_t ssrc, uint16_t seq)
+{
+    unsigned char packet[RTP_MAX_MTU];
+    int slot = seq % RTX_HISTORY;
+    int len = 0;
+
+    pthread_mutex_lock(&rtx->lock);
+    const unsigned char* p = rtx->packet[slot];
+    //the slot may hold a newer packet, or one of a previous stream
+    if (rtx->len[slot] && (((p[2] << 8) | p[3]) == seq)
+            && (get32(p + 8) == ssrc))
+    {
+        len = rtx->len[slot];
+        memcpy(packet, p, len);
+    }
+    if (len)
+        rtx->resent++;
+    else
+        rtx->missed++;
+    pthread_mutex_unlock(&rtx->lock);
+
+    if (len == 0)
+        return -1;
+
+    if (sendto(sock, packet, len, 0, (const struct sockaddr*)addr,
+            sizeof(*addr)) == -1)
+    {
+        perror("sendto");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+   read the NACKs and PLIs of an RTCP message (compound or not)
+   return : 0, -1 if it is not RTCP (e.g. a "Keep alive" text message)
+----------------------------------------------------------------------*/
+int rtcp_parse_feedback(const unsigned char* msg, int len,
+        rtcp_feedback_t* fb)
+{
+    int i;
+
+    memset(fb, 0, sizeof(*fb));
+
+    //version 2 and an RTCP packet type (192..223) in front
+    if (len < 4 || (msg[0] >> 6) != 2 || msg[1] < 192 || msg[1] > 223)
+        return -1;
+
+    while (len >= 4)
+    {
+        int fmt = msg[0] & 0x1f;
+        int pt = msg[1];
+        int size = (((msg[2] << 8) | msg[3]) + 1) * 4;
+        if (size > len)
+            return -1;
+
+        //every RTCP packet starts with the SSRC of its sender
+        if (size >= 8 && fb->sender == 0)
+            fb->sender = get32(msg + 4);
+
+        //common feedback header: sender SSRC, media source SSRC, FCI
+        if (size >= 12)
+        {
+            if (pt == RTCP_PT_RTPFB && fmt == RTCP_FMT_NACK)
+            {
+                fb->ssrc = get32(msg + 8);
+                //FCI: lost packet id, bitmask of the 16 following ones
+                for (i = 12; i + 4 <= size; i += 4)
+                {
+                    uint16_t pid = (msg[i] << 8) | msg[i + 1];
+                    uint16_t blp = (msg[i + 2] << 8) | msg[i + 3];
+                    int b;
+
+                    for (b = -1; b < 16; b++)
+                    {
+                        if (b >= 0 && !(blp & (1 << b)))
+                            continue;
+                        if (fb->nlost < RTCP_MAX_NACK)
+                            fb->lost[fb->nlost++] = pid + b + 1;
+                    }
+                }
+            }
+            else if (pt == RTCP_PT_PSFB && fmt == RTCP_FMT_PLI)
+            {
+                fb->ssrc = get32(msg + 8);
+                fb->pli = 1;
+            }
+        }
+
+        msg += size;
+        len -= size;
+    }
+
+    return 0;
+}
+
+//feedback header, 'words' : length of the message in 32 bits words
+static void write_fb_header(unsigned char* msg, int fmt, int pt, int words,
+        uint32_t sender_ssrc, uint32_t media_ssrc)
+{
+    msg[0] = 0x80 | fmt;
+    msg[1] = pt;
+    msg[2] = (words - 1) >> 8;
+    msg[3] = words - 1;
+    put32(msg + 4, sender_ssrc);
+    put32(msg + 8, media_ssrc);
+}
+
+/*---------------------------------------------------------------------
+   generic NACK of the lost sequence numbers, in increasing order
+   return : size of the message, -1 if 'size' is too small
+----------------------------------------------------------------------*/
+int rtcp_build_nack(unsigned char* msg, int size, uint32_t sender_ssrc,
+        uint32_t media_ssrc, const uint16_t* lost, int nlost)
+{
+    int len = 12;
+    int i = 0;
+
+    if (size < len)
+        return -1;
+
+    while (i < nlost)
+    {
+        uint16_t pid = lost[i++];
+        uint16_t blp = 0;
+
+        while ((i < nlost) && ((uint16_t)(lost[i] - pid - 1) < 16))
+            blp |= 1 << (uint16_t)(lost[i++] - pid - 1);
+
+        if (len + 4 > size)
+            return -1;
+        msg[len] = pid >> 8;
+        msg[len + 1] = pid;
+        msg[len + 2] = blp >> 8;
+        msg[len + 3] = blp;
+        len += 4;
+    }
+
+    write_fb_header(msg, RTCP_FMT_NACK, RTCP_PT_RTPFB, len / 4, sender_ssrc,
+            media_ssrc);
+    return len;
+}
+
+//picture loss indication, the sender answers with an IDR
+int rtcp_build_pli(unsigned char* msg, int size, uint32_t sender_ssrc,
+        uint32_t media_ssrc)
+{
+    if (size < 12)
+        return -1;
+
+    write_fb_header(msg, RTCP_FMT_PLI, RTCP_PT_PSFB, 3, sender_ssrc,
+            media_ssrc);
+    return 12;
+}
@@ -0,0 +1,63 @@
+#ifndef RTX_H
+#define RTX_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include "rtp.h"
+
+//Retransmission of the packets a viewer reports lost
+//The sent packets are kept in a ring indexed by sequence number, a viewer
+//asks for the lost ones with an RTCP generic NACK (RFC 4585) on the UDP
+//socket it sends the keep-alive messages to. The packet is sent again as
+//it was (same sequence number), the player puts it back in order.
+
+//packets kept, power of 2: about 1s of preview
+#define RTX_HISTORY 512
+
+//RTCP feedback messages (RFC 4585)
+#define RTCP_PT_RTPFB 205 //transport layer feedback
+#define RTCP_PT_PSFB 206  //payload specific feedback
+#define RTCP_FMT_NACK 1   //RTPFB: generic NACK
+#define RTCP_FMT_PLI 1    //PSFB: picture loss indication, asks for an IDR
+//lost packets handled in one feedback message
+#define RTCP_MAX_NACK 64
+
+typedef struct
+{
+    pthread_mutex_t lock; //stored by the sender, read by the control thread
+    unsigned char packet[RTX_HISTORY][RTP_MAX_MTU];
+    int len[RTX_HISTORY];
+
+    //statistics
+    uint32_t resent;
+    uint32_t missed; //asked for but no longer in the ring
+} rtx_history_t;
+
+void rtx_init(rtx_history_t* rtx);
+void rtx_deinit(rtx_history_t* rtx);
+int rtx_store(void* rtx, const unsigned char* packet, int len);
+int rtx_resend(rtx_history_t* rtx, int sock, const struct sockaddr_in* addr,
+        uint32_t ssrc, uint16_t seq);
+
+//content of a (compound) RTCP feedback message
+typedef struct
+{
+    uint32_t sender; //SSRC of the viewer that sent it
+    uint32_t ssrc; //media source the feedback is about
+    int pli;
+    int nlost;
+    uint16_t lost[RTCP_MAX_NACK];
+} rtcp_feedback_t;
+
+int rtcp_parse_feedback(const unsigned char* msg, int len,
+        rtcp_feedback_t* fb);
+
+//Receiver side
+int rtcp_build_nack(unsigned char* msg, int size, uint32_t sender_ssrc,
+        uint32_t media_ssrc, const uint16_t* lost, int nlost);
+int rtcp_build_pli(unsigned char* msg, int size, uint32_t sender_ssrc,
+        uint32_t media_ssrc);
+
+#endif
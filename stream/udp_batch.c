@@ -0,0 +1,308 @@
+#define _GNU_SOURCE //sendmmsg()
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#include "udp_batch.h"
+
+//not in the headers of older libc
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+static const char* mode_name[] = { "UDP_SEGMENT", "sendmmsg", "sendto" };
+
+/*---------------------------------------------------------------------
+   check the preferred way to send on the socket
+   return : 'mode', or the next one if the kernel does not support it
+----------------------------------------------------------------------*/
+udp_send_mode_t udp_batch_probe(int sock, udp_send_mode_t mode)
+{
+    //GSO appeared in Linux 4.18, the option is unknown before
+    if (mode == UDP_SEND_GSO)
+    {
+        int segment;
+        socklen_t len = sizeof(segment);
+        if (getsockopt(sock, SOL_UDP, UDP_SEGMENT, &segment, &len) == -1)
+            mode = UDP_SEND_MMSG;
+    }
+
+    printf("udp_batch : datagrams sent with %s\n", mode_name[mode]);
+    return mode;
+}
+
+/*---------------------------------------------------------------------
+   init an empty batch
+   sock : the UDP socket, used to check if the kernel supports GSO
+   mode : the preferred way to send, see udp_send_mode_t
+----------------------------------------------------------------------*/
+void udp_batch_init(udp_batch_t* batch, int sock, udp_send_mode_t mode)
+{
+    batch->mode = udp_batch_probe(sock, mode);
+    batch->packets = 0;
+    batch->calls = 0;
+    udp_batch_clear(batch);
+}
+
+//forget the datagrams of the batch
+void udp_batch_clear(udp_batch_t* batch)
+{
+    batch->count = 0;
+    batch->size = 0;
+}
+
+static int send_single(udp_batch_t* batch, int sock,
+        const struct sockaddr_in* addr, int first, int count, int* calls)
+{
+    int i;
+
+    for (i = first; i < first + count; i++)
+    {
+        (*calls)++;
+        if (sendto(sock, batch->data + batch->offset[i], batch->len[i], 0,
+                (const struct sockaddr *) addr, sizeof(*addr)) == -1)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int send_mmsg(udp_batch_t* batch, int sock,
+        const struct sockaddr_in* addr, int first, int count, int* calls)
+{
+    struct mmsghdr msgs[UDP_BATCH_MAX];
+    struct iovec iovs[UDP_BATCH_MAX];
+    int i;
+
+    memset(msgs, 0, sizeof(struct mmsghdr) * count);
+    for (i = 0; i < count; i++)
+    {
+        iovs[i].iov_base = batch->data + batch->offset[first + i];
+        iovs[i].iov_len = batch->len[first + i];
+        msgs[i].msg_hdr.msg_name = (void *) addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(*addr);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    //sendmmsg() may send only the first datagrams
+    i = 0;
+    while (i < count)
+    {
+        (*calls)++;
+        int n = sendmmsg(sock, msgs + i, count - i, 0);
+        if (n == -1)
+            return -1;
+        i += n;
+    }
+
+    return 0;
+}
+
+//one sendmsg() for 'count' contiguous datagrams of 'segment' bytes, the last
+//one may be shorter
+static int send_gso(udp_batch_t* batch, int sock,
+        const struct sockaddr_in* addr, int first, int count, int segment,
+        int* calls)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    struct cmsghdr* cmsg;
+
+    iov.iov_base = batch->data + batch->offset[first];
+    iov.iov_len = batch->offset[first + count - 1] + batch->len[first + count - 1]
+            - batch->offset[first];
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_name = (void *) addr;
+    msg.msg_namelen = sizeof(*addr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    *((uint16_t *) CMSG_DATA(cmsg)) = segment;
+
+    (*calls)++;
+    if (sendmsg(sock, &msg, 0) == -1)
+        return -1;
+
+    return 0;
+}
+
+//split the datagrams in runs of equal sizes, each run is one GSO send
+static int send_runs(udp_batch_t* batch, udp_send_mode_t* mode, int sock,
+        const struct sockaddr_in* addr, int first, int count, int* calls)
+{
+    int end = first + count;
+
+    while (first < end)
+    {
+        int segment = batch->len[first];
+        int size = segment;
+        int last = first + 1;
+
+        while ((last < end)
+                && (last - first < UDP_GSO_MAX_SEGMENTS)
+                && (size + batch->len[last] <= UDP_GSO_MAX_SIZE)
+                && (batch->len[last] <= segment))
+        {
+            size += batch->len[last];
+            last++;
+            //a shorter datagram can only end a run
+            if (batch->len[last - 1] < segment)
+                break;
+        }
+
+        int r;
+        if (last - first == 1)
+            r = send_single(batch, sock, addr, first, 1, calls);
+        else
+            r = send_gso(batch, sock, addr, first, last - first, segment,
+                    calls);
+
+        if (r == -1)
+        {
+            //no GSO on this route (e.g. the device cannot checksum)
+            if ((errno == EIO) || (errno == EINVAL) || (errno == EOPNOTSUPP))
+            {
+                fprintf(stderr, "udp_batch : UDP_SEGMENT failed, "
+                        "fall back to sendmmsg\n");
+                *mode = UDP_SEND_MMSG;
+                return send_mmsg(batch, sock, addr, first, end - first,
+                        calls);
+            }
+            return -1;
+        }
+
+        first = last;
+    }
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+   send 'count' datagrams of the batch from 'first' to 'addr' with 'mode'
+   a fall back to a slower mode is written to 'mode' and the batch is only
+   read, so several threads can send one batch, each with its own mode
+   return : number of send syscalls, -1 if some datagrams were not sent
+----------------------------------------------------------------------*/
+int udp_batch_send_mode(udp_batch_t* batch, udp_send_mode_t* mode, int sock,
+        const struct sockaddr_in* addr, int first, int count)
+{
+    int r = 0;
+    int calls = 0;
+
+    if (count == 0)
+        return 0;
+
+    switch (*mode)
+    {
+    case UDP_SEND_GSO:
+        r = send_runs(batch, mode, sock, addr, first, count, &calls);
+        break;
+    case UDP_SEND_MMSG:
+        r = send_mmsg(batch, sock, addr, first, count, &calls);
+        if ((r == -1) && (errno == ENOSYS))
+        {
+            *mode = UDP_SEND_SINGLE;
+            r = send_single(batch, sock, addr, first, count, &calls);
+        }
+        break;
+    case UDP_SEND_SINGLE:
+        r = send_single(batch, sock, addr, first, count, &calls);
+        break;
+    }
+
+    if (r == -1)
+    {
+        fprintf(stderr, "cannot send all data to client: %s\n",
+                strerror(errno));
+        return -1;
+    }
+
+    return calls;
+}
+
+//udp_batch_send_mode() with the mode of the batch
+int udp_batch_send_range(udp_batch_t* batch, int sock,
+        const struct sockaddr_in* addr, int first, int count)
+{
+    return udp_batch_send_mode(batch, &batch->mode, sock, addr, first, count);
+}
+
+/*---------------------------------------------------------------------
+   send all the datagrams of the batch to 'addr', the batch is kept
+   so that it can be sent to other destinations
+   return : number of send syscalls, -1 if some datagrams were not sent
+----------------------------------------------------------------------*/
+int udp_batch_send(udp_batch_t* batch, int sock,
+        const struct sockaddr_in* addr)
+{
+    return udp_batch_send_range(batch, sock, addr, 0, batch->count);
+}
+
+/*---------------------------------------------------------------------
+   send all the datagrams of the batch to 'addr' and empty it
+   return : 0, -1 if some of them could not be sent
+----------------------------------------------------------------------*/
+int udp_batch_flush(udp_batch_t* batch, int sock,
+        const struct sockaddr_in* addr)
+{
+    int r = udp_batch_send(batch, sock, addr);
+
+    if (r > 0)
+        batch->calls += r;
+    batch->packets += batch->count;
+    udp_batch_clear(batch);
+
+    return (r == -1) ? -1 : 0;
+}
+
+//copy a datagram in the batch
+//return : 0, -1 if the batch is full
+int udp_batch_put(udp_batch_t* batch, const unsigned char* packet, int len)
+{
+    if ((batch->count == UDP_BATCH_MAX)
+            || (batch->size + len > (int) sizeof(batch->data)))
+        return -1;
+
+    batch->offset[batch->count] = batch->size;
+    batch->len[batch->count] = len;
+    memcpy(batch->data + batch->size, packet, len);
+    batch->size += len;
+    batch->count++;
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+   copy a datagram in the batch, the batch is flushed first if it is full
+   can be used as the rtp_send_t of a packetizer through a small wrapper
+----------------------------------------------------------------------*/
+int udp_batch_add(udp_batch_t* batch, int sock,
+        const struct sockaddr_in* addr, const unsigned char* packet, int len)
+{
+    int r = 0;
+
+    if (udp_batch_put(batch, packet, len) == -1)
+    {
+        r = udp_batch_flush(batch, sock, addr);
+        udp_batch_put(batch, packet, len);
+    }
+
+    return r;
+}
@@ -0,0 +1,57 @@
+#ifndef UDP_BATCH_H
+#define UDP_BATCH_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "rtp.h"
+
+//Max number of datagrams kept before they are sent
+#define UDP_BATCH_MAX 64
+//Kernel limits of one UDP_SEGMENT (GSO) send
+#define UDP_GSO_MAX_SEGMENTS 64
+#define UDP_GSO_MAX_SIZE 65000
+
+//How the datagrams of a batch are handed to the kernel, from the fastest
+//A mode not supported by the kernel falls back to the next one
+typedef enum
+{
+    UDP_SEND_GSO,    //one sendmsg() with UDP_SEGMENT per run of equal packets
+    UDP_SEND_MMSG,   //one sendmmsg() for the whole batch
+    UDP_SEND_SINGLE, //one sendto() per datagram (old behaviour)
+} udp_send_mode_t;
+
+//Datagrams stored back to back, so that a run of equal sized packets (the
+//FU-A fragments of a NAL unit) is one contiguous buffer for GSO
+typedef struct
+{
+    udp_send_mode_t mode;
+    int count;
+    int size; //bytes used in 'data'
+    int offset[UDP_BATCH_MAX];
+    int len[UDP_BATCH_MAX];
+    unsigned char data[UDP_BATCH_MAX * RTP_MAX_MTU];
+
+    //statistics
+    uint32_t packets;
+    uint32_t calls; //send syscalls
+} udp_batch_t;
+
+udp_send_mode_t udp_batch_probe(int sock, udp_send_mode_t mode);
+void udp_batch_init(udp_batch_t* batch, int sock, udp_send_mode_t mode);
+void udp_batch_clear(udp_batch_t* batch);
+
+int udp_batch_put(udp_batch_t* batch, const unsigned char* packet, int len);
+int udp_batch_send(udp_batch_t* batch, int sock,
+        const struct sockaddr_in* addr);
+int udp_batch_send_range(udp_batch_t* batch, int sock,
+        const struct sockaddr_in* addr, int first, int count);
+int udp_batch_send_mode(udp_batch_t* batch, udp_send_mode_t* mode, int sock,
+        const struct sockaddr_in* addr, int first, int count);
+
+int udp_batch_add(udp_batch_t* batch, int sock,
+        const struct sockaddr_in* addr, const unsigned char* packet, int len);
+int udp_batch_flush(udp_batch_t* batch, int sock,
+        const struct sockaddr_in* addr);
+
+#endif
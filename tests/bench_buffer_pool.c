@@ -0,0 +1,70 @@
+//frames per second out of the software encoder with 1 to 16 output
+//buffers, under a sink that takes 1 to 8 ms per frame (a write() to a
+//file or a socket), while the encoder makes a frame every 5 ms (200 fps).
+//The mean of the sink is under the frame interval, a single buffer still
+//loses the frames that come while it is held
+
+#include <time.h>
+
+#include "check.h"
+#include "soft_encoder.h"
+#include "omx/omx_soft.h"
+
+#define FRAME_INTERVAL 5000 //us
+#define SINK_MIN 1000 //us
+#define SINK_MAX 8000 //us
+#define DURATION 3000000 //us
+
+static void sleep_us(unsigned us)
+{
+    struct timespec t = { us / 1000000, (us % 1000000) * 1000 };
+
+    nanosleep(&t, NULL);
+}
+
+static void run(int count)
+{
+    omx_soft_config_t config;
+    omx_soft_stats_t stats;
+    component_t encoder = { .name = "soft.video_encode" };
+    buffer_pool_t pool;
+    unsigned seed = 1;
+    unsigned consumed = 0;
+    uint64_t start, elapsed;
+
+    omx_soft_default_config(&config);
+    config.frame_interval = FRAME_INTERVAL;
+    omx_soft_configure(&config);
+
+    soft_encoder_open(&encoder, &pool, count);
+    CHECK(buffer_pool_fill_all(&encoder) == OMX_ErrorNone);
+
+    start = soft_now_us();
+    do
+    {
+        OMX_BUFFERHEADERTYPE* buffer = buffer_pool_get_filled(&encoder);
+        sleep_us(SINK_MIN + rand_r(&seed) % (SINK_MAX - SINK_MIN));
+        consumed++;
+        CHECK(buffer_pool_fill(&encoder, buffer) == OMX_ErrorNone);
+        elapsed = soft_now_us() - start;
+    } while (elapsed < DURATION);
+
+    omx_soft_stats(encoder.handle, &stats);
+    soft_encoder_close(&encoder, &pool);
+
+    fprintf(stderr, "buffers %2d: %6.1f fps, %4u frames dropped by the "
+            "encoder\n", count, consumed * 1000000.0 / elapsed, stats.dropped);
+}
+
+int main(int argc, char** argv)
+{
+    int counts[] = { 1, 2, 4, 16 };
+    unsigned i;
+
+    OMX_Init();
+    for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+        run(counts[i]);
+    OMX_Deinit();
+
+    return 0;
+}
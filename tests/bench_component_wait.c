@@ -0,0 +1,215 @@
+//bring-up latency of a graph of the size of rpiomx_open() (6 components,
+//6 tunnel ports, 2 encoder output ports with buffers) with the event based
+//wait_*() of component_common.c, against the polling of the
+//OMX_GetParameter()/OMX_GetState() loops with usleep(10000) they replaced,
+//one command at a time or with the graph level steps (change_state_graph(),
+//enable_ports()).
+//The software core completes each command after 1 to 5 ms
+
+#include "check.h"
+#include "soft_encoder.h"
+#include "omx/omx_soft.h"
+
+#define COMPONENTS 6
+#define ENCODERS 2
+#define RUNS 10
+
+static component_t components[COMPONENTS];
+static char names[COMPONENTS][32];
+static buffer_pool_t pools[ENCODERS];
+
+//the waits before the events, one command at a time
+static void poll_port(component_t* component, OMX_U32 port, OMX_BOOL enabled)
+{
+    OMX_PARAM_PORTDEFINITIONTYPE port_st;
+    OMX_INIT_STRUCTURE(port_st);
+    port_st.nPortIndex = port;
+    port_st.bEnabled = !enabled;
+    while (port_st.bEnabled != enabled)
+    {
+        CHECK(OMX_GetParameter(component->handle,
+                OMX_IndexParamPortDefinition, &port_st) == OMX_ErrorNone);
+        usleep(10000);
+    }
+}
+
+static void poll_state(component_t* component, OMX_STATETYPE wanted_state)
+{
+    OMX_STATETYPE receive_state = OMX_StateInvalid;
+    while (receive_state != wanted_state)
+    {
+        OMX_GetState(component->handle, &receive_state);
+        usleep(10000);
+    }
+}
+
+static void open_polling(void)
+{
+    int i;
+
+    for (i = 0; i < COMPONENTS; i++)
+    {
+        OMX_CALLBACKTYPE callbacks_st = { event_handler, NULL,
+                fill_buffer_done };
+        CHECK(!vcos_event_flags_create(&components[i].flags, "component"));
+        CHECK(!vcos_mutex_create(&components[i].lock, "component"));
+        CHECK(OMX_GetHandle(&components[i].handle, components[i].name,
+                &components[i], &callbacks_st) == OMX_ErrorNone);
+        disable_port(&components[i], OMX_SOFT_INPUT_PORT);
+        poll_port(&components[i], OMX_SOFT_INPUT_PORT, OMX_FALSE);
+        disable_port(&components[i], OMX_SOFT_OUTPUT_PORT);
+        poll_port(&components[i], OMX_SOFT_OUTPUT_PORT, OMX_FALSE);
+    }
+    for (i = 0; i < COMPONENTS; i++)
+    {
+        change_state(&components[i], OMX_StateIdle);
+        poll_state(&components[i], OMX_StateIdle);
+    }
+    for (i = 0; i < COMPONENTS; i++)
+    {
+        enable_port(&components[i], OMX_SOFT_INPUT_PORT);
+        poll_port(&components[i], OMX_SOFT_INPUT_PORT, OMX_TRUE);
+    }
+    for (i = 0; i < ENCODERS; i++)
+    {
+        int count = buffer_pool_set_count(&components[i],
+                OMX_SOFT_OUTPUT_PORT, VIDEO_OUTPUT_BUFFERS);
+        enable_port(&components[i], OMX_SOFT_OUTPUT_PORT);
+        buffer_pool_allocate(&components[i], &pools[i], OMX_SOFT_OUTPUT_PORT,
+                count);
+        poll_port(&components[i], OMX_SOFT_OUTPUT_PORT, OMX_TRUE);
+    }
+    for (i = 0; i < COMPONENTS; i++)
+    {
+        change_state(&components[i], OMX_StateExecuting);
+        poll_state(&components[i], OMX_StateExecuting);
+    }
+}
+
+//the event waits, one command at a time as the polling
+static void open_events_serial(void)
+{
+    int i;
+
+    for (i = 0; i < COMPONENTS; i++)
+        init_component(&components[i]);
+    for (i = 0; i < COMPONENTS; i++)
+    {
+        change_state(&components[i], OMX_StateIdle);
+        wait_state_change(&components[i], OMX_StateIdle);
+    }
+    for (i = 0; i < COMPONENTS; i++)
+    {
+        enable_port(&components[i], OMX_SOFT_INPUT_PORT);
+        wait_enable_port(&components[i], OMX_SOFT_INPUT_PORT);
+    }
+    for (i = 0; i < ENCODERS; i++)
+    {
+        int count = buffer_pool_set_count(&components[i],
+                OMX_SOFT_OUTPUT_PORT, VIDEO_OUTPUT_BUFFERS);
+        enable_port(&components[i], OMX_SOFT_OUTPUT_PORT);
+        buffer_pool_allocate(&components[i], &pools[i], OMX_SOFT_OUTPUT_PORT,
+                count);
+        wait_enable_port(&components[i], OMX_SOFT_OUTPUT_PORT);
+    }
+    for (i = 0; i < COMPONENTS; i++)
+    {
+        change_state(&components[i], OMX_StateExecuting);
+        wait_state_change(&components[i], OMX_StateExecuting);
+    }
+}
+
+//as rpiomx_open(), the commands of a graph level step in flight together
+static void open_events(void)
+{
+    component_t* graph[COMPONENTS];
+    component_port_t tunnel_ports[COMPONENTS];
+    int i;
+
+    for (i = 0; i < COMPONENTS; i++)
+    {
+        init_component(&components[i]);
+        graph[i] = &components[i];
+        tunnel_ports[i].component = &components[i];
+        tunnel_ports[i].port = OMX_SOFT_INPUT_PORT;
+    }
+    change_state_graph(graph, COMPONENTS, OMX_StateIdle);
+    enable_ports(tunnel_ports, COMPONENTS);
+    for (i = 0; i < ENCODERS; i++)
+    {
+        int count = buffer_pool_set_count(&components[i],
+                OMX_SOFT_OUTPUT_PORT, VIDEO_OUTPUT_BUFFERS);
+        enable_port(&components[i], OMX_SOFT_OUTPUT_PORT);
+        buffer_pool_allocate(&components[i], &pools[i], OMX_SOFT_OUTPUT_PORT,
+                count);
+        wait_enable_port(&components[i], OMX_SOFT_OUTPUT_PORT);
+    }
+    change_state_graph(graph, COMPONENTS, OMX_StateExecuting);
+}
+
+static void close_graph(void)
+{
+    component_t* graph[COMPONENTS];
+    int i;
+
+    for (i = 0; i < COMPONENTS; i++)
+        graph[i] = &components[i];
+    change_state_graph(graph, COMPONENTS, OMX_StateIdle);
+    for (i = 0; i < ENCODERS; i++)
+    {
+        disable_port(&components[i], OMX_SOFT_OUTPUT_PORT);
+        buffer_pool_free(&components[i], &pools[i]);
+        wait_disable_port(&components[i], OMX_SOFT_OUTPUT_PORT);
+    }
+    change_state_graph(graph, COMPONENTS, OMX_StateLoaded);
+    for (i = 0; i < COMPONENTS; i++)
+        deinit_component(&components[i]);
+}
+
+static void run(const char* label, void (*open_graph)(void))
+{
+    uint64_t start, elapsed, total = 0, min = UINT64_MAX, max = 0;
+    int i, c;
+
+    for (i = 0; i < RUNS; i++)
+    {
+        memset(components, 0, sizeof(components));
+        for (c = 0; c < COMPONENTS; c++)
+        {
+            snprintf(names[c], sizeof(names[c]), "soft.component%d", c);
+            components[c].name = names[c];
+        }
+
+        start = soft_now_us();
+        open_graph();
+        elapsed = soft_now_us() - start;
+        close_graph();
+
+        total += elapsed;
+        if (elapsed < min)
+            min = elapsed;
+        if (elapsed > max)
+            max = elapsed;
+    }
+
+    fprintf(stderr, "%-22s bring-up: mean %6.1f ms, min %6.1f ms, max %6.1f ms\n",
+            label, total / 1000.0 / RUNS, min / 1000.0, max / 1000.0);
+}
+
+int main(int argc, char** argv)
+{
+    omx_soft_config_t config;
+
+    omx_soft_default_config(&config);
+    config.command_min = 1000;
+    config.command_max = 5000;
+    omx_soft_configure(&config);
+
+    OMX_Init();
+    run("polling", open_polling);
+    run("events, one at a time", open_events_serial);
+    run("events, graph", open_events);
+    OMX_Deinit();
+
+    return 0;
+}
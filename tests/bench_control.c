@@ -0,0 +1,168 @@
+//Loopback benchmark of stream/control.c: connection churn (connect, "sc"
+//in one write, the two answers, the server closes), then the CPU of
+//IDLE_CLIENTS idle connections while their keep-alive time-outs expire and
+//after. The CPU is the one of the process, the clients included. The
+//figures of stream.md (control)
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+
+#include "check.h"
+#include "../stream/control.h"
+
+#define CHURN 20000
+#define IDLE_CLIENTS 250
+#define TIMEOUT 300 //ms, keep-alive time-out of the server
+#define IDLE_TIME 2 //s
+
+static control_server_t control;
+static volatile int quit;
+static int opened, closed, expired;
+
+static int on_opened(void* arg, int id, const struct sockaddr_in* addr)
+{
+    opened++;
+    return 0;
+}
+
+//'s' is acknowledged, 'c' too and closes the connection
+static int on_command(void* arg, int id, unsigned char cmd)
+{
+    if (cmd == 'c')
+        return 'a' | CONTROL_CLOSE;
+    return (cmd == 's') ? 'a' : 'n';
+}
+
+static void on_expired(void* arg, int id)
+{
+    expired++;
+}
+
+static void on_closed(void* arg, int id)
+{
+    closed++;
+}
+
+static void* serve(void* arg)
+{
+    while (!quit)
+        CHECK(control_run(&control, 100) != -1);
+
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static long cpu_time(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000L
+            + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static int connect_server(const struct sockaddr_in* addr)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+    CHECK(sock != -1);
+    CHECK(connect(sock, (const struct sockaddr*)addr, sizeof(*addr)) == 0);
+
+    return sock;
+}
+
+static void answers(int sock, const char* expected)
+{
+    char rx[4];
+    int len = strlen(expected), got = 0;
+
+    while (got < len)
+    {
+        int n = read(sock, rx + got, len - got);
+        CHECK(n > 0);
+        got += n;
+    }
+    CHECK(memcmp(rx, expected, len) == 0);
+}
+
+int main(int argc, char** argv)
+{
+    control_ops_t ops = { on_opened, on_command, on_expired, on_closed,
+            NULL, NULL };
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int idle[IDLE_CLIENTS];
+    pthread_t tid;
+    char rx;
+    int i;
+
+    int listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK(listenfd != -1);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(bind(listenfd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    CHECK(getsockname(listenfd, (struct sockaddr*)&addr, &len) == 0);
+    CHECK(listen(listenfd, SOMAXCONN) == 0);
+
+    CHECK(control_init(&control, listenfd, -1, TIMEOUT, &ops) == 0);
+    CHECK(pthread_create(&tid, NULL, serve, NULL) == 0);
+
+    double start = now();
+    for (i = 0; i < CHURN; i++)
+    {
+        int sock = connect_server(&addr);
+        CHECK(write(sock, "sc", 2) == 2);
+        answers(sock, "aa");
+        CHECK(read(sock, &rx, 1) == 0); //closed by the server
+        close(sock);
+    }
+    double churn = now() - start;
+    fprintf(stderr, "churn: %d connections in %.2f s, %.0f connections/s\n",
+            CHURN, churn, CHURN / churn);
+
+    for (i = 0; i < IDLE_CLIENTS; i++)
+    {
+        idle[i] = connect_server(&addr);
+        CHECK(write(idle[i], "s", 1) == 1);
+        answers(idle[i], "a");
+    }
+    long cpu = cpu_time();
+    sleep(IDLE_TIME);
+    cpu = cpu_time() - cpu;
+    CHECK(expired == IDLE_CLIENTS);
+    fprintf(stderr, "%d idle connections, timers expiring: %.1f ms of CPU "
+            "per second\n", IDLE_CLIENTS, cpu / 1000.0 / IDLE_TIME);
+
+    cpu = cpu_time();
+    sleep(IDLE_TIME);
+    cpu = cpu_time() - cpu;
+    CHECK(expired == IDLE_CLIENTS); //the timers are one-shot
+    fprintf(stderr, "%d idle connections, after the time-outs: %.1f ms of "
+            "CPU per second\n", IDLE_CLIENTS, cpu / 1000.0 / IDLE_TIME);
+
+    for (i = 0; i < IDLE_CLIENTS; i++)
+        close(idle[i]);
+    while (control.nclients)
+        usleep(10000);
+    CHECK(opened == CHURN + IDLE_CLIENTS && closed == opened);
+
+    quit = 1;
+    pthread_join(tid, NULL);
+    control_deinit(&control);
+    close(listenfd);
+
+    return 0;
+}
@@ -0,0 +1,278 @@
+//Writes of a recording through record/segment.c and record/disk_writer.c
+//to a directory of the current one: 512MB of encoder buffers of 1 to 16KB
+//(8KB on average, a keyframe every 1.25MB: 1s GOP at 10Mbit/s) written as
+//fast as possible in 64MB segments, a preview file written with write()
+//meanwhile (a quarter of the bytes). The time runs up to the syncfs()
+//after the close. Linked with --wrap (Makefile): the latency of the write
+//system calls of the segments, io_uring_setup fails but for the io_uring
+//rows. Extents of the segments with FIEMAP. The figures of record.md
+//(disk_writer, benchmark)
+
+#define _GNU_SOURCE //syncfs()
+#include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+
+#include "check.h"
+#include "../record/segment.h"
+
+#define TOTAL (512 * 1024 * 1024)
+#define SEGMENT_BYTES (64 * 1024 * 1024)
+#define GOP_BYTES (1250 * 1000)
+#define MAX_BUFFER 16384
+#define MAX_SAMPLES 200000
+
+static const char* dir = "bench_disk_writer.dir";
+static unsigned char buffer[MAX_BUFFER];
+static int preview_fd = -1;
+
+static volatile int use_uring;
+static double write_time[MAX_SAMPLES];
+static int nwrites;
+
+static double now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/*---------------------------------------------------------------------
+   the write system calls of the segments, timed
+----------------------------------------------------------------------*/
+
+ssize_t __real_write(int fd, const void* buf, size_t count);
+ssize_t __real_pwritev(int fd, const struct iovec* iov, int iovcnt,
+        off_t offset);
+long __real_syscall(long number, ...);
+
+static void timed(double start)
+{
+    if (nwrites < MAX_SAMPLES)
+        write_time[nwrites++] = now() - start;
+}
+
+ssize_t __wrap_write(int fd, const void* buf, size_t count)
+{
+    double start = now();
+    ssize_t n = __real_write(fd, buf, count);
+    if (fd != preview_fd)
+        timed(start);
+
+    return n;
+}
+
+ssize_t __wrap_pwritev(int fd, const struct iovec* iov, int iovcnt,
+        off_t offset)
+{
+    double start = now();
+    ssize_t n = __real_pwritev(fd, iov, iovcnt, offset);
+    timed(start);
+
+    return n;
+}
+
+long __wrap_syscall(long number, ...)
+{
+    long a[6];
+    va_list ap;
+    int i;
+
+    va_start(ap, number);
+    for (i = 0; i < 6; i++)
+        a[i] = va_arg(ap, long);
+    va_end(ap);
+
+#ifdef __NR_io_uring_setup
+    if (number == __NR_io_uring_setup && !use_uring)
+    {
+        errno = ENOSYS;
+        return -1;
+    }
+#endif
+
+    return __real_syscall(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+/*---------------------------------------------------------------------
+   runs
+----------------------------------------------------------------------*/
+
+typedef struct
+{
+    const char* name;
+    int writer;
+    int chunk;
+    int direct;
+    int preallocate;
+    int fsync;
+    int uring;
+} run_t;
+
+static int compare(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double p99(double* samples, int n)
+{
+    if (n == 0)
+        return 0;
+    qsort(samples, n, sizeof(double), compare);
+    return samples[n * 99 / 100];
+}
+
+//extents of the segments listed in the index, then the files deleted
+static int extents(void)
+{
+    char path[2 * SEGMENT_NAME_MAX];
+    char line[2 * SEGMENT_NAME_MAX];
+    char name[SEGMENT_NAME_MAX];
+    struct fiemap fm;
+    int n = 0;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, SEGMENT_INDEX_NAME);
+    FILE* f = fopen(path, "r");
+    CHECK(f != NULL);
+    while (fgets(line, sizeof(line), f))
+    {
+        CHECK(sscanf(line, "%*s %*s %255s", name) == 1);
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        int fd = open(path, O_RDONLY);
+        CHECK(fd != -1);
+        memset(&fm, 0, sizeof(fm));
+        fm.fm_length = ~0ULL;
+        fm.fm_flags = FIEMAP_FLAG_SYNC;
+        CHECK(ioctl(fd, FS_IOC_FIEMAP, &fm) == 0);
+        n += fm.fm_mapped_extents;
+        close(fd);
+        unlink(path);
+    }
+    fclose(f);
+    snprintf(path, sizeof(path), "%s/%s", dir, SEGMENT_INDEX_NAME);
+    unlink(path);
+
+    return n;
+}
+
+static void run(const run_t* r)
+{
+    static double call_time[MAX_SAMPLES];
+    segment_config_t config;
+    segment_writer_t seg;
+    disk_writer_t w;
+    unsigned seed = 1;
+    uint64_t pts = 0;
+    int written = 0, gop = 0, calls = 0;
+    char path[64];
+
+    snprintf(path, sizeof(path), "%s/preview.h264", dir);
+    preview_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    CHECK(preview_fd != -1);
+
+    use_uring = r->uring;
+    if (r->writer)
+        CHECK(disk_writer_init(&w, r->chunk, r->direct) == 0);
+    memset(&config, 0, sizeof(config));
+    config.dir = dir;
+    config.name = "bench-%Y%m%d-%H%M%S.ts";
+    config.bytes = SEGMENT_BYTES;
+    config.writer = r->writer ? &w : NULL;
+    config.preallocate = r->preallocate ? SEGMENT_BYTES + GOP_BYTES : 0;
+    config.fsync = r->fsync;
+    nwrites = 0;
+
+    double start = now();
+    CHECK(segment_open(&seg, &config) == 0);
+    while (written < TOTAL)
+    {
+        seed = seed * 1103515245 + 12345;
+        int len = 1 + (seed >> 8) % MAX_BUFFER;
+        buffer[0] = seed;
+
+        double t = now();
+        if (gop >= GOP_BYTES)
+        {
+            //end of a GOP, the next buffer starts a keyframe
+            CHECK(segment_sync(&seg) == 0);
+            if (segment_due(&seg, pts))
+                segment_rotate(&seg, pts, pts);
+            gop = 0;
+        }
+        else if (written == 0)
+            segment_due(&seg, pts);
+        CHECK(segment_write(&seg, buffer, len) == 0);
+        if (calls < MAX_SAMPLES)
+            call_time[calls++] = now() - t;
+
+        CHECK(write(preview_fd, buffer, len / 4 + 1) == len / 4 + 1);
+        written += len;
+        gop += len;
+        pts += 1000;
+    }
+    segment_close(&seg);
+    if (r->writer)
+        disk_writer_deinit(&w);
+    close(preview_fd);
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    CHECK(fd != -1 && syncfs(fd) == 0);
+    double time = now() - start;
+    close(fd);
+    preview_fd = -1;
+    unlink(path);
+
+    uint32_t writes = r->writer ? w.writes : nwrites;
+    fprintf(stderr, "| %s | %.0f | %u | %dKB | ", r->name, TOTAL / time / 1e6,
+            writes, (int)(TOTAL / writes / 1024));
+    if (r->uring)
+        fprintf(stderr, "| ");
+    else
+        fprintf(stderr, "%.2fms | ", p99(write_time, nwrites) * 1000);
+    fprintf(stderr, "%.3fms | %d |\n", p99(call_time, calls) * 1000,
+            extents());
+}
+
+int main(int argc, char** argv)
+{
+    static const run_t runs[] = {
+        { "`write()` per buffer", 0, 0, 0, 0, 0, 0 },
+        { "1MB chunks", 1, 1 << 20, 0, 0, 0, 0 },
+        { "1MB chunks, fallocate", 1, 1 << 20, 0, 1, 0, 0 },
+        { "4MB chunks, fallocate", 1, 4 << 20, 0, 1, 0, 0 },
+        { "1MB O_DIRECT, fallocate", 1, 1 << 20, 1, 1, 0, 0 },
+        { "4MB O_DIRECT, fallocate", 1, 4 << 20, 1, 1, 0, 0 },
+        { "1MB O_DIRECT, fsync per segment", 1, 1 << 20, 1, 1,
+                SEGMENT_FSYNC_SEGMENT, 0 },
+        { "1MB O_DIRECT, fsync per GOP", 1, 1 << 20, 1, 1,
+                SEGMENT_FSYNC_GOP, 0 },
+        { "1MB page cache, fsync per GOP", 1, 1 << 20, 0, 1,
+                SEGMENT_FSYNC_GOP, 0 },
+        { "4MB O_DIRECT, io_uring", 1, 4 << 20, 1, 1, 0, 1 },
+        { "1MB page cache, io_uring", 1, 1 << 20, 0, 1, 0, 1 },
+    };
+    unsigned i;
+
+    CHECK(mkdir(dir, 0777) == 0 || errno == EEXIST);
+
+    fprintf(stderr, "| writes | MB/s | write calls | size | p99 write "
+            "| p99 writing thread | extents of the segments |\n"
+            "|--------|------|-------------|------|-----------"
+            "|--------------------|-------------------------|\n");
+    for (i = 0; i < sizeof(runs) / sizeof(runs[0]); i++)
+        run(&runs[i]);
+
+    rmdir(dir);
+
+    return 0;
+}
@@ -0,0 +1,111 @@
+//Frames of stream/fec.c received complete with random packet loss: 5000
+//frames of 4KB and 20KB packetized for an MTU of 1400 (the media packets
+//leave FEC_OVERHEAD bytes), each packet lost with the probability 'loss',
+//the survivors go through fec_decode(). No sockets, the loss is simulated.
+//The figures of stream.md (fec)
+
+#include <string.h>
+
+#include "check.h"
+#include "../stream/fec.h"
+
+#define FRAMES 5000
+#define MTU RTP_DEFAULT_MTU
+
+static udp_batch_t batch;
+static int received[UDP_BATCH_MAX];
+static uint16_t first_seq;
+
+static int batch_put(void* arg, const unsigned char* packet, int len)
+{
+    return udp_batch_put(&batch, packet, len);
+}
+
+static int recovered(void* arg, const unsigned char* packet, int len)
+{
+    received[(uint16_t)(((packet[2] << 8) | packet[3]) - first_seq)] = 1;
+    return 0;
+}
+
+//percentage of the frames received complete
+static double run(const unsigned char* frame, int size, double ratio,
+        double loss, int* packets)
+{
+    static fec_encoder_t fec;
+    static fec_decoder_t dec;
+    rtp_packetizer_t rtp;
+    unsigned seed = 1;
+    int complete = 0;
+    int f, i;
+
+    rtp_packetizer_init(&rtp, (ratio > 0) ? MTU - FEC_OVERHEAD : MTU, 1,
+            batch_put, NULL);
+    fec_encoder_init(&fec, ratio, 2);
+    fec_decoder_init(&dec);
+
+    for (f = 0; f < FRAMES; f++)
+    {
+        udp_batch_clear(&batch);
+        CHECK(rtp_send_frame(&rtp, frame, size, f * 3000, 1) == 0);
+        int k = batch.count;
+        CHECK(k <= fec.block);
+        fec_protect(&fec, &batch);
+        *packets = k;
+
+        first_seq = (batch.data[batch.offset[0] + 2] << 8)
+                | batch.data[batch.offset[0] + 3];
+        memset(received, 0, sizeof(received));
+        for (i = 0; i < batch.count; i++)
+        {
+            const unsigned char* packet = batch.data + batch.offset[i];
+            CHECK(batch.len[i] <= MTU);
+            if (rand_r(&seed) < loss * RAND_MAX)
+                continue;
+            if (i < k)
+                recovered(NULL, packet, batch.len[i]);
+            fec_decode(&dec, packet, batch.len[i], recovered, NULL);
+        }
+
+        for (i = 0; i < k && received[i]; i++)
+            ;
+        complete += (i == k);
+    }
+
+    return 100.0 * complete / FRAMES;
+}
+
+int main(int argc, char** argv)
+{
+    static unsigned char frame[20000];
+    int sizes[] = { 4000, 20000 };
+    double losses[] = { 0.01, 0.02, 0.05, 0.1 };
+    double ratios[] = { 0, 0.25, 0.5 };
+    unsigned seed = 1;
+    int s, l, r, i, packets;
+
+    //one IDR NAL unit of random bytes, no start code inside
+    memcpy(frame, "\0\0\0\1\x65", 5);
+    for (i = 5; i < (int)sizeof(frame); i++)
+        frame[i] = 1 + rand_r(&seed) % 255;
+
+    printf("| frame | loss | no FEC | ratio 0.25 | ratio 0.5 |\n");
+    printf("|---|---|---|---|---|\n");
+    for (s = 0; s < 2; s++)
+    {
+        for (l = 0; l < 4; l++)
+        {
+            double complete[3];
+            for (r = 0; r < 3; r++)
+                complete[r] = run(frame, sizes[s], ratios[r], losses[l],
+                        &packets);
+            if (l == 0)
+                printf("| %dKB (%d packets) ", sizes[s] / 1000, packets);
+            else
+                printf("| ");
+            printf("| %.0f%% | %.1f%% | %.1f%% | %.1f%% |\n",
+                    losses[l] * 100, complete[0], complete[1], complete[2]);
+        }
+    }
+
+    return 0;
+}
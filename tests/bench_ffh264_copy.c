@@ -0,0 +1,151 @@
+//ffh264_enc_encode() against ffh264_enc_encode_buffer() of
+//h264_udp_ffstream_dir/ffh264enc.c: the copy of the picture into the
+//encoder alone (the 3 memcpy() of ffh264_enc_encode(), from a buffer in
+//cache and from ROTATING buffers, like a frame just written by DMA), then
+//the encode time per frame of both calls, 432x240 at 300 kbit/s, slice
+//threads, all IDR, FRAMES synthetic frames. Needs libavcodec: make ffbench.
+//The figures of h264_udp_ffstream.md (zero copy)
+
+#include <string.h>
+#include <time.h>
+
+#include "check.h"
+#include "../h264_udp_ffstream_dir/ffh264enc.h"
+
+#define WIDTH 432
+#define HEIGHT 240
+#define LINE 448 //the lines of the resize output, padded to 32 bytes
+#define FRAME_SIZE (LINE * HEIGHT * 3 / 2)
+#define FRAMES 1100
+#define COPIES 20000
+#define ROTATING 1000 //161 MB, far more than the caches
+
+static unsigned seed = 1;
+
+static unsigned rnd(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+static double now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int compare(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+//the planes of ffh264_enc_encode(), us per frame
+static double copy(unsigned char *dst, unsigned char *src, int buffers)
+{
+    int luma = LINE * HEIGHT, chroma = LINE / 2 * HEIGHT / 2;
+    int i;
+
+    double start = now();
+    for (i = 0; i < COPIES; i++)
+    {
+        unsigned char *p = src + (size_t) (i % buffers) * FRAME_SIZE;
+        memcpy(dst, p, luma);
+        memcpy(dst + luma, p + luma, chroma);
+        memcpy(dst + luma + chroma, p + luma + chroma, chroma);
+    }
+    return (now() - start) / COPIES * 1e6;
+}
+
+//a gradient moving 2 pixels a frame, a noise block
+static void make_frame(unsigned char *p, int n)
+{
+    int x, y;
+
+    for (y = 0; y < HEIGHT; y++)
+    {
+        for (x = 0; x < LINE; x++)
+        {
+            p[y * LINE + x] = (x + y + 2 * n) & 0xff;
+            if (x >= 64 && x < 128 && y >= 64 && y < 128)
+                p[y * LINE + x] = rnd();
+        }
+    }
+    memset(p + LINE * HEIGHT, 128, LINE * HEIGHT / 2);
+}
+
+static void released(void *opaque, unsigned char *data)
+{
+    (*(int *) opaque)++;
+}
+
+//encode time per frame in ms, mean and p99
+static void encode(int in_place)
+{
+    static double times[FRAMES];
+    static unsigned char frame[FRAME_SIZE];
+    ffh264_enc_config_t cfg;
+    unsigned char *out;
+    double sum = 0;
+    int n, len, releases = 0;
+
+    ffh264_enc_config_default(&cfg, WIDTH, HEIGHT, 300000, 30);
+    ffh264_enc_t *enc = ffh264_enc_open_config(&cfg);
+    CHECK(enc != NULL);
+
+    for (n = 0; n < FRAMES; n++)
+    {
+        make_frame(frame, n);
+        double start = now();
+        if (in_place)
+        {
+            len = ffh264_enc_encode_buffer(enc, frame, FRAME_SIZE, released,
+                    &releases, &out);
+            //x264 copies its input, the buffer is given back at once
+            CHECK(releases == n + 1);
+        }
+        else
+            len = ffh264_enc_encode(enc, frame, &out);
+        times[n] = (now() - start) * 1000;
+        CHECK(len > 0);
+    }
+    CHECK(ffh264_enc_close(enc) == 0);
+
+    //the first frames open the threads and the lookahead
+    for (n = 100; n < FRAMES; n++)
+        sum += times[n];
+    qsort(times + 100, FRAMES - 100, sizeof(double), compare);
+    fprintf(stderr, "| %s | %.2f | %.2f |\n", in_place
+            ? "ffh264_enc_encode_buffer()" : "ffh264_enc_encode()",
+            sum / (FRAMES - 100), times[100 + (FRAMES - 100) * 99 / 100]);
+}
+
+int main(int argc, char **argv)
+{
+    static unsigned char dst[FRAME_SIZE];
+    unsigned char *src = malloc((size_t) ROTATING * FRAME_SIZE);
+    double us;
+
+    CHECK(src != NULL);
+    memset(src, 1, (size_t) ROTATING * FRAME_SIZE);
+
+    fprintf(stderr, "| source | per frame | copy |\n|---|---|---|\n");
+    us = copy(dst, src, 1);
+    fprintf(stderr, "| in cache | %.1f us | %.1f GB/s |\n", us,
+            FRAME_SIZE / us / 1000);
+    us = copy(dst, src, ROTATING);
+    fprintf(stderr, "| %d rotating buffers | %.1f us | %.1f GB/s |\n",
+            ROTATING, us, FRAME_SIZE / us / 1000);
+    free(src);
+
+    fprintf(stderr, "| call | encode mean (ms) | p99 (ms) |\n|---|---|---|\n");
+    encode(0);
+    encode(1);
+    encode(0);
+    encode(1);
+
+    return 0;
+}
@@ -0,0 +1,196 @@
+//Threading, GOP and intra refresh of ffh264_enc_open_config()
+//(h264_udp_ffstream_dir/ffh264enc.c), 432x240 at 300 kbit/s on synthetic
+//frames (moving gradient and noise). fps: FRAMES frames as fast as
+//possible. Latency: FRAMES frames paced at FPS, from the capture time of
+//a frame to its packet out of the encoder (the n-th packet is the n-th
+//frame, there are no B frames), the first second left out. Needs
+//libavcodec: make ffbench. The table of h264_udp_ffstream.md (threading,
+//GOP and intra refresh)
+
+#include <string.h>
+#include <time.h>
+
+#include "check.h"
+#include "../h264_udp_ffstream_dir/ffh264enc.h"
+
+#define WIDTH 432
+#define HEIGHT 240
+#define LINE 448 //the lines of the resize output, padded to 32 bytes
+#define FRAME_SIZE (LINE * HEIGHT * 3 / 2)
+#define FRAMES 300
+#define FPS 30
+
+typedef struct
+{
+    const char *name;
+    int thread_type;
+    int threads;
+    int lookahead;
+    int gop;
+    int intra_refresh;
+} encoder_mode_t;
+
+static const encoder_mode_t modes[] =
+{
+    { "slice, 1 thread, gop 1", FFH264_THREAD_SLICE, 1, 0, 1, 0 },
+    { "slice, 3 threads, gop 1 (default)", FFH264_THREAD_SLICE, 3, 0, 1, 0 },
+    { "slice, 3 threads, gop 30", FFH264_THREAD_SLICE, 3, 0, 30, 0 },
+    { "slice, 3 threads, intra refresh 30", FFH264_THREAD_SLICE, 3, 0, 30, 1 },
+    { "frame, 3 threads, lookahead 0, gop 30", FFH264_THREAD_FRAME, 3, 0, 30,
+            0 },
+    { "frame, 3 threads, lookahead 10, gop 30", FFH264_THREAD_FRAME, 3, 10,
+            30, 0 },
+    { "frame, 3 threads, lookahead 40, gop 30", FFH264_THREAD_FRAME, 3, 40,
+            30, 0 },
+};
+
+static unsigned char frames[FRAMES][FRAME_SIZE];
+static double captured[FRAMES], latency[FRAMES];
+
+static unsigned seed = 1;
+
+static unsigned rnd(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+//a gradient moving 2 pixels a frame, a noise block
+static void make_frames(void)
+{
+    int n, x, y;
+
+    for (n = 0; n < FRAMES; n++)
+    {
+        unsigned char *p = frames[n];
+        for (y = 0; y < HEIGHT; y++)
+        {
+            for (x = 0; x < LINE; x++)
+            {
+                p[y * LINE + x] = (x + y + 2 * n) & 0xff;
+                if (x >= 64 && x < 128 && y >= 64 && y < 128)
+                    p[y * LINE + x] = rnd();
+            }
+        }
+        memset(p + LINE * HEIGHT, 128, LINE * HEIGHT / 2);
+    }
+}
+
+static double now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void wait_until(double t)
+{
+    struct timespec ts;
+
+    ts.tv_sec = (time_t) t;
+    ts.tv_nsec = (long) ((t - ts.tv_sec) * 1e9);
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+static int compare(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+static ffh264_enc_t *open_mode(const encoder_mode_t *mode)
+{
+    ffh264_enc_config_t cfg;
+
+    ffh264_enc_config_default(&cfg, WIDTH, HEIGHT, 300000, FPS);
+    cfg.thread_type = mode->thread_type;
+    cfg.threads = mode->threads;
+    cfg.lookahead = mode->lookahead;
+    cfg.gop = mode->gop;
+    cfg.intra_refresh = mode->intra_refresh;
+    ffh264_enc_t *enc = ffh264_enc_open_config(&cfg);
+    CHECK(enc != NULL);
+
+    return enc;
+}
+
+//the packets ready, dated; return: the next frame to come out
+static int receive(ffh264_enc_t *enc, int len, int out, long *bytes)
+{
+    unsigned char *data;
+
+    while (len > 0)
+    {
+        CHECK(out < FRAMES);
+        latency[out] = (now() - captured[out]) * 1000;
+        *bytes += len;
+        out++;
+        len = ffh264_enc_receive(enc, &data);
+    }
+    CHECK(len == 0);
+
+    return out;
+}
+
+static void run(const encoder_mode_t *mode)
+{
+    unsigned char *data;
+    long bytes = 0;
+    double sum = 0;
+    int n, out = 0;
+
+    //fps
+    ffh264_enc_t *enc = open_mode(mode);
+    double start = now();
+    for (n = 0; n < FRAMES; n++)
+    {
+        captured[n] = now();
+        out = receive(enc, ffh264_enc_encode(enc, frames[n], &data), out,
+                &bytes);
+    }
+    CHECK(ffh264_enc_drain(enc) == 0);
+    out = receive(enc, ffh264_enc_receive(enc, &data), out, &bytes);
+    double fps = FRAMES / (now() - start);
+    CHECK(out == FRAMES);
+    CHECK(ffh264_enc_close(enc) == 0);
+
+    //latency, at the camera rate
+    enc = open_mode(mode);
+    start = now();
+    out = 0;
+    bytes = 0;
+    for (n = 0; n < FRAMES; n++)
+    {
+        wait_until(start + (double) n / FPS);
+        captured[n] = now();
+        out = receive(enc, ffh264_enc_encode(enc, frames[n], &data), out,
+                &bytes);
+    }
+    CHECK(ffh264_enc_drain(enc) == 0);
+    out = receive(enc, ffh264_enc_receive(enc, &data), out, &bytes);
+    CHECK(out == FRAMES);
+    CHECK(ffh264_enc_close(enc) == 0);
+
+    for (n = FPS; n < FRAMES; n++)
+        sum += latency[n];
+    qsort(latency + FPS, FRAMES - FPS, sizeof(double), compare);
+    fprintf(stderr, "| %s | %.0f | %.1f | %.1f | %.0f |\n", mode->name, fps,
+            sum / (FRAMES - FPS),
+            latency[FPS + (FRAMES - FPS) * 99 / 100],
+            bytes * 8.0 * FPS / FRAMES / 1000);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned i;
+
+    make_frames();
+    fprintf(stderr, "| mode | fps | latency mean (ms) | latency p99 (ms) | "
+            "kbit/s |\n|---|---|---|---|---|\n");
+    for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+        run(&modes[i]);
+
+    return 0;
+}
@@ -0,0 +1,132 @@
+//K encoders of h264_udp_ffstream_dir/ffh264enc.c, each on its own thread:
+//ffh264_enc_open_config() slice threads, 432x240 at 300 kbit/s, all IDR,
+//FRAMES synthetic frames (moving gradient and noise) as fast as possible.
+//The aggregate and per stream fps for K = 1, 2, 4 and 1 or 3 x264
+//threads per encoder. Needs libavcodec: make ffbench. The table of
+//h264_udp_ffstream.md (ffh264enc)
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "check.h"
+#include "../h264_udp_ffstream_dir/ffh264enc.h"
+
+#define WIDTH 432
+#define HEIGHT 240
+#define LINE 448 //the lines of the resize output, padded to 32 bytes
+#define FRAME_SIZE (LINE * HEIGHT * 3 / 2)
+#define FRAMES 300
+#define MAX_STREAMS 4
+
+typedef struct
+{
+    int threads;
+    unsigned char *frames; //FRAMES of FRAME_SIZE
+    long bytes;
+} stream_t;
+
+static unsigned seed = 1;
+
+static unsigned rnd(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+//a gradient moving 2 pixels a frame, a noise block
+static void make_frames(unsigned char *frames)
+{
+    int n, x, y;
+
+    for (n = 0; n < FRAMES; n++)
+    {
+        unsigned char *p = frames + (size_t) n * FRAME_SIZE;
+        for (y = 0; y < HEIGHT; y++)
+        {
+            for (x = 0; x < LINE; x++)
+            {
+                p[y * LINE + x] = (x + y + 2 * n) & 0xff;
+                if (x >= 64 && x < 128 && y >= 64 && y < 128)
+                    p[y * LINE + x] = rnd();
+            }
+        }
+        memset(p + LINE * HEIGHT, 128, LINE * HEIGHT / 2);
+    }
+}
+
+static double now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void *encode(void *arg)
+{
+    stream_t *stream = arg;
+    ffh264_enc_config_t cfg;
+    unsigned char *out;
+    int n, len;
+
+    ffh264_enc_config_default(&cfg, WIDTH, HEIGHT, 300000, 30);
+    cfg.threads = stream->threads;
+    ffh264_enc_t *enc = ffh264_enc_open_config(&cfg);
+    CHECK(enc != NULL);
+
+    for (n = 0; n < FRAMES; n++)
+    {
+        len = ffh264_enc_encode(enc,
+                stream->frames + (size_t) n * FRAME_SIZE, &out);
+        CHECK(len > 0); //slice threads: every frame out of its own call
+        stream->bytes += len;
+    }
+    CHECK(ffh264_enc_close(enc) == 0);
+
+    return NULL;
+}
+
+static void run(unsigned char *frames, int k, int threads)
+{
+    stream_t streams[MAX_STREAMS];
+    pthread_t tid[MAX_STREAMS];
+    int i;
+
+    double start = now();
+    for (i = 0; i < k; i++)
+    {
+        streams[i].threads = threads;
+        streams[i].frames = frames;
+        streams[i].bytes = 0;
+        CHECK(pthread_create(&tid[i], NULL, encode, &streams[i]) == 0);
+    }
+    for (i = 0; i < k; i++)
+        pthread_join(tid[i], NULL);
+    double time = now() - start;
+
+    fprintf(stderr, "| %d | %d | %.0f | %.0f |\n", k, threads,
+            k * FRAMES / time, FRAMES / time);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned char *frames = malloc((size_t) FRAMES * FRAME_SIZE);
+
+    CHECK(frames != NULL);
+    make_frames(frames);
+
+    fprintf(stderr, "%ld CPU\n", sysconf(_SC_NPROCESSORS_ONLN));
+    fprintf(stderr, "| K | x264 threads per encoder | aggregate fps | "
+            "fps per stream |\n|---|---|---|---|\n");
+    run(frames, 1, 1);
+    run(frames, 2, 1);
+    run(frames, 4, 1);
+    run(frames, 1, 3);
+    run(frames, 4, 3);
+
+    free(frames);
+
+    return 0;
+}
@@ -0,0 +1,138 @@
+//Write amplification and CPU of the containers of record/ against the raw
+//writer: 5 minutes of 10Mbit/s at 30fps (GOP 30, 150KB IDR + 37KB P
+//frames), written to a file of the current directory through the page
+//cache. raw : the frames in buffers of up to 64KB, as the encoder gives
+//them, fmp4 : fmp4_write_frame(), ts : ts_mux_frame() in writes of
+//TS_PACKETS_PER_FILE_WRITE. The figures of record.md (fmp4)
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "check.h"
+#include "../record/fmp4.h"
+#include "../record/ts.h"
+
+#define FRAMES 9000 //5 minutes at 30fps
+#define GOP 30
+#define IDR_SIZE 150000
+#define P_SIZE 37000
+#define ENCODER_BUFFER 65536
+
+static unsigned char idr[IDR_SIZE], p_frame[P_SIZE];
+static long writes;
+
+static int write_fd(void* arg, const unsigned char* data, int len)
+{
+    writes++;
+
+    return (write(*(int*)arg, data, len) == len) ? 0 : -1;
+}
+
+static double cpu_time(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+            + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static void make_frames(void)
+{
+    //SPS, PPS and IDR slice of a 640x480 High profile stream
+    static const unsigned char header[] = { 0, 0, 0, 1, 0x67, 0x64, 0, 0x1e,
+            0xac, 0xb4, 0x05, 0x01, 0xed, 0x08, 0, 0, 3, 0, 8, 0, 0, 3, 1,
+            0xe4, 0x78, 0xb1, 0x75, 0, 0, 0, 1, 0x68, 0xef, 0x0f, 0xcb, 0, 0,
+            0, 1, 0x65 };
+    unsigned seed = 2;
+    int i;
+
+    //no 00 00 in the slices
+    for (i = 0; i < IDR_SIZE; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        idr[i] = 1 + (seed >> 16) % 255;
+    }
+    for (i = 0; i < P_SIZE; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        p_frame[i] = 1 + (seed >> 16) % 255;
+    }
+    memcpy(idr, header, sizeof(header));
+    memcpy(p_frame, "\0\0\0\1\x41", 5);
+}
+
+static void run(const char* name, int fd)
+{
+    static fmp4_writer_t mp4;
+    static ts_muxer_t ts;
+    long long in = 0;
+    int i, off;
+
+    CHECK(ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0);
+    writes = 0;
+    if (name[0] == 'f')
+        CHECK(fmp4_writer_init(&mp4, write_fd, &fd) == 0);
+    else if (name[0] == 't')
+        ts_muxer_init(&ts, TS_PACKETS_PER_FILE_WRITE, write_fd, &fd);
+
+    double cpu = cpu_time();
+    for (i = 0; i < FRAMES; i++)
+    {
+        int keyframe = (i % GOP == 0);
+        const unsigned char* data = keyframe ? idr : p_frame;
+        int len = keyframe ? IDR_SIZE : P_SIZE;
+        uint64_t pts = i * 33333ULL;
+
+        in += len;
+        if (name[0] == 'r')
+        {
+            for (off = 0; off < len; off += ENCODER_BUFFER)
+            {
+                int n = (len - off < ENCODER_BUFFER) ? len - off
+                        : ENCODER_BUFFER;
+                CHECK(write_fd(&fd, data + off, n) == 0);
+            }
+        }
+        else if (name[0] == 'f')
+            CHECK(fmp4_write_frame(&mp4, data, len, pts, keyframe) == 0);
+        else
+            CHECK(ts_mux_frame(&ts, data, len, pts, pts, keyframe) == 0);
+    }
+    if (name[0] == 'f')
+    {
+        CHECK(fmp4_finish(&mp4) == 0);
+        fmp4_writer_deinit(&mp4);
+    }
+    else if (name[0] == 't')
+        CHECK(ts_flush(&ts) == 0);
+    cpu = cpu_time() - cpu;
+
+    off_t size = lseek(fd, 0, SEEK_END);
+    fprintf(stderr, "| %s | %.4f | %ld | %.3fs | %.2f%% |\n", name,
+            (double)size / in, writes, cpu, cpu / (FRAMES / 30.0) * 100);
+}
+
+int main(int argc, char** argv)
+{
+    char path[] = "bench_fmp4.XXXXXX";
+    int fd = mkstemp(path);
+
+    CHECK(fd != -1);
+    make_frames();
+
+    fprintf(stderr, "| writer | file bytes / encoder bytes | write() calls "
+            "| CPU (user+sys) | of one core |\n"
+            "|--------|----------------------------|---------------"
+            "|----------------|-------------|\n");
+    run("raw", fd);
+    run("fmp4", fd);
+    run("ts", fd);
+
+    close(fd);
+    unlink(path);
+
+    return 0;
+}
@@ -0,0 +1,184 @@
+//Speed of the start code search of stream/h264_nal.c: every start code of
+//a buffer found with h264_find_start_code_scalar(), h264_find_start_code()
+//(SSE2 or NEON as built) and the NAL units read with h264_next_nal(), in
+//GB/s, best of 5. The frames are synthetic: slices of random bytes escaped
+//as an encoder does (00 00 03), 150KB IDR with SPS/PPS then 29 P frames of
+//37KB. The figures of stream.md (h264_nal)
+
+#include <string.h>
+#include <time.h>
+
+#include "check.h"
+#include "../stream/h264_nal.h"
+
+#define SMALL (4 << 20)
+#define LARGE (64 << 20)
+#define RUNS 5
+
+static unsigned seed = 1;
+
+static unsigned rnd(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+static double now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+//Annex-B frames filling 'n' bytes
+static void make_frames(unsigned char* p, int n)
+{
+    static const unsigned char sps_pps[] = { 0, 0, 0, 1, 0x67, 0x64, 0, 0x1e,
+            0xac, 0xb4, 0x05, 0x01, 0xed, 0x08, 0, 0, 3, 0, 8, 0, 0, 3, 1,
+            0xe4, 0x78, 0xb1, 0x75, 0, 0, 0, 1, 0x68, 0xef, 0x0f, 0xcb };
+    int pos = 0, frame = 0;
+
+    while (1)
+    {
+        int keyframe = (frame++ % 30 == 0);
+        int len = keyframe ? 150000 : 37000;
+        int zeros = 0;
+        int i;
+
+        //the last frame is cut to the end of the buffer
+        int last = (pos + len + (int)sizeof(sps_pps) + 6 >= n);
+        if (last)
+            len = n - pos - sizeof(sps_pps) - 6;
+        if (keyframe)
+        {
+            memcpy(p + pos, sps_pps, sizeof(sps_pps));
+            pos += sizeof(sps_pps);
+        }
+        memcpy(p + pos, keyframe ? "\0\0\0\1\x65" : "\0\0\0\1\x41", 5);
+        pos += 5;
+        //a slice: no 00 00 0x with x <= 3 but through 00 00 03
+        for (i = 0; i < len; i++)
+        {
+            unsigned char b = rnd();
+            if (zeros >= 2 && b <= 3)
+            {
+                p[pos++] = 3;
+                zeros = 0;
+                i++;
+            }
+            p[pos++] = b;
+            zeros = (b == 0) ? zeros + 1 : 0;
+        }
+        if (last)
+            break;
+    }
+    memset(p + pos, 0xff, n - pos);
+}
+
+static void make_random(unsigned char* p, int n, int zeros)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        p[i] = (int)(rnd() % 100) < zeros ? 0 : rnd();
+}
+
+typedef const unsigned char* (*find_t)(const unsigned char* p,
+        const unsigned char* end);
+
+//GB/s of a search through the whole buffer, best of RUNS
+static double search(find_t find, const unsigned char* data, int n,
+        int* found)
+{
+    double best = 0;
+    int r;
+
+    for (r = 0; r < RUNS; r++)
+    {
+        const unsigned char* p = data;
+        const unsigned char* end = data + n;
+        int count = 0;
+
+        double start = now();
+        while ((p = find(p, end)) < end)
+        {
+            count++;
+            p += 3;
+        }
+        double gbs = n / (now() - start) / 1e9;
+        if (gbs > best)
+            best = gbs;
+        *found = count;
+    }
+
+    return best;
+}
+
+static double read_nals(const unsigned char* data, int n, int* found)
+{
+    h264_nal_reader_t reader;
+    h264_nal_t nal;
+    double best = 0;
+    int r;
+
+    for (r = 0; r < RUNS; r++)
+    {
+        int count = 0;
+
+        double start = now();
+        h264_nal_reader_init(&reader, data, n);
+        while (h264_next_nal(&reader, &nal))
+            count++;
+        double gbs = n / (now() - start) / 1e9;
+        if (gbs > best)
+            best = gbs;
+        *found = count;
+    }
+
+    return best;
+}
+
+static void run(const char* name, const unsigned char* data, int n)
+{
+    int scalar_found, simd_found, nals;
+
+    double scalar = search(h264_find_start_code_scalar, data, n,
+            &scalar_found);
+    double simd = search(h264_find_start_code, data, n, &simd_found);
+    double reader = read_nals(data, n, &nals);
+
+    CHECK(scalar_found == simd_found);
+    fprintf(stderr, "| %s | %.2f | %.2f | x%.1f | %.2f |\n", name, scalar,
+            simd, simd / scalar, reader);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned char* data = malloc(LARGE);
+
+    CHECK(data != NULL);
+
+#if defined(__SSE2__)
+    const char* simd = "SSE2";
+#elif defined(__ARM_NEON)
+    const char* simd = "NEON";
+#else
+    const char* simd = "scalar";
+#endif
+    fprintf(stderr, "| data | scalar | %s | | `h264_next_nal()` |\n"
+            "|------|--------|------|-|-------------------|\n", simd);
+
+    make_frames(data, SMALL);
+    run("H.264 frames, 4MB (in cache)", data, SMALL);
+    make_frames(data, LARGE);
+    run("H.264 frames, 64MB", data, LARGE);
+    make_random(data, LARGE, 0);
+    run("random bytes, 64MB", data, LARGE);
+    make_random(data, SMALL, 75);
+    run("75% zero bytes, 4MB", data, SMALL);
+
+    free(data);
+
+    return 0;
+}
@@ -0,0 +1,174 @@
+//Spacing of the packets of stream/pacer.c over loopback: a 42KB IDR (31
+//packets) every 33 ms, spread over PACING_FRACTION 0.5 of the frame
+//interval, with and without the pacer. A thread takes the arrival time of
+//each packet, the gap between two bursts is the median of the gaps over
+//BURST_GAP. The figures of stream.md (pacer)
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "check.h"
+#include "../stream/rtp.h"
+#include "../stream/pacer.h"
+
+#define FRAME_SIZE (42 * 1024)
+#define FRAMES 30
+#define FRAME_INTERVAL 33333 //us, 30 fps
+#define WINDOW (FRAME_INTERVAL / 2)
+#define MAX_PACKETS 64
+#define BURST_GAP 100 //us, longer gaps are between two bursts
+
+static int rx_sock;
+static volatile int quit;
+static uint64_t arrival[FRAMES][MAX_PACKETS];
+static int count[FRAMES];
+
+static uint64_t now_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+//arrival time of each packet, the RTP timestamp is the frame number
+static void* receiver(void* arg)
+{
+    unsigned char packet[2048];
+
+    while (!quit)
+    {
+        if (recv(rx_sock, packet, sizeof(packet), 0) < RTP_HEADER_SIZE)
+            continue;
+        uint64_t t = now_us();
+        uint32_t frame = ((uint32_t)packet[4] << 24) | (packet[5] << 16)
+                | (packet[6] << 8) | packet[7];
+        if (frame < FRAMES && count[frame] < MAX_PACKETS)
+            arrival[frame][count[frame]++] = t;
+    }
+    return NULL;
+}
+
+static int compare(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+typedef struct
+{
+    udp_batch_t* batch;
+    int sock;
+    struct sockaddr_in* addr;
+} sender_t;
+
+//rtp_send_t of the packetizer
+static int batch_add(void* arg, const unsigned char* packet, int len)
+{
+    sender_t* sender = arg;
+
+    return udp_batch_add(sender->batch, sender->sock, sender->addr, packet,
+            len);
+}
+
+static void run(const char* label, int sock, struct sockaddr_in* addr,
+        const unsigned char* frame, pacer_mode_t mode)
+{
+    static udp_batch_t batch;
+    sender_t sender = { &batch, sock, addr };
+    rtp_packetizer_t rtp;
+    pacer_t pacer;
+    static double burst_gap[FRAMES * MAX_PACKETS];
+    double span = 0, gap = 0, max_gap = 0;
+    int gaps = 0, bursts = 0;
+    int i, p;
+
+    memset(count, 0, sizeof(count));
+    udp_batch_init(&batch, sock, UDP_SEND_GSO);
+    pacer_init(&pacer, sock, mode, WINDOW, 0);
+    rtp_packetizer_init(&rtp, RTP_DEFAULT_MTU, 1, batch_add, &sender);
+
+    for (i = 0; i < FRAMES; i++)
+    {
+        uint64_t start = now_us();
+
+        CHECK(rtp_send_frame(&rtp, frame, FRAME_SIZE, i, 1) == 0);
+        CHECK(pacer_flush(&pacer, &batch, sock, addr) == 0);
+        uint64_t spent = now_us() - start;
+        if (spent < FRAME_INTERVAL)
+            usleep(FRAME_INTERVAL - spent);
+    }
+    usleep(100000);
+    pacer_deinit(&pacer);
+
+    for (i = 0; i < FRAMES; i++)
+    {
+        CHECK(count[i] == rtp.packet_count / FRAMES);
+        span += arrival[i][count[i] - 1] - arrival[i][0];
+        for (p = 1; p < count[i]; p++)
+        {
+            double g = arrival[i][p] - arrival[i][p - 1];
+            gap += g;
+            gaps++;
+            if (g > max_gap)
+                max_gap = g;
+            if (g > BURST_GAP)
+                burst_gap[bursts++] = g;
+        }
+    }
+    qsort(burst_gap, bursts, sizeof(double), compare);
+
+    fprintf(stderr, "%-14s %2d packets, first to last %7.0f us, mean gap "
+            "%4.0f us, between bursts %4.0f us, max gap %5.0f us\n", label,
+            count[0], span / FRAMES, gap / gaps,
+            bursts ? burst_gap[bursts / 2] : 0, max_gap);
+}
+
+int main(int argc, char** argv)
+{
+    static unsigned char frame[FRAME_SIZE];
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    pthread_t tid;
+    int sock, size = 8 * 1024 * 1024;
+    unsigned seed = 1;
+    int i;
+
+    //one IDR NAL unit of random bytes, no start code inside
+    frame[0] = 0;
+    frame[1] = 0;
+    frame[2] = 0;
+    frame[3] = 1;
+    frame[4] = 0x65;
+    for (i = 5; i < FRAME_SIZE; i++)
+        frame[i] = 1 + rand_r(&seed) % 255;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    rx_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    CHECK(rx_sock != -1);
+    setsockopt(rx_sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    CHECK(bind(rx_sock, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    CHECK(getsockname(rx_sock, (struct sockaddr *) &addr, &addrlen) == 0);
+    struct timeval timeout = { 0, 100000 };
+    setsockopt(rx_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    CHECK(pthread_create(&tid, NULL, receiver, NULL) == 0);
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    CHECK(sock != -1);
+
+    run("no pacing", sock, &addr, frame, PACER_OFF);
+    run("PACER_TIMER", sock, &addr, frame, PACER_TIMER);
+
+    quit = 1;
+    pthread_join(tid, NULL);
+    close(sock);
+    close(rx_sock);
+
+    return 0;
+}
@@ -0,0 +1,155 @@
+//NACK recovery of stream/rtx.c over loopback: 3000 frames of 15 RTP
+//packets, a deterministic loss injector drops one packet out of N before
+//the socket, the receiver NACKs the gaps (RTCP) after each frame and the
+//sender resends from its history. Loopback delivers in sendto(), so the
+//receiving socket is read without waiting. The figures of stream.md (rtx)
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "check.h"
+#include "../stream/rtp.h"
+#include "../stream/rtx.h"
+
+#define FRAME_SIZE 20000 //15 packets of RTP_DEFAULT_MTU
+#define FRAMES 3000
+#define SSRC 0x1234
+#define VIEWER_SSRC 1
+
+static int tx_sock, rx_sock;
+static struct sockaddr_in tx_addr, rx_addr;
+static rtx_history_t rtx;
+static int drop_every;
+static unsigned sent, dropped, recovered;
+static unsigned char received[65536];
+
+//rtp_send_t: keep the packet, then lose one out of drop_every
+static int send_lossy(void* arg, const unsigned char* packet, int len)
+{
+    rtx_store(&rtx, packet, len);
+    if (++sent % drop_every == 3)
+    {
+        dropped++;
+        return 0;
+    }
+    if (sendto(tx_sock, packet, len, 0, (struct sockaddr *) &rx_addr,
+            sizeof(rx_addr)) != len)
+        return -1;
+    return 0;
+}
+
+static void open_socket(int* sock, struct sockaddr_in* addr)
+{
+    socklen_t len = sizeof(*addr);
+    int size = 4 * 1024 * 1024;
+
+    *sock = socket(AF_INET, SOCK_DGRAM, 0);
+    CHECK(*sock != -1);
+    setsockopt(*sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(bind(*sock, (struct sockaddr *) addr, len) == 0);
+    CHECK(getsockname(*sock, (struct sockaddr *) addr, &len) == 0);
+}
+
+//read the queued packets, add the gaps to 'lost'
+static void receive(int* expect, uint16_t* lost, int* nlost)
+{
+    unsigned char packet[2048];
+    ssize_t n;
+
+    while ((n = recv(rx_sock, packet, sizeof(packet), MSG_DONTWAIT)) > 0)
+    {
+        uint16_t seq = (packet[2] << 8) | packet[3];
+
+        if (received[seq])
+            continue;
+        received[seq] = 1;
+        if (*expect != -1 && (uint16_t)(seq - *expect) < 0x8000)
+        {
+            uint16_t s;
+            for (s = *expect; s != seq; s++)
+            {
+                if (*nlost < RTCP_MAX_NACK)
+                    lost[(*nlost)++] = s;
+            }
+        }
+        if (*expect == -1 || (uint16_t)(seq - *expect) < 0x8000)
+            *expect = (uint16_t)(seq + 1);
+        else
+            recovered++; //an older one, resent
+    }
+}
+
+static void run(int every)
+{
+    static unsigned char frame[FRAME_SIZE];
+    rtp_packetizer_t rtp;
+    unsigned char msg[1500];
+    rtcp_feedback_t fb;
+    int expect = -1;
+    int i, f, n;
+
+    drop_every = every;
+    sent = dropped = recovered = 0;
+    memset(received, 0, sizeof(received));
+    rtx_init(&rtx);
+    rtp_packetizer_init(&rtp, RTP_DEFAULT_MTU, SSRC, send_lossy, NULL);
+
+    srand(1);
+    memcpy(frame, "\0\0\0\1\x65", 5);
+    for (i = 5; i < FRAME_SIZE; i++)
+        frame[i] = 1 + rand() % 250; //no start code
+
+    for (f = 0; f < FRAMES; f++)
+    {
+        uint16_t lost[RTCP_MAX_NACK];
+        int nlost = 0;
+
+        CHECK(rtp_send_frame(&rtp, frame, FRAME_SIZE, f * 3000, 1) == 0);
+
+        //viewer: NACK the gaps
+        receive(&expect, lost, &nlost);
+        if (nlost == 0)
+            continue;
+        n = rtcp_build_nack(msg, sizeof(msg), VIEWER_SSRC, SSRC, lost, nlost);
+        CHECK(n > 0);
+        CHECK(sendto(rx_sock, msg, n, 0, (struct sockaddr *) &tx_addr,
+                sizeof(tx_addr)) == n);
+
+        //sender: resend what is asked
+        CHECK((n = recv(tx_sock, msg, sizeof(msg), MSG_DONTWAIT)) > 0);
+        CHECK(rtcp_parse_feedback(msg, n, &fb) == 0);
+        CHECK(fb.sender == VIEWER_SSRC && fb.ssrc == SSRC);
+        for (i = 0; i < fb.nlost; i++)
+            rtx_resend(&rtx, tx_sock, &rx_addr, fb.ssrc, fb.lost[i]);
+
+        //viewer: the resent packets
+        receive(&expect, lost, &nlost);
+    }
+
+    printf("| 1/%d | %u | %u | %.0f%% |\n", every, dropped, rtx.resent,
+            dropped ? 100.0 * recovered / dropped : 100.0);
+    rtx_deinit(&rtx);
+}
+
+int main(int argc, char** argv)
+{
+    open_socket(&tx_sock, &tx_addr);
+    open_socket(&rx_sock, &rx_addr);
+
+    printf("%d frames of %d bytes, MTU %d\n\n", FRAMES, FRAME_SIZE,
+            RTP_DEFAULT_MTU);
+    printf("| loss | dropped | resent | recovered |\n|---|---|---|---|\n");
+    run(10);
+    run(50);
+
+    close(tx_sock);
+    close(rx_sock);
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+//Muxing speed of record/ts.c: 200MB of frames of 1000 to 200000 bytes
+//(a keyframe every 25) through ts_mux_frame() in writes of
+//TS_PACKETS_PER_FILE_WRITE packets, the write callback discards them.
+//The figures of record.md (ts)
+
+#include <string.h>
+#include <time.h>
+
+#include "check.h"
+#include "../record/ts.h"
+
+#define TOTAL 200000000 //bytes of frames per size
+#define MAX_FRAME 200000
+
+static unsigned char frame[MAX_FRAME];
+
+static int discard(void* arg, const unsigned char* data, int len)
+{
+    return 0;
+}
+
+static double now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv)
+{
+    static const int sizes[] = { 1000, 10000, 85000, 200000 };
+    ts_muxer_t ts;
+    unsigned seed = 1;
+    unsigned i, s;
+
+    for (i = 0; i < MAX_FRAME; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        frame[i] = seed >> 16;
+    }
+    memcpy(frame, "\0\0\0\1\x41", 5);
+
+    fprintf(stderr, "| frame size | MB/s |\n|------------|------|\n");
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        int n = TOTAL / sizes[s];
+
+        ts_muxer_init(&ts, TS_PACKETS_PER_FILE_WRITE, discard, NULL);
+        double start = now();
+        for (i = 0; i < n; i++)
+            CHECK(ts_mux_frame(&ts, frame, sizes[s], i * 40000ULL,
+                    i * 40000ULL, i % 25 == 0) == 0);
+        CHECK(ts_flush(&ts) == 0);
+        double time = now() - start;
+        fprintf(stderr, "| %d bytes | %.0f |\n", sizes[s],
+                (double)n * sizes[s] / time / 1e6);
+    }
+
+    return 0;
+}
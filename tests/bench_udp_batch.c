@@ -0,0 +1,166 @@
+//CPU of the send paths of udp_batch over loopback: a 42KB IDR sent 3000
+//times, as 512 bytes datagrams with sendto() (before RTP), and as RTP
+//packets of 1400 bytes with each udp_send_mode_t. The CPU is the one of
+//the sending thread (the loopback delivery runs in it too), a thread
+//drains the receiving socket before the next frame. Relative numbers only
+
+#define _GNU_SOURCE //RUSAGE_THREAD
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+
+#include "check.h"
+#include "../stream/udp_batch.h"
+
+#define FRAME_SIZE (42 * 1024)
+#define FRAMES 3000
+#define OLD_DATAGRAM 512
+
+static int rx_sock;
+static volatile int quit;
+static volatile unsigned received;
+
+static void* receiver(void* arg)
+{
+    unsigned char buffer[65536];
+
+    while (!quit)
+    {
+        if (recv(rx_sock, buffer, sizeof(buffer), 0) > 0)
+            received++;
+    }
+    return NULL;
+}
+
+static double thread_cpu_us(void)
+{
+    struct rusage r;
+
+    getrusage(RUSAGE_THREAD, &r);
+    return (r.ru_utime.tv_sec + r.ru_stime.tv_sec) * 1e6
+            + r.ru_utime.tv_usec + r.ru_stime.tv_usec;
+}
+
+typedef struct
+{
+    udp_batch_t* batch;
+    int sock;
+    struct sockaddr_in* addr;
+} sender_t;
+
+//rtp_send_t of the packetizer
+static int batch_add(void* arg, const unsigned char* packet, int len)
+{
+    sender_t* sender = arg;
+
+    return udp_batch_add(sender->batch, sender->sock, sender->addr, packet,
+            len);
+}
+
+static void run(const char* label, int sock, struct sockaddr_in* addr,
+        const unsigned char* frame, int mode)
+{
+    static udp_batch_t batch;
+    rtp_packetizer_t rtp;
+    sender_t sender = { &batch, sock, addr };
+    unsigned sent = 0, calls = 0;
+    double bytes = 0, cpu;
+    int i, offset;
+
+    received = 0;
+    if (mode >= 0)
+    {
+        udp_batch_init(&batch, sock, mode);
+        rtp_packetizer_init(&rtp, RTP_DEFAULT_MTU, 1, batch_add, &sender);
+    }
+
+    cpu = thread_cpu_us();
+    for (i = 0; i < FRAMES; i++)
+    {
+        if (mode < 0)
+        {
+            for (offset = 0; offset < FRAME_SIZE; offset += OLD_DATAGRAM)
+            {
+                int n = FRAME_SIZE - offset < OLD_DATAGRAM
+                        ? FRAME_SIZE - offset : OLD_DATAGRAM;
+                CHECK(sendto(sock, frame + offset, n, 0,
+                        (struct sockaddr *) addr, sizeof(*addr)) == n);
+                sent++;
+                calls++;
+                bytes += n;
+            }
+        }
+        else
+        {
+            CHECK(rtp_send_frame(&rtp, frame, FRAME_SIZE, i * 3000, 1) == 0);
+            CHECK(udp_batch_flush(&batch, sock, addr) == 0);
+            sent = batch.packets;
+        }
+        //let the receiver drain the frame, a full socket drops datagrams
+        //and makes the next sends cheaper
+        int wait;
+        for (wait = 0; received < sent && wait < 1000; wait++)
+            usleep(100);
+    }
+    cpu = thread_cpu_us() - cpu;
+    if (mode >= 0)
+    {
+        calls = batch.calls;
+        bytes = rtp.octet_count + (double)rtp.packet_count * RTP_HEADER_SIZE;
+    }
+
+    fprintf(stderr, "%-30s %7u datagrams, %7u send calls, %5.0f us CPU per "
+            "Mbit, %u received\n", label, sent, calls,
+            cpu / (bytes * 8 / 1e6), received);
+}
+
+int main(int argc, char** argv)
+{
+    static unsigned char frame[FRAME_SIZE];
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    pthread_t tid;
+    int sock, size = 8 * 1024 * 1024;
+    unsigned seed = 1;
+    int i;
+
+    //one IDR NAL unit of random bytes, no start code inside
+    frame[0] = 0;
+    frame[1] = 0;
+    frame[2] = 0;
+    frame[3] = 1;
+    frame[4] = 0x65;
+    for (i = 5; i < FRAME_SIZE; i++)
+        frame[i] = 1 + rand_r(&seed) % 255;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    rx_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    CHECK(rx_sock != -1);
+    setsockopt(rx_sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    CHECK(bind(rx_sock, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    CHECK(getsockname(rx_sock, (struct sockaddr *) &addr, &addrlen) == 0);
+    struct timeval timeout = { 0, 100000 };
+    setsockopt(rx_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    CHECK(pthread_create(&tid, NULL, receiver, NULL) == 0);
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    CHECK(sock != -1);
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+    run("old 512 bytes, sendto()", sock, &addr, frame, -1);
+    run("RTP 1400 bytes, sendto()", sock, &addr, frame, UDP_SEND_SINGLE);
+    run("RTP 1400 bytes, sendmmsg()", sock, &addr, frame, UDP_SEND_MMSG);
+    run("RTP 1400 bytes, UDP_SEGMENT", sock, &addr, frame, UDP_SEND_GSO);
+
+    quit = 1;
+    pthread_join(tid, NULL);
+    close(sock);
+    close(rx_sock);
+
+    return 0;
+}
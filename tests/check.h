@@ -0,0 +1,18 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+//stop the test at the first failed condition
+#define CHECK(x) \
+    do \
+    { \
+        if (!(x)) \
+        { \
+            fprintf(stderr, "error: %s:%d: %s\n", __FILE__, __LINE__, #x); \
+            exit(1); \
+        } \
+    } while (0)
+
+#endif
@@ -0,0 +1,236 @@
+#ifndef OMX_SOFT_BROADCOM_H
+#define OMX_SOFT_BROADCOM_H
+
+//Software stand-in of the OpenMAX IL headers of the VideoCore, only what
+//the code of components/ uses. The types have the names and the fields of
+//the real ones, the values of the enums are not the same. See omx_soft.h
+
+#include <stdint.h>
+#include <string.h>
+
+typedef uint32_t OMX_U32;
+typedef int32_t OMX_S32;
+typedef uint8_t OMX_U8;
+typedef int64_t OMX_TICKS;
+typedef void* OMX_PTR;
+typedef void* OMX_HANDLETYPE;
+typedef char* OMX_STRING;
+
+typedef enum
+{
+    OMX_FALSE = 0,
+    OMX_TRUE = 1
+} OMX_BOOL;
+
+#define OMX_IN
+#define OMX_OUT
+#define OMX_ALL 0xFFFFFFFF
+
+#define OMX_VERSION 0x00000101
+#define OMX_VERSION_MAJOR 1
+#define OMX_VERSION_MINOR 1
+#define OMX_VERSION_REVISION 2
+#define OMX_VERSION_STEP 0
+
+#define OMX_BUFFERFLAG_EOS 0x00000001
+#define OMX_BUFFERFLAG_STARTTIME 0x00000002
+#define OMX_BUFFERFLAG_ENDOFFRAME 0x00000010
+#define OMX_BUFFERFLAG_SYNCFRAME 0x00000020
+#define OMX_BUFFERFLAG_CODECCONFIG 0x00000080
+
+typedef union
+{
+    struct
+    {
+        OMX_U8 nVersionMajor;
+        OMX_U8 nVersionMinor;
+        OMX_U8 nRevision;
+        OMX_U8 nStep;
+    } s;
+    OMX_U32 nVersion;
+} OMX_VERSIONTYPE;
+
+typedef enum
+{
+    OMX_ErrorNone = 0,
+    OMX_ErrorInsufficientResources,
+    OMX_ErrorUndefined,
+    OMX_ErrorBadParameter,
+    OMX_ErrorNotImplemented,
+    OMX_ErrorTimeout,
+    OMX_ErrorSameState,
+    OMX_ErrorIncorrectStateOperation,
+    OMX_ErrorUnsupportedIndex,
+    OMX_ErrorBadPortIndex
+} OMX_ERRORTYPE;
+
+typedef enum
+{
+    OMX_StateInvalid,
+    OMX_StateLoaded,
+    OMX_StateIdle,
+    OMX_StateExecuting,
+    OMX_StatePause,
+    OMX_StateWaitForResources
+} OMX_STATETYPE;
+
+typedef enum
+{
+    OMX_CommandStateSet,
+    OMX_CommandFlush,
+    OMX_CommandPortDisable,
+    OMX_CommandPortEnable,
+    OMX_CommandMarkBuffer
+} OMX_COMMANDTYPE;
+
+typedef enum
+{
+    OMX_EventCmdComplete,
+    OMX_EventError,
+    OMX_EventMark,
+    OMX_EventPortSettingsChanged,
+    OMX_EventBufferFlag,
+    OMX_EventResourcesAcquired,
+    OMX_EventComponentResumed,
+    OMX_EventDynamicResourcesAvailable,
+    OMX_EventPortFormatDetected,
+    OMX_EventParamOrConfigChanged
+} OMX_EVENTTYPE;
+
+typedef enum
+{
+    OMX_IndexParamPortDefinition,
+    OMX_IndexParamAudioInit,
+    OMX_IndexParamVideoInit,
+    OMX_IndexParamImageInit,
+    OMX_IndexParamOtherInit
+} OMX_INDEXTYPE;
+
+typedef enum
+{
+    OMX_DirInput,
+    OMX_DirOutput
+} OMX_DIRTYPE;
+
+typedef enum
+{
+    OMX_PortDomainAudio,
+    OMX_PortDomainVideo,
+    OMX_PortDomainImage,
+    OMX_PortDomainOther
+} OMX_PORTDOMAINTYPE;
+
+typedef enum
+{
+    OMX_VIDEO_CodingUnused,
+    OMX_VIDEO_CodingAVC
+} OMX_VIDEO_CODINGTYPE;
+
+typedef enum
+{
+    OMX_COLOR_FormatUnused,
+    OMX_COLOR_FormatYUV420PackedPlanar
+} OMX_COLOR_FORMATTYPE;
+
+typedef int OMX_OTHER_FORMATTYPE;
+typedef int OMX_AUDIO_CODINGTYPE;
+typedef int OMX_IMAGE_CODINGTYPE;
+
+typedef struct
+{
+    OMX_U32 nFrameWidth;
+    OMX_U32 nFrameHeight;
+    OMX_S32 nStride;
+    OMX_U32 nSliceHeight;
+    OMX_U32 nBitrate;
+    OMX_U32 xFramerate;
+    OMX_VIDEO_CODINGTYPE eCompressionFormat;
+    OMX_COLOR_FORMATTYPE eColorFormat;
+} OMX_VIDEO_PORTDEFINITIONTYPE;
+
+typedef struct
+{
+    OMX_U32 nSize;
+    OMX_VERSIONTYPE nVersion;
+    OMX_U32 nPortIndex;
+    OMX_DIRTYPE eDir;
+    OMX_U32 nBufferCountActual;
+    OMX_U32 nBufferCountMin;
+    OMX_U32 nBufferSize;
+    OMX_BOOL bEnabled;
+    OMX_BOOL bPopulated;
+    OMX_PORTDOMAINTYPE eDomain;
+    union
+    {
+        OMX_VIDEO_PORTDEFINITIONTYPE video;
+    } format;
+    OMX_BOOL bBuffersContiguous;
+    OMX_U32 nBufferAlignment;
+} OMX_PARAM_PORTDEFINITIONTYPE;
+
+typedef struct
+{
+    OMX_U32 nSize;
+    OMX_VERSIONTYPE nVersion;
+    OMX_U32 nPortIndex;
+    OMX_U32 nIndex;
+    OMX_IMAGE_CODINGTYPE eCompressionFormat;
+    OMX_COLOR_FORMATTYPE eColorFormat;
+} OMX_IMAGE_PARAM_PORTFORMATTYPE;
+
+typedef struct
+{
+    OMX_U32 nSize;
+    OMX_VERSIONTYPE nVersion;
+    OMX_U32 nPorts;
+    OMX_U32 nStartPortNumber;
+} OMX_PORT_PARAM_TYPE;
+
+typedef struct OMX_BUFFERHEADERTYPE
+{
+    OMX_U32 nSize;
+    OMX_VERSIONTYPE nVersion;
+    OMX_U8* pBuffer;
+    OMX_U32 nAllocLen;
+    OMX_U32 nFilledLen;
+    OMX_U32 nOffset;
+    OMX_PTR pAppPrivate;
+    OMX_PTR pPlatformPrivate;
+    OMX_U32 nFlags;
+    OMX_TICKS nTimeStamp;
+    OMX_U32 nOutputPortIndex;
+    OMX_U32 nInputPortIndex;
+} OMX_BUFFERHEADERTYPE;
+
+typedef struct
+{
+    OMX_ERRORTYPE (*EventHandler)(OMX_HANDLETYPE comp, OMX_PTR app_data,
+            OMX_EVENTTYPE event, OMX_U32 data1, OMX_U32 data2,
+            OMX_PTR event_data);
+    OMX_ERRORTYPE (*EmptyBufferDone)(OMX_HANDLETYPE comp, OMX_PTR app_data,
+            OMX_BUFFERHEADERTYPE* buffer);
+    OMX_ERRORTYPE (*FillBufferDone)(OMX_HANDLETYPE comp, OMX_PTR app_data,
+            OMX_BUFFERHEADERTYPE* buffer);
+} OMX_CALLBACKTYPE;
+
+OMX_ERRORTYPE OMX_Init(void);
+OMX_ERRORTYPE OMX_Deinit(void);
+OMX_ERRORTYPE OMX_GetHandle(OMX_HANDLETYPE* handle, OMX_STRING name,
+        OMX_PTR app_data, OMX_CALLBACKTYPE* callbacks);
+OMX_ERRORTYPE OMX_FreeHandle(OMX_HANDLETYPE handle);
+OMX_ERRORTYPE OMX_GetParameter(OMX_HANDLETYPE handle, OMX_INDEXTYPE index,
+        OMX_PTR param);
+OMX_ERRORTYPE OMX_SetParameter(OMX_HANDLETYPE handle, OMX_INDEXTYPE index,
+        OMX_PTR param);
+OMX_ERRORTYPE OMX_GetState(OMX_HANDLETYPE handle, OMX_STATETYPE* state);
+OMX_ERRORTYPE OMX_SendCommand(OMX_HANDLETYPE handle, OMX_COMMANDTYPE command,
+        OMX_U32 param, OMX_PTR data);
+OMX_ERRORTYPE OMX_AllocateBuffer(OMX_HANDLETYPE handle,
+        OMX_BUFFERHEADERTYPE** buffer, OMX_U32 port, OMX_PTR app_private,
+        OMX_U32 size);
+OMX_ERRORTYPE OMX_FreeBuffer(OMX_HANDLETYPE handle, OMX_U32 port,
+        OMX_BUFFERHEADERTYPE* buffer);
+OMX_ERRORTYPE OMX_FillThisBuffer(OMX_HANDLETYPE handle,
+        OMX_BUFFERHEADERTYPE* buffer);
+
+#endif
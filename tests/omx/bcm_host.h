@@ -0,0 +1,18 @@
+#ifndef OMX_SOFT_BCM_HOST_H
+#define OMX_SOFT_BCM_HOST_H
+
+//Software stand-in of bcm_host.h, nothing to initialise on x86
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+static inline void bcm_host_init(void)
+{
+}
+
+static inline void bcm_host_deinit(void)
+{
+}
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef OMX_SOFT_VCOS_H
+#define OMX_SOFT_VCOS_H
+
+//Software stand-in of the VCOS calls used by components/, on pthreads
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+typedef unsigned int VCOS_UNSIGNED;
+typedef int VCOS_STATUS_T;
+
+#define VCOS_SUCCESS 0
+#define VCOS_EAGAIN 1
+#define VCOS_EINVAL 2
+
+#define VCOS_OR 1
+#define VCOS_AND 2
+#define VCOS_CONSUME 4
+#define VCOS_OR_CONSUME (VCOS_OR | VCOS_CONSUME)
+
+#define VCOS_SUSPEND 0xFFFFFFFF //wait forever
+#define VCOS_NO_SUSPEND 0
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    VCOS_UNSIGNED events;
+} VCOS_EVENT_FLAGS_T;
+
+typedef struct
+{
+    pthread_mutex_t m;
+} VCOS_MUTEX_T;
+
+static inline VCOS_STATUS_T vcos_event_flags_create(VCOS_EVENT_FLAGS_T* flags,
+        const char* name)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&flags->lock, NULL);
+    pthread_cond_init(&flags->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    flags->events = 0;
+
+    return VCOS_SUCCESS;
+}
+
+static inline void vcos_event_flags_delete(VCOS_EVENT_FLAGS_T* flags)
+{
+    pthread_cond_destroy(&flags->cond);
+    pthread_mutex_destroy(&flags->lock);
+}
+
+static inline void vcos_event_flags_set(VCOS_EVENT_FLAGS_T* flags,
+        VCOS_UNSIGNED events, VCOS_UNSIGNED op)
+{
+    pthread_mutex_lock(&flags->lock);
+    if (op == VCOS_OR)
+        flags->events |= events;
+    else
+        flags->events &= events;
+    pthread_cond_broadcast(&flags->cond);
+    pthread_mutex_unlock(&flags->lock);
+}
+
+//wait until one of 'events' is set (VCOS_OR), 'suspend' in ms
+static inline VCOS_STATUS_T vcos_event_flags_get(VCOS_EVENT_FLAGS_T* flags,
+        VCOS_UNSIGNED events, VCOS_UNSIGNED op, VCOS_UNSIGNED suspend,
+        VCOS_UNSIGNED* retrieved)
+{
+    struct timespec deadline;
+    VCOS_STATUS_T status = VCOS_SUCCESS;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    if (suspend != VCOS_SUSPEND)
+    {
+        deadline.tv_sec += suspend / 1000;
+        deadline.tv_nsec += (long)(suspend % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    pthread_mutex_lock(&flags->lock);
+    while (!(flags->events & events))
+    {
+        if (suspend == VCOS_NO_SUSPEND)
+        {
+            status = VCOS_EAGAIN;
+            break;
+        }
+        if (suspend == VCOS_SUSPEND)
+            pthread_cond_wait(&flags->cond, &flags->lock);
+        else if (pthread_cond_timedwait(&flags->cond, &flags->lock,
+                &deadline) == ETIMEDOUT)
+        {
+            status = VCOS_EAGAIN;
+            break;
+        }
+    }
+    if (status == VCOS_SUCCESS)
+    {
+        *retrieved = flags->events & events;
+        if (op & VCOS_CONSUME)
+            flags->events &= ~events;
+    }
+    pthread_mutex_unlock(&flags->lock);
+
+    return status;
+}
+
+static inline VCOS_STATUS_T vcos_mutex_create(VCOS_MUTEX_T* mutex,
+        const char* name)
+{
+    return pthread_mutex_init(&mutex->m, NULL) ? VCOS_EINVAL : VCOS_SUCCESS;
+}
+
+static inline void vcos_mutex_delete(VCOS_MUTEX_T* mutex)
+{
+    pthread_mutex_destroy(&mutex->m);
+}
+
+static inline void vcos_mutex_lock(VCOS_MUTEX_T* mutex)
+{
+    pthread_mutex_lock(&mutex->m);
+}
+
+static inline void vcos_mutex_unlock(VCOS_MUTEX_T* mutex)
+{
+    pthread_mutex_unlock(&mutex->m);
+}
+
+#endif
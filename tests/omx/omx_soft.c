@@ -0,0 +1,540 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "omx_soft.h"
+
+#define SOFT_PORTS 2
+#define SOFT_MAX_BUFFERS 16
+#define SOFT_MAX_COMMANDS 64
+
+typedef struct
+{
+    OMX_PARAM_PORTDEFINITIONTYPE def;
+    int allocated; //buffers allocated on the port
+    OMX_BUFFERHEADERTYPE* queue[SOFT_MAX_BUFFERS]; //given to fill, FIFO
+    int head;
+    int nqueued;
+} soft_port_t;
+
+typedef struct
+{
+    OMX_COMMANDTYPE command;
+    OMX_U32 data;
+    uint64_t due; //us, monotonic
+} soft_command_t;
+
+typedef struct
+{
+    char name[128];
+    OMX_PTR app_data;
+    OMX_CALLBACKTYPE callbacks;
+    omx_soft_config_t config;
+    unsigned seed;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int quit;
+
+    OMX_STATETYPE state;
+    soft_port_t ports[SOFT_PORTS];
+    soft_command_t commands[SOFT_MAX_COMMANDS]; //pending
+    int ncommands;
+    uint64_t next_frame; //0 : not producing
+    unsigned frame_number;
+    omx_soft_stats_t stats;
+} soft_component_t;
+
+static omx_soft_config_t soft_config =
+{ 1000, 5000, 0, 4096, 1 };
+static unsigned soft_seed = 1;
+
+static uint64_t now_us(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+void omx_soft_default_config(omx_soft_config_t* config)
+{
+    config->command_min = 1000;
+    config->command_max = 5000;
+    config->frame_interval = 0;
+    config->frame_size = 4096;
+    config->buffer_count_min = 1;
+}
+
+void omx_soft_configure(const omx_soft_config_t* config)
+{
+    soft_config = *config;
+}
+
+void omx_soft_stats(OMX_HANDLETYPE handle, omx_soft_stats_t* stats)
+{
+    soft_component_t* c = handle;
+
+    pthread_mutex_lock(&c->lock);
+    *stats = c->stats;
+    pthread_mutex_unlock(&c->lock);
+}
+
+static soft_port_t* find_port(soft_component_t* c, OMX_U32 index)
+{
+    if (index < OMX_SOFT_INPUT_PORT || index >= OMX_SOFT_INPUT_PORT + SOFT_PORTS)
+        return NULL;
+    return &c->ports[index - OMX_SOFT_INPUT_PORT];
+}
+
+//an output port enable (disable) completes once its buffers are allocated
+//(freed), except in Loaded where nothing is allocated. The buffers of the
+//input port come through a tunnel, it does not wait for them
+static int command_ready(soft_component_t* c, soft_command_t* cmd)
+{
+    soft_port_t* port;
+
+    if (cmd->command == OMX_CommandStateSet)
+        return 1;
+    port = find_port(c, cmd->data);
+    if (!port || port->def.eDir == OMX_DirInput
+            || c->state == OMX_StateLoaded)
+        return 1;
+    if (cmd->command == OMX_CommandPortEnable)
+        return port->allocated >= (int)port->def.nBufferCountActual;
+    if (cmd->command == OMX_CommandPortDisable)
+        return port->allocated == 0;
+    return 1;
+}
+
+static void update_production(soft_component_t* c)
+{
+    soft_port_t* out = &c->ports[1];
+
+    if (c->config.frame_interval && c->state == OMX_StateExecuting
+            && out->def.bEnabled)
+    {
+        if (!c->next_frame)
+            c->next_frame = now_us() + c->config.frame_interval;
+    }
+    else
+        c->next_frame = 0;
+}
+
+//apply a command, called with the lock held
+//return the buffers given back (port disabled), *nreturned of them
+static void apply_command(soft_component_t* c, soft_command_t* cmd,
+        OMX_BUFFERHEADERTYPE** returned, int* nreturned)
+{
+    soft_port_t* port;
+
+    *nreturned = 0;
+    switch (cmd->command)
+    {
+        case OMX_CommandStateSet:
+        c->state = cmd->data;
+        break;
+        case OMX_CommandPortEnable:
+        if ((port = find_port(c, cmd->data)))
+            port->def.bEnabled = OMX_TRUE;
+        break;
+        case OMX_CommandPortDisable:
+        if ((port = find_port(c, cmd->data)))
+            port->def.bEnabled = OMX_FALSE;
+        break;
+        default:
+        break;
+    }
+    update_production(c);
+
+    //a port being disabled gives its buffers back empty
+    if (cmd->command == OMX_CommandPortDisable
+            && (port = find_port(c, cmd->data)))
+    {
+        while (port->nqueued > 0)
+        {
+            OMX_BUFFERHEADERTYPE* b = port->queue[port->head];
+            port->head = (port->head + 1) % SOFT_MAX_BUFFERS;
+            port->nqueued--;
+            b->nFilledLen = 0;
+            returned[(*nreturned)++] = b;
+        }
+    }
+}
+
+//the thread of a component: completes its commands, produces its frames
+static void* soft_thread(void* arg)
+{
+    soft_component_t* c = arg;
+    OMX_BUFFERHEADERTYPE* returned[SOFT_MAX_BUFFERS];
+    int nreturned;
+
+    pthread_mutex_lock(&c->lock);
+    while (!c->quit)
+    {
+        uint64_t now = now_us();
+        uint64_t wake = now + 100000;
+        int i, done = 0;
+
+        //the first pending command that is due and ready
+        for (i = 0; i < c->ncommands; i++)
+        {
+            soft_command_t* cmd = &c->commands[i];
+            if (cmd->due <= now && command_ready(c, cmd))
+            {
+                soft_command_t completed = *cmd;
+                memmove(cmd, cmd + 1,
+                        sizeof(*cmd) * (c->ncommands - i - 1));
+                c->ncommands--;
+                c->stats.commands++;
+                apply_command(c, &completed, returned, &nreturned);
+                pthread_mutex_unlock(&c->lock);
+                for (i = 0; i < nreturned; i++)
+                    c->callbacks.FillBufferDone(c, c->app_data, returned[i]);
+                c->callbacks.EventHandler(c, c->app_data,
+                        OMX_EventCmdComplete, completed.command,
+                        completed.data, NULL);
+                pthread_mutex_lock(&c->lock);
+                done = 1;
+                break;
+            }
+            if (cmd->due > now && cmd->due < wake)
+                wake = cmd->due;
+            if (cmd->due <= now)
+                wake = now + 1000; //waiting for buffers
+        }
+        if (done)
+            continue;
+
+        if (c->next_frame && c->next_frame <= now)
+        {
+            soft_port_t* out = &c->ports[1];
+            c->next_frame += c->config.frame_interval;
+            //the thread itself was late (host scheduling), the frames it
+            //missed were never made rather than all made at once
+            if (c->next_frame <= now)
+                c->next_frame = now + c->config.frame_interval;
+            if (out->nqueued == 0)
+            {
+                c->stats.dropped++;
+                c->frame_number++;
+                continue;
+            }
+            OMX_BUFFERHEADERTYPE* b = out->queue[out->head];
+            out->head = (out->head + 1) % SOFT_MAX_BUFFERS;
+            out->nqueued--;
+            b->nFilledLen = c->config.frame_size < b->nAllocLen
+                    ? c->config.frame_size : b->nAllocLen;
+            if (b->nFilledLen >= sizeof(unsigned))
+                memcpy(b->pBuffer, &c->frame_number, sizeof(unsigned));
+            b->nTimeStamp = c->frame_number;
+            b->nFlags = OMX_BUFFERFLAG_ENDOFFRAME
+                    | ((c->frame_number % 30) ? 0 : OMX_BUFFERFLAG_SYNCFRAME);
+            c->frame_number++;
+            c->stats.frames++;
+            pthread_mutex_unlock(&c->lock);
+            c->callbacks.FillBufferDone(c, c->app_data, b);
+            pthread_mutex_lock(&c->lock);
+            continue;
+        }
+        if (c->next_frame && c->next_frame < wake)
+            wake = c->next_frame;
+
+        struct timespec t;
+        t.tv_sec = wake / 1000000;
+        t.tv_nsec = (wake % 1000000) * 1000;
+        pthread_cond_timedwait(&c->cond, &c->lock, &t);
+    }
+    pthread_mutex_unlock(&c->lock);
+
+    return NULL;
+}
+
+OMX_ERRORTYPE OMX_Init(void)
+{
+    return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE OMX_Deinit(void)
+{
+    return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE OMX_GetHandle(OMX_HANDLETYPE* handle, OMX_STRING name,
+        OMX_PTR app_data, OMX_CALLBACKTYPE* callbacks)
+{
+    soft_component_t* c = calloc(1, sizeof(*c));
+    pthread_condattr_t attr;
+    int i;
+
+    if (!c)
+        return OMX_ErrorInsufficientResources;
+    snprintf(c->name, sizeof(c->name), "%s", name);
+    c->app_data = app_data;
+    c->callbacks = *callbacks;
+    c->config = soft_config;
+    c->seed = soft_seed++;
+    c->state = OMX_StateLoaded;
+    for (i = 0; i < SOFT_PORTS; i++)
+    {
+        OMX_PARAM_PORTDEFINITIONTYPE* def = &c->ports[i].def;
+        def->nSize = sizeof(*def);
+        def->nPortIndex = OMX_SOFT_INPUT_PORT + i;
+        def->eDir = i ? OMX_DirOutput : OMX_DirInput;
+        def->nBufferCountMin = soft_config.buffer_count_min;
+        def->nBufferCountActual = soft_config.buffer_count_min;
+        def->nBufferSize = soft_config.frame_size;
+        def->bEnabled = OMX_TRUE;
+        def->eDomain = OMX_PortDomainVideo;
+    }
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if (pthread_create(&c->thread, NULL, soft_thread, c))
+    {
+        free(c);
+        return OMX_ErrorInsufficientResources;
+    }
+
+    *handle = c;
+    return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE OMX_FreeHandle(OMX_HANDLETYPE handle)
+{
+    soft_component_t* c = handle;
+
+    pthread_mutex_lock(&c->lock);
+    c->quit = 1;
+    pthread_cond_signal(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+    pthread_join(c->thread, NULL);
+
+    pthread_cond_destroy(&c->cond);
+    pthread_mutex_destroy(&c->lock);
+    free(c);
+
+    return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE OMX_GetParameter(OMX_HANDLETYPE handle, OMX_INDEXTYPE index,
+        OMX_PTR param)
+{
+    soft_component_t* c = handle;
+    OMX_ERRORTYPE error = OMX_ErrorNone;
+
+    pthread_mutex_lock(&c->lock);
+    if (index == OMX_IndexParamPortDefinition)
+    {
+        OMX_PARAM_PORTDEFINITIONTYPE* def = param;
+        soft_port_t* port = find_port(c, def->nPortIndex);
+        if (port)
+            *def = port->def;
+        else
+            error = OMX_ErrorBadPortIndex;
+    }
+    else if (index == OMX_IndexParamVideoInit)
+    {
+        OMX_PORT_PARAM_TYPE* ports = param;
+        ports->nPorts = SOFT_PORTS;
+        ports->nStartPortNumber = OMX_SOFT_INPUT_PORT;
+    }
+    else if (index == OMX_IndexParamAudioInit
+            || index == OMX_IndexParamImageInit
+            || index == OMX_IndexParamOtherInit)
+    {
+        OMX_PORT_PARAM_TYPE* ports = param;
+        ports->nPorts = 0;
+        ports->nStartPortNumber = 0;
+    }
+    else
+        error = OMX_ErrorUnsupportedIndex;
+    pthread_mutex_unlock(&c->lock);
+
+    return error;
+}
+
+//only nBufferCountActual of a disabled port (or in Loaded) is changed
+OMX_ERRORTYPE OMX_SetParameter(OMX_HANDLETYPE handle, OMX_INDEXTYPE index,
+        OMX_PTR param)
+{
+    soft_component_t* c = handle;
+    OMX_ERRORTYPE error = OMX_ErrorNone;
+
+    if (index != OMX_IndexParamPortDefinition)
+        return OMX_ErrorUnsupportedIndex;
+
+    pthread_mutex_lock(&c->lock);
+    OMX_PARAM_PORTDEFINITIONTYPE* def = param;
+    soft_port_t* port = find_port(c, def->nPortIndex);
+    if (!port)
+        error = OMX_ErrorBadPortIndex;
+    else if (port->def.bEnabled && c->state != OMX_StateLoaded)
+        error = OMX_ErrorIncorrectStateOperation;
+    else if (def->nBufferCountActual < port->def.nBufferCountMin
+            || def->nBufferCountActual > SOFT_MAX_BUFFERS)
+        error = OMX_ErrorBadParameter;
+    else
+        port->def.nBufferCountActual = def->nBufferCountActual;
+    pthread_mutex_unlock(&c->lock);
+
+    return error;
+}
+
+OMX_ERRORTYPE OMX_GetState(OMX_HANDLETYPE handle, OMX_STATETYPE* state)
+{
+    soft_component_t* c = handle;
+
+    pthread_mutex_lock(&c->lock);
+    *state = c->state;
+    pthread_mutex_unlock(&c->lock);
+
+    return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE OMX_SendCommand(OMX_HANDLETYPE handle, OMX_COMMANDTYPE command,
+        OMX_U32 param, OMX_PTR data)
+{
+    soft_component_t* c = handle;
+    unsigned delay = c->config.command_min;
+
+    pthread_mutex_lock(&c->lock);
+    if (c->ncommands == SOFT_MAX_COMMANDS)
+    {
+        pthread_mutex_unlock(&c->lock);
+        return OMX_ErrorInsufficientResources;
+    }
+    if (c->config.command_max > c->config.command_min)
+        delay += rand_r(&c->seed)
+                % (c->config.command_max - c->config.command_min);
+    c->commands[c->ncommands].command = command;
+    c->commands[c->ncommands].data = param;
+    c->commands[c->ncommands].due = now_us() + delay;
+    c->ncommands++;
+    pthread_cond_signal(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+
+    return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE OMX_AllocateBuffer(OMX_HANDLETYPE handle,
+        OMX_BUFFERHEADERTYPE** buffer, OMX_U32 port_index,
+        OMX_PTR app_private, OMX_U32 size)
+{
+    soft_component_t* c = handle;
+    soft_port_t* port = find_port(c, port_index);
+    OMX_BUFFERHEADERTYPE* b;
+
+    if (!port)
+        return OMX_ErrorBadPortIndex;
+    b = calloc(1, sizeof(*b) + size);
+    if (!b)
+        return OMX_ErrorInsufficientResources;
+    b->nSize = sizeof(*b);
+    b->pBuffer = (OMX_U8*)(b + 1);
+    b->nAllocLen = size;
+    b->pAppPrivate = app_private;
+    b->nOutputPortIndex = port_index;
+
+    pthread_mutex_lock(&c->lock);
+    port->allocated++;
+    pthread_cond_signal(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+
+    *buffer = b;
+    return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE OMX_FreeBuffer(OMX_HANDLETYPE handle, OMX_U32 port_index,
+        OMX_BUFFERHEADERTYPE* buffer)
+{
+    soft_component_t* c = handle;
+    soft_port_t* port = find_port(c, port_index);
+
+    if (!port)
+        return OMX_ErrorBadPortIndex;
+
+    pthread_mutex_lock(&c->lock);
+    port->allocated--;
+    //a buffer still queued to be filled is forgotten, not given back
+    int i, n = port->nqueued;
+    port->nqueued = 0;
+    for (i = 0; i < n; i++)
+    {
+        OMX_BUFFERHEADERTYPE* b = port->queue[(port->head + i)
+                % SOFT_MAX_BUFFERS];
+        if (b != buffer)
+            port->queue[(port->head + port->nqueued++) % SOFT_MAX_BUFFERS] = b;
+    }
+    pthread_cond_signal(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+
+    free(buffer);
+    return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE OMX_FillThisBuffer(OMX_HANDLETYPE handle,
+        OMX_BUFFERHEADERTYPE* buffer)
+{
+    soft_component_t* c = handle;
+    soft_port_t* port = &c->ports[1];
+    OMX_ERRORTYPE error = OMX_ErrorNone;
+
+    pthread_mutex_lock(&c->lock);
+    if (!port->def.bEnabled || port->nqueued == SOFT_MAX_BUFFERS)
+        error = OMX_ErrorIncorrectStateOperation;
+    else
+    {
+        port->queue[(port->head + port->nqueued) % SOFT_MAX_BUFFERS] = buffer;
+        port->nqueued++;
+        update_production(c);
+        pthread_cond_signal(&c->cond);
+    }
+    pthread_mutex_unlock(&c->lock);
+
+    return error;
+}
+
+//stand-ins of dump/dump.c, which names every enum of the real headers
+
+const char* dump_OMX_ERRORTYPE(OMX_ERRORTYPE error)
+{
+    static const char* names[] =
+    { "OMX_ErrorNone", "OMX_ErrorInsufficientResources", "OMX_ErrorUndefined",
+            "OMX_ErrorBadParameter", "OMX_ErrorNotImplemented",
+            "OMX_ErrorTimeout", "OMX_ErrorSameState",
+            "OMX_ErrorIncorrectStateOperation", "OMX_ErrorUnsupportedIndex",
+            "OMX_ErrorBadPortIndex" };
+
+    if ((unsigned)error < sizeof(names) / sizeof(names[0]))
+        return names[error];
+    return "unknown";
+}
+
+const char* dump_OMX_STATETYPE(OMX_STATETYPE state)
+{
+    static const char* names[] =
+    { "OMX_StateInvalid", "OMX_StateLoaded", "OMX_StateIdle",
+            "OMX_StateExecuting", "OMX_StatePause",
+            "OMX_StateWaitForResources" };
+
+    if ((unsigned)state < sizeof(names) / sizeof(names[0]))
+        return names[state];
+    return "unknown";
+}
+
+uint64_t GetTimeStamp()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec * (uint64_t)1000000 + tv.tv_usec;
+}
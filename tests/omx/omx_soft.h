@@ -0,0 +1,41 @@
+#ifndef OMX_SOFT_H
+#define OMX_SOFT_H
+
+//Software stand-in of the VideoCore OpenMAX core, to run the code of
+//components/ (buffer_pool, the command waits) on an x86 box.
+//Every component has a video input port 200, fed through a tunnel, and a
+//video output port 201 whose buffers the application allocates.
+//The commands (state set, port enable/disable) complete asynchronously
+//from a thread of the component, after a random delay in
+//[command_min, command_max] us. In Executing, with port 201 enabled, the
+//thread also produces a frame every 'frame_interval' us into the oldest
+//buffer given with OMX_FillThisBuffer(); without a free buffer the frame is
+//dropped, like a camera whose encoder is stalled.
+
+#include <IL/OMX_Broadcom.h>
+
+#define OMX_SOFT_INPUT_PORT 200
+#define OMX_SOFT_OUTPUT_PORT 201
+
+typedef struct
+{
+    unsigned command_min;    //us
+    unsigned command_max;    //us
+    unsigned frame_interval; //us, 0 : no frames
+    unsigned frame_size;     //bytes written in each buffer
+    unsigned buffer_count_min;
+} omx_soft_config_t;
+
+typedef struct
+{
+    unsigned frames;  //filled and returned
+    unsigned dropped; //no buffer when the frame was due
+    unsigned commands;
+} omx_soft_stats_t;
+
+//for the components opened after the call
+void omx_soft_configure(const omx_soft_config_t* config);
+void omx_soft_default_config(omx_soft_config_t* config);
+void omx_soft_stats(OMX_HANDLETYPE handle, omx_soft_stats_t* stats);
+
+#endif
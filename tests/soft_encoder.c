@@ -0,0 +1,43 @@
+#include "soft_encoder.h"
+#include "omx/omx_soft.h"
+
+void soft_encoder_open(component_t* encoder, buffer_pool_t* pool, int count)
+{
+    init_component(encoder);
+
+    change_state(encoder, OMX_StateIdle);
+    wait_state_change(encoder, OMX_StateIdle);
+
+    //as enable_encoder_output_port()
+    count = buffer_pool_set_count(encoder, OMX_SOFT_OUTPUT_PORT, count);
+    enable_port(encoder, OMX_SOFT_OUTPUT_PORT);
+    buffer_pool_allocate(encoder, pool, OMX_SOFT_OUTPUT_PORT, count);
+    wait_enable_port(encoder, OMX_SOFT_OUTPUT_PORT);
+
+    change_state(encoder, OMX_StateExecuting);
+    wait_state_change(encoder, OMX_StateExecuting);
+}
+
+void soft_encoder_close(component_t* encoder, buffer_pool_t* pool)
+{
+    change_state(encoder, OMX_StateIdle);
+    wait_state_change(encoder, OMX_StateIdle);
+
+    //as disable_encoder_output_port()
+    disable_port(encoder, OMX_SOFT_OUTPUT_PORT);
+    buffer_pool_free(encoder, pool);
+    wait_disable_port(encoder, OMX_SOFT_OUTPUT_PORT);
+
+    change_state(encoder, OMX_StateLoaded);
+    wait_state_change(encoder, OMX_StateLoaded);
+
+    deinit_component(encoder);
+}
+
+uint64_t soft_now_us(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
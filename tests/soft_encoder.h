@@ -0,0 +1,16 @@
+#ifndef SOFT_ENCODER_H
+#define SOFT_ENCODER_H
+
+//An encoder of the software OMX core (omx/omx_soft.h) brought up the way
+//rpiomx_open() brings up the real one: Loaded -> Idle, output port 201
+//enabled with a buffer pool, Executing
+
+#include "../components/component_common.h"
+#include "../components/buffer_pool.h"
+
+void soft_encoder_open(component_t* encoder, buffer_pool_t* pool, int count);
+void soft_encoder_close(component_t* encoder, buffer_pool_t* pool);
+
+uint64_t soft_now_us(void);
+
+#endif
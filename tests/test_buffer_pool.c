@@ -0,0 +1,92 @@
+//buffer_pool on the software OMX core: the count is clamped, the buffers
+//come back in the order they were filled and none is lost
+
+#include "check.h"
+#include "soft_encoder.h"
+#include "omx/omx_soft.h"
+
+#define FRAMES 300
+
+static void test_set_count(void)
+{
+    omx_soft_config_t config;
+    component_t encoder = { .name = "soft.video_encode" };
+
+    omx_soft_default_config(&config);
+    config.buffer_count_min = 2;
+    omx_soft_configure(&config);
+
+    init_component(&encoder);
+    CHECK(buffer_pool_set_count(&encoder, OMX_SOFT_OUTPUT_PORT, 1) == 2);
+    CHECK(buffer_pool_set_count(&encoder, OMX_SOFT_OUTPUT_PORT, 4) == 4);
+    CHECK(buffer_pool_set_count(&encoder, OMX_SOFT_OUTPUT_PORT, 100)
+            == BUFFER_POOL_MAX);
+    deinit_component(&encoder);
+}
+
+//a consumer faster than the encoder: every frame, in order
+static void test_fifo(int count)
+{
+    omx_soft_config_t config;
+    omx_soft_stats_t stats;
+    component_t encoder = { .name = "soft.video_encode" };
+    buffer_pool_t pool;
+    unsigned expected = 0, dropped = 0;
+    int i;
+
+    omx_soft_default_config(&config);
+    config.frame_interval = 2000;
+    omx_soft_configure(&config);
+
+    soft_encoder_open(&encoder, &pool, count);
+    CHECK(pool.count == count);
+    CHECK(buffer_pool_fill_all(&encoder) == OMX_ErrorNone);
+
+    for (i = 0; i < FRAMES; i++)
+    {
+        OMX_BUFFERHEADERTYPE* buffer = buffer_pool_get_filled(&encoder);
+        unsigned number;
+
+        CHECK(buffer->nFilledLen == config.frame_size);
+        memcpy(&number, buffer->pBuffer, sizeof(number));
+        //frames dropped by the encoder show up as a gap, never as a
+        //reordering
+        CHECK(number >= expected);
+        expected = number + 1;
+        CHECK(buffer_pool_fill(&encoder, buffer) == OMX_ErrorNone);
+
+        //the frames due between Executing and buffer_pool_fill_all()
+        //have nowhere to go
+        if (i == 0)
+        {
+            omx_soft_stats(encoder.handle, &stats);
+            dropped = stats.dropped;
+        }
+    }
+
+    omx_soft_stats(encoder.handle, &stats);
+    //the buffers still in the pool were filled, not lost
+    CHECK(stats.frames >= FRAMES);
+    CHECK(stats.frames - FRAMES <= (unsigned)count);
+    if (count > 1)
+        CHECK(stats.dropped == dropped);
+    printf("buffers %d: %u frames, %u dropped\n", count, stats.frames,
+            stats.dropped);
+
+    soft_encoder_close(&encoder, &pool);
+}
+
+int main(int argc, char** argv)
+{
+    OMX_Init();
+
+    test_set_count();
+    test_fifo(1);
+    test_fifo(4);
+    test_fifo(BUFFER_POOL_MAX);
+
+    OMX_Deinit();
+    printf("test_buffer_pool: ok\n");
+
+    return 0;
+}
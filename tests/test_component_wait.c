@@ -0,0 +1,166 @@
+//the wait_*() of component_common.c on a core that completes the commands
+//asynchronously and out of order: every waiter gets its own completion,
+//and a completion that comes before the wait is not lost, an error is not
+//lost either
+
+#include <time.h>
+#include <unistd.h>
+#define wait posix_wait //component_common.h has its own wait()
+#include <sys/wait.h>
+#undef wait
+
+#include "check.h"
+#include "soft_encoder.h"
+#include "omx/omx_soft.h"
+
+#define COMPONENTS 4
+#define ROUNDS 30
+
+static OMX_BOOL port_enabled(component_t* component, OMX_U32 port)
+{
+    OMX_PARAM_PORTDEFINITIONTYPE port_st;
+
+    OMX_INIT_STRUCTURE(port_st);
+    port_st.nPortIndex = port;
+    CHECK(OMX_GetParameter(component->handle, OMX_IndexParamPortDefinition,
+            &port_st) == OMX_ErrorNone);
+    return port_st.bEnabled;
+}
+
+static OMX_STATETYPE state(component_t* component)
+{
+    OMX_STATETYPE st;
+
+    CHECK(OMX_GetState(component->handle, &st) == OMX_ErrorNone);
+    return st;
+}
+
+//commands of several components and ports in flight at once, completed in
+//a random order
+static void test_concurrent(void)
+{
+    omx_soft_config_t config;
+    component_t components[COMPONENTS];
+    component_t* graph[COMPONENTS];
+    component_port_t ports[COMPONENTS * 2];
+    char names[COMPONENTS][32];
+    int i, round;
+
+    omx_soft_default_config(&config);
+    config.command_min = 100;
+    config.command_max = 20000;
+    omx_soft_configure(&config);
+
+    memset(components, 0, sizeof(components));
+    for (i = 0; i < COMPONENTS; i++)
+    {
+        snprintf(names[i], sizeof(names[i]), "soft.component%d", i);
+        components[i].name = names[i];
+        graph[i] = &components[i];
+        ports[i * 2].component = &components[i];
+        ports[i * 2].port = OMX_SOFT_OUTPUT_PORT;
+        ports[i * 2 + 1].component = &components[i];
+        ports[i * 2 + 1].port = OMX_SOFT_INPUT_PORT;
+        init_component(&components[i]);
+    }
+
+    for (round = 0; round < ROUNDS; round++)
+    {
+        change_state_graph(graph, COMPONENTS, OMX_StateIdle);
+        for (i = 0; i < COMPONENTS; i++)
+            CHECK(state(&components[i]) == OMX_StateIdle);
+
+        change_state_graph(graph, COMPONENTS, OMX_StateLoaded);
+        for (i = 0; i < COMPONENTS; i++)
+            CHECK(state(&components[i]) == OMX_StateLoaded);
+
+        enable_ports(ports, COMPONENTS * 2);
+        for (i = 0; i < COMPONENTS * 2; i++)
+            CHECK(port_enabled(ports[i].component, ports[i].port));
+
+        disable_ports(ports, COMPONENTS * 2);
+        for (i = 0; i < COMPONENTS * 2; i++)
+            CHECK(!port_enabled(ports[i].component, ports[i].port));
+
+        //every completion was taken by its waiter
+        for (i = 0; i < COMPONENTS; i++)
+            CHECK(components[i].ncompleted == 0);
+    }
+
+    for (i = 0; i < COMPONENTS; i++)
+        deinit_component(&components[i]);
+}
+
+//the command completes before anybody waits for it
+static void test_early_completion(void)
+{
+    omx_soft_config_t config;
+    component_t component = { .name = "soft.component" };
+    struct timespec t = { 0, 20000000 };
+    uint64_t start;
+
+    omx_soft_default_config(&config);
+    config.command_min = 1000;
+    config.command_max = 1000;
+    omx_soft_configure(&config);
+
+    init_component(&component);
+
+    enable_port(&component, OMX_SOFT_INPUT_PORT);
+    change_state(&component, OMX_StateIdle);
+    nanosleep(&t, NULL);
+    CHECK(component.ncompleted == 2);
+
+    start = soft_now_us();
+    wait_state_change(&component, OMX_StateIdle);
+    wait_enable_port(&component, OMX_SOFT_INPUT_PORT);
+    CHECK(soft_now_us() - start < 5000);
+    CHECK(component.ncompleted == 0);
+
+    change_state(&component, OMX_StateLoaded);
+    wait_state_change(&component, OMX_StateLoaded);
+    deinit_component(&component);
+}
+
+//an error raised with the flag of the awaited event, in one wakeup, stops
+//the waiter (exit(1)) instead of being consumed with it
+static void test_error_with_event(void)
+{
+    int status;
+
+    pid_t pid = fork();
+    CHECK(pid != -1);
+    if (pid == 0)
+    {
+        omx_soft_config_t config;
+        component_t component = { .name = "soft.component" };
+
+        omx_soft_default_config(&config);
+        config.command_min = 100000;
+        config.command_max = 100000;
+        omx_soft_configure(&config);
+        init_component(&component);
+
+        enable_port(&component, OMX_SOFT_INPUT_PORT);
+        wake(&component, EVENT_ERROR | EVENT_PORT_ENABLE);
+        wait_enable_port(&component, OMX_SOFT_INPUT_PORT);
+        _exit(0); //the error went unnoticed
+    }
+
+    CHECK(waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 1);
+}
+
+int main(int argc, char** argv)
+{
+    OMX_Init();
+
+    test_concurrent();
+    test_early_completion();
+    test_error_with_event();
+
+    OMX_Deinit();
+    printf("test_component_wait: ok\n");
+
+    return 0;
+}
@@ -0,0 +1,382 @@
+//record/disk_writer.c on a slow disk: the test is linked with
+//--wrap=pwritev,pwrite,syscall (Makefile), the writes of the writer thread
+//and io_uring_enter go through a hook that sleeps, or blocks while the disk
+//is stalled, and io_uring_setup can be made to fail for the pwritev()
+//backend.
+//- 24MB in writes of 1 byte to 64KB to 3 files, with syncs and waits:
+//  the files are byte exact, the writes end on chunk boundaries but at a
+//  change of file, a sync or a wait. pwritev() with 64KB chunks, with 1MB
+//  chunks and O_DIRECT, and io_uring when the kernel has it
+//- a stalled disk under the frames of an encoder, dropped as
+//  h264_with_preview does when the ring has no room for twice the frame:
+//  the caller never blocks, the frames are dropped up to the next keyframe
+//  and the file has the frames kept, whole and in order
+
+#include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include "check.h"
+#include "../record/disk_writer.h"
+
+#define FILES 3
+#define TOTAL (24 * 1024 * 1024)
+#define MAX_WRITE 65536
+#define MAX_LOG 100000
+
+#define FRAMES 600
+#define GOP 30
+#define IDR_SIZE 600000
+#define P_SIZE 150000
+#define STALL_FRAMES 300 //the disk is stalled for the first frames
+#define FRAME_TIME 2000  //us
+
+static unsigned seed = 1;
+
+static unsigned rnd(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+/*---------------------------------------------------------------------
+   the disk
+----------------------------------------------------------------------*/
+
+static volatile int stalled;       //the writes wait
+static volatile int write_delay;   //us per write
+static volatile int no_uring;      //io_uring_setup fails
+
+typedef struct
+{
+    int fd;
+    off_t offset;
+    int len;
+} write_log_t;
+
+static write_log_t write_log[MAX_LOG];
+static int nlog;
+
+static void slow_disk(void)
+{
+    while (stalled)
+        usleep(1000);
+    if (write_delay)
+        usleep(write_delay);
+}
+
+static void log_write(int fd, off_t offset, int len)
+{
+    CHECK(nlog < MAX_LOG);
+    write_log[nlog].fd = fd;
+    write_log[nlog].offset = offset;
+    write_log[nlog].len = len;
+    nlog++;
+}
+
+ssize_t __real_pwritev(int fd, const struct iovec* iov, int iovcnt,
+        off_t offset);
+ssize_t __real_pwrite(int fd, const void* buf, size_t count, off_t offset);
+long __real_syscall(long number, ...);
+
+ssize_t __wrap_pwritev(int fd, const struct iovec* iov, int iovcnt,
+        off_t offset)
+{
+    int len = 0;
+    int i;
+
+    slow_disk();
+    for (i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+    log_write(fd, offset, len);
+
+    return __real_pwritev(fd, iov, iovcnt, offset);
+}
+
+ssize_t __wrap_pwrite(int fd, const void* buf, size_t count, off_t offset)
+{
+    slow_disk();
+
+    return __real_pwrite(fd, buf, count, offset);
+}
+
+long __wrap_syscall(long number, ...)
+{
+    long a[6];
+    va_list ap;
+    int i;
+
+    va_start(ap, number);
+    for (i = 0; i < 6; i++)
+        a[i] = va_arg(ap, long);
+    va_end(ap);
+
+#ifdef __NR_io_uring_setup
+    if (number == __NR_io_uring_setup && no_uring)
+    {
+        errno = ENOSYS;
+        return -1;
+    }
+    if (number == __NR_io_uring_enter)
+        slow_disk();
+#endif
+
+    return __real_syscall(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+/*---------------------------------------------------------------------
+   byte exact files
+----------------------------------------------------------------------*/
+
+static unsigned char pattern(int file, off_t offset)
+{
+    return (offset >> 12) * 31 + offset * 7 + file * 101;
+}
+
+static void check_file(int fd, int file, off_t size)
+{
+    static unsigned char data[MAX_WRITE];
+    off_t offset;
+    int i;
+
+    CHECK(lseek(fd, 0, SEEK_END) == size);
+    for (offset = 0; offset < size; offset += MAX_WRITE)
+    {
+        int len = (size - offset < MAX_WRITE) ? size - offset : MAX_WRITE;
+        CHECK(pread(fd, data, len, offset) == len);
+        for (i = 0; i < len; i++)
+            CHECK(data[i] == pattern(file, offset + i));
+    }
+}
+
+static void run_files(int chunk, int direct, int uring)
+{
+    static unsigned char data[MAX_WRITE];
+    char paths[FILES][32];
+    int fds[FILES];
+    off_t sizes[FILES] = { 0 };
+    disk_writer_t w;
+    int queued = 0, file = 0, cuts = 0, unaligned = 0;
+    int i, k;
+
+    for (i = 0; i < FILES; i++)
+    {
+        snprintf(paths[i], sizeof(paths[i]), "test_disk_writer.XXXXXX");
+        fds[i] = mkstemp(paths[i]);
+        CHECK(fds[i] != -1);
+    }
+
+    no_uring = !uring;
+    write_delay = 100;
+    nlog = 0;
+    CHECK(disk_writer_init(&w, chunk, direct) == 0);
+    if (uring && !w.use_uring)
+    {
+        printf("io_uring: not in this kernel\n");
+        disk_writer_deinit(&w);
+        for (i = 0; i < FILES; i++)
+        {
+            close(fds[i]);
+            unlink(paths[i]);
+        }
+        return;
+    }
+
+    while (queued < TOTAL)
+    {
+        int len = 1 + rnd() % MAX_WRITE;
+        int r = rnd() % 100;
+
+        //another file (the next segment), a sync or a wait now and then
+        if (r < 2)
+        {
+            file = (file + 1) % FILES;
+            cuts++;
+        }
+        else if (r < 4)
+        {
+            CHECK(disk_writer_sync(&w, fds[file]) == 0);
+            cuts++;
+        }
+        else if (r < 5)
+        {
+            CHECK(disk_writer_wait(&w, disk_writer_position(&w)) == 0);
+            cuts++;
+        }
+
+        for (k = 0; k < len; k++)
+            data[k] = pattern(file, sizes[file] + k);
+        CHECK(disk_writer_write(&w, fds[file], sizes[file], data, len) == 0);
+        sizes[file] += len;
+        queued += len;
+    }
+    CHECK(disk_writer_wait(&w, disk_writer_position(&w)) == 0);
+    CHECK(w.written == (uint64_t)queued && w.max_queued <= DISK_WRITER_SIZE);
+
+    //pwritev() writes seen by the hook: up to the next chunk boundary,
+    //shorter only before a cut
+    if (!w.use_uring)
+    {
+        CHECK(nlog == (int)w.writes);
+        for (i = 0; i < nlog; i++)
+        {
+            off_t end = write_log[i].offset + write_log[i].len;
+            CHECK(write_log[i].len <= chunk);
+            CHECK(write_log[i].offset / chunk == (end - 1) / chunk);
+            if (end % chunk != 0)
+                unaligned++;
+        }
+        CHECK(unaligned <= cuts + 1);
+    }
+
+    for (i = 0; i < FILES; i++)
+    {
+        check_file(fds[i], i, sizes[i]);
+        close(fds[i]);
+        unlink(paths[i]);
+    }
+    printf("%s, %dKB chunks%s: %d bytes, %u writes (%u partial, %d cuts), "
+            "%u syncs, waited for room %u times, %llu bytes queued at most\n",
+            w.use_uring ? "io_uring" : "pwritev", chunk / 1024,
+            direct ? ", O_DIRECT" : "", queued, w.writes, w.partial, cuts,
+            w.syncs, w.full, (unsigned long long)w.max_queued);
+    disk_writer_deinit(&w);
+}
+
+/*---------------------------------------------------------------------
+   backpressure
+----------------------------------------------------------------------*/
+
+static double now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void make_frame(unsigned char* frame, int n, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++)
+        frame[i] = n * 7 + i;
+    memcpy(frame, &n, sizeof(n));
+}
+
+static void run_backpressure(void)
+{
+    static unsigned char frame[IDR_SIZE];
+    static int kept[FRAMES];
+    char path[] = "test_disk_writer.XXXXXX";
+    int fd = mkstemp(path);
+    disk_writer_t w;
+    off_t size = 0;
+    int disk_drop = 0, dropped = 0;
+    double longest = 0;
+    int n;
+
+    CHECK(fd != -1);
+    no_uring = 0;
+    write_delay = 0;
+    CHECK(disk_writer_init(&w, 0, 0) == 0);
+
+    stalled = 1;
+    for (n = 0; n < FRAMES; n++)
+    {
+        int keyframe = (n % GOP == 0);
+        int len = keyframe ? IDR_SIZE : P_SIZE;
+
+        //the next frame of the encoder, faster than real time
+        usleep(FRAME_TIME);
+
+        //the disk is back: what was queued is written, the next frames fit
+        if (n == STALL_FRAMES)
+        {
+            stalled = 0;
+            CHECK(disk_writer_wait(&w, disk_writer_position(&w)) == 0);
+        }
+
+        //record_main() of h264_with_preview
+        kept[n] = 0;
+        if (disk_drop && !keyframe)
+        {
+            dropped++;
+            continue;
+        }
+        disk_drop = (disk_writer_free(&w) < 2 * len);
+        if (disk_drop)
+        {
+            dropped++;
+            continue;
+        }
+
+        make_frame(frame, n, len);
+        double start = now();
+        CHECK(disk_writer_write(&w, fd, size, frame, len) == 0);
+        if (now() - start > longest)
+            longest = now() - start;
+        size += len;
+        kept[n] = 1;
+    }
+    CHECK(disk_writer_wait(&w, disk_writer_position(&w)) == 0);
+
+    //the ring filled up while stalled, never blocked the caller, and every
+    //run of dropped frames ends at a keyframe
+    CHECK(w.full == 0 && w.max_queued <= DISK_WRITER_SIZE);
+    CHECK(dropped > 0);
+    for (n = 1; n < FRAMES; n++)
+    {
+        if (kept[n] && !kept[n - 1])
+            CHECK(n % GOP == 0);
+        if (!kept[n])
+            CHECK(n < STALL_FRAMES);
+    }
+
+    //the frames kept, whole and in order
+    unsigned char* data = malloc(size);
+    CHECK(data != NULL);
+    CHECK(pread(fd, data, size, 0) == size);
+    off_t offset = 0;
+    for (n = 0; n < FRAMES; n++)
+    {
+        if (!kept[n])
+            continue;
+        int len = (n % GOP == 0) ? IDR_SIZE : P_SIZE;
+        make_frame(frame, n, len);
+        CHECK(memcmp(data + offset, frame, len) == 0);
+        offset += len;
+    }
+    CHECK(offset == size);
+    free(data);
+
+    for (n = 0; n < STALL_FRAMES && kept[n]; n++)
+        ;
+    printf("stalled disk: first frame dropped %d, %d of %d dropped, "
+            "%.2fms longest write call, %llu bytes queued at most\n", n,
+            dropped, FRAMES, longest * 1000,
+            (unsigned long long)w.max_queued);
+    disk_writer_deinit(&w);
+    close(fd);
+    unlink(path);
+}
+
+int main(int argc, char** argv)
+{
+    //a caller blocked on the stalled disk would never come back
+    alarm(60);
+
+    run_files(64 * 1024, 0, 0);
+    run_files(DISK_WRITER_CHUNK, 1, 0);
+    run_files(256 * 1024, 0, 1);
+    run_backpressure();
+
+    printf("test_disk_writer: ok\n");
+
+    return 0;
+}
@@ -0,0 +1,171 @@
+//stream/fanout.c over loopback: the frames of more than UDP_BATCH_MAX
+//packets reach a slow viewer whole or not at all, and a frame that finds
+//no free part is dropped for everybody
+
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "check.h"
+#include "../stream/fanout.h"
+
+#define VIEWERS 3
+#define FRAMES 12
+#define FRAME_PACKETS (2 * UDP_BATCH_MAX + 22) //3 parts
+#define PACKET_SIZE 1200
+#define WINDOW 20000 //us per part, the viewers cannot keep up
+#define BIG_FRAME 100 //timestamp of a frame bigger than all the parts
+#define LAST_FRAME 101
+#define MAX_TIMESTAMP 128
+
+typedef struct
+{
+    int sock;
+    struct sockaddr_in addr;
+    pthread_t tid;
+    int packets[MAX_TIMESTAMP]; //received, by timestamp
+} receiver_t;
+
+static void* receive(void* arg)
+{
+    receiver_t* rx = arg;
+    unsigned char packet[2048];
+    ssize_t n;
+
+    //ends after 500 ms without a packet
+    while ((n = recv(rx->sock, packet, sizeof(packet), 0)) > 0)
+    {
+        CHECK(n == PACKET_SIZE);
+        uint32_t timestamp = ((uint32_t)packet[4] << 24) | (packet[5] << 16)
+                | (packet[6] << 8) | packet[7];
+        CHECK(timestamp < MAX_TIMESTAMP);
+        rx->packets[timestamp]++;
+    }
+
+    return NULL;
+}
+
+static void open_receiver(receiver_t* rx)
+{
+    socklen_t len = sizeof(rx->addr);
+    struct timeval timeout = { 0, 500000 };
+    int size = 4 * 1024 * 1024;
+
+    memset(rx, 0, sizeof(*rx));
+    rx->sock = socket(AF_INET, SOCK_DGRAM, 0);
+    CHECK(rx->sock != -1);
+    setsockopt(rx->sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    setsockopt(rx->sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    rx->addr.sin_family = AF_INET;
+    rx->addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(bind(rx->sock, (struct sockaddr *) &rx->addr, len) == 0);
+    CHECK(getsockname(rx->sock, (struct sockaddr *) &rx->addr, &len) == 0);
+    CHECK(pthread_create(&rx->tid, NULL, receive, rx) == 0);
+}
+
+static void send_frame(fanout_t* fanout, uint32_t timestamp, int packets)
+{
+    unsigned char packet[PACKET_SIZE];
+    static uint16_t seq;
+    int i;
+
+    memset(packet, 0xaa, sizeof(packet));
+    for (i = 0; i < packets; i++)
+    {
+        packet[0] = 0x80;
+        packet[1] = RTP_H264_PAYLOAD_TYPE | ((i == packets - 1) ? 0x80 : 0);
+        packet[2] = seq >> 8;
+        packet[3] = seq;
+        packet[4] = timestamp >> 24;
+        packet[5] = timestamp >> 16;
+        packet[6] = timestamp >> 8;
+        packet[7] = timestamp;
+        seq++;
+        fanout_add(fanout, packet, sizeof(packet));
+    }
+    fanout_publish(fanout);
+}
+
+//wait until every viewer sent its queue
+static void wait_idle(fanout_t* fanout)
+{
+    int i, busy;
+
+    do
+    {
+        usleep(10000);
+        busy = 0;
+        pthread_mutex_lock(&fanout->lock);
+        for (i = 0; i < FANOUT_FRAMES; i++)
+            busy |= fanout->frames[i].refs;
+        pthread_mutex_unlock(&fanout->lock);
+    } while (busy);
+}
+
+int main(int argc, char** argv)
+{
+    static fanout_t fanout;
+    receiver_t rx[VIEWERS];
+    int ids[VIEWERS];
+    int sock, i, t;
+    uint32_t discarded;
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    CHECK(sock != -1);
+    fanout_init(&fanout, sock, UDP_SEND_GSO, PACER_TIMER, WINDOW, 0);
+    for (i = 0; i < VIEWERS; i++)
+    {
+        open_receiver(&rx[i]);
+        ids[i] = fanout_subscribe(&fanout, &rx[i].addr, 1);
+        CHECK(ids[i] != -1);
+    }
+
+    //faster than the viewers can send them
+    for (t = 0; t < FRAMES; t++)
+        send_frame(&fanout, t, FRAME_PACKETS);
+    wait_idle(&fanout);
+    //some did not even find free parts
+    discarded = fanout.discarded;
+
+    //needs more parts than there are
+    send_frame(&fanout, BIG_FRAME, UDP_BATCH_MAX * (FANOUT_FRAMES + 1));
+    CHECK(fanout.discarded == discarded + 1);
+    send_frame(&fanout, LAST_FRAME, 10);
+    wait_idle(&fanout);
+
+    for (i = 0; i < VIEWERS; i++)
+    {
+        subscriber_t* sub = &fanout.subscribers[ids[i]];
+        int whole = 0;
+
+        pthread_mutex_lock(&fanout.lock);
+        CHECK(sub->frames + sub->dropped == FRAMES - discarded + 1);
+        //fell behind, the frames were dropped from the queue or found
+        //no free part
+        CHECK(sub->dropped > 0 || discarded > 0);
+        CHECK(sub->packets == (sub->frames - 1) * FRAME_PACKETS + 10);
+        pthread_mutex_unlock(&fanout.lock);
+
+        pthread_join(rx[i].tid, NULL);
+        for (t = 0; t < FRAMES; t++)
+        {
+            //a dropped frame is dropped with all its parts
+            CHECK(rx[i].packets[t] == 0 || rx[i].packets[t] == FRAME_PACKETS);
+            whole += (rx[i].packets[t] == FRAME_PACKETS);
+        }
+        CHECK(whole == (int)sub->frames - 1);
+        CHECK(rx[i].packets[BIG_FRAME] == 0);
+        CHECK(rx[i].packets[LAST_FRAME] == 10);
+        printf("viewer %d : %d frames whole, %u dropped\n", i, whole,
+                sub->dropped);
+        close(rx[i].sock);
+    }
+
+    fanout_deinit(&fanout);
+    close(sock);
+    printf("test_fanout: ok\n");
+
+    return 0;
+}
@@ -0,0 +1,319 @@
+//stream/fec.c through the fan-out over loopback: frames of 1 packet to
+//several FEC blocks (a block exactly full, one packet over) are published
+//with FEC_RATIO 0.25, every part must be a block with its repair packets,
+//every packet must fit in the MTU. A loss simulator then drops up to 'r'
+//packets of each block (media or repair) and fec_decode() must rebuild
+//every media packet byte for byte; with one loss more it must not
+//invent any. A viewer without FEC gets the media packets only.
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "check.h"
+#include "../stream/fanout.h"
+
+#define RATIO 0.25
+#define MTU RTP_DEFAULT_MTU
+#define MEDIA_MTU (MTU - FEC_OVERHEAD)
+#define MAX_PACKETS 512
+#define TRIALS 200
+#define SSRC 0x12345678
+
+typedef struct
+{
+    unsigned char data[RTP_MAX_MTU];
+    int len;
+} packet_t;
+
+//what the viewer received of one frame
+static packet_t received[MAX_PACKETS];
+static int nreceived;
+
+//media packets of the frame, by index from the first sequence number
+static packet_t media[MAX_PACKETS];
+static int nmedia;
+static uint16_t first_seq;
+
+//what the decoder gave back
+static int rebuilt[MAX_PACKETS];
+
+typedef struct
+{
+    uint16_t base;
+    int k;
+    int r;
+    int packets[UDP_BATCH_MAX]; //indexes in received[]
+    int npackets;
+} block_t;
+
+static block_t blocks[MAX_PACKETS];
+static int nblocks;
+
+static uint16_t packet_seq(const unsigned char* packet)
+{
+    return (packet[2] << 8) | packet[3];
+}
+
+static void send_frame(fanout_t* fanout, uint32_t timestamp, int packets)
+{
+    static uint16_t seq = 65500; //wraps in the test
+    unsigned char packet[RTP_MAX_MTU];
+    uint32_t ssrc = SSRC;
+    int i, j;
+
+    first_seq = seq;
+    nmedia = packets;
+    for (i = 0; i < packets; i++)
+    {
+        int len = (i % 5 == 4) ? RTP_HEADER_SIZE + 1 + rand() % 1000
+                : MEDIA_MTU;
+
+        packet[0] = 0x80;
+        packet[1] = RTP_H264_PAYLOAD_TYPE | ((i == packets - 1) ? 0x80 : 0);
+        packet[2] = seq >> 8;
+        packet[3] = seq;
+        packet[4] = timestamp >> 24;
+        packet[5] = timestamp >> 16;
+        packet[6] = timestamp >> 8;
+        packet[7] = timestamp;
+        packet[8] = ssrc >> 24;
+        packet[9] = ssrc >> 16;
+        packet[10] = ssrc >> 8;
+        packet[11] = ssrc;
+        for (j = RTP_HEADER_SIZE; j < len; j++)
+            packet[j] = rand();
+        seq++;
+
+        memcpy(media[i].data, packet, len);
+        media[i].len = len;
+        fanout_add(fanout, packet, len);
+    }
+    fanout_publish(fanout);
+}
+
+//wait until the viewer sent its queue, loopback delivers in the send
+static void wait_idle(fanout_t* fanout)
+{
+    int i, busy;
+
+    do
+    {
+        usleep(1000);
+        busy = 0;
+        pthread_mutex_lock(&fanout->lock);
+        for (i = 0; i < FANOUT_FRAMES; i++)
+            busy |= fanout->frames[i].refs;
+        pthread_mutex_unlock(&fanout->lock);
+    } while (busy);
+}
+
+//open a receiving socket on loopback
+static int open_receiver(struct sockaddr_in* addr)
+{
+    socklen_t len = sizeof(*addr);
+    int size = 4 * 1024 * 1024;
+    int sock;
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    CHECK(sock != -1);
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(bind(sock, (struct sockaddr *) addr, len) == 0);
+    CHECK(getsockname(sock, (struct sockaddr *) addr, &len) == 0);
+
+    return sock;
+}
+
+static void receive_frame(int sock)
+{
+    ssize_t n;
+
+    nreceived = 0;
+    while ((n = recv(sock, received[nreceived].data, RTP_MAX_MTU,
+            MSG_DONTWAIT)) > 0)
+    {
+        CHECK(n <= MTU);
+        received[nreceived].len = n;
+        CHECK(++nreceived < MAX_PACKETS);
+    }
+}
+
+//the blocks of the frame, from the headers of the repair packets
+static void find_blocks(void)
+{
+    int i, b;
+
+    nblocks = 0;
+    for (i = 0; i < nreceived; i++)
+    {
+        const unsigned char* p = received[i].data;
+        if ((p[1] & 0x7f) != FEC_PAYLOAD_TYPE)
+            continue;
+        p += RTP_HEADER_SIZE;
+        uint16_t base = (p[0] << 8) | p[1];
+        if (nblocks == 0 || blocks[nblocks - 1].base != base)
+        {
+            CHECK(nblocks < MAX_PACKETS);
+            blocks[nblocks].base = base;
+            blocks[nblocks].k = p[2];
+            blocks[nblocks].r = p[3];
+            blocks[nblocks].npackets = 0;
+            nblocks++;
+        }
+    }
+
+    for (i = 0; i < nreceived; i++)
+    {
+        const unsigned char* p = received[i].data;
+        uint16_t seq = packet_seq(p);
+        int repair = ((p[1] & 0x7f) == FEC_PAYLOAD_TYPE);
+
+        for (b = 0; b < nblocks; b++)
+        {
+            block_t* block = &blocks[b];
+            if (repair ? ((p[12] << 8 | p[13]) == block->base)
+                    : ((uint16_t)(seq - block->base) < block->k))
+            {
+                CHECK(block->npackets < UDP_BATCH_MAX);
+                block->packets[block->npackets++] = i;
+                break;
+            }
+        }
+        CHECK(b < nblocks); //every media packet is protected
+    }
+}
+
+static int recovered(void* arg, const unsigned char* packet, int len)
+{
+    int i = (uint16_t)(packet_seq(packet) - first_seq);
+
+    CHECK(i < nmedia);
+    CHECK(!rebuilt[i]);
+    CHECK(len == media[i].len && !memcmp(packet, media[i].data, len));
+    rebuilt[i] = 1;
+
+    return 0;
+}
+
+//lose 'extra' packets more than the repairs in each block
+static void simulate(int extra)
+{
+    static char lost[MAX_PACKETS];
+    fec_decoder_t* dec = malloc(sizeof(fec_decoder_t));
+    int i, b, n;
+
+    CHECK(dec);
+    fec_decoder_init(dec);
+    memset(lost, 0, sizeof(lost));
+    memset(rebuilt, 0, sizeof(rebuilt));
+    for (b = 0; b < nblocks; b++)
+    {
+        int nlost = extra ? blocks[b].r + extra : rand() % (blocks[b].r + 1);
+        //a media packet first, otherwise there is nothing to rebuild
+        if (nlost > 0)
+            lost[blocks[b].packets[rand() % blocks[b].k]] = 1;
+        for (n = 1; n < nlost; )
+        {
+            int p = blocks[b].packets[rand() % blocks[b].npackets];
+            if (!lost[p])
+            {
+                lost[p] = 1;
+                n++;
+            }
+        }
+    }
+
+    for (i = 0; i < nreceived; i++)
+    {
+        if (lost[i])
+            continue;
+        if ((received[i].data[1] & 0x7f) != FEC_PAYLOAD_TYPE)
+            recovered(NULL, received[i].data, received[i].len);
+        fec_decode(dec, received[i].data, received[i].len, recovered, NULL);
+    }
+
+    for (b = 0; b < nblocks; b++)
+    {
+        int missing = 0;
+        for (i = 0; i < blocks[b].k; i++)
+            missing += !rebuilt[(uint16_t)(blocks[b].base + i - first_seq)];
+        CHECK(extra ? missing > 0 : missing == 0);
+    }
+    free(dec);
+}
+
+static void check_frame(int packets, int block)
+{
+    int i, b;
+
+    CHECK(nblocks == (packets + block - 1) / block);
+    for (b = 0, i = 0; b < nblocks; b++)
+    {
+        //the parts are the blocks, each one with its repairs
+        CHECK(blocks[b].base == (uint16_t)(first_seq + i));
+        CHECK(blocks[b].k == ((packets - i < block) ? packets - i : block));
+        CHECK(blocks[b].r > 0 && blocks[b].k + blocks[b].r <= UDP_BATCH_MAX);
+        CHECK(blocks[b].npackets == blocks[b].k + blocks[b].r);
+        i += blocks[b].k;
+    }
+
+    for (i = 0; i < TRIALS; i++)
+        simulate(0);
+    for (i = 0; i < TRIALS; i++)
+        simulate(1);
+}
+
+int main(int argc, char** argv)
+{
+    static fanout_t fanout;
+    static fec_encoder_t fec;
+    struct sockaddr_in addr, media_addr;
+    int sock, rx, rx_media, i;
+
+    fec_encoder_init(&fec, RATIO, 1);
+    //the biggest block with its repairs in one batch
+    CHECK(fec.block + (int)(fec.block * RATIO + 0.999) <= UDP_BATCH_MAX);
+    CHECK(fec.block + 1 + (int)((fec.block + 1) * RATIO + 0.999)
+            > UDP_BATCH_MAX);
+    int block = fec.block;
+
+    rx = open_receiver(&addr);
+    rx_media = open_receiver(&media_addr);
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    CHECK(sock != -1);
+    fanout_init(&fanout, sock, UDP_SEND_GSO, PACER_OFF, 0, 0);
+    fanout.fec = &fec;
+    CHECK(fanout_subscribe(&fanout, &addr, 1) != -1);
+    //a viewer without FEC (RTSP) only gets the media packets
+    CHECK(fanout_subscribe(&fanout, &media_addr, 0) != -1);
+
+    int sizes[] = { 1, 4, 5, block - 1, block, block + 1, UDP_BATCH_MAX,
+            3 * block + 7 };
+    for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++)
+    {
+        send_frame(&fanout, i, sizes[i]);
+        wait_idle(&fanout);
+        receive_frame(rx_media);
+        CHECK(nreceived == sizes[i]);
+        while (nreceived-- > 0)
+            CHECK((received[nreceived].data[1] & 0x7f) != FEC_PAYLOAD_TYPE);
+        receive_frame(rx);
+        find_blocks();
+        check_frame(sizes[i], block);
+        printf("%3d packets : %d blocks, %d packets sent\n", sizes[i],
+                nblocks, nreceived);
+    }
+
+    fanout_deinit(&fanout);
+    close(sock);
+    close(rx);
+    close(rx_media);
+    printf("test_fec: ok\n");
+
+    return 0;
+}
@@ -0,0 +1,150 @@
+//h264_udp_ffstream_dir/ffh264enc.c: with slice threads every frame comes
+//out of its own encode call; with frame threads and a lookahead the first
+//calls return nothing and ffh264_enc_drain() gives the rest: every frame
+//comes out, once, as one Annex-B access unit, the first one an IDR. A
+//requested IDR is one.
+//Needs libavcodec: make fftest
+
+#include <string.h>
+
+#include "check.h"
+#include "../h264_udp_ffstream_dir/ffh264enc.h"
+
+#define WIDTH 432
+#define HEIGHT 240
+#define LINE 448 //the lines of the resize output, padded to 32 bytes
+#define FRAME_SIZE (LINE * HEIGHT * 3 / 2)
+#define FRAMES 60
+
+static unsigned char frame[FRAME_SIZE];
+
+static void make_frame(int n)
+{
+    int x, y;
+
+    for (y = 0; y < HEIGHT; y++)
+        for (x = 0; x < LINE; x++)
+            frame[y * LINE + x] = (x + y + 2 * n) & 0xff;
+    memset(frame + LINE * HEIGHT, 128, LINE * HEIGHT / 2);
+}
+
+//type of the first slice of an access unit, 5 : IDR
+static int nal_type(const unsigned char *p, int len)
+{
+    int i;
+
+    for (i = 0; i + 3 < len; i++)
+    {
+        if (p[i] == 0 && p[i + 1] == 0 && p[i + 2] == 1)
+        {
+            int type = p[i + 3] & 0x1f;
+            if (type == 1 || type == 5)
+                return type;
+        }
+    }
+
+    return -1;
+}
+
+static void test_slice(void)
+{
+    ffh264_enc_config_t cfg;
+    unsigned char *out;
+    int n, len;
+
+    ffh264_enc_config_default(&cfg, WIDTH, HEIGHT, 300000, 30);
+    cfg.gop = 30;
+    ffh264_enc_t *enc = ffh264_enc_open_config(&cfg);
+    CHECK(enc != NULL);
+
+    for (n = 0; n < FRAMES; n++)
+    {
+        make_frame(n);
+        if (n == 10)
+            ffh264_enc_request_idr(enc);
+        len = ffh264_enc_encode(enc, frame, &out);
+        CHECK(len > 0);
+        CHECK(nal_type(out, len) == 5 || (n != 0 && n != 10));
+        CHECK(ffh264_enc_receive(enc, &out) == 0);
+    }
+    CHECK(ffh264_enc_drain(enc) == 0);
+    CHECK(ffh264_enc_receive(enc, &out) == 0);
+    CHECK(ffh264_enc_close(enc) == 0);
+}
+
+static void test_frame(int lookahead)
+{
+    ffh264_enc_config_t cfg;
+    unsigned char *out;
+    int n, len, first = -1, received = 0;
+
+    ffh264_enc_config_default(&cfg, WIDTH, HEIGHT, 300000, 30);
+    cfg.thread_type = FFH264_THREAD_FRAME;
+    cfg.threads = 3;
+    cfg.lookahead = lookahead;
+    cfg.gop = 30;
+    ffh264_enc_t *enc = ffh264_enc_open_config(&cfg);
+    CHECK(enc != NULL);
+
+    for (n = 0; n < FRAMES; n++)
+    {
+        make_frame(n);
+        for (len = ffh264_enc_encode_buffer(enc, frame, FRAME_SIZE, NULL,
+                NULL, &out); len > 0; len = ffh264_enc_receive(enc, &out))
+        {
+            if (first == -1)
+                first = n;
+            CHECK(nal_type(out, len) == 5 || received > 0);
+            CHECK(nal_type(out, len) != -1);
+            received++;
+        }
+        CHECK(len == 0);
+    }
+    if (lookahead > 0)
+        CHECK(first >= lookahead); //delayed
+    CHECK(received < FRAMES);
+
+    CHECK(ffh264_enc_drain(enc) == 0);
+    while ((len = ffh264_enc_receive(enc, &out)) > 0)
+    {
+        CHECK(nal_type(out, len) != -1);
+        received++;
+    }
+    CHECK(len == 0);
+    CHECK(received == FRAMES);
+    printf("frame threads, lookahead %d: first frame out after %d frames\n",
+            lookahead, first);
+    CHECK(ffh264_enc_close(enc) == 0);
+}
+
+//frames left in the encoder are dropped by close
+static void test_close(void)
+{
+    ffh264_enc_config_t cfg;
+    unsigned char *out;
+    int n;
+
+    ffh264_enc_config_default(&cfg, WIDTH, HEIGHT, 300000, 30);
+    cfg.thread_type = FFH264_THREAD_FRAME;
+    cfg.lookahead = 10;
+    ffh264_enc_t *enc = ffh264_enc_open_config(&cfg);
+    CHECK(enc != NULL);
+    for (n = 0; n < 5; n++)
+    {
+        make_frame(n);
+        CHECK(ffh264_enc_encode(enc, frame, &out) >= 0);
+    }
+    CHECK(ffh264_enc_close(enc) == 0);
+}
+
+int main(int argc, char **argv)
+{
+    test_slice();
+    test_frame(0);
+    test_frame(10);
+    test_close();
+
+    printf("test_ffh264enc: ok\n");
+
+    return 0;
+}
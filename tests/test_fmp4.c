@@ -0,0 +1,486 @@
+//record/fmp4.c: access units with the SPS/PPS of a few picture sizes
+//(with and without cropping, Baseline and High) written with
+//fmp4_write_frame(), then the boxes walked back: the layout of the file,
+//the picture size of tkhd and avc1, the avcC, the fragments (sequence,
+//tfdt, trun durations, sizes, flags and data offset, the samples in AVC
+//format without SPS/PPS/AUD), a fragment cut at FMP4_MAX_SAMPLES, the mfra
+//entries and the mfro size. A file after fmp4_restart(). An SPS with an
+//Exp-Golomb code of more than 32 bits gives a picture size of 0
+
+#include <string.h>
+
+#include "check.h"
+#include "../record/fmp4.h"
+
+#define FILE_MAX (32 << 20)
+#define FRAME_TIME 33333 //us
+#define START 987654321 //us, the clock of the encoder does not start at 0
+#define MAX_NALS 4
+
+static unsigned char file[FILE_MAX];
+static int file_len, writes;
+
+static int write_file(void* arg, const unsigned char* data, int len)
+{
+    CHECK(file_len + len <= FILE_MAX);
+    memcpy(file + file_len, data, len);
+    file_len += len;
+    writes++;
+
+    return 0;
+}
+
+//Exp-Golomb writer, for the SPS
+typedef struct
+{
+    unsigned char data[64];
+    int pos; //bit
+} bit_writer_t;
+
+static void put_bit(bit_writer_t* bw, int bit)
+{
+    if (bit)
+        bw->data[bw->pos >> 3] |= 0x80 >> (bw->pos & 7);
+    bw->pos++;
+}
+
+static void put_bits(bit_writer_t* bw, uint32_t v, int n)
+{
+    while (n-- > 0)
+        put_bit(bw, (v >> n) & 1);
+}
+
+static void put_ue(bit_writer_t* bw, uint32_t v)
+{
+    int bits = 0;
+
+    while ((v + 1) >> (bits + 1))
+        bits++;
+    put_bits(bw, 0, bits);
+    put_bits(bw, v + 1, bits + 1);
+}
+
+//SPS NAL unit (header included, emulation prevention added) of a picture
+//of width x height, cropped to a multiple of 16 below
+static int make_sps(unsigned char* out, int profile, int width, int height)
+{
+    bit_writer_t bw;
+    int mbs_w = (width + 15) / 16, mbs_h = (height + 15) / 16;
+    int i, n = 0, zeros = 0;
+
+    memset(&bw, 0, sizeof(bw));
+    put_bits(&bw, 0x67, 8);
+    put_bits(&bw, profile, 8);
+    put_bits(&bw, 0, 8);  //constraint flags
+    put_bits(&bw, 40, 8); //level 4
+    put_ue(&bw, 0);       //seq_parameter_set_id
+    if (profile == 100)
+    {
+        put_ue(&bw, 1);   //chroma_format_idc 4:2:0
+        put_ue(&bw, 0);
+        put_ue(&bw, 0);
+        put_bit(&bw, 0);
+        put_bit(&bw, 1);  //seq_scaling_matrix_present_flag
+        for (i = 0; i < 8; i++)
+        {
+            put_bit(&bw, i == 0); //one list
+            if (i == 0)
+                put_ue(&bw, 16);  //delta_scale -8: the default list
+        }
+    }
+    put_ue(&bw, 0);       //log2_max_frame_num_minus4
+    put_ue(&bw, 0);       //pic_order_cnt_type
+    put_ue(&bw, 2);       //log2_max_pic_order_cnt_lsb_minus4
+    put_ue(&bw, 1);       //max_num_ref_frames
+    put_bit(&bw, 0);
+    put_ue(&bw, mbs_w - 1);
+    put_ue(&bw, mbs_h - 1);
+    put_bit(&bw, 1);      //frame_mbs_only_flag
+    put_bit(&bw, 1);      //direct_8x8_inference_flag
+    if (mbs_w * 16 != width || mbs_h * 16 != height)
+    {
+        put_bit(&bw, 1);  //frame_cropping_flag, 4:2:0 : units of 2
+        put_ue(&bw, 0);
+        put_ue(&bw, (mbs_w * 16 - width) / 2);
+        put_ue(&bw, 0);
+        put_ue(&bw, (mbs_h * 16 - height) / 2);
+    }
+    else
+        put_bit(&bw, 0);
+    put_bit(&bw, 0);      //vui_parameters_present_flag
+    put_bit(&bw, 1);      //rbsp_stop_one_bit
+
+    for (i = 0; i < (bw.pos + 7) / 8; i++)
+    {
+        if (zeros == 2 && bw.data[i] <= 3)
+        {
+            out[n++] = 3;
+            zeros = 0;
+        }
+        out[n++] = bw.data[i];
+        zeros = bw.data[i] ? 0 : zeros + 1;
+    }
+
+    return n;
+}
+
+typedef struct
+{
+    unsigned char* data; //Annex-B
+    int len;
+    const unsigned char* nal[MAX_NALS]; //the NAL units of the samples
+    int nal_len[MAX_NALS];
+    int nnals;
+    uint64_t pts;
+    int keyframe;
+} frame_t;
+
+static unsigned seed = 1;
+
+static unsigned rnd(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+//random NAL unit payload without 00 00 (no start code inside)
+static void fill(unsigned char* p, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++)
+        p[i] = 1 + rnd() % 255;
+}
+
+static void append(frame_t* f, const unsigned char* nal, int len,
+        int in_sample)
+{
+    memcpy(f->data + f->len, "\0\0\0\1", 4);
+    memcpy(f->data + f->len + 4, nal, len);
+    if (in_sample)
+    {
+        f->nal[f->nnals] = f->data + f->len + 4;
+        f->nal_len[f->nnals++] = len;
+    }
+    f->len += 4 + len;
+}
+
+//an AUD, SPS + PPS on keyframes, then one or two slices
+static void make_frame(frame_t* f, int n, int keyframe,
+        const unsigned char* sps, int sps_len)
+{
+    static const unsigned char aud[] = { 0x09, 0xf0 };
+    static const unsigned char pps[] = { 0x68, 0xee, 0x3c, 0x80 };
+    unsigned char slice[20000];
+    int len = keyframe ? 10000 + rnd() % 10000 : 1 + rnd() % 3000;
+
+    f->data = malloc(len + 2 * sizeof(slice));
+    CHECK(f->data != NULL);
+    f->len = 0;
+    f->nnals = 0;
+    f->pts = START + (uint64_t)n * FRAME_TIME;
+    f->keyframe = keyframe;
+
+    append(f, aud, sizeof(aud), 0);
+    if (keyframe)
+    {
+        append(f, sps, sps_len, 0);
+        append(f, pps, sizeof(pps), 0);
+    }
+    fill(slice, len);
+    slice[0] = keyframe ? 0x65 : 0x41;
+    append(f, slice, len, 1);
+    if (n % 3 == 0)
+    {
+        fill(slice, 100);
+        slice[0] = keyframe ? 0x65 : 0x41;
+        append(f, slice, 100, 1);
+    }
+}
+
+static uint32_t get32(const unsigned char* p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static uint64_t get64(const unsigned char* p)
+{
+    return ((uint64_t)get32(p) << 32) | get32(p + 4);
+}
+
+//the child box of a type in [p, end), NULL : none
+static const unsigned char* find_box(const unsigned char* p,
+        const unsigned char* end, const char* type)
+{
+    while (end - p >= 8)
+    {
+        uint32_t size = get32(p);
+        CHECK(size >= 8 && size <= end - p);
+        if (memcmp(p + 4, type, 4) == 0)
+            return p;
+        p += size;
+    }
+    CHECK(p == end);
+
+    return NULL;
+}
+
+//box at a path of types, each one in the one before
+static const unsigned char* find_path(const unsigned char* box,
+        const char* const* path, int n)
+{
+    int i;
+
+    for (i = 0; i < n && box; i++)
+    {
+        const unsigned char* inside = box + 8;
+        //the children of stsd and avc1 come after their fields
+        if (memcmp(box + 4, "stsd", 4) == 0)
+            inside = box + 16;
+        else if (memcmp(box + 4, "avc1", 4) == 0)
+            inside = box + 86;
+        box = find_box(inside, box + get32(box), path[i]);
+    }
+
+    return box;
+}
+
+//the file written from 'frames', a picture of 'width' x 'height'
+static void check_file(const frame_t* frames, int nframes, int width,
+        int height, const unsigned char* sps, int sps_len)
+{
+    static const char* const avc1_path[] = { "trak", "mdia", "minf", "stbl",
+            "stsd", "avc1" };
+    static const char* const tkhd_path[] = { "trak", "tkhd" };
+    const unsigned char* end = file + file_len;
+    const unsigned char* p = file;
+    uint32_t sequence = 0; //goes on after fmp4_restart()
+    uint64_t keyframe_moofs[64];
+    int nkeyframes = 0;
+    int first, f, i, k;
+
+    for (first = 0; !frames[first].keyframe; first++)
+        ;
+    f = first;
+
+    //ftyp, moov
+    CHECK(find_box(p, end, "ftyp") == p);
+    p += get32(p);
+    const unsigned char* moov = find_box(p, end, "moov");
+    CHECK(moov == p);
+    p += get32(p);
+
+    const unsigned char* tkhd = find_path(moov, tkhd_path, 2);
+    CHECK(tkhd != NULL);
+    CHECK(get32(tkhd + 84) == (uint32_t)width << 16);
+    CHECK(get32(tkhd + 88) == (uint32_t)height << 16);
+    const unsigned char* avc1 = find_path(moov, avc1_path, 6);
+    CHECK(avc1 != NULL);
+    CHECK(((avc1 + 32)[0] << 8 | (avc1 + 32)[1]) == width);
+    CHECK(((avc1 + 34)[0] << 8 | (avc1 + 34)[1]) == height);
+    const unsigned char* avcc = find_box(avc1 + 86, avc1 + get32(avc1),
+            "avcC");
+    CHECK(avcc != NULL);
+    CHECK(avcc[8] == 1 && avcc[9] == sps[1] && avcc[11] == sps[3]);
+    CHECK(avcc[12] == 0xff && avcc[13] == 0xe1);
+    CHECK((avcc[14] << 8 | avcc[15]) == sps_len);
+    CHECK(memcmp(avcc + 16, sps, sps_len) == 0);
+    CHECK(avcc[16 + sps_len] == 1 && avcc[19 + sps_len] == 0x68);
+
+    //moof + mdat, the samples of the frames in order
+    while (f < nframes)
+    {
+        const unsigned char* moof = p;
+        CHECK(find_box(p, end, "moof") == moof);
+        const unsigned char* mdat = moof + get32(moof);
+        CHECK(find_box(mdat, end, "mdat") == mdat);
+        p = mdat + get32(mdat);
+
+        const unsigned char* mfhd = find_box(moof + 8, mdat, "mfhd");
+        CHECK(mfhd && (sequence == 0 || get32(mfhd + 12) == sequence + 1));
+        sequence = get32(mfhd + 12);
+        const unsigned char* traf = find_box(moof + 8, mdat, "traf");
+        CHECK(traf != NULL);
+        const unsigned char* tfdt = find_box(traf + 8, traf + get32(traf),
+                "tfdt");
+        CHECK(tfdt && tfdt[8] == 1);
+        CHECK(get64(tfdt + 12) == (frames[f].pts - frames[first].pts)
+                * 9 / 100);
+        const unsigned char* trun = find_box(traf + 8, traf + get32(traf),
+                "trun");
+        CHECK(trun && get32(trun + 8) == 0x000701);
+        int nsamples = get32(trun + 12);
+        CHECK(nsamples > 0 && nsamples <= FMP4_MAX_SAMPLES);
+        CHECK(moof + get32(trun + 16) == mdat + 8);
+        if (frames[f].keyframe)
+        {
+            CHECK(nkeyframes < 64);
+            keyframe_moofs[nkeyframes++] = moof - file;
+        }
+
+        const unsigned char* sample = mdat + 8;
+        for (i = 0; i < nsamples; i++, f++)
+        {
+            const unsigned char* entry = trun + 20 + 12 * i;
+            const frame_t* frame = &frames[f];
+            CHECK(f < nframes);
+            //the duration of the last one is the one before it
+            CHECK(get32(entry) == 3000 || get32(entry) == 2999);
+            CHECK(get32(entry + 8) == (frame->keyframe ? 0x02000000
+                    : 0x01010000));
+            const unsigned char* sample_end = sample + get32(entry + 4);
+            for (k = 0; k < frame->nnals; k++)
+            {
+                CHECK(get32(sample) == (uint32_t)frame->nal_len[k]);
+                CHECK(memcmp(sample + 4, frame->nal[k],
+                        frame->nal_len[k]) == 0);
+                sample += 4 + frame->nal_len[k];
+            }
+            CHECK(sample == sample_end);
+        }
+        CHECK(sample == p);
+    }
+
+    //mfra: the keyframe fragments, the mfro gives its size at the end
+    const unsigned char* mfra = find_box(p, end, "mfra");
+    CHECK(mfra == p && mfra + get32(mfra) == end);
+    CHECK(get32(end - 4) == get32(mfra));
+    const unsigned char* tfra = find_box(mfra + 8, end, "tfra");
+    CHECK(tfra && tfra[8] == 1 && get32(tfra + 12) == 1);
+    CHECK((int)get32(tfra + 20) == nkeyframes);
+    for (i = 0, f = first; i < nkeyframes; i++, f++)
+    {
+        const unsigned char* entry = tfra + 24 + 19 * i;
+        while (!frames[f].keyframe)
+            f++;
+        CHECK(get64(entry) == (frames[f].pts - frames[first].pts) * 9 / 100);
+        CHECK(get64(entry + 8) == keyframe_moofs[i]);
+        CHECK(entry[16] == 1 && entry[17] == 1 && entry[18] == 1);
+    }
+    const unsigned char* mfro = find_box(tfra + get32(tfra), end, "mfro");
+    CHECK(mfro && get32(mfro) == 16 && mfro + 16 == end);
+}
+
+//GOPs of 'gop' frames, 2 P frames before the first keyframe
+static int write_frames(fmp4_writer_t* mp4, frame_t* frames, int nframes,
+        int gop, const unsigned char* sps, int sps_len)
+{
+    int n;
+
+    for (n = 0; n < nframes; n++)
+    {
+        make_frame(&frames[n], n, n >= 2 && (n - 2) % gop == 0, sps,
+                sps_len);
+        CHECK(fmp4_write_frame(mp4, frames[n].data, frames[n].len,
+                frames[n].pts, frames[n].keyframe) == 0);
+    }
+    CHECK(fmp4_finish(mp4) == 0);
+
+    return n;
+}
+
+static void free_frames(frame_t* frames, int nframes)
+{
+    int n;
+
+    for (n = 0; n < nframes; n++)
+        free(frames[n].data);
+}
+
+static void test_sizes(void)
+{
+    static const int sizes[][3] = { { 66, 432, 240 }, { 100, 640, 480 },
+            { 100, 1920, 1080 }, { 66, 1280, 720 }, { 100, 720, 576 } };
+    static frame_t frames[200];
+    unsigned char sps[64];
+    fmp4_writer_t mp4;
+    unsigned i;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        int sps_len = make_sps(sps, sizes[i][0], sizes[i][1], sizes[i][2]);
+
+        file_len = 0;
+        writes = 0;
+        CHECK(fmp4_writer_init(&mp4, write_file, NULL) == 0);
+        write_frames(&mp4, frames, 200, 30, sps, sps_len);
+        CHECK(mp4.skipped == 2);
+        CHECK(mp4.width == sizes[i][1] && mp4.height == sizes[i][2]);
+        check_file(frames, 200, sizes[i][1], sizes[i][2], sps, sps_len);
+        //init segment, 2 writes per fragment, mfra
+        CHECK(writes == 1 + 2 * 7 + 1);
+        printf("%dx%d (profile %d): %d bytes, %d writes\n", sizes[i][1],
+                sizes[i][2], sizes[i][0], file_len, writes);
+
+        //a new file on the next keyframe, the same stream
+        file_len = 0;
+        writes = 0;
+        fmp4_restart(&mp4);
+        free_frames(frames, 200);
+        write_frames(&mp4, frames, 200, 30, sps, sps_len);
+        check_file(frames, 200, sizes[i][1], sizes[i][2], sps, sps_len);
+        free_frames(frames, 200);
+        fmp4_writer_deinit(&mp4);
+    }
+}
+
+//a GOP longer than FMP4_MAX_SAMPLES is cut, the second fragment has no
+//keyframe and no mfra entry
+static void test_long_gop(void)
+{
+    static frame_t frames[FMP4_MAX_SAMPLES + 102];
+    int nframes = sizeof(frames) / sizeof(frames[0]);
+    unsigned char sps[64];
+    fmp4_writer_t mp4;
+
+    int sps_len = make_sps(sps, 66, 432, 240);
+    file_len = 0;
+    writes = 0;
+    CHECK(fmp4_writer_init(&mp4, write_file, NULL) == 0);
+    write_frames(&mp4, frames, nframes, 100000, sps, sps_len);
+    check_file(frames, nframes, 432, 240, sps, sps_len);
+    CHECK(writes == 1 + 2 * 2 + 1);
+    CHECK(mp4.nindex == 1);
+    free_frames(frames, nframes);
+    fmp4_writer_deinit(&mp4);
+}
+
+//SPS with a 33 bits code: no picture size, no read past the SPS
+static void test_bad_sps(void)
+{
+    static const unsigned char bad[][17] = {
+        //Baseline, then 64 zeros for seq_parameter_set_id (with the
+        //emulation prevention bytes)
+        { 0x67, 0x42, 0x00, 0x1e, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00,
+                0x00, 0x03, 0x00, 0x00, 0x03, 0x01 },
+        //log2_max_frame_num, then nothing: read past the end
+        { 0x67, 0x42, 0x00, 0x1e, 0x80 },
+    };
+    static const int lens[] = { 17, 5 };
+    static frame_t frames[40];
+    fmp4_writer_t mp4;
+    int i;
+
+    for (i = 0; i < 2; i++)
+    {
+        file_len = 0;
+        writes = 0;
+        CHECK(fmp4_writer_init(&mp4, write_file, NULL) == 0);
+        write_frames(&mp4, frames, 40, 30, bad[i], lens[i]);
+        CHECK(mp4.width == 0 && mp4.height == 0);
+        check_file(frames, 40, 0, 0, bad[i], lens[i]);
+        free_frames(frames, 40);
+        fmp4_writer_deinit(&mp4);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    test_sizes();
+    test_long_gop();
+    test_bad_sps();
+
+    printf("test_fmp4: ok\n");
+
+    return 0;
+}
@@ -0,0 +1,153 @@
+//h264_udp_ffstream_dir/frame_queue.c: a full queue drops its oldest frame
+//and hands it back, the others come out in order with their push time,
+//close lets the encoder empty the queue then stops it. Then an OMX side
+//thread against an encoder thread slower than it: every frame comes back
+//exactly once, popped in order or dropped
+
+#include <unistd.h>
+
+#include "check.h"
+#include "../h264_udp_ffstream_dir/frame_queue.h"
+
+#define FRAMES 20000
+
+static frame_queue_t queue;
+static char frames[FRAMES];
+static int popped[FRAMES], dropped[FRAMES];
+
+static void* frame(int i)
+{
+    return &frames[i];
+}
+
+static int index_of(void* p)
+{
+    return (char*)p - frames;
+}
+
+static void test_drop_oldest(void)
+{
+    uint64_t time;
+    int i;
+
+    frame_queue_init(&queue, 2);
+    CHECK(frame_queue_push(&queue, frame(0), 100) == NULL);
+    CHECK(frame_queue_push(&queue, frame(1), 200) == NULL);
+    CHECK(frame_queue_push(&queue, frame(2), 300) == frame(0));
+    CHECK(frame_queue_pop(&queue, &time) == frame(1) && time == 200);
+    CHECK(frame_queue_pop(&queue, &time) == frame(2) && time == 300);
+    CHECK(queue.pushed == 3 && queue.dropped == 1);
+
+    //around the end of the entries, the newest frames are kept
+    for (i = 3; i < 3 * FRAME_QUEUE_MAX; i++)
+    {
+        void* old = frame_queue_push(&queue, frame(i), i);
+        CHECK(old == ((i >= 5) ? frame(i - 2) : NULL));
+    }
+    CHECK(frame_queue_pop(&queue, &time) == frame(i - 2) && time == i - 2);
+    CHECK(frame_queue_flush(&queue) == frame(i - 1));
+    CHECK(frame_queue_flush(&queue) == NULL);
+    frame_queue_deinit(&queue);
+
+    //the depth is kept within 1 .. FRAME_QUEUE_MAX
+    frame_queue_init(&queue, 0);
+    CHECK(queue.depth == 1);
+    frame_queue_deinit(&queue);
+    frame_queue_init(&queue, 100);
+    CHECK(queue.depth == FRAME_QUEUE_MAX);
+    for (i = 0; i < FRAME_QUEUE_MAX; i++)
+        CHECK(frame_queue_push(&queue, frame(i), i) == NULL);
+    CHECK(frame_queue_push(&queue, frame(i), i) == frame(0));
+    frame_queue_deinit(&queue);
+}
+
+static void* wait_pop(void* arg)
+{
+    return frame_queue_pop(&queue, NULL);
+}
+
+static void test_close(void)
+{
+    pthread_t tid;
+    void* result;
+
+    //what is queued still comes out, then NULL
+    frame_queue_init(&queue, 2);
+    frame_queue_push(&queue, frame(0), 0);
+    frame_queue_close(&queue);
+    CHECK(frame_queue_pop(&queue, NULL) == frame(0));
+    CHECK(frame_queue_pop(&queue, NULL) == NULL);
+    frame_queue_deinit(&queue);
+
+    //an encoder waiting on the empty queue is woken up
+    frame_queue_init(&queue, 2);
+    CHECK(pthread_create(&tid, NULL, wait_pop, NULL) == 0);
+    usleep(20000);
+    frame_queue_close(&queue);
+    pthread_join(tid, &result);
+    CHECK(result == NULL);
+    frame_queue_deinit(&queue);
+}
+
+static void* encoder(void* arg)
+{
+    void* p;
+    int last = -1, i = 0;
+
+    while ((p = frame_queue_pop(&queue, NULL)) != NULL)
+    {
+        int n = index_of(p);
+        CHECK(n > last); //oldest first
+        last = n;
+        popped[n]++;
+        if (++i % 4 == 0)
+            usleep(100); //slower than the camera
+    }
+
+    return NULL;
+}
+
+static void test_threads(int depth)
+{
+    pthread_t tid;
+    int i, npopped = 0, ndropped = 0;
+
+    for (i = 0; i < FRAMES; i++)
+        popped[i] = dropped[i] = 0;
+    frame_queue_init(&queue, depth);
+    CHECK(pthread_create(&tid, NULL, encoder, NULL) == 0);
+    for (i = 0; i < FRAMES; i++)
+    {
+        void* old = frame_queue_push(&queue, frame(i), i);
+        if (old)
+            dropped[index_of(old)]++;
+        if (i % 64 == 0)
+            usleep(50);
+    }
+    frame_queue_close(&queue);
+    pthread_join(tid, NULL);
+
+    for (i = 0; i < FRAMES; i++)
+    {
+        CHECK(popped[i] + dropped[i] == 1);
+        npopped += popped[i];
+        ndropped += dropped[i];
+    }
+    CHECK(queue.pushed == FRAMES && queue.dropped == ndropped);
+    CHECK(ndropped > 0); //the encoder did fall behind
+    printf("depth %d: %d encoded, %d dropped\n", depth, npopped, ndropped);
+    frame_queue_deinit(&queue);
+}
+
+int main(int argc, char** argv)
+{
+    test_drop_oldest();
+    test_close();
+    test_threads(1);
+    test_threads(2);
+    test_threads(FRAME_QUEUE_MAX);
+
+    printf("test_frame_queue: ok\n");
+
+    return 0;
+}
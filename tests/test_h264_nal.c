@@ -0,0 +1,146 @@
+//stream/h264_nal.c: h264_find_start_code() (SSE2 or NEON when built with
+//them) against h264_find_start_code_scalar() and a byte by byte reference,
+//on random buffers with 00 00 01 and 00 00 00 01 planted at every alignment
+//of the 32 bytes blocks and at the ends of the buffer, searched from every
+//position. The NAL reader is checked against the reference too
+
+#include <string.h>
+
+#include "check.h"
+#include "../stream/h264_nal.h"
+
+#define MAX_SIZE 200
+#define ROUNDS 20000
+#define ALIGNMENTS 16 //of the buffer start
+
+static unsigned seed = 1;
+
+static unsigned rnd(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+//random bytes, 'zeros' % of them 0 and a few 1 to make near misses
+static void fill(unsigned char* p, int n, int zeros)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        int r = rnd() % 100;
+        p[i] = (r < zeros) ? 0 : (r < zeros + 5) ? 1 : rnd();
+    }
+}
+
+static void plant(unsigned char* p, int n, int pos, int four)
+{
+    static const unsigned char code[] = { 0, 0, 0, 1 };
+    int len = four ? 4 : 3;
+
+    if (pos + len <= n)
+        memcpy(p + pos, code + 4 - len, len);
+}
+
+static const unsigned char* reference(const unsigned char* p,
+        const unsigned char* end)
+{
+    for (; end - p >= 3; p++)
+    {
+        if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+            return p;
+    }
+
+    return end;
+}
+
+//every start position of the buffer
+static void check_search(const unsigned char* p, int n)
+{
+    int i;
+
+    for (i = 0; i <= n; i++)
+    {
+        const unsigned char* expected = reference(p + i, p + n);
+        CHECK(h264_find_start_code_scalar(p + i, p + n) == expected);
+        CHECK(h264_find_start_code(p + i, p + n) == expected);
+    }
+}
+
+//the NAL units of the reader are the ones between the reference matches
+static void check_reader(const unsigned char* p, int n)
+{
+    const unsigned char* code = reference(p, p + n);
+    h264_nal_reader_t reader;
+    h264_nal_t nal;
+
+    h264_nal_reader_init(&reader, p, n);
+    while (code < p + n)
+    {
+        const unsigned char* start = code + 3;
+        const unsigned char* next = reference(start, p + n);
+        const unsigned char* end = next;
+        while (end > start && end[-1] == 0)
+            end--;
+        if (end > start)
+        {
+            CHECK(h264_next_nal(&reader, &nal) == 1);
+            CHECK(nal.data == start && nal.len == end - start);
+            CHECK(nal.start_code_len == ((code > p && code[-1] == 0) ? 4 : 3));
+            CHECK(nal.last == (next == p + n));
+        }
+        code = next;
+    }
+    CHECK(h264_next_nal(&reader, &nal) == 0);
+}
+
+int main(int argc, char** argv)
+{
+    static unsigned char buffer[MAX_SIZE + ALIGNMENTS];
+    long searches = 0;
+    int round, n, pos, four;
+
+    //one start code at each position of buffers of every size, the last
+    //ones ending on the end of the buffer or cut by it
+    for (n = 0; n <= 3 * 32 + 2; n++)
+    {
+        for (pos = 0; pos < n; pos++)
+        {
+            for (four = 0; four < 2; four++)
+            {
+                unsigned char* p = buffer + (pos % ALIGNMENTS);
+                memset(p, 0xff, n);
+                plant(p, n, pos, four);
+                //a cut start code: 00 or 00 00 at the end
+                if (pos + 3 > n)
+                    memset(p + pos, 0, n - pos);
+                check_search(p, n);
+                check_reader(p, n);
+                searches += n + 1;
+            }
+        }
+    }
+
+    //random data, from no zero to mostly zeros, with several start codes
+    for (round = 0; round < ROUNDS; round++)
+    {
+        unsigned char* p = buffer + round % ALIGNMENTS;
+        int codes = rnd() % 5;
+
+        n = rnd() % (MAX_SIZE + 1);
+        fill(p, n, (int[]){ 0, 2, 20, 50, 90 }[round % 5]);
+        while (codes-- > 0 && n > 0)
+            plant(p, n, rnd() % n, rnd() & 1);
+        //a start code right at the end half of the time
+        if ((round & 1) && n >= 4)
+            plant(p, n, n - 3 - (rnd() & 1), rnd() & 1);
+        check_search(p, n);
+        check_reader(p, n);
+        searches += n + 1;
+    }
+
+    printf("%ld searches, the same as the reference\n", searches);
+    printf("test_h264_nal: ok\n");
+
+    return 0;
+}
@@ -0,0 +1,328 @@
+//stream/h264_params.c: the SPS/PPS kept from the encoder output, the fmtp
+//of the SDP (base64 of every padding), the Annex-B copy, and
+//h264_params_inject() on a minute of frames: only IDRs get the copy, a
+//frame with its own SPS counts as one, h264_params_resend() (a viewer
+//joins) gives it to the next IDR inside the repeat interval, and the
+//repeat interval. The frames then go through the packetizer, with the
+//SPS/PPS in every frame and from the cache: the packets and bytes saved in
+//a minute, the figures of stream.md (h264_params)
+
+#include <string.h>
+
+#include "check.h"
+#include "../stream/h264_params.h"
+#include "../stream/rtp.h"
+
+#define FRAME_TIME 33333 //us, 30fps
+#define MINUTE 60000000  //us
+#define SLICE_SIZE 1000
+#define IP_UDP_HEADERS 28
+
+//the size of the libx264 ones of the preview (33 bytes with start codes)
+static const unsigned char sps[] = { 0x67, 0x42, 0xc0, 0x15, 0xda, 0x06,
+        0xc1, 0xef, 0x2e, 0x02, 0x20, 0, 0, 3, 0, 0x20, 0, 0, 7, 0xa4 };
+static const unsigned char pps[] = { 0x68, 0xce, 0x0f, 0x2c, 0x80 };
+
+//SPS + PPS + IDR or a P slice, as the encoder gives them
+static int make_frame(unsigned char* out, int idr, int headers)
+{
+    int n = 0;
+    int i;
+
+    if (headers)
+    {
+        memcpy(out + n, "\0\0\0\1", 4);
+        memcpy(out + n + 4, sps, sizeof(sps));
+        n += 4 + sizeof(sps);
+        memcpy(out + n, "\0\0\0\1", 4);
+        memcpy(out + n + 4, pps, sizeof(pps));
+        n += 4 + sizeof(pps);
+    }
+    memcpy(out + n, idr ? "\0\0\0\1\x65" : "\0\0\0\1\x41", 5);
+    n += 5;
+    for (i = 0; i < SLICE_SIZE; i++)
+        out[n++] = 0x80 | i;
+
+    return n;
+}
+
+static void test_update_fmtp(void)
+{
+    static const char* expected[] = { "Z0LAHg==", "Z0LAHvA=", "Z0LAHvDx" };
+    unsigned char frame[2048];
+    char fmtp[256];
+    h264_params_t params;
+    int k;
+
+    h264_params_init(&params);
+    CHECK(h264_params_fmtp(&params, fmtp, sizeof(fmtp)) == 0);
+    CHECK(h264_params_annexb(&params, frame, sizeof(frame)) == 0);
+
+    //SPS of 4 to 6 bytes: base64 with 2, 1 and 0 '='
+    for (k = 0; k < 3; k++)
+    {
+        static const unsigned char sps_end[] = { 0xf0, 0xf1 };
+        static const unsigned char pps_nal[] = { 0, 0, 0, 1, 0x68, 0xce,
+                0x3c, 0x80 };
+        unsigned char buffer[64] = { 0, 0, 0, 1, 0x67, 0x42, 0xc0, 0x1e };
+        char want[128];
+
+        memcpy(buffer + 8, sps_end, k);
+        memcpy(buffer + 8 + k, pps_nal, sizeof(pps_nal));
+        h264_params_update(&params, buffer, 8 + k + sizeof(pps_nal));
+        CHECK(params.sps_len == 4 + k && params.pps_len == 4);
+        snprintf(want, sizeof(want),
+                "profile-level-id=42C01E;sprop-parameter-sets=%s,aM48gA==",
+                expected[k]);
+        CHECK(h264_params_fmtp(&params, fmtp, sizeof(fmtp))
+                == (int)strlen(want));
+        CHECK(strcmp(fmtp, want) == 0);
+    }
+
+    //the SPS/PPS of a frame, the slice is left out
+    int len = make_frame(frame, 1, 1);
+    h264_params_update(&params, frame, len);
+    CHECK(params.sps_len == sizeof(sps) && memcmp(params.sps, sps,
+            sizeof(sps)) == 0);
+    CHECK(params.pps_len == sizeof(pps) && memcmp(params.pps, pps,
+            sizeof(pps)) == 0);
+    CHECK(h264_params_fmtp(&params, fmtp, sizeof(fmtp)) > 0);
+    CHECK(strcmp(fmtp, "profile-level-id=42C015;sprop-parameter-sets="
+            "Z0LAFdoGwe8uAiAAAAMAIAAAB6Q=,aM4PLIA=") == 0);
+    CHECK(h264_params_fmtp(&params, fmtp, 40) == 0); //no room
+
+    //a P frame changes nothing
+    len = make_frame(frame, 0, 0);
+    h264_params_update(&params, frame, len);
+    CHECK(params.sps_len == sizeof(sps) && params.pps_len == sizeof(pps));
+
+    //the copy is the headers of the frame, byte for byte
+    unsigned char copy[64];
+    int n = h264_params_annexb(&params, copy, sizeof(copy));
+    CHECK(n == 8 + (int)sizeof(sps) + (int)sizeof(pps) && n == 33);
+    len = make_frame(frame, 1, 1);
+    CHECK(memcmp(copy, frame, n) == 0);
+    CHECK(h264_params_skip(frame, len) == n);
+    CHECK(h264_params_skip(frame + n, len - n) == 0);
+    CHECK(h264_params_annexb(&params, copy, n - 1) == 0);
+
+    h264_params_deinit(&params);
+}
+
+//copies of a minute of h264_params_inject(): an IDR every 'idr' frames,
+//the headers in band or not, a viewer joins every 'join_every' us
+static int copies(uint64_t repeat, int frame_time, int idr, int in_band,
+        uint64_t join_every)
+{
+    unsigned char frame[2048];
+    unsigned char out[64];
+    h264_params_t params;
+    uint64_t next_join = join_every;
+    int count = 0;
+    int i;
+
+    h264_params_init(&params);
+    params.repeat = repeat;
+    make_frame(frame, 1, 1);
+    h264_params_update(&params, frame, 33);
+
+    //the frames of a minute, as many as its frame times
+    for (i = 0; i < MINUTE / frame_time; i++)
+    {
+        uint64_t now = (uint64_t)i * frame_time;
+        int is_idr = (i % idr == 0);
+        int len = make_frame(frame, is_idr, is_idr && in_band);
+
+        if (join_every && now >= next_join)
+        {
+            h264_params_resend(&params);
+            next_join += join_every;
+        }
+        int n = h264_params_inject(&params, frame, len, now, out,
+                sizeof(out));
+        CHECK(n == 0 || n == 33);
+        CHECK(!in_band || n == 0);
+        if (n > 0 || (in_band && is_idr))
+            count++;
+        //the sent time moves with every copy, in band too
+        if (n > 0 || (in_band && is_idr))
+            CHECK(params.sent == now && params.resend == 0);
+        else
+            CHECK(params.sent < now || now == 0);
+    }
+    h264_params_deinit(&params);
+
+    return count;
+}
+
+static void test_inject(void)
+{
+    unsigned char frame[2048];
+    unsigned char out[64];
+    h264_params_t params;
+
+    h264_params_init(&params);
+    params.repeat = 1000000;
+
+    //no SPS/PPS seen yet: nothing to send, the first IDR still waits
+    int len = make_frame(frame, 1, 0);
+    CHECK(h264_params_inject(&params, frame, len, 0, out, sizeof(out)) == 0);
+    CHECK(params.resend == 1);
+    make_frame(frame, 1, 1);
+    h264_params_update(&params, frame, 33);
+
+    //P frames never get it, the first IDR does
+    len = make_frame(frame, 0, 0);
+    CHECK(h264_params_inject(&params, frame, len, 1000, out,
+            sizeof(out)) == 0);
+    len = make_frame(frame, 1, 0);
+    CHECK(h264_params_inject(&params, frame, len, 2000, out,
+            sizeof(out)) == 33);
+    CHECK(h264_params_inject(&params, frame, len, 3000, out,
+            sizeof(out)) == 0);
+
+    //a viewer joins: the next IDR, not the P frame before it
+    h264_params_resend(&params);
+    len = make_frame(frame, 0, 0);
+    CHECK(h264_params_inject(&params, frame, len, 4000, out,
+            sizeof(out)) == 0);
+    len = make_frame(frame, 1, 0);
+    CHECK(h264_params_inject(&params, frame, len, 5000, out,
+            sizeof(out)) == 33);
+
+    //in band: nothing added, and the frame counts as a copy
+    h264_params_resend(&params);
+    len = make_frame(frame, 1, 1);
+    CHECK(h264_params_inject(&params, frame, len, 6000, out,
+            sizeof(out)) == 0);
+    CHECK(params.resend == 0 && params.sent == 6000);
+
+    //the repeat interval from the last copy
+    len = make_frame(frame, 1, 0);
+    CHECK(h264_params_inject(&params, frame, len, 1005999, out,
+            sizeof(out)) == 0);
+    CHECK(h264_params_inject(&params, frame, len, 1006000, out,
+            sizeof(out)) == 33);
+    h264_params_deinit(&params);
+
+    //a minute at 30fps, every frame an IDR: the first frame then every 31
+    //(30 frames are 999990us)
+    CHECK(copies(1000000, FRAME_TIME, 1, 0, 0) == 59);
+    CHECK(copies(0, FRAME_TIME, 1, 0, 0) == 1800);
+    CHECK(copies(1000000, FRAME_TIME, 1, 1, 0) == 1800);
+    CHECK(copies(1000000, FRAME_TIME, 1, 0, 10000000) == 60);
+    CHECK(copies(1000000, 3 * FRAME_TIME, 1, 0, 0) == 55);
+    CHECK(copies(0, FRAME_TIME, 30, 0, 0) == 60);
+}
+
+/*---------------------------------------------------------------------
+   packets and bytes of a minute through the packetizer
+----------------------------------------------------------------------*/
+
+typedef struct
+{
+    int packets;
+    long bytes; //with the IP/UDP headers
+} count_t;
+
+static int count_packet(void* arg, const unsigned char* packet, int len)
+{
+    count_t* c = (count_t*)arg;
+
+    c->packets++;
+    c->bytes += len + IP_UDP_HEADERS;
+
+    return 0;
+}
+
+//GOP 1: the headers in every frame, or the frames without them and the
+//copies of the cache
+static count_t minute(int cache, uint64_t repeat, int frame_time,
+        uint64_t join_every)
+{
+    unsigned char frame[2048];
+    unsigned char out[64];
+    rtp_packetizer_t rtp;
+    h264_params_t params;
+    count_t c = { 0, 0 };
+    uint64_t next_join = join_every;
+    int i;
+
+    rtp_packetizer_init(&rtp, RTP_DEFAULT_MTU, 1, count_packet, &c);
+    h264_params_init(&params);
+    params.repeat = repeat;
+    for (i = 0; i < MINUTE / frame_time; i++)
+    {
+        uint64_t now = (uint64_t)i * frame_time;
+        int len = make_frame(frame, 1, 1);
+        uint32_t ts = rtp_timestamp(now);
+
+        if (!cache)
+        {
+            CHECK(rtp_send_frame(&rtp, frame, len, ts, 1) == 0);
+            continue;
+        }
+
+        h264_params_update(&params, frame, len);
+        if (join_every && now >= next_join)
+        {
+            h264_params_resend(&params);
+            next_join += join_every;
+        }
+        int skip = h264_params_skip(frame, len);
+        int n = h264_params_inject(&params, frame + skip, len - skip, now,
+                out, sizeof(out));
+        if (n > 0)
+            CHECK(rtp_send_frame(&rtp, out, n, ts, 0) == 0);
+        CHECK(rtp_send_frame(&rtp, frame + skip, len - skip, ts, 1) == 0);
+    }
+    h264_params_deinit(&params);
+
+    return c;
+}
+
+static void test_saved(void)
+{
+    static const struct
+    {
+        const char* name;
+        uint64_t repeat;
+        int frame_time;
+        uint64_t join_every;
+        int packets; //saved in a minute
+        long bytes;
+    } rows[] = {
+        { "30 fps, repeat 1s", 1000000, FRAME_TIME, 0, 1741, 121870 },
+        { "30 fps, repeat 1s, a viewer joins every 10s", 1000000,
+                FRAME_TIME, 10000000, 1740, 121800 },
+        { "10 fps, repeat 1s", 1000000, 3 * FRAME_TIME, 0, 545, 38150 },
+    };
+    unsigned i;
+
+    for (i = 0; i < sizeof(rows) / sizeof(rows[0]); i++)
+    {
+        count_t every = minute(0, 0, rows[i].frame_time, 0);
+        count_t cached = minute(1, rows[i].repeat, rows[i].frame_time,
+                rows[i].join_every);
+
+        //a copy is a STAP-A of its own: 70 bytes with the RTP/UDP/IP headers
+        printf("%s: %d packets, %ld bytes saved a minute (%.1f kbit/s)\n",
+                rows[i].name, every.packets - cached.packets,
+                every.bytes - cached.bytes,
+                (every.bytes - cached.bytes) * 8 / 60.0 / 1000);
+        CHECK(every.packets - cached.packets == rows[i].packets);
+        CHECK(every.bytes - cached.bytes == rows[i].bytes);
+        CHECK(rows[i].bytes == rows[i].packets * 70L);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    test_update_fmtp();
+    test_inject();
+    test_saved();
+
+    printf("test_h264_params: ok\n");
+
+    return 0;
+}
@@ -0,0 +1,297 @@
+//record/preroll.c: the placement of the frames in the ring (at the end,
+//wrapped to the beginning, in the hole before the oldest frame), the GOPs
+//dropped for the seconds kept, the PREROLL_MAX_FRAMES limit, flushes given
+//in parts with frames added in between, and random streams with the ring
+//checked after every call: frames whole, in order and apart, the byte
+//count, a keyframe first
+
+#include <string.h>
+
+#include "check.h"
+#include "../record/preroll.h"
+
+#define FRAME_TIME 40000 //us, 25fps
+
+static unsigned seed = 1;
+
+static unsigned rnd(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+//frame 'n' of 'len' bytes: its number and a pattern of it
+static void make_frame(unsigned char* data, int n, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++)
+        data[i] = n * 13 + i;
+    if (len >= (int)sizeof(n))
+        memcpy(data, &n, sizeof(n));
+}
+
+static void add(preroll_t* pr, int n, int len, int keyframe)
+{
+    static unsigned char data[1 << 20];
+
+    CHECK(len <= (int)sizeof(data));
+    make_frame(data, n, len);
+    preroll_add(pr, data, len, (uint64_t)n * FRAME_TIME, keyframe);
+}
+
+static preroll_frame_t* frame(preroll_t* pr, unsigned i)
+{
+    return &pr->frames[i % PREROLL_MAX_FRAMES];
+}
+
+//the frames of the ring apart and intact, numbered by their pts, in order;
+//'flushing' : a flush has given the first part, no keyframe first
+static void check_ring(preroll_t* pr, int flushing)
+{
+    static unsigned char data[1 << 20];
+    unsigned i, j;
+    int bytes = 0;
+
+    CHECK(pr->head - pr->tail <= PREROLL_MAX_FRAMES);
+    if (pr->tail != pr->head && !flushing)
+        CHECK(frame(pr, pr->tail)->keyframe);
+    for (i = pr->tail; i != pr->head; i++)
+    {
+        preroll_frame_t* f = frame(pr, i);
+        int n = f->pts / FRAME_TIME;
+
+        CHECK(f->offset >= 0 && f->len > 0 && f->offset + f->len <= pr->size);
+        CHECK(i == pr->tail || f->pts > frame(pr, i - 1)->pts);
+        make_frame(data, n, f->len);
+        CHECK(memcmp(pr->ring + f->offset, data, f->len) == 0);
+        bytes += f->len;
+
+        //the next ones by offset are after it or before the previous one
+        for (j = i + 1; j != pr->head; j++)
+        {
+            preroll_frame_t* g = frame(pr, j);
+            CHECK(g->offset >= f->offset + f->len
+                    || g->offset + g->len <= f->offset);
+        }
+    }
+    CHECK(bytes == pr->bytes);
+}
+
+typedef struct
+{
+    int frames;
+    int last; //number of the last frame given
+    int keyframes;
+    int fail_at; //return -1 on this frame
+} flushed_t;
+
+static int flushed(void* arg, const unsigned char* data, int len,
+        uint64_t pts, int keyframe)
+{
+    static unsigned char expected[1 << 20];
+    flushed_t* fl = (flushed_t*)arg;
+    int n = pts / FRAME_TIME;
+
+    CHECK(n > fl->last);
+    make_frame(expected, n, len);
+    CHECK(memcmp(data, expected, len) == 0);
+    fl->last = n;
+    fl->frames++;
+    fl->keyframes += keyframe;
+
+    return (fl->frames == fl->fail_at) ? -1 : 0;
+}
+
+//1000 bytes: the frames go at the end, then at the beginning once the
+//oldest GOP is out, then between the newest and the oldest frame
+static void test_placement(void)
+{
+    preroll_t pr;
+
+    CHECK(preroll_init(&pr, 1000, 3600) == 0);
+
+    //frames before the first keyframe, and frames bigger than the ring
+    add(&pr, 0, 100, 0);
+    add(&pr, 1, 1001, 1);
+    CHECK(preroll_frames(&pr) == 0 && pr.frames_skipped == 2);
+
+    add(&pr, 2, 300, 1);
+    add(&pr, 3, 300, 0);
+    add(&pr, 4, 300, 1);
+    CHECK(frame(&pr, pr.head - 1)->offset == 600);
+
+    //no room at the end: the first GOP is dropped, the frame wraps to 0
+    add(&pr, 5, 300, 0);
+    CHECK(pr.gops_dropped == 1 && preroll_frames(&pr) == 2);
+    CHECK(frame(&pr, pr.head - 1)->offset == 0);
+    CHECK(preroll_first_pts(&pr) == 4 * FRAME_TIME);
+
+    //in the hole between the newest frame and the oldest one
+    add(&pr, 6, 250, 0);
+    CHECK(frame(&pr, pr.head - 1)->offset == 300);
+    add(&pr, 7, 50, 0);
+    CHECK(frame(&pr, pr.head - 1)->offset == 550);
+    CHECK(pr.bytes == 900);
+    check_ring(&pr, 0);
+
+    //one byte too many: the only GOP goes, a P frame cannot start the ring
+    add(&pr, 8, 101, 0);
+    CHECK(preroll_frames(&pr) == 0 && pr.gops_dropped == 2);
+    CHECK(pr.frames_skipped == 3);
+
+    //a keyframe starts it again at 0
+    add(&pr, 9, 1000, 1);
+    CHECK(frame(&pr, pr.head - 1)->offset == 0 && pr.bytes == 1000);
+    check_ring(&pr, 0);
+
+    preroll_deinit(&pr);
+}
+
+//2s kept at 25fps with GOPs of 10 frames (0.4s): the ring holds from 2s
+//to 2.4s once 2s are in, the oldest GOP goes when the next one starts 2s
+//back
+static void test_seconds(void)
+{
+    preroll_t pr;
+    int n;
+
+    CHECK(preroll_init(&pr, 1 << 20, 2) == 0);
+    for (n = 0; n < 1000; n++)
+    {
+        add(&pr, n, 100, n % 10 == 0);
+        uint64_t span = (uint64_t)n * FRAME_TIME - preroll_first_pts(&pr);
+        if (n >= 50)
+            CHECK(span >= 2000000 && span < 2400000);
+        else
+            CHECK(preroll_first_pts(&pr) == 0);
+        CHECK(preroll_first_pts(&pr) % (10 * FRAME_TIME) == 0);
+    }
+    //the GOP of frame 50 went out at frame 60
+    CHECK(pr.gops_dropped == 94 && pr.frames_skipped == 0);
+    check_ring(&pr, 0);
+
+    preroll_deinit(&pr);
+}
+
+//more frames than PREROLL_MAX_FRAMES, in GOPs of 100: a GOP goes when the
+//table is full, whatever the room and the seconds
+static void test_max_frames(void)
+{
+    preroll_t pr;
+    int n;
+
+    CHECK(preroll_init(&pr, 1 << 20, 3600) == 0);
+    for (n = 0; n < 3 * PREROLL_MAX_FRAMES; n++)
+    {
+        add(&pr, n, 8, n % 100 == 0);
+        CHECK(preroll_frames(&pr) <= PREROLL_MAX_FRAMES);
+        if (n >= PREROLL_MAX_FRAMES)
+            CHECK(preroll_frames(&pr) > PREROLL_MAX_FRAMES - 100);
+    }
+    CHECK(pr.gops_dropped > 0 && pr.frames_skipped == 0);
+    CHECK(preroll_first_pts(&pr) % (100 * FRAME_TIME) == 0);
+    check_ring(&pr, 0);
+
+    //the frames come out in order across the end of the table
+    flushed_t fl = { 0, -1, 0, 0 };
+    int frames = preroll_frames(&pr);
+    CHECK(preroll_flush(&pr, 1 << 30, flushed, &fl) == 0);
+    CHECK(fl.frames == frames && fl.last == n - 1);
+    CHECK(preroll_frames(&pr) == 0 && pr.bytes == 0);
+
+    preroll_deinit(&pr);
+}
+
+//a flush in parts, frames added in between: the rest comes next time, in
+//order, and the frames added go after it
+static void test_partial_flush(void)
+{
+    preroll_t pr;
+    int n;
+
+    CHECK(preroll_init(&pr, 1 << 20, 3600) == 0);
+    for (n = 0; n < 100; n++)
+        add(&pr, n, 1000, n % 25 == 0);
+
+    //nothing fits
+    flushed_t fl = { 0, -1, 0, 0 };
+    CHECK(preroll_flush(&pr, 999, flushed, &fl) == 0);
+    CHECK(fl.frames == 0 && preroll_frames(&pr) == 100);
+
+    //30 frames, the ring now starts on a P frame
+    CHECK(preroll_flush(&pr, 30500, flushed, &fl) == 0);
+    CHECK(fl.frames == 30 && fl.last == 29 && fl.keyframes == 2);
+    CHECK(preroll_frames(&pr) == 70 && pr.bytes == 70000);
+    CHECK(preroll_first_pts(&pr) == 30 * FRAME_TIME);
+    check_ring(&pr, 1);
+
+    //the encoder goes on meanwhile
+    for (; n < 120; n++)
+    {
+        add(&pr, n, 1000, n % 25 == 0);
+        check_ring(&pr, 1);
+    }
+    CHECK(preroll_flush(&pr, 40000, flushed, &fl) == 0);
+    CHECK(fl.frames == 70 && fl.last == 69);
+    CHECK(preroll_flush(&pr, 1 << 30, flushed, &fl) == 0);
+    CHECK(fl.frames == 120 && fl.last == 119 && preroll_frames(&pr) == 0);
+
+    //out failing stops the flush and drops the rest; the empty ring starts
+    //again at the keyframe 125
+    for (; n < 150; n++)
+        add(&pr, n, 1000, n % 25 == 0);
+    CHECK(pr.frames_skipped == 5 && preroll_first_pts(&pr) == 125 * FRAME_TIME);
+    fl.fail_at = fl.frames + 5;
+    CHECK(preroll_flush(&pr, 1 << 30, flushed, &fl) == -1);
+    CHECK(fl.last == 129 && preroll_frames(&pr) == 0 && pr.bytes == 0);
+
+    preroll_deinit(&pr);
+}
+
+//random streams: frames of 1 byte to a third of the ring, GOPs of 1 to
+//60 frames, 5s kept, flushes in parts now and then
+static void test_random(void)
+{
+    preroll_t pr;
+    flushed_t fl = { 0, -1, 0, 0 };
+    int flushing = 0;
+    int n;
+
+    CHECK(preroll_init(&pr, 300000, 5) == 0);
+    for (n = 0; n < 200000; n++)
+    {
+        int keyframe = (rnd() % 30 == 0);
+        int len = 1 + rnd() % ((rnd() % 20 == 0) ? 100000 : 5000);
+
+        add(&pr, n, len, keyframe);
+        if (rnd() % 500 == 0)
+        {
+            CHECK(preroll_flush(&pr, rnd() % 200000, flushed, &fl) == 0);
+            flushing = (preroll_frames(&pr) > 0);
+        }
+        //a GOP dropped from the front ends the part not given yet
+        if (flushing && pr.tail != pr.head && frame(&pr, pr.tail)->keyframe)
+            flushing = 0;
+        if (n % 97 == 0)
+            check_ring(&pr, flushing);
+    }
+    check_ring(&pr, flushing);
+    printf("random: %u GOPs dropped, %u frames skipped, %d frames flushed\n",
+            pr.gops_dropped, pr.frames_skipped, fl.frames);
+
+    preroll_deinit(&pr);
+}
+
+int main(int argc, char** argv)
+{
+    test_placement();
+    test_seconds();
+    test_max_frames();
+    test_partial_flush();
+    test_random();
+
+    printf("test_preroll: ok\n");
+
+    return 0;
+}
@@ -0,0 +1,313 @@
+//stream/rtp.c against a reference RFC 6184 depacketizer written from the
+//RFC: random access units (SPS, PPS, slices of every size around the MTU,
+//3 and 4 bytes start codes) at several MTUs must come back NAL unit by
+//NAL unit, in valid RTP packets
+
+#include <string.h>
+
+#include "check.h"
+#include "../stream/rtp.h"
+
+#define MAX_NALS 16
+#define MAX_NAL_SIZE 40000
+#define SSRC 0x12345678
+
+typedef struct
+{
+    unsigned char data[MAX_NAL_SIZE];
+    int len;
+} nal_t;
+
+//what the packetizer was given
+static nal_t sent[MAX_NALS];
+static int nsent;
+
+//what the depacketizer rebuilt
+static nal_t received[MAX_NALS];
+static int nreceived;
+
+//state of the depacketizer
+static int mtu;
+static int first_packet;
+static uint16_t next_seq;
+static uint32_t frame_timestamp;
+static int marker_seen;
+static nal_t fu; //FU-A being reassembled
+static int in_fu;
+static int stap_count, fu_count, single_count, packet_count;
+static int fail_after; //make the send fail after n packets, -1 : never
+
+static void receive_nal(const unsigned char* data, int len)
+{
+    CHECK(nreceived < MAX_NALS);
+    CHECK(len > 0 && len <= MAX_NAL_SIZE);
+    memcpy(received[nreceived].data, data, len);
+    received[nreceived].len = len;
+    nreceived++;
+}
+
+static int depacketize(void* arg, const unsigned char* packet, int len)
+{
+    if (fail_after == 0)
+        return -1;
+    if (fail_after > 0)
+        fail_after--;
+
+    CHECK(len > RTP_HEADER_SIZE && len <= mtu);
+    CHECK(packet[0] == 0x80); //V=2, no P, no X, no CC
+    CHECK((packet[1] & 0x7f) == RTP_H264_PAYLOAD_TYPE);
+    CHECK(!marker_seen); //nothing after the marker of the frame
+
+    uint16_t seq = (packet[2] << 8) | packet[3];
+    uint32_t timestamp = ((uint32_t)packet[4] << 24) | (packet[5] << 16)
+            | (packet[6] << 8) | packet[7];
+    uint32_t ssrc = ((uint32_t)packet[8] << 24) | (packet[9] << 16)
+            | (packet[10] << 8) | packet[11];
+    CHECK(ssrc == SSRC);
+    if (!first_packet)
+        CHECK(seq == next_seq);
+    first_packet = 0;
+    next_seq = seq + 1;
+    CHECK(timestamp == frame_timestamp);
+    marker_seen = packet[1] >> 7;
+    packet_count++;
+
+    const unsigned char* payload = packet + RTP_HEADER_SIZE;
+    int payload_len = len - RTP_HEADER_SIZE;
+    int type = payload[0] & 0x1f;
+
+    CHECK(!(payload[0] & 0x80)); //forbidden_zero_bit
+    if (type == NAL_TYPE_STAP_A)
+    {
+        int offset = 1, count = 0, nri = 0;
+        CHECK(!in_fu);
+        while (offset < payload_len)
+        {
+            CHECK(offset + 2 <= payload_len);
+            int size = (payload[offset] << 8) | payload[offset + 1];
+            CHECK(size > 0 && offset + 2 + size <= payload_len);
+            if ((payload[offset + 2] & 0x60) > nri)
+                nri = payload[offset + 2] & 0x60;
+            receive_nal(payload + offset + 2, size);
+            offset += 2 + size;
+            count++;
+        }
+        //a single NAL unit is not aggregated
+        CHECK(count >= 2);
+        CHECK((payload[0] & 0x60) == nri);
+        stap_count++;
+    }
+    else if (type == NAL_TYPE_FU_A)
+    {
+        CHECK(payload_len > 2);
+        int start = payload[1] & 0x80;
+        int end = payload[1] & 0x40;
+        CHECK(!(start && end)); //a NAL unit that fits goes alone
+        CHECK(!(payload[1] & 0x20)); //R
+        if (start)
+        {
+            CHECK(!in_fu);
+            in_fu = 1;
+            fu.data[0] = (payload[0] & 0xe0) | (payload[1] & 0x1f);
+            fu.len = 1;
+        }
+        else
+        {
+            CHECK(in_fu);
+            CHECK(fu.data[0] == ((payload[0] & 0xe0) | (payload[1] & 0x1f)));
+        }
+        CHECK(fu.len + payload_len - 2 <= MAX_NAL_SIZE);
+        memcpy(fu.data + fu.len, payload + 2, payload_len - 2);
+        fu.len += payload_len - 2;
+        //the marker can only be on the last fragment
+        if (marker_seen)
+            CHECK(end);
+        if (end)
+        {
+            in_fu = 0;
+            receive_nal(fu.data, fu.len);
+            fu_count++;
+        }
+    }
+    else
+    {
+        CHECK(type >= 1 && type <= 23);
+        CHECK(!in_fu);
+        receive_nal(payload, payload_len);
+        single_count++;
+    }
+
+    return 0;
+}
+
+//random NAL unit with no start code or trailing zero inside
+static void make_nal(nal_t* nal, int type, int nri, int len, unsigned* seed)
+{
+    int i;
+
+    nal->data[0] = (nri << 5) | type;
+    for (i = 1; i < len; i++)
+    {
+        unsigned char b = rand_r(seed);
+        //00 00 0x would be an emulation prevention case, not a payload
+        if (b < 4 && i >= 2 && nal->data[i - 1] == 0 && nal->data[i - 2] == 0)
+            b = 0x80;
+        nal->data[i] = b;
+    }
+    if (nal->data[len - 1] == 0)
+        nal->data[len - 1] = 0x80;
+    nal->len = len;
+}
+
+//the access unit of sent[] as the encoder writes it, offsets[i] : start
+//code of sent[i]
+static int annex_b(unsigned char* out, int* offsets, unsigned* seed)
+{
+    int i, len = 0;
+
+    for (i = 0; i < nsent; i++)
+    {
+        offsets[i] = len;
+        if (rand_r(seed) & 1)
+            out[len++] = 0;
+        out[len++] = 0;
+        out[len++] = 0;
+        out[len++] = 1;
+        memcpy(out + len, sent[i].data, sent[i].len);
+        len += sent[i].len;
+    }
+
+    return len;
+}
+
+static void begin_frame(uint32_t timestamp)
+{
+    nreceived = 0;
+    marker_seen = 0;
+    frame_timestamp = timestamp;
+}
+
+static void check_frame(void)
+{
+    int i;
+
+    CHECK(marker_seen);
+    CHECK(!in_fu);
+    CHECK(nreceived == nsent);
+    for (i = 0; i < nsent; i++)
+    {
+        CHECK(received[i].len == sent[i].len);
+        CHECK(!memcmp(received[i].data, sent[i].data, sent[i].len));
+    }
+}
+
+//random access units, the slices around the single NAL / FU-A limit
+static void test_round_trip(int test_mtu, int frames)
+{
+    static unsigned char buffer[MAX_NALS * (MAX_NAL_SIZE + 4)];
+    int offsets[MAX_NALS];
+    rtp_packetizer_t rtp;
+    unsigned seed = test_mtu;
+    int frame, i;
+
+    mtu = test_mtu;
+    first_packet = 1;
+    fail_after = -1;
+    in_fu = 0;
+    rtp_packetizer_init(&rtp, mtu, SSRC, depacketize, NULL);
+
+    for (frame = 0; frame < frames; frame++)
+    {
+        int limit = mtu - RTP_HEADER_SIZE; //biggest single NAL unit
+        nsent = 0;
+        if (frame % 10 == 0)
+        {
+            make_nal(&sent[nsent++], NAL_TYPE_SPS, 3, 4 + rand_r(&seed) % 30,
+                    &seed);
+            make_nal(&sent[nsent++], NAL_TYPE_PPS, 3, 2 + rand_r(&seed) % 8,
+                    &seed);
+        }
+        else if (frame % 10 == 5)
+            //a lone PPS goes as a single NAL unit packet
+            make_nal(&sent[nsent++], NAL_TYPE_PPS, 3, 4, &seed);
+
+        int slices = 1 + rand_r(&seed) % 3;
+        for (i = 0; i < slices; i++)
+        {
+            int len;
+            switch (rand_r(&seed) % 4)
+            {
+            case 0:
+                len = 1 + rand_r(&seed) % limit;
+                break;
+            case 1: //around the limit and the FU-A fragment boundaries
+                len = limit - 2 + rand_r(&seed) % 5;
+                if (rand_r(&seed) & 1)
+                    len += (limit - 2) * (1 + rand_r(&seed) % 3);
+                break;
+            default:
+                len = 1 + rand_r(&seed) % (MAX_NAL_SIZE - 1);
+                break;
+            }
+            make_nal(&sent[nsent++], (frame % 10) ? NAL_TYPE_SLICE
+                    : NAL_TYPE_IDR, 2 + (frame % 10 == 0), len, &seed);
+        }
+
+        uint32_t timestamp = rtp_timestamp(frame * 33333ULL);
+        begin_frame(timestamp);
+        int len = annex_b(buffer, offsets, &seed);
+        //the encoder can give the SPS/PPS in a buffer of their own
+        if (frame % 10 == 0 && (frame / 10) & 1)
+        {
+            int params = offsets[2];
+            CHECK(rtp_send_frame(&rtp, buffer, params, timestamp, 0) == 0);
+            CHECK(rtp_send_frame(&rtp, buffer + params, len - params,
+                    timestamp, 1) == 0);
+        }
+        else
+            CHECK(rtp_send_frame(&rtp, buffer, len, timestamp, 1) == 0);
+        check_frame();
+    }
+    CHECK(stap_count > 0 && fu_count > 0 && single_count > 0);
+    CHECK(rtp.packet_count == (uint32_t)packet_count);
+}
+
+//a failed send is reported
+static void test_send_error(void)
+{
+    static unsigned char buffer[MAX_NAL_SIZE + 4];
+    int offsets[1];
+    rtp_packetizer_t rtp;
+    unsigned seed = 1;
+
+    mtu = RTP_DEFAULT_MTU;
+    first_packet = 1;
+    in_fu = 0;
+    rtp_packetizer_init(&rtp, mtu, SSRC, depacketize, NULL);
+
+    nsent = 1;
+    make_nal(&sent[0], NAL_TYPE_IDR, 3, 10000, &seed);
+    begin_frame(0);
+    fail_after = 3; //in the middle of the FU-A
+    CHECK(rtp_send_frame(&rtp, buffer, annex_b(buffer, offsets, &seed), 0,
+            1) == -1);
+}
+
+int main(int argc, char** argv)
+{
+    int mtus[] = { 100, 576, RTP_DEFAULT_MTU, RTP_MAX_MTU };
+    unsigned i;
+
+    for (i = 0; i < sizeof(mtus) / sizeof(mtus[0]); i++)
+    {
+        stap_count = fu_count = single_count = packet_count = 0;
+        test_round_trip(mtus[i], 400);
+        printf("mtu %4d: %d single, %d STAP-A, %d FU-A\n", mtus[i],
+                single_count, stap_count, fu_count);
+    }
+    test_send_error();
+
+    printf("test_rtp: ok\n");
+
+    return 0;
+}
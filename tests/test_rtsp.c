@@ -0,0 +1,331 @@
+//stream/rtsp.c over loopback: a client plays track0 over UDP and track1
+//interleaved in its RTSP connection, at 30 fps. Every packet arrives in
+//order, without FEC, with no framing error in the TCP stream, and dozens
+//of idle RTSP connections cost the server thread nothing
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+
+#include "check.h"
+#include "../stream/rtsp.h"
+
+#define FRAMES 60
+#define FRAME_INTERVAL 33333 //us
+#define FRAME_SIZE 30000 //track1, track0 sends the first 8000 bytes
+#define IDLE_CONNECTIONS 60
+#define IDLE_TIME 2 //s
+
+static fanout_t fanout[RTSP_MAX_TRACKS];
+static rtp_packetizer_t packetizer[RTSP_MAX_TRACKS];
+static h264_params_t params[RTSP_MAX_TRACKS];
+static fec_encoder_t fec;
+static rtsp_server_t server;
+static int plays, stops, idr_requests;
+
+static unsigned char frame[FRAME_SIZE];
+static const unsigned char sps_pps[] =
+{
+    0, 0, 0, 1, 0x67, 0x42, 0xc0, 0x1e, 0xda, 0x02, 0x80,
+    0, 0, 0, 1, 0x68, 0xce, 0x3c, 0x80,
+    0, 0, 0, 1, 0x65
+};
+
+static int on_play(void* arg)
+{
+    plays++;
+    return 0;
+}
+
+static void on_stop(void* arg)
+{
+    stops++;
+}
+
+static void request_idr(void)
+{
+    idr_requests++;
+}
+
+static void* produce(void* arg)
+{
+    int n;
+
+    for (n = 0; n < FRAMES; n++)
+    {
+        rtp_send_frame(&packetizer[0], frame, 8000, n * 3000, 1);
+        fanout_publish(&fanout[0]);
+        rtp_send_frame(&packetizer[1], frame, sizeof(frame), n * 3000, 1);
+        fanout_publish(&fanout[1]);
+        usleep(FRAME_INTERVAL);
+    }
+
+    return NULL;
+}
+
+static int connect_server(int port)
+{
+    struct sockaddr_in addr;
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+    CHECK(sock != -1);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+
+    return sock;
+}
+
+//the reply of a request, with its body
+static char* request(int sock, const char* msg, char* reply, int size)
+{
+    int len = 0;
+
+    CHECK(write(sock, msg, strlen(msg)) == (ssize_t)strlen(msg));
+    while (1)
+    {
+        int n = read(sock, reply + len, size - len - 1);
+        CHECK(n > 0);
+        len += n;
+        reply[len] = 0;
+
+        char* end = strstr(reply, "\r\n\r\n");
+        if (end)
+        {
+            char* length = strstr(reply, "Content-Length:");
+            int body = length ? atoi(length + 15) : 0;
+            if (len >= end + 4 - reply + body)
+                break;
+        }
+    }
+    CHECK(strncmp(reply, "RTSP/1.0 200 OK", 15) == 0);
+
+    return reply;
+}
+
+typedef struct
+{
+    int packets;
+    int frames;
+    uint16_t seq;
+} track_rx_t;
+
+//an RTP packet of the client, in the order it arrived
+static void receive_packet(track_rx_t* rx, const unsigned char* packet,
+        int len)
+{
+    CHECK(len > RTP_HEADER_SIZE);
+    CHECK((packet[1] & 0x7f) == RTP_H264_PAYLOAD_TYPE);
+
+    uint16_t seq = (packet[2] << 8) | packet[3];
+    if (rx->packets)
+        CHECK(seq == (uint16_t)(rx->seq + 1));
+    rx->seq = seq;
+    rx->packets++;
+    if (packet[1] & 0x80)
+        rx->frames++;
+}
+
+//the interleaved frames read so far, return : bytes used
+static int receive_interleaved(track_rx_t* rx, const unsigned char* data,
+        int len)
+{
+    int used = 0;
+
+    while (len - used >= 4)
+    {
+        const unsigned char* p = data + used;
+        int size = (p[2] << 8) | p[3];
+
+        CHECK(p[0] == '$');
+        CHECK(p[1] == 2);
+        if (len - used < 4 + size)
+            break;
+        receive_packet(rx, p + 4, size);
+        used += 4 + size;
+    }
+
+    return used;
+}
+
+static long cpu_time(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000L
+            + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+int main(int argc, char** argv)
+{
+    static unsigned char rx[65536 + 4];
+    static char reply[8192];
+    char msg[512], session[32];
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    track_rx_t track[RTSP_MAX_TRACKS];
+    int idle[IDLE_CONNECTIONS];
+    int port, rtp_port, rtcp_port, have = 0;
+    int sock, media, i;
+    pthread_t producer;
+
+    memcpy(frame, sps_pps, sizeof(sps_pps));
+    for (i = sizeof(sps_pps); i < FRAME_SIZE; i++)
+        frame[i] = 1 + i % 250;
+
+    //both tracks share the UDP socket, like the applications
+    media = socket(AF_INET, SOCK_DGRAM, 0);
+    CHECK(media != -1);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(bind(media, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+
+    fec_encoder_init(&fec, 0.25, 0x5eed);
+    for (i = 0; i < RTSP_MAX_TRACKS; i++)
+    {
+        fanout_init(&fanout[i], media, UDP_SEND_MMSG, PACER_OFF, 0, 0);
+        h264_params_init(&params[i]);
+        h264_params_update(&params[i], frame, sizeof(frame));
+        rtp_packetizer_init(&packetizer[i], RTP_DEFAULT_MTU, 0xaaaa + i,
+                fanout_add, &fanout[i]);
+    }
+    //the RTSP viewers do not take the repair packets
+    fanout[0].fec = &fec;
+
+    CHECK(rtsp_server_init(&server, 0, on_play, on_stop, NULL) == 0);
+    CHECK(getsockname(server.listenfd, (struct sockaddr*)&addr, &len) == 0);
+    port = ntohs(addr.sin_port);
+    for (i = 0; i < RTSP_MAX_TRACKS; i++)
+        CHECK(rtsp_server_add_track(&server, &fanout[i], &params[i],
+                request_idr) == i);
+    CHECK(rtsp_server_start(&server) == 0);
+
+    sock = connect_server(port);
+    request(sock, "OPTIONS * RTSP/1.0\r\nCSeq: 1\r\n\r\n", reply,
+            sizeof(reply));
+    sprintf(msg, "DESCRIBE rtsp://127.0.0.1:%d/ RTSP/1.0\r\nCSeq: 2\r\n"
+            "Accept: application/sdp\r\n\r\n", port);
+    request(sock, msg, reply, sizeof(reply));
+    CHECK(strstr(reply, "sprop-parameter-sets=") != NULL);
+    CHECK(strstr(reply, "a=control:track1") != NULL);
+
+    //track0 over UDP
+    int udp = socket(AF_INET, SOCK_DGRAM, 0);
+    int size = 4 * 1024 * 1024;
+    struct timeval timeout = { 0, 200000 };
+    CHECK(udp != -1);
+    setsockopt(udp, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    setsockopt(udp, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    addr.sin_port = 0;
+    len = sizeof(addr);
+    CHECK(bind(udp, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    CHECK(getsockname(udp, (struct sockaddr*)&addr, &len) == 0);
+    sprintf(msg, "SETUP rtsp://127.0.0.1:%d/track0 RTSP/1.0\r\nCSeq: 3\r\n"
+            "Transport: RTP/AVP;unicast;client_port=%d-%d\r\n\r\n", port,
+            ntohs(addr.sin_port), ntohs(addr.sin_port) + 1);
+    request(sock, msg, reply, sizeof(reply));
+    CHECK(sscanf(strstr(reply, "Session: ") + 9, "%8s", session) == 1);
+    char* transport = strstr(reply, "server_port=");
+    CHECK(transport != NULL);
+    CHECK(sscanf(transport, "server_port=%d-%d", &rtp_port, &rtcp_port) == 2);
+    CHECK(rtp_port == server.tracks[0].server_port);
+    CHECK(rtcp_port == server.tracks[0].rtcp_port && rtcp_port != rtp_port);
+
+    //the RTCP port is bound by the server
+    int probe = socket(AF_INET, SOCK_DGRAM, 0);
+    addr.sin_port = htons(rtcp_port);
+    CHECK(bind(probe, (struct sockaddr*)&addr, sizeof(addr)) == -1);
+    CHECK(errno == EADDRINUSE);
+    close(probe);
+
+    //track1 interleaved
+    sprintf(msg, "SETUP rtsp://127.0.0.1:%d/track1 RTSP/1.0\r\nCSeq: 4\r\n"
+            "Session: %s\r\nTransport: RTP/AVP/TCP;unicast;interleaved=2-3"
+            "\r\n\r\n", port, session);
+    request(sock, msg, reply, sizeof(reply));
+    CHECK(server.tracks[1].rtcp_sock == server.tracks[0].rtcp_sock);
+
+    sprintf(msg, "PLAY rtsp://127.0.0.1:%d/ RTSP/1.0\r\nCSeq: 5\r\n"
+            "Session: %s\r\n\r\n", port, session);
+    request(sock, msg, reply, sizeof(reply));
+    //the server subscribes the viewer after its reply
+    while (fanout_count(&fanout[0]) == 0 || fanout_count(&fanout[1]) == 0)
+        usleep(1000);
+
+    memset(track, 0, sizeof(track));
+    CHECK(pthread_create(&producer, NULL, produce, NULL) == 0);
+    while (track[0].frames < FRAMES || track[1].frames < FRAMES)
+    {
+        struct pollfd fds[2] = { { udp, POLLIN, 0 }, { sock, POLLIN, 0 } };
+
+        CHECK(poll(fds, 2, 1000) > 0);
+        if (fds[0].revents & POLLIN)
+        {
+            int n = recv(udp, rx, sizeof(rx), 0);
+            CHECK(n > 0);
+            receive_packet(&track[0], rx, n);
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            int n = read(sock, rx + have, sizeof(rx) - have);
+            CHECK(n > 0);
+            have += n;
+            int used = receive_interleaved(&track[1], rx, have);
+            memmove(rx, rx + used, have - used);
+            have -= used;
+        }
+    }
+    pthread_join(producer, NULL);
+    CHECK(plays == 1);
+    CHECK(idr_requests == RTSP_MAX_TRACKS);
+    CHECK(have == 0);
+    CHECK(recv(udp, rx, sizeof(rx), 0) == -1);
+    printf("track0 (UDP) : %d frames, %d packets in order\n", track[0].frames,
+            track[0].packets);
+    printf("track1 (interleaved) : %d frames, %d packets in order\n",
+            track[1].frames, track[1].packets);
+
+    sprintf(msg, "TEARDOWN rtsp://127.0.0.1:%d/ RTSP/1.0\r\nCSeq: 6\r\n"
+            "Session: %s\r\n\r\n", port, session);
+    request(sock, msg, reply, sizeof(reply));
+    CHECK(stops == 1);
+    CHECK(fanout_count(&fanout[0]) == 0 && fanout_count(&fanout[1]) == 0);
+
+    //idle connections, the epoll thread sleeps
+    for (i = 0; i < IDLE_CONNECTIONS; i++)
+    {
+        idle[i] = connect_server(port);
+        request(idle[i], "OPTIONS * RTSP/1.0\r\nCSeq: 1\r\n\r\n", reply,
+                sizeof(reply));
+    }
+    long cpu = cpu_time();
+    sleep(IDLE_TIME);
+    cpu = cpu_time() - cpu;
+    printf("%d idle connections : %ld us of CPU in %d s\n",
+            IDLE_CONNECTIONS + 1, cpu, IDLE_TIME);
+    CHECK(cpu < 20000);
+
+    for (i = 0; i < IDLE_CONNECTIONS; i++)
+        close(idle[i]);
+    close(sock);
+    close(udp);
+    rtsp_server_stop(&server);
+    for (i = 0; i < RTSP_MAX_TRACKS; i++)
+    {
+        fanout_deinit(&fanout[i]);
+        h264_params_deinit(&params[i]);
+    }
+    close(media);
+    printf("test_rtsp: ok\n");
+
+    return 0;
+}
@@ -0,0 +1,343 @@
+//record/segment.c in a temporary directory: frames at 25fps with a
+//keyframe every 15 frames, 2s segments, 3 kept. The cuts are on the first
+//keyframe after 2s, each file holds its frames in order, the pre-opened
+//.segment-next is the file renamed to the next segment, the segments past
+//the retention are deleted, a second run deletes the ones of the first
+//through the index. segments.idx is read all the time by another thread:
+//it is always whole (replaced with rename()), and at the end it lists the
+//files left with their sizes. segment_rotate() with a now_pts later than
+//the pts names and indexes the segment at the time of its first frame
+
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "check.h"
+#include "../record/segment.h"
+
+#define FRAME_SIZE 1000
+#define FRAME_TIME 40000 //us, 25fps
+#define GOP 15
+#define SECONDS 2
+#define KEEP 3
+#define SEGMENT_FRAMES 60 //first keyframe after 2s: 4 GOPs of 0.6s
+#define NAME "seg-%Y%m%d-%H%M%S.ts"
+
+static char dir[] = "/tmp/test_segment.XXXXXX";
+static volatile int reading;
+static int index_reads;
+
+static void path_of(const char* name, char* path)
+{
+    snprintf(path, 2 * SEGMENT_NAME_MAX, "%s/%s", dir, name);
+}
+
+//'K' or 'P', the frame number, filler
+static void write_frame(segment_writer_t* seg, int n)
+{
+    unsigned char frame[FRAME_SIZE];
+
+    memset(frame, n & 0xff, sizeof(frame));
+    frame[0] = (n % GOP == 0) ? 'K' : 'P';
+    memcpy(frame + 1, &n, sizeof(n));
+    CHECK(segment_write(seg, frame, sizeof(frame)) == 0);
+}
+
+//the helper thread has finished the last rotation and opened the next file
+static void wait_ready(segment_writer_t* seg)
+{
+    int i;
+
+    for (i = 0; i < 5000 && !segment_ready(seg); i++)
+        usleep(1000);
+    CHECK(segment_ready(seg));
+}
+
+static ino_t inode_of(const char* name)
+{
+    char path[2 * SEGMENT_NAME_MAX];
+    struct stat st;
+
+    path_of(name, path);
+    CHECK(stat(path, &st) == 0);
+
+    return st.st_ino;
+}
+
+typedef struct
+{
+    long long start; //ms
+    unsigned long long bytes;
+    char name[SEGMENT_NAME_MAX];
+} entry_t;
+
+//the entries of segments.idx, every line whole
+static int read_index(entry_t* entries, int max)
+{
+    char path[2 * SEGMENT_NAME_MAX];
+    char line[2 * SEGMENT_NAME_MAX];
+    long long sec;
+    int ms, n = 0;
+
+    path_of(SEGMENT_INDEX_NAME, path);
+    FILE* f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), f))
+    {
+        CHECK(n < max);
+        CHECK(line[strlen(line) - 1] == '\n');
+        CHECK(sscanf(line, "%lld.%d %llu %255s", &sec, &ms, &entries[n].bytes,
+                entries[n].name) == 4);
+        entries[n].start = sec * 1000 + ms;
+        n++;
+    }
+    fclose(f);
+
+    return n;
+}
+
+//the index is never seen half written
+static void* index_reader(void* arg)
+{
+    entry_t entries[64];
+
+    //a file written in place would be seen empty or cut at a line
+    while (reading)
+    {
+        int n = read_index(entries, 64);
+        if (n != -1)
+        {
+            CHECK(n > 0);
+            index_reads++;
+        }
+    }
+
+    return NULL;
+}
+
+//the files of the directory, segments.idx.tmp never stays
+static int list_dir(char names[][SEGMENT_NAME_MAX], int max, int* next)
+{
+    DIR* d = opendir(dir);
+    struct dirent* e;
+    int n = 0;
+
+    CHECK(d != NULL);
+    *next = 0;
+    while ((e = readdir(d)) != NULL)
+    {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0
+                || strcmp(e->d_name, SEGMENT_INDEX_NAME) == 0)
+            continue;
+        if (strcmp(e->d_name, SEGMENT_NEXT_NAME) == 0)
+        {
+            (*next)++;
+            continue;
+        }
+        CHECK(strncmp(e->d_name, "seg-", 4) == 0);
+        CHECK(n < max);
+        snprintf(names[n++], SEGMENT_NAME_MAX, "%s", e->d_name);
+    }
+    closedir(d);
+
+    return n;
+}
+
+//the frames of a segment file: the keyframe 'first', then the next ones in
+//order
+static int check_segment(const char* name, int first, int nframes)
+{
+    char path[2 * SEGMENT_NAME_MAX];
+    unsigned char frame[FRAME_SIZE];
+    int i, n;
+
+    CHECK(first % GOP == 0);
+    path_of(name, path);
+    FILE* f = fopen(path, "r");
+    CHECK(f != NULL);
+    for (i = 0; fread(frame, 1, FRAME_SIZE, f) == FRAME_SIZE; i++)
+    {
+        memcpy(&n, frame + 1, sizeof(n));
+        CHECK(n == first + i);
+        CHECK(frame[0] == ((n % GOP == 0) ? 'K' : 'P'));
+        CHECK(frame[FRAME_SIZE - 1] == (n & 0xff));
+    }
+    CHECK(feof(f));
+    fclose(f);
+    CHECK(i == nframes);
+
+    return first + i;
+}
+
+//'nframes' frames, the segments cut by segment_due()
+static void record(const segment_config_t* config, int first, int nframes,
+        int* segments)
+{
+    segment_writer_t seg;
+    ino_t next = 0;
+    int n;
+
+    CHECK(segment_open(&seg, config) == 0);
+    wait_ready(&seg);
+    *segments = 1;
+    for (n = first; n < first + nframes; n++)
+    {
+        uint64_t pts = (uint64_t)n * FRAME_TIME;
+        if (n % GOP == 0)
+        {
+            wait_ready(&seg); //never late
+            next = inode_of(SEGMENT_NEXT_NAME);
+            int due = segment_due(&seg, pts);
+            CHECK(due == ((n - first) % SEGMENT_FRAMES == 0 && n > first));
+            if (due)
+            {
+                segment_rotate(&seg, pts, pts);
+                (*segments)++;
+                wait_ready(&seg);
+                //the pre-opened file goes on as the new segment
+                CHECK(inode_of(seg.entries[seg.nentries - 1].name) == next);
+            }
+        }
+        write_frame(&seg, n);
+    }
+    CHECK(seg.late == 0 && (int)seg.segments == *segments);
+    segment_close(&seg);
+}
+
+//KEEP segments left, from 'first_frame' to 'last_frame', with their sizes
+//in the index
+static void check_dir(int first_frame, int last_frame)
+{
+    char names[16][SEGMENT_NAME_MAX];
+    entry_t entries[16];
+    int next, i;
+
+    int n = list_dir(names, 16, &next);
+    CHECK(next == 0); //the spare file is dropped at the close
+    CHECK(n == KEEP);
+    CHECK(read_index(entries, 16) == KEEP);
+
+    //the index in time order, the frames follow from one to the next
+    int frame = first_frame;
+    for (i = 0; i < KEEP; i++)
+    {
+        char path[2 * SEGMENT_NAME_MAX];
+        struct stat st;
+
+        path_of(entries[i].name, path);
+        CHECK(stat(path, &st) == 0);
+        CHECK((unsigned long long)st.st_size == entries[i].bytes);
+        CHECK(i == 0 || entries[i].start >= entries[i - 1].start);
+        frame = check_segment(entries[i].name, frame,
+                entries[i].bytes / FRAME_SIZE);
+    }
+    CHECK(frame == last_frame);
+}
+
+static void test_rotation(void)
+{
+    segment_config_t config;
+    pthread_t tid;
+    int segments;
+
+    memset(&config, 0, sizeof(config));
+    config.dir = dir;
+    config.name = NAME;
+    config.seconds = SECONDS;
+    config.keep = KEEP;
+
+    reading = 1;
+    CHECK(pthread_create(&tid, NULL, index_reader, NULL) == 0);
+
+    //10 segments and a half: 480 to 539, 540 to 599 and 600 to 629 left
+    record(&config, 0, 630, &segments);
+    CHECK(segments == 11);
+    check_dir(480, 630);
+
+    //a second run goes on in the same directory, the segments of the first
+    //one are deleted through the index: 600 to 629, 630 to 689, 690 to 749
+    record(&config, 630, 2 * SEGMENT_FRAMES, &segments);
+    CHECK(segments == 2);
+    check_dir(600, 750);
+
+    reading = 0;
+    pthread_join(tid, NULL);
+    CHECK(index_reads > 0);
+    printf("13 segments, %d whole reads of the index\n", index_reads);
+}
+
+//a pre-roll: the segment starts an hour before the frame being recorded
+static void test_backdated(void)
+{
+    segment_config_t config;
+    segment_writer_t seg;
+    entry_t entries[4];
+    char name[SEGMENT_NAME_MAX];
+    struct timeval tv;
+    struct tm tm;
+
+    memset(&config, 0, sizeof(config));
+    config.dir = dir;
+    config.name = "event-%Y%m%d-%H%M%S.ts";
+    CHECK(segment_open(&seg, &config) == 0);
+    wait_ready(&seg);
+    write_frame(&seg, 0);
+
+    gettimeofday(&tv, NULL);
+    long long now = (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    segment_rotate(&seg, 1000000, 1000000 + 3600 * 1000000ULL);
+    wait_ready(&seg);
+    write_frame(&seg, 1);
+
+    CHECK(read_index(entries, 4) == 2);
+    long long start = entries[1].start;
+    CHECK(start <= now - 3600 * 1000 + 2000 && start >= now - 3600 * 1000);
+    time_t t = start / 1000;
+    localtime_r(&t, &tm);
+    strftime(name, sizeof(name), config.name, &tm);
+    CHECK(strcmp(entries[1].name, name) == 0);
+    CHECK(inode_of(name) != 0);
+    segment_close(&seg);
+
+    //both segments written, the last size in the index at the close
+    CHECK(read_index(entries, 4) == 2);
+    CHECK(entries[0].bytes == FRAME_SIZE && entries[1].bytes == FRAME_SIZE);
+}
+
+//empty the temporary directory
+static void remove_dir(void)
+{
+    char path[2 * SEGMENT_NAME_MAX];
+    DIR* d = opendir(dir);
+    struct dirent* e;
+
+    CHECK(d != NULL);
+    while ((e = readdir(d)) != NULL)
+    {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+            continue;
+        path_of(e->d_name, path);
+        CHECK(unlink(path) == 0);
+    }
+    closedir(d);
+}
+
+int main(int argc, char** argv)
+{
+    CHECK(mkdtemp(dir) != NULL);
+
+    test_rotation();
+    remove_dir();
+    test_backdated();
+    remove_dir();
+    CHECK(rmdir(dir) == 0);
+
+    printf("test_segment: ok\n");
+
+    return 0;
+}
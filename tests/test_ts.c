@@ -0,0 +1,302 @@
+//record/ts.c: synthetic Annex-B access units (1 to 60000 bytes, the sizes
+//around one packet payload, some with B frame timestamps) through
+//ts_mux_frame() and back through an independent demuxer: sync bytes,
+//continuity counters, CRC and content of the PAT/PMT, PAT/PMT in front of
+//the keyframes and every TS_PSI_INTERVAL, PCR on the video PID, monotonic
+//and not after the DTS, random access bit, stuffing, and the payload, PTS
+//and DTS of every frame. With 1, 7 and 348 packets per write
+
+#include <string.h>
+
+#include "check.h"
+#include "../record/ts.h"
+
+#define FRAMES 3000
+#define MAX_FRAME 60000
+#define FRAME_TIME 33333 //us
+#define START 123456789 //us, the clock of the encoder does not start at 0
+#define STREAM_SIZE (16 << 20)
+
+typedef struct
+{
+    unsigned char* data;
+    int len;
+    uint64_t pts;
+    uint64_t dts;
+    int keyframe;
+} frame_t;
+
+static frame_t frames[FRAMES];
+
+static unsigned char* stream;
+static int stream_len, writes, packets_per_write;
+
+static unsigned seed = 1;
+
+static unsigned rnd(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+static int write_stream(void* arg, const unsigned char* data, int len)
+{
+    CHECK(len > 0 && len % TS_PACKET_SIZE == 0);
+    CHECK(len <= packets_per_write * TS_PACKET_SIZE);
+    CHECK(stream_len + len <= STREAM_SIZE);
+    memcpy(stream + stream_len, data, len);
+    stream_len += len;
+    writes++;
+
+    return 0;
+}
+
+static void make_frames(void)
+{
+    static const int sizes[] = { 1, 170, 171, 172, 173, 174, 182, 183, 184,
+            185, 1000 };
+    int i, k;
+
+    for (i = 0; i < FRAMES; i++)
+    {
+        frame_t* f = &frames[i];
+        int len;
+
+        f->keyframe = (i % 30 == 0);
+        if (f->keyframe)
+            len = 20000 + rnd() % (MAX_FRAME - 20000);
+        else if (i < 30 * (int)(sizeof(sizes) / sizeof(sizes[0])))
+            len = sizes[i / 30];
+        else
+            len = 1 + rnd() % ((i % 7 == 0) ? 3000 : 200);
+
+        //a start code and a slice header byte, the rest random
+        f->len = len + 5;
+        f->data = malloc(f->len);
+        CHECK(f->data != NULL);
+        memcpy(f->data, "\0\0\0\1", 4);
+        f->data[4] = f->keyframe ? 0x65 : 0x41;
+        for (k = 5; k < f->len; k++)
+            f->data[k] = rnd();
+
+        //frames 1000 to 1999 reordered as with B frames: PTS 2 frames
+        //after the DTS
+        f->dts = START + (uint64_t)i * FRAME_TIME;
+        f->pts = f->dts + ((i >= 1000 && i < 2000) ? 2 * FRAME_TIME : 0);
+    }
+}
+
+static uint32_t crc32_mpeg(const unsigned char* data, int len)
+{
+    uint32_t crc = 0xffffffff;
+    int i, j;
+
+    for (i = 0; i < len; i++)
+    {
+        crc ^= (uint32_t)data[i] << 24;
+        for (j = 0; j < 8; j++)
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+    }
+
+    return crc;
+}
+
+static uint64_t timestamp(const unsigned char* p)
+{
+    return ((uint64_t)((p[0] >> 1) & 7) << 30) | (p[1] << 22)
+            | ((p[2] >> 1) << 15) | (p[3] << 7) | (p[4] >> 1);
+}
+
+//state of the demuxer
+static int cc[8192];
+static int pmt_pid, video_pid, pcr_pid;
+static uint64_t pcr, last_psi;
+static int have_pcr, psi_since_frame, pes_psi, random_access;
+static unsigned char pes[MAX_FRAME + 1000];
+static int pes_len, nframes;
+
+//a whole PES: the next frame
+static void check_pes(void)
+{
+    static const unsigned char aud[6] = { 0, 0, 0, 1, 0x09, 0xf0 };
+    frame_t* f = &frames[nframes];
+
+    CHECK(nframes < FRAMES);
+    CHECK(memcmp(pes, "\0\0\1\xe0\0\0", 6) == 0); //unbounded video PES
+    int flags = pes[7] >> 6;
+    CHECK(flags == 2 || flags == 3);
+    uint64_t pts = timestamp(pes + 9);
+    uint64_t dts = (flags == 3) ? timestamp(pes + 14) : pts;
+    CHECK((flags == 3) == (f->pts != f->dts));
+
+    //on the 90kHz clock from 0 on the first DTS, TS_PCR_DELAY ahead
+    CHECK(pts == (f->pts - START) * 9 / 100 + TS_PCR_DELAY);
+    CHECK(dts == (f->dts - START) * 9 / 100 + TS_PCR_DELAY);
+    CHECK(have_pcr && pcr <= dts && dts - pcr <= TS_PCR_DELAY);
+
+    //an AUD in front of the frame as it was given
+    const unsigned char* es = pes + 9 + pes[8];
+    CHECK(memcmp(es, aud, sizeof(aud)) == 0);
+    es += sizeof(aud);
+    CHECK(pes + pes_len - es == f->len);
+    CHECK(memcmp(es, f->data, f->len) == 0);
+
+    CHECK(random_access == f->keyframe);
+    if (f->keyframe)
+        CHECK(pes_psi);
+    nframes++;
+}
+
+static void check_section(int pid, const unsigned char* payload)
+{
+    const unsigned char* s = payload + 1 + payload[0];
+    int len = ((s[1] & 0x0f) << 8) | s[2];
+
+    CHECK(crc32_mpeg(s, len + 3) == 0);
+    if (pid == 0)
+    {
+        CHECK(s[0] == 0x00 && len == 13);
+        CHECK(((s[8] << 8) | s[9]) == TS_PROGRAM);
+        pmt_pid = ((s[10] & 0x1f) << 8) | s[11];
+        CHECK(pmt_pid == TS_PID_PMT);
+        //the PSI comes every TS_PSI_INTERVAL, checked at the frame rate
+        CHECK(!have_pcr || pcr - last_psi <= TS_PSI_INTERVAL
+                + FRAME_TIME * 9 / 100);
+        last_psi = pcr;
+        psi_since_frame = 1;
+    }
+    else
+    {
+        CHECK(s[0] == 0x02 && len == 18);
+        pcr_pid = ((s[8] & 0x1f) << 8) | s[9];
+        CHECK(s[12] == 0x1b); //H.264
+        video_pid = ((s[13] & 0x1f) << 8) | s[14];
+        CHECK(video_pid == TS_PID_VIDEO && pcr_pid == video_pid);
+    }
+}
+
+static void demux(void)
+{
+    int off, i;
+
+    for (i = 0; i < 8192; i++)
+        cc[i] = -1;
+    pmt_pid = video_pid = pcr_pid = -1;
+    have_pcr = psi_since_frame = pes_psi = random_access = 0;
+    pcr = last_psi = 0;
+    pes_len = -1;
+    nframes = 0;
+
+    CHECK(stream_len % TS_PACKET_SIZE == 0);
+    for (off = 0; off < stream_len; off += TS_PACKET_SIZE)
+    {
+        const unsigned char* p = stream + off;
+        int start = p[1] & 0x40;
+        int pid = ((p[1] & 0x1f) << 8) | p[2];
+        int afc = (p[3] >> 4) & 3;
+        int payload = 4;
+
+        CHECK(p[0] == 0x47);
+        CHECK(afc & 1); //every packet has a payload
+        CHECK(cc[pid] == -1 || ((cc[pid] + 1) & 0x0f) == (p[3] & 0x0f));
+        cc[pid] = p[3] & 0x0f;
+
+        if (pid == video_pid && start)
+        {
+            if (pes_len >= 0)
+                check_pes();
+            pes_len = 0;
+            random_access = 0;
+            pes_psi = psi_since_frame;
+            psi_since_frame = 0;
+        }
+
+        if (afc & 2)
+        {
+            int af_len = p[4];
+            payload = 5 + af_len;
+            CHECK(payload <= TS_PACKET_SIZE);
+            if (af_len > 0)
+            {
+                int flags = p[5];
+                int k = 6;
+                if (pid == video_pid && start)
+                    random_access = !!(flags & 0x40);
+                if (flags & 0x10)
+                {
+                    uint64_t base = ((uint64_t)p[6] << 25) | (p[7] << 17)
+                            | (p[8] << 9) | (p[9] << 1) | (p[10] >> 7);
+                    CHECK(pid == pcr_pid && start);
+                    CHECK(!have_pcr || base >= pcr);
+                    pcr = base;
+                    have_pcr = 1;
+                    k = 12;
+                }
+                for (; k < payload; k++)
+                    CHECK(p[k] == 0xff);
+            }
+        }
+
+        if (pid == 0 || pid == pmt_pid)
+        {
+            CHECK(start);
+            check_section(pid, p + payload);
+        }
+        else
+        {
+            CHECK(pid == video_pid && pes_len >= 0);
+            memcpy(pes + pes_len, p + payload, TS_PACKET_SIZE - payload);
+            pes_len += TS_PACKET_SIZE - payload;
+        }
+    }
+    if (pes_len >= 0)
+        check_pes();
+}
+
+static void run(int ppw)
+{
+    ts_muxer_t ts;
+    int i;
+
+    packets_per_write = ppw;
+    stream_len = 0;
+    writes = 0;
+    ts_muxer_init(&ts, ppw, write_stream, NULL);
+    for (i = 0; i < FRAMES; i++)
+    {
+        const frame_t* f = &frames[i];
+        CHECK(ts_mux_frame(&ts, f->data, f->len, f->pts, f->dts,
+                f->keyframe) == 0);
+        //a write of every whole group, the rest waits for ts_flush()
+        CHECK(stream_len / TS_PACKET_SIZE / ppw * ppw
+                == stream_len / TS_PACKET_SIZE);
+    }
+    CHECK(ts_flush(&ts) == 0);
+    CHECK(ts_flush(&ts) == 0);
+    CHECK(ts.frames == FRAMES && ts.packets * TS_PACKET_SIZE == stream_len);
+
+    demux();
+    CHECK(nframes == FRAMES);
+    printf("%3d packets per write: %d/%d frames back, %d writes\n", ppw,
+            nframes, FRAMES, writes);
+}
+
+int main(int argc, char** argv)
+{
+    int i;
+
+    stream = malloc(STREAM_SIZE);
+    CHECK(stream != NULL);
+    make_frames();
+
+    run(1);
+    run(TS_PACKETS_PER_DATAGRAM);
+    run(TS_PACKETS_PER_FILE_WRITE);
+
+    for (i = 0; i < FRAMES; i++)
+        free(frames[i].data);
+    free(stream);
+    printf("test_ts: ok\n");
+
+    return 0;
+}